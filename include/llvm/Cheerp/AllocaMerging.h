@@ -12,7 +12,10 @@
 #ifndef _CHEERP_ALLOCA_MERGING_H
 #define _CHEERP_ALLOCA_MERGING_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Cheerp/Registerize.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Pass.h"
@@ -24,11 +27,27 @@ namespace llvm {
 class AllocaMergingBase: public FunctionPass
 {
 protected:
+	// Order the allocas as they are found in the function and not by their address, so that
+	// the same allocas are merged on every run
+	struct AllocaOrder
+	{
+		const llvm::DenseMap<const AllocaInst*, uint32_t>* allocaIndexes;
+		bool operator()(const AllocaInst* a, const AllocaInst* b) const
+		{
+			return allocaIndexes->lookup(a) < allocaIndexes->lookup(b);
+		}
+	};
+	typedef std::map<AllocaInst*, cheerp::Registerize::LiveRange, AllocaOrder> AllocaInfosMap;
+	llvm::DenseMap<const AllocaInst*, uint32_t> allocaIndexes;
 	AllocaMergingBase(char& ID):FunctionPass(ID)
 	{
 	}
-	void analyzeBlock(const cheerp::Registerize& registerize, llvm::BasicBlock& BB,
-				std::map<AllocaInst*, cheerp::Registerize::LiveRange>& allocaInfos);
+	AllocaInfosMap createAllocaInfosMap()
+	{
+		allocaIndexes.clear();
+		return AllocaInfosMap(AllocaOrder{&allocaIndexes});
+	}
+	void analyzeBlock(const cheerp::Registerize& registerize, llvm::BasicBlock& BB, AllocaInfosMap& allocaInfos);
 };
 
 // This class is resposible for recycling allocas. We can use lifetime intrinsics to know
@@ -57,12 +76,50 @@ public:
 	void getAnalysisUsage(AnalysisUsage & AU) const;
 };
 
+// This class shares the memory of typed arrays which are not used at the same time, regardless of their
+// element types and sizes. Allocas in the same slot are annotated with cheerp.stackslot metadata holding
+// the slot index and size. The writer creates one buffer per slot and the allocas become views of it.
+// The views are zeroed by the writer at the lifetime_start markers of the allocas, the allocas without
+// markers share a slot only if they are completely written before any read.
+class AllocaBuffersMerging: public AllocaMergingBase
+{
+private:
+	static uint32_t getBufferSize(const DataLayout& DL, AllocaInst* alloca);
+public:
+	static char ID;
+	explicit AllocaBuffersMerging() : AllocaMergingBase(ID) { }
+	bool runOnFunction(Function &F);
+	const char *getPassName() const;
+	void getAnalysisUsage(AnalysisUsage & AU) const;
+};
+
+// This class moves the typed array allocas of functions which can't be reentered to internal globals, so that
+// the arrays are created once instead of on every call. A function can't be reentered if it is not recursive and
+// it can't call, even indirectly, unknown code which may call it back. Unknown code is any indirect call and any
+// external function but a few builtins, client functions other than the ones of Math are all unknown code.
+// The arrays are zeroed on entry, like the new arrays created for the allocas, unless they are completely written
+// before any read.
+class AllocaArraysHoisting: public ModulePass
+{
+private:
+	static bool isSafeCall(ImmutableCallSite CS);
+	static bool hoistAllocas(Function& F);
+public:
+	static char ID;
+	explicit AllocaArraysHoisting() : ModulePass(ID) { }
+	bool runOnModule(Module &M);
+	const char *getPassName() const;
+	void getAnalysisUsage(AnalysisUsage & AU) const;
+};
+
 //===----------------------------------------------------------------------===//
 //
 // AllocaMerging - This pass merges allocas which are not used at the same time
 //
 FunctionPass *createAllocaMergingPass();
 FunctionPass *createAllocaArraysMergingPass();
+FunctionPass *createAllocaBuffersMergingPass();
+ModulePass *createAllocaArraysHoistingPass();
 }
 
 #endif //_CHEERP_ALLOCA_MERGING_H
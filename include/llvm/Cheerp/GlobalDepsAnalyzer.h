@@ -64,12 +64,27 @@ public:
 	 * Get a list of the arrays which are dynamically allocated with unknown size
 	 */
 	const std::unordered_set<llvm::StructType*> & dynAllocArrays() const { return arraysNeeded; }
+
+	/**
+	 * Get the layout of the struct types with bases and of the dynamically allocated arrays of structs
+	 */
+	const StructInfoMap & structsInfo() const { return structsInfoCache; }
 	
 	/**
 	 * Get the list of constructors (static initializers) required by the program
 	 */
 	const std::vector<const llvm::Function*> & constructors() const { return constructorsNeeded; }
 	
+	/**
+	 * Get the list of functions which are called from JS, i.e. webMain and the methods of exported classes
+	 */
+	const std::vector<const llvm::Function*> & entryPoints() const { return entryPointsNeeded; }
+	
+	/**
+	 * Get the functions with a body which are directly called by the given reachable function
+	 */
+	const std::vector<const llvm::Function*> & directCallees(const llvm::Function* F) const;
+	
 	/**
 	 * Determine if we need to compile a cheerpCreateClosure function
 	 */
@@ -85,6 +100,31 @@ public:
 	 */
 	bool needCreatePointerArray() const { return hasPointerArrays; }
 	
+	/**
+	 * Determine if we need to compile a cheerpMemMove function
+	 */
+	bool needMemMove() const { return hasMemMoveUsers; }
+
+	/**
+	 * Determine if there are copies of byte layout objects
+	 */
+	bool needByteLayoutCopy() const { return hasByteLayoutCopies; }
+	
+	/**
+	 * Determine if there are dynamic allocations of typed arrays
+	 */
+	bool hasTypedArrayAllocations() const { return hasTypedArrayAllocs; }
+	
+	/**
+	 * Determine if we need to compile the cheerpRealloc and cheerpResizeArray functions
+	 */
+	bool needRealloc() const { return hasReallocs; }
+
+	/**
+	 * Determine if we need to compile the exception handling helpers
+	 */
+	bool needExceptions() const { return hasExceptions; }
+	
 	bool runOnModule( llvm::Module & ) override;
 
 	void getAnalysisUsage( llvm::AnalysisUsage& ) const override;
@@ -131,18 +171,32 @@ private:
 	 */
 	int filterModule( llvm::Module & );
 
+	/**
+	 * Compute the layout of the struct types used by the writer, from the _bases metadata
+	 */
+	void computeStructsInfo( const llvm::Module & );
+
 	std::unordered_set< const llvm::GlobalValue * > reachableGlobals; // Set of all the reachable globals
 	
 	FixupMap varsFixups;
 	std::unordered_set<llvm::StructType* > classesNeeded;
 	std::unordered_set<llvm::StructType* > arraysNeeded;
+	std::unordered_set<llvm::StructType* > typesInstantiated;
+	StructInfoMap structsInfoCache;
 	std::vector< const llvm::Function* > constructorsNeeded;
+	std::vector< const llvm::Function* > entryPointsNeeded;
+	std::unordered_map< const llvm::Function*, std::vector< const llvm::Function* > > callGraph;
 		
 	std::vector< const llvm::GlobalVariable * > varsOrder;
 	
 	bool hasCreateClosureUsers;
 	bool hasVAArgs;
 	bool hasPointerArrays;
+	bool hasMemMoveUsers;
+	bool hasByteLayoutCopies;
+	bool hasTypedArrayAllocs;
+	bool hasReallocs;
+	bool hasExceptions;
 };
 
 inline llvm::Pass * createGlobalDepsAnalyzerPass()
@@ -0,0 +1,54 @@
+//===-- Cheerp/I64Lowering.h - Cheerp helper ------------------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2014 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef CHEERP_I64_LOWERING_H
+#define CHEERP_I64_LOWERING_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/IRBuilder.h"
+
+namespace llvm
+{
+
+class I64Lowering: public FunctionPass
+{
+private:
+	// The low and high 32 bits of a lowered i64 value
+	typedef std::pair<Value*, Value*> SplitValue;
+	DenseMap<Value*, SplitValue> splitValues;
+	IntegerType* int32Type;
+	static bool isI64(Type* t)
+	{
+		return t->isIntegerTy(64);
+	}
+	bool canLowerFunction(const Function& F) const;
+	SplitValue getSplitValue(Value* v);
+	SplitValue lowerInstruction(Instruction& I);
+	SplitValue createMul32(IRBuilder<>& IRB, Value* lhs, Value* rhs);
+	Value* lowerComparison(ICmpInst& I);
+public:
+	static char ID;
+	explicit I64Lowering() : FunctionPass(ID), int32Type(NULL) { }
+	bool runOnFunction(Function &F);
+	const char *getPassName() const;
+};
+
+//===----------------------------------------------------------------------===//
+//
+// I64Lowering - This pass splits the i64 values computed inside a function
+// into pairs of i32 values, so that they are kept as two JS integers
+//
+FunctionPass *createI64LoweringPass();
+
+}
+
+#endif
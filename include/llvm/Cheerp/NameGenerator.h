@@ -17,7 +17,9 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/Cheerp/Registerize.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 namespace cheerp {
 
@@ -30,21 +32,24 @@ class NameGenerator
 public:
 	/**
 	 * This initialize the namegenerator by collecting
-	 * all the global variable names
+	 * all the global variable names.
+	 * If computeSavings is true, the bytes saved by the ordering of compressed names are computed as well
 	 */
-	explicit NameGenerator( const llvm::Module&, const GlobalDepsAnalyzer &, const Registerize &, const PointerAnalyzer& PA, bool makeReadableNames = true );
+	explicit NameGenerator( const llvm::Module&, const GlobalDepsAnalyzer &, const Registerize &, const PointerAnalyzer& PA,
+				bool makeReadableNames = true, bool computeSavings = false );
 
 	/**
 	 * Return the computed name for the given variable.
-	 * This function can be called only if the passed value is not an inlined instruction
+	 * This function can be called only if the passed value is not an inlined instruction.
+	 * It only reads the shared names, so the copies of the generator used by parallel writers can call it concurrently
 	 */
 	llvm::StringRef getName(const llvm::Value* v) const
 	{
-		assert(namemap.count(v) );
-		assert(! namemap.at(v).empty() );
+		assert(namemap->count(v) );
+		assert(! namemap->at(v).empty() );
 		if(!edgeContext.isNull())
 			return getNameForEdge(v);
-		return namemap.at(v);
+		return namemap->at(v);
 	}
 
 	/**
@@ -65,11 +70,25 @@ public:
 		edgeContext.clear();
 	}
 
+	/**
+	 * Forget the names of the local values of a function which has already been compiled.
+	 * It must be called before the registers of the function are invalidated.
+	 * It modifies the shared names, so no other copy of the generator can be in use meanwhile
+	 */
+	void releaseFunction(const llvm::Function& F);
+
 	// Filter the original string so that it no longer contains invalid JS characters.
 	static llvm::SmallString<4> filterLLVMName( llvm::StringRef, bool isGlobalName );
 
+	/**
+	 * The estimated number of bytes used by the compressed names in the output,
+	 * and how many bytes are saved with respect to ordering them by the plain number of uses
+	 */
+	uint64_t getNameBytes() const { return nameBytes; }
+	int64_t getNameBytesSaved() const { return nameBytesSaved; }
+
 private:
-	void generateCompressedNames( const llvm::Module& M, const GlobalDepsAnalyzer & );
+	void generateCompressedNames( const llvm::Module& M, const GlobalDepsAnalyzer &, bool computeSavings );
 	void generateReadableNames( const llvm::Module& M, const GlobalDepsAnalyzer & );
 	
 	// Determine if an instruction actually needs a name
@@ -77,7 +96,10 @@ private:
 
 	const Registerize& registerize;
 	const PointerAnalyzer& PA;
-	std::unordered_map<const llvm::Value*, llvm::SmallString<4> > namemap;
+	// The names are shared by the copies of the generator used by the writers which compile functions
+	// in parallel or in separate chunks, each copy only has its own edge context
+	typedef std::unordered_map<const llvm::Value*, llvm::SmallString<4> > NameMapTy;
+	std::shared_ptr<NameMapTy> namemap;
 	struct InstOnEdge
 	{
 		const llvm::BasicBlock* fromBB;
@@ -101,7 +123,37 @@ private:
 		};
 	};
 	typedef std::unordered_map<InstOnEdge, llvm::SmallString<8>, InstOnEdge::Hash > EdgeNameMapTy;
-	EdgeNameMapTy edgeNamemap;
+	std::shared_ptr<EdgeNameMapTy> edgeNamemap;
+
+	// The values which share a compressed name: a global, or all the values assigned to the same register of a function
+	struct NameCandidate
+	{
+		uint32_t refs; // Estimated number of times the name is written in the output
+		uint32_t uses; // Number of uses in the IR
+		std::vector<const llvm::Value*> values;
+		NameCandidate():refs(0), uses(0)
+		{
+		}
+	};
+	typedef std::pair<unsigned, std::vector<InstOnEdge> > useInstsOnEdgePair;
+	typedef std::vector<useInstsOnEdgePair> useInstsOnEdgeVec;
+
+	/**
+	 * Give the shortest names to the heaviest candidates and return the estimated bytes used by the names.
+	 * The weight is the number of references if byRefs is true, the number of uses otherwise.
+	 * If emitNames is false the namemap is not modified
+	 */
+	uint64_t assignCompressedNames( const std::vector<NameCandidate>& globals, const std::vector<std::vector<NameCandidate>>& functionsLocals,
+					const useInstsOnEdgeVec& allTmpPHIs, bool byRefs, bool emitNames );
+
+	/**
+	 * Estimate how many times a value is written by its users. Inlined instructions and constant expressions
+	 * are written again wherever they are used, their count is memoized in the cache
+	 */
+	uint32_t countReferences( const llvm::Value* v, std::unordered_map<const llvm::Value*, uint32_t>& cache ) const;
+
+	uint64_t nameBytes;
+	int64_t nameBytesSaved;
 	struct EdgeContext
 	{
 		const llvm::BasicBlock* fromBB;
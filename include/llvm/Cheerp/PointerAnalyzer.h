@@ -14,9 +14,15 @@
 
 #include "llvm/Pass.h"
 #include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Mutex.h"
 #include "llvm/Support/Timer.h"
+#include <string>
+#include <vector>
 
 namespace cheerp {
 
@@ -28,6 +34,11 @@ enum POINTER_KIND {
 	INDIRECT
 };
 
+/**
+ * STORED_TYPE_CONSTRAINT depends on the pointers stored in memory. When i is 0 typePtr is the pointed type
+ * and the constraint covers all the memory of that type. Otherwise typePtr is a struct and the constraint
+ * only covers the field i-1 of it, this is used by the field sensitive mode.
+ */
 enum INDIRECT_POINTER_KIND_CONSTRAINT { RETURN_CONSTRAINT, DIRECT_ARG_CONSTRAINT, STORED_TYPE_CONSTRAINT, RETURN_TYPE_CONSTRAINT};
 
 struct IndirectPointerKindConstraint
@@ -116,7 +127,7 @@ public:
 class PointerAnalyzer : public llvm::ModulePass
 {
 public:
-	PointerAnalyzer() : 
+	PointerAnalyzer(bool fieldSensitive = false) :
 		ModulePass(ID)
 #ifndef NDEBUG
 		,fullyResolved(false),
@@ -124,7 +135,9 @@ public:
 		gpkTimer("getPointerKind",timerGroup),
 		gpkfrTimer("getPointerKindForReturn",timerGroup)
 #endif //NDEBUG
-	{}
+	{
+		cacheBundle.fieldSensitive = fieldSensitive;
+	}
 
 	void prefetch( const llvm::Module & ) const;
 	static char ID;
@@ -138,6 +151,11 @@ public:
 	POINTER_KIND getPointerKind(const llvm::Value* v) const;
 	POINTER_KIND getPointerKindForReturn(const llvm::Function* F) const;
 	POINTER_KIND getPointerKindForStoredType( llvm::Type * pointerType ) const;
+	// Kind of the pointers stored in the given field, it is the same as getPointerKindForStoredType
+	// unless the field sensitive mode is enabled and the field address never escapes
+	POINTER_KIND getPointerKindForStoredField( llvm::StructType * structType, uint32_t fieldIndex ) const;
+	// Kind of the pointer stored by SI, based on the address it is stored to
+	POINTER_KIND getPointerKindForStore( const llvm::StoreInst * SI ) const;
 	POINTER_KIND getPointerKindForArgumentType( llvm::Type * pointerType ) const;
 	PointerKindWrapper getFinalPointerKindWrapper(const llvm::Value* v ) const;
 	PointerKindWrapper getFinalPointerKindWrapperForReturn(const llvm::Function* F) const;
@@ -150,8 +168,12 @@ public:
 	void invalidate( const llvm::Value * );
 
 	// Fully resolve indirect pointer kinds. After you call this function you should not call invalidate anymore.
+	// The getPointerKind* queries can be used from multiple threads, the caches are only filled under cacheMutex.
 	void fullResolve() const;
 
+	// Find the struct fields that can be tracked separately in the field sensitive mode
+	void computeTrackedFields(const llvm::Module& M);
+
 #ifndef NDEBUG
 	mutable bool fullyResolved;
 	// Dump a pointer value info
@@ -161,6 +183,8 @@ public:
 	typedef llvm::DenseMap<const llvm::Value*, PointerKindWrapper> ValueKindMap;
 	typedef llvm::DenseMap<llvm::Type*, PointerKindWrapper> TypeKindMap;
 	typedef llvm::DenseMap<llvm::Type*, PointerKindWrapper> ReturnTypeKindMap;
+	typedef std::pair<llvm::StructType*, uint32_t> StructField;
+	typedef llvm::DenseMap<StructField, PointerKindWrapper> FieldKindMap;
 	struct AddressTakenMap: public llvm::DenseMap<const llvm::Function*, bool>
 	{
 		bool checkAddressTaken(const llvm::Function* F)
@@ -182,11 +206,29 @@ public:
 		TypeKindMap typeCache;
 		ReturnTypeKindMap returnTypeCache;
 		AddressTakenMap addressTakenCache;
+		FieldKindMap fieldCache;
+		// Field sensitivity, the fields of untracked structs and the fields whose address is
+		// used for anything but loads and stores fall back to the per type constraints
+		bool fieldSensitive;
+		llvm::DenseSet<llvm::StructType*> untrackedStructs;
+		llvm::DenseSet<StructField> untrackedFields;
+		CacheBundle():fieldSensitive(false)
+		{
+		}
+		bool isFieldTracked(llvm::StructType* st, uint32_t fieldIndex) const
+		{
+			return fieldSensitive && st->getElementType(fieldIndex)->isPointerTy() &&
+				!untrackedStructs.count(st) && !untrackedFields.count(StructField(st, fieldIndex));
+		}
 	};
 
 private:
 
 	mutable CacheBundle cacheBundle;
+	// The functions in bottom up call graph order, as visited by prefetch
+	mutable std::vector<const llvm::Function*> functionOrder;
+	// The caches are filled lazily, this makes queries safe from multiple threads
+	mutable llvm::sys::SmartMutex<true> cacheMutex;
 
 #ifndef NDEBUG
 	mutable llvm::TimerGroup timerGroup;
@@ -201,9 +243,9 @@ void writePointerDumpHeader();
 
 #endif //NDEBUG
 
-inline llvm::Pass * createPointerAnalyzerPass()
+inline llvm::Pass * createPointerAnalyzerPass(bool fieldSensitive = false)
 {
-	return new PointerAnalyzer;
+	return new PointerAnalyzer(fieldSensitive);
 }
 
 }
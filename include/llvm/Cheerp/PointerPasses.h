@@ -15,6 +15,8 @@
 #include "llvm/Pass.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
+#include <map>
+#include <vector>
 
 namespace llvm
 {
@@ -45,6 +47,32 @@ public:
 FunctionPass *createAllocaArraysPass();
 
 
+/**
+ * Replace the allocas of structs whose address never escapes the function with one alloca for each
+ * of the accessed fields and promote them to registers. This avoids creating a JS object on every call.
+ * The address only escapes if it is used by anything else than constant GEPs, loads and stores.
+ */
+class StructAllocaScalarization: public FunctionPass
+{
+	typedef std::map<std::vector<uint32_t>, std::vector<Instruction*>> FieldAccessMap;
+	bool collectFieldAccesses(Value* ptr, std::vector<uint32_t>& path, FieldAccessMap& accesses,
+				std::vector<Instruction*>& deadInsts);
+	void scalarizeAlloca(AllocaInst* ai, const FieldAccessMap& accesses, std::vector<AllocaInst*>& fieldAllocas);
+public:
+	static char ID;
+	explicit StructAllocaScalarization() : FunctionPass(ID) { }
+	bool runOnFunction(Function &F);
+	const char *getPassName() const;
+
+	virtual void getAnalysisUsage(AnalysisUsage&) const override;
+};
+
+//===----------------------------------------------------------------------===//
+//
+// StructAllocaScalarization
+//
+FunctionPass *createStructAllocaScalarizationPass();
+
 /**
  * Construct a wrapper function for the function which are called indirectly.
  * This is used to allow the PA to pass the function parameters as CO when the function is called
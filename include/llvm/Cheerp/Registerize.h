@@ -12,6 +12,7 @@
 #ifndef _CHEERP_REGISTERIZE_H
 #define _CHEERP_REGISTERIZE_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
 #include <unordered_set>
@@ -63,11 +64,23 @@ public:
 	
 	const char *getPassName() const override;
 
+	// The queries only read the computed registers and live ranges, they can be used from multiple threads
 	uint32_t getRegisterId(const llvm::Instruction* I) const;
 
+	// Registers should have a consistent JS type
+	enum REGISTER_KIND { OBJECT=0, INTEGER, FLOAT, DOUBLE, BOOLEAN };
+	// The JS type of the value computed by I, only values of the same kind share a register
+	static REGISTER_KIND getRegisterKind(const llvm::Instruction* I);
+
 	void handleFunction(llvm::Function& F);
-	void invalidateFunction(llvm::Function& F);
+	// Erase the registers and the live ranges of F, the queries cannot be used from other threads meanwhile
+	void invalidateFunction(const llvm::Function& F);
 
+	// The live ranges of the allocas are only computed when the registers are assigned
+	bool hasAllocaLiveRanges() const
+	{
+		return !NoRegisterize;
+	}
 	const LiveRange& getLiveRangeForAlloca(const llvm::AllocaInst* alloca) const
 	{
 		assert(allocaLiveRanges.count(alloca));
@@ -89,20 +102,61 @@ private:
 		}
 		void addUse(uint32_t codePathId, uint32_t thisIndex);
 	};
-	// Map from instructions to their live ranges
-	typedef std::unordered_map<llvm::Instruction*, InstructionLiveRange> LiveRangesTy;
+	// Live ranges of the instructions, stored densely in definition order
+	struct LiveRangesTy
+	{
+		std::vector<llvm::Instruction*> instructions;
+		std::vector<InstructionLiveRange> ranges;
+		// Map from instructions to their index in the vectors above
+		llvm::DenseMap<const llvm::Instruction*, uint32_t> indexes;
+		InstructionLiveRange& add(llvm::Instruction* I, uint32_t codePathId)
+		{
+			assert(!indexes.count(I));
+			indexes[I] = ranges.size();
+			instructions.push_back(I);
+			ranges.push_back(InstructionLiveRange(codePathId));
+			return ranges.back();
+		}
+		uint32_t count(const llvm::Instruction* I) const
+		{
+			return indexes.count(I);
+		}
+		InstructionLiveRange& get(const llvm::Instruction* I)
+		{
+			assert(indexes.count(I));
+			return ranges[indexes.find(I)->second];
+		}
+		const InstructionLiveRange& get(const llvm::Instruction* I) const
+		{
+			assert(indexes.count(I));
+			return ranges[indexes.find(I)->second];
+		}
+		uint32_t size() const
+		{
+			return ranges.size();
+		}
+	};
 	// Map from instructions to their unique identifier
-	typedef std::unordered_map<llvm::Instruction*, uint32_t> InstIdMapTy;
-	// Registers should have a consistent JS type
-	enum REGISTER_KIND { OBJECT=0, INTEGER, FLOAT, DOUBLE };
+	typedef llvm::DenseMap<llvm::Instruction*, uint32_t> InstIdMapTy;
 	struct RegisterRange
 	{
+		// The chunks are kept sorted by start, maxEnds[i] is the maximum end of the chunks up to i.
+		// Together they are used to check interference with a binary search for each chunk.
 		LiveRange range;
+		llvm::SmallVector<uint32_t, 4> maxEnds;
 		REGISTER_KIND regKind;
-		RegisterRange(const LiveRange& range, REGISTER_KIND k):range(range),regKind(k)
+		RegisterRange(const LiveRange& range, REGISTER_KIND k):regKind(k)
+		{
+			addRange(range);
+		}
+		bool doesInterfere(const LiveRange& other) const;
+		void addRange(const LiveRange& other);
+		uint32_t getMaxEnd() const
 		{
+			return maxEnds.empty() ? 0 : maxEnds.back();
 		}
 	};
+	typedef llvm::SmallVector<RegisterRange, 4> RegistersTy;
 	// Temporary data structures used while exploring the CFG
 	struct BlockState
 	{
@@ -166,10 +220,9 @@ private:
 	void extendRangeForUsedOperands(llvm::Instruction& I, LiveRangesTy& liveRanges,
 					uint32_t thisIndex, uint32_t codePathId);
 	void assignToRegisters(const LiveRangesTy& F);
-	void handlePHI(llvm::Instruction& I, const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers);
-	uint32_t findOrCreateRegister(llvm::SmallVector<RegisterRange, 4>& registers, const InstructionLiveRange& range,
+	void handlePHI(llvm::Instruction& I, const LiveRangesTy& liveRanges, RegistersTy& registers);
+	uint32_t findOrCreateRegister(RegistersTy& registers, const InstructionLiveRange& range,
 					REGISTER_KIND kind);
-	static REGISTER_KIND getRegKindFromType(llvm::Type*);
 	bool addRangeToRegisterIfPossible(RegisterRange& regRange, const InstructionLiveRange& liveRange, REGISTER_KIND kind);
 	void computeAllocaLiveRanges(AllocaSetTy& allocaSet, const InstIdMapTy& instIdMap);
 	std::unordered_set<llvm::Instruction*> gatherDerivedMemoryAccesses(llvm::AllocaInst* rootI);
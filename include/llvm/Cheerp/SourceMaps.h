@@ -12,10 +12,11 @@
 #ifndef _CHEERP_SOURCE_MAPS_H
 #define _CHEERP_SOURCE_MAPS_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/Support/ToolOutputFile.h"
-#include <map>
+#include <vector>
 
 namespace cheerp
 {
@@ -24,19 +25,33 @@ class SourceMapGenerator
 {
 private:
 	llvm::tool_output_file sourceMap;
-	const std::string& sourceMapName;
-	const std::string& sourceMapPrefix;
+	const std::string sourceMapName;
+	const std::string sourceMapPrefix;
 	llvm::LLVMContext& Ctx;
-	std::map<llvm::MDString*, uint32_t> fileMap;
+	bool sourcesContent;
+	// Maps the file names to their index, and the index to the file name and directory
+	llvm::DenseMap<llvm::MDString*, uint32_t> fileMap;
+	std::vector<llvm::MDNode*> files;
+	// Most consecutive locations share the scope, remember the file of the last one
+	llvm::MDNode* lastScope;
+	uint32_t lastScopeFile;
+	// The mappings are encoded in memory and written all at once by endFile
+	std::string mappings;
 	uint32_t lastFile;
 	uint32_t lastLine;
 	uint32_t lastColoumn;
+	// Whether the previous line has the location of the last segment, either written or omitted
+	bool lastLineMapped;
 	bool validInfo;
 	bool lineStart;
 	void writeBase64VLQInt(int32_t i);
+	uint32_t getFileIndex(llvm::MDNode* scope);
 public:
-	// sourceMapName and sourceMapPrefix life spans should be longer than the one of the SourceMapGenerator
-	SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C, std::string& ErrorString);
+	// If sourcesContent is true, the content of the source files is embedded in the map
+	SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, bool sourcesContent,
+			llvm::LLVMContext& C, std::string& ErrorString);
+	// Build a generator for another output file, with the same options
+	SourceMapGenerator(const SourceMapGenerator& other, const std::string& sourceMapName, std::string& ErrorString);
 	void setDebugLoc(const llvm::DebugLoc& debugLoc);
 	void clearDebugInfo()
 	{
@@ -48,5 +63,31 @@ public:
 	std::string getSourceMapName() const;
 };
 
+/**
+ * Records the source map events of code compiled in a separate buffer.
+ * The events can then be replayed in order on the real SourceMapGenerator.
+ */
+class SourceMapRecorder
+{
+private:
+	// An unknown location marks the end of a line
+	std::vector<llvm::DebugLoc> events;
+public:
+	void setDebugLoc(const llvm::DebugLoc& debugLoc)
+	{
+		assert(!debugLoc.isUnknown());
+		events.push_back(debugLoc);
+	}
+	void finishLine()
+	{
+		events.push_back(llvm::DebugLoc());
+	}
+	void replay(SourceMapGenerator& generator) const;
+	void clear()
+	{
+		events.clear();
+	}
+};
+
 }
 #endif
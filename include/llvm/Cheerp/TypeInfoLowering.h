@@ -0,0 +1,76 @@
+//===-- Cheerp/TypeInfoLowering.h - Cheerp utility code -------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2011-2014 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_TYPE_INFO_LOWERING_H
+#define _CHEERP_TYPE_INFO_LOWERING_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include <unordered_map>
+
+namespace llvm
+{
+
+/**
+ * TypeInfoLowering - Replace the type infos used by the exception handling with integer ids.
+ *
+ * Type infos are compared by id at runtime, so they do not need to be compiled if they are
+ * only used to catch exceptions. The ids are encoded as inttoptr constants in the landing pad
+ * clauses and in the calls to __cxa_throw and llvm.eh.typeid.for.
+ *
+ * Every call to __cxa_throw is also tagged with the cheerp.catchable metadata, the list of
+ * the types which catch the thrown one. This is the thrown type and its public bases, found
+ * through the __si_class_type_info and __vmi_class_type_info type infos. Each id is followed
+ * by the indices of the fields which lead from the thrown object to the base subobject, the
+ * list is empty if the subobject is the thrown object itself.
+ */
+class TypeInfoLowering : public llvm::ModulePass
+{
+public:
+	static char ID;
+
+	explicit TypeInfoLowering() : ModulePass(ID) { }
+
+	bool runOnModule( llvm::Module & ) override;
+
+	const char *getPassName() const override;
+
+	/**
+	 * Get the id of a type info replaced by this pass. Ids start from 1.
+	 */
+	static uint32_t getTypeInfoId( const llvm::Value * typeInfo );
+
+private:
+	/**
+	 * Replace a type info, or a filter made of type infos, with the corresponding ids
+	 */
+	llvm::Constant * encodeTypeInfo( llvm::Constant * typeInfo );
+
+	uint32_t getId( const llvm::Value * typeInfo );
+
+	/**
+	 * Add the id of a type info and the ids of its public bases to the catchable list.
+	 * The struct type of the type info, if known, is reached from the thrown object through the fields in path
+	 */
+	void collectCatchableTypes( const llvm::Module & module, const llvm::Value * typeInfo, llvm::StructType * type,
+			llvm::SmallVectorImpl< llvm::Value * > & path, llvm::SmallVectorImpl< llvm::Value * > & catchable );
+
+	std::unordered_map< const llvm::Value *, uint32_t > typeInfoIds;
+};
+
+llvm::ModulePass *createTypeInfoLoweringPass();
+
+}
+
+#endif
@@ -14,6 +14,7 @@
 
 #include <cctype>
 #include <set>
+#include <unordered_map>
 #include <unordered_set>
 #include "llvm/ADT/SmallString.h"
 #include "llvm/IR/CallSite.h"
@@ -60,13 +61,37 @@ uint32_t getIntFromValue(const llvm::Value* v);
 // Printable name of the llvm type - useful only for debugging
 std::string valueObjectName(const llvm::Value * v);
 
+/**
+ * Layout information of a struct type, computed once from the _bases metadata
+ * so that the writer does not need to look up the metadata by name
+ */
+struct StructInfo
+{
+	StructInfo() : firstBase(0), baseCount(0), downcastArraySize(0), hasBasesMetadata(false), needsDowncastArray(false),
+		hasDowncastSlots(false), constructorId(0) {}
+	// The direct bases are the elements in [firstBase, firstBase+baseCount)
+	uint32_t firstBase;
+	uint32_t baseCount;
+	// The type itself and all its bases, recursively
+	uint32_t downcastArraySize;
+	bool hasBasesMetadata;
+	// Objects of this type are created with a downcast array
+	bool needsDowncastArray;
+	// Objects of this type may be part of a downcast array, so they need the o and a properties
+	bool hasDowncastSlots;
+	// The name used by the create and createArray helpers and by the constructor
+	std::string jsName;
+	// The instantiated named structs are numbered from 1, so that the constructors get short names
+	uint32_t constructorId;
+};
+
+typedef std::unordered_map<llvm::StructType*, StructInfo> StructInfoMap;
+
 class TypeSupport
 {
 public:
-	TypeSupport( const llvm::Module & module,
-		     const std::unordered_set<llvm::StructType*> & basesInfo ) : 
-		module(module),
-		classesWithBaseInfo(basesInfo) {}
+	explicit TypeSupport( const StructInfoMap & structsInfo ) :
+		structsInfo(structsInfo) {}
 
 	static bool isValidTypeCast(const llvm::Value * castOp, llvm::Type * dstPtr);
 
@@ -104,6 +129,13 @@ public:
 			t->isFloatTy() || t->isDoubleTy();
 	}
 
+	// Arrays of more than one number are stored as a typed array of their own
+	static bool isTypedArrayObjectType(llvm::Type* t)
+	{
+		llvm::ArrayType* at = llvm::dyn_cast<llvm::ArrayType>(t);
+		return at && isTypedArrayType(at->getElementType()) && at->getNumElements() > 1;
+	}
+
 	static bool isImmutableType(llvm::Type* t)
 	{
 		if(t->isIntegerTy() || t->isFloatTy() || t->isDoubleTy() || t->isPointerTy())
@@ -124,10 +156,20 @@ public:
 		return getBasesMetadata(t, m) != nullptr;
 	}
 
+	/**
+	 * Get the cached layout of a struct type, or null if the type is not instantiated, has no bases
+	 * and it is not dynamically allocated as an array
+	 */
+	const StructInfo* getStructInfo(llvm::StructType* t) const
+	{
+		auto it = structsInfo.find(t);
+		return it == structsInfo.end() ? nullptr : &it->second;
+	}
+
 	bool hasBasesInfo(llvm::StructType* t) const
 	{
-		assert( !( classesWithBaseInfo.count(t) && !hasBasesInfoMetadata(t, module) ) );
-		return classesWithBaseInfo.count(t);
+		const StructInfo* info = getStructInfo(t);
+		return info && info->needsDowncastArray;
 	}
 
 	// Syntactic sugar for when we do not know if we have a struct type
@@ -138,11 +180,16 @@ public:
 		return false;
 	}
 
-	// Bridge to the static version
 	bool getBasesInfo(llvm::StructType* t, uint32_t& firstBase, uint32_t& baseCount) const
 	{
-		return getBasesInfo(module, t, firstBase, baseCount);
+		const StructInfo* info = getStructInfo(t);
+		if(!info || !info->hasBasesMetadata)
+			return false;
+		firstBase = info->firstBase;
+		baseCount = info->baseCount;
+		return true;
 	}
+	// Uncached version, reads the metadata
 	static bool getBasesInfo(const llvm::Module& module, llvm::StructType* t, uint32_t& firstBase, uint32_t& baseCount);
 
 private:
@@ -156,8 +203,7 @@ private:
 
 	static bool safeCallForNewedMemory(const llvm::CallInst* ci);
 
-	const llvm::Module & module;
-	const std::unordered_set<llvm::StructType*> & classesWithBaseInfo;
+	const StructInfoMap & structsInfo;
 };
 
 /*
@@ -174,7 +220,8 @@ public:
 		cheerp_allocate,
 		cheerp_reallocate,
 		opnew, // operator new(unsigned int)
-		opnew_array // operator new[](unsigned int)
+		opnew_array, // operator new[](unsigned int)
+		cxa_allocate_exception // __cxa_allocate_exception(unsigned int)
 	};
 	
 	/**
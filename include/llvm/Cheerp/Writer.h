@@ -23,9 +23,11 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
+#include "llvm/PassManager.h"
 #include "llvm/Support/FormattedStream.h"
 #include <set>
 #include <map>
+#include <vector>
 
 namespace cheerp
 {
@@ -34,8 +36,9 @@ class NewLineHandler
 {
 private:
 	SourceMapGenerator* sourceMapGenerator;
+	SourceMapRecorder* sourceMapRecorder;
 public:
-	NewLineHandler(SourceMapGenerator* s):sourceMapGenerator(s)
+	NewLineHandler(SourceMapGenerator* s, SourceMapRecorder* r = NULL):sourceMapGenerator(s),sourceMapRecorder(r)
 	{
 	}
 
@@ -44,6 +47,8 @@ public:
 		s << '\n';
 		if(handler.sourceMapGenerator)
 			handler.sourceMapGenerator->finishLine();
+		else if(handler.sourceMapRecorder)
+			handler.sourceMapRecorder->finishLine();
 		return s;
 	}
 
@@ -95,6 +100,23 @@ public:
 		return os;
 	}
 
+	/**
+	 * Append code which has already been indented, the indentation level is not changed
+	 */
+	void writeFormatted( llvm::StringRef s )
+	{
+		if ( s.empty() )
+			return;
+		stream << s;
+		newLine = s.back() == '\n';
+	}
+
+	// Number of bytes written so far
+	uint64_t tell() const
+	{
+		return stream.tell();
+	}
+
 private:
 
 	// Return true if we are closing a curly bracket, need to unindent by 1.
@@ -143,29 +165,72 @@ private:
 	llvm::DataLayout targetData;
 	const llvm::Function* currentFun;
 	const PointerAnalyzer & PA;
-	const Registerize & registerize;
+	Registerize & registerize;
 
 	GlobalDepsAnalyzer & globalDeps;
 	NameGenerator namegen;
 	TypeSupport types;
 	std::set<const llvm::GlobalVariable*> compiledGVars;
+	// Named struct types instantiated by the compiled code, their constructors are compiled with the helpers
+	std::set<llvm::StructType*> constructedTypes;
+
+	// Support for asm.js style coercions in numeric functions
+	bool asmJSCoercions;
+	std::set<const llvm::Function*> asmJSFunctions;
 
 	// Support for source maps
 	SourceMapGenerator* sourceMapGenerator;
+	// Only used by the writers compiling functions in parallel
+	SourceMapRecorder* sourceMapRecorder;
 	const NewLineHandler NewLine;
 
+	// Support for pooling typed arrays used by dynamic allocations
+	bool typedArrayPool;
+
+	// Support for declaring all the locals with their type at the start of functions
+	bool typedLocals;
+
+	// Support for the code size mode and the size report
+	bool codeSize;
+	bool sizeReport;
+	uint32_t mergedFunctions;
+	uint64_t mergedFunctionsBytes;
+	std::vector<std::pair<uint64_t, const llvm::Function*>> functionSizes;
+
+	// Support for lazily loaded chunks of functions
+	std::string lazyChunksPrefix;
+
+	// Support for parallel compilation of functions
+	bool readableOutput;
+	unsigned numThreads;
+	// Workers which are compiling a function, the data of the analyses cannot be released while they read it
+	uint32_t compilingWorkers;
+
 	/**
 	 * \addtogroup MemFunction methods to handle memcpy, memmove, mallocs and free (and alike)
 	 *
 	 * @{
 	 */
 
+	/**
+	 * Copies of up to this number of elements with a constant size are unrolled
+	 */
+	static const uint32_t MemFuncUnrollThreshold = 4;
+
 	/**
 	 * Compile memcpy and memmove
 	 */
 	void compileMemFunc(const llvm::Value* dest,
-	                    const llvm::Value* srcOrResetVal,
-	                    const llvm::Value* size);
+	                    const llvm::Value* src,
+	                    const llvm::Value* size,
+	                    bool isMemmove);
+
+	/**
+	 * Compile memset on typed arrays
+	 */
+	void compileMemset(const llvm::Value* dest,
+	                   const llvm::Value* resetVal,
+	                   const llvm::Value* size);
 
 	/**
 	 * Copy baseSrc into baseDest
@@ -175,6 +240,10 @@ private:
 	                        llvm::Type* currentType);
 
 	void compileAllocation(const DynamicAllocInfo& info);
+	/**
+	 * Compile an allocation of a typed array using the cheerpPool helpers
+	 */
+	void compilePooledAllocation(const DynamicAllocInfo& info);
 	void compileFree(const llvm::Value* obj);
 
 	/** @} */
@@ -187,6 +256,12 @@ private:
 
 	void compilePredicate(llvm::CmpInst::Predicate p);
 	void compileOperandForIntegerPredicate(const llvm::Value* v, llvm::CmpInst::Predicate p);
+	/**
+	 * With typed locals the registers of the BOOLEAN kind must only hold booleans,
+	 * i1 values which may be numbers are coerced with !!
+	 */
+	bool isBooleanValue(const llvm::Value* v) const;
+	void compileBooleanOperand(const llvm::Value* v);
 
 	/**
 	 * \addtogroup Pointers Methods to compile pointers
@@ -237,6 +312,14 @@ private:
 	 */
 	const llvm::Value* compileByteLayoutOffset(const llvm::Value* p, BYTE_LAYOUT_OFFSET_MODE offsetMode);
 
+	/**
+	 * Compile the parts of a REGULAR pointer literal, in code size mode the $P helper is used
+	 */
+	void compileRegularBegin();
+	void compileRegularOffset();
+	void compileRegularEnd();
+	void compileRegularZeroOffsetEnd();
+
 	/**
 	 * Compile a pointer from a GEP expression, with the given pointer kind
 	 */
@@ -276,11 +359,72 @@ private:
 	void compileSignedInteger(const llvm::Value* v);
 	void compileUnsignedInteger(const llvm::Value* v);
 
+	/**
+	 * \addtogroup AsmJS Methods to emit asm.js style coercions in numeric functions
+	 * @{
+	 */
+
+	/**
+	 * Collect the functions which only operate on numeric values and can be
+	 * emitted with asm.js style type coercions
+	 */
+	void computeAsmJSFunctions();
+	bool isAsmJSFunction(const llvm::Function* F) const
+	{
+		return asmJSFunctions.count(F);
+	}
+	/**
+	 * Emit an explicit coercion to the type t around an expression, i.e. (x|0), +x or Math.fround(x)
+	 */
+	void compileCoercionBegin(llvm::Type* t);
+	void compileCoercionEnd(llvm::Type* t);
+	/**
+	 * Emit Math.fround around float expressions inside asm.js style functions
+	 */
+	void compileFloatCoercionBegin(llvm::Type* t);
+	void compileFloatCoercionEnd(llvm::Type* t);
+
+	/** @} */
+
 	void compileMethod(const llvm::Function& F);
+	/**
+	 * Declare all the locals of F with an initial value of their JS type
+	 */
+	void compileTypedLocals(const llvm::Function& F);
+	/**
+	 * Create the buffers shared by the allocas of F which are annotated with cheerp.stackslot metadata
+	 */
+	void compileStackSlots(const llvm::Function& F);
+	/**
+	 * Zero the part of its stack slot used by an alloca when its lifetime starts
+	 */
+	void compileStackSlotReset(const llvm::Value* ptr);
+	void compileStackSlotName(uint32_t slot);
+	/**
+	 * Compile all the functions using numThreads workers, the output is the same as the serial one.
+	 * In code size mode identical functions are also merged
+	 */
+	void compileMethodsInParallel(const std::vector<const llvm::Function*>& functions);
+	/**
+	 * Move the functions which are not directly reachable from the entry points to separate chunks.
+	 * The chunks and their manifest are written next to lazyChunksPrefix, stubs to load them are compiled in the main output.
+	 * Only the functions which belong to the core chunk are left in functions
+	 */
+	void compileLazyChunks(std::vector<const llvm::Function*>& functions);
+	/**
+	 * Release the names and the registers of a function which has been completely compiled.
+	 * It modifies data shared with the workers, so it cannot be called while any worker is compiling
+	 */
+	void releaseFunction(const llvm::Function& F);
 	void compileGlobal(const llvm::GlobalVariable& G);
 	void compileNullPtrs();
 	void compileCreateClosure();
+	void compileMemMove();
+	void compileTypedArrayPool();
+	void compileCodeSizeHelpers();
+	void compileRealloc();
 	void compileHandleVAArg();
+	void compileExceptionHelpers();
 
 	/**
 	 * Methods implemented in types.cpp
@@ -289,10 +433,18 @@ private:
 	void compileTypedArrayType(llvm::Type* t);
 	void compileTypeImpl(llvm::Type* t, COMPILE_TYPE_STYLE style);
 	void compileType(llvm::Type* t, COMPILE_TYPE_STYLE style);
+	// Allocas which share a stack slot are views of the buffer of the slot
+	void compileAllocaType(const llvm::AllocaInst* ai);
 	uint32_t compileClassTypeRecursive(const std::string& baseName, llvm::StructType* currentType, uint32_t baseCount);
 	void compileClassType(llvm::StructType* T);
 	void compileArrayClassType(llvm::StructType* T);
 	void compileArrayPointerType();
+	/**
+	 * Named struct types are instantiated with new and a constructor which takes all the fields,
+	 * so that all the objects of a type are created with the same properties in the same order
+	 */
+	void compileStructConstructorName(llvm::StructType* T);
+	void compileStructConstructors();
 
 	/**
 	 * Methods implemented in opcodes.cpp
@@ -300,6 +452,14 @@ private:
 	void compileIntegerComparison(const llvm::Value* lhs, const llvm::Value* rhs, llvm::CmpInst::Predicate p);
 	void compilePtrToInt(const llvm::Value* v);
 	void compileSubtraction(const llvm::Value* lhs, const llvm::Value* rhs);
+	void compileMultiplication(const llvm::Value* lhs, const llvm::Value* rhs);
+	void compileDivRem(const llvm::Value* lhs, const llvm::Value* rhs, unsigned opcode);
+	void compileLogicalShiftRight(const llvm::Value* lhs, const llvm::Value* rhs);
+	/**
+	 * Returns true if the JS value of the i32 v is known to be in [0, 2^31).
+	 * Signed and unsigned operations on such values do not need any normalization.
+	 */
+	bool isKnownNonNegativeI32(const llvm::Value* v);
 
 	static uint32_t getMaskForBitWidth(int width)
 	{
@@ -308,13 +468,36 @@ private:
 
 	//JS interoperability support
 	void compileClassesExportedToJs();
+
+	/**
+	 * Build a writer to compile functions in parallel with the given one.
+	 * It shares the analysis results and the names but it has its own stream and edge context.
+	 */
+	CheerpWriter(const CheerpWriter& parent, llvm::raw_ostream& s, SourceMapRecorder* recorder):
+		module(parent.module),targetData(&parent.module),currentFun(NULL),PA(parent.PA),registerize(parent.registerize),
+		globalDeps(parent.globalDeps),namegen(parent.namegen),types(parent.types),
+		asmJSCoercions(parent.asmJSCoercions),asmJSFunctions(parent.asmJSFunctions),
+		sourceMapGenerator(NULL),sourceMapRecorder(recorder),NewLine(NULL, recorder),
+		typedArrayPool(parent.typedArrayPool),typedLocals(parent.typedLocals),
+		codeSize(parent.codeSize),sizeReport(false),mergedFunctions(0),mergedFunctionsBytes(0),
+		readableOutput(parent.readableOutput),numThreads(1),compilingWorkers(0),
+		stream(s, parent.readableOutput)
+	{
+	}
 public:
 	ostream_proxy stream;
 	CheerpWriter(llvm::Module& m, llvm::raw_ostream& s, cheerp::PointerAnalyzer & PA, cheerp::Registerize & registerize,
-	             cheerp::GlobalDepsAnalyzer & gda, SourceMapGenerator* sourceMapGenerator, bool ReadableOutput, bool NoRegisterize):
+	             cheerp::GlobalDepsAnalyzer & gda, SourceMapGenerator* sourceMapGenerator, bool ReadableOutput, bool NoRegisterize,
+	             bool AsmJSCoercions, bool TypedArrayPool, bool TypedLocals, bool CodeSize, bool SizeReport,
+	             const std::string& LazyChunksPrefix, unsigned NumThreads):
 		module(m),targetData(&m),currentFun(NULL),PA(PA),registerize(registerize),globalDeps(gda),
-		namegen(m, globalDeps, registerize, PA, ReadableOutput),types(m, globalDeps.classesWithBaseInfo()),
-		sourceMapGenerator(sourceMapGenerator),NewLine(sourceMapGenerator),
+		namegen(m, globalDeps, registerize, PA, ReadableOutput, SizeReport),types(globalDeps.structsInfo()),
+		asmJSCoercions(AsmJSCoercions),
+		sourceMapGenerator(sourceMapGenerator),sourceMapRecorder(NULL),NewLine(sourceMapGenerator),
+		typedArrayPool(TypedArrayPool),typedLocals(TypedLocals),
+		codeSize(CodeSize),sizeReport(SizeReport),mergedFunctions(0),mergedFunctionsBytes(0),
+		lazyChunksPrefix(LazyChunksPrefix),
+		readableOutput(ReadableOutput),numThreads(NumThreads),compilingWorkers(0),
 		stream(s, ReadableOutput)
 	{
 	}
@@ -325,5 +508,11 @@ public:
 	void compilePHIOfBlockFromOtherBlock(const llvm::BasicBlock* to, const llvm::BasicBlock* from);
 };
 
+/**
+ * Add the passes which transform and analyze the module before it can be written.
+ * After them GlobalDepsAnalyzer, PointerAnalyzer and Registerize are available to CheerpWriter.
+ */
+void addPreparationPasses(llvm::PassManagerBase& PM, bool FieldSensitivePointers, bool NoRegisterize);
+
 }
 #endif
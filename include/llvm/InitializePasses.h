@@ -273,6 +273,7 @@ void initializeBBVectorizePass(PassRegistry&);
 void initializeMachineFunctionPrinterPassPass(PassRegistry&);
 void initializeStackMapLivenessPass(PassRegistry&);
 void initializeStructMemFuncLoweringPass(PassRegistry&);
+void initializeI64LoweringPass(PassRegistry&);
 void initializeAllocaMergingPass(PassRegistry&);
 void initializeGlobalDepsAnalyzerPass(PassRegistry&);
 }
@@ -9,22 +9,33 @@
 //
 //===----------------------------------------------------------------------===//
 
+#define DEBUG_TYPE "CheerpAllocaMerging"
 #include <algorithm>
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/CaptureTracking.h"
 #include "llvm/Cheerp/AllocaMerging.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/Cheerp/Registerize.h"
+#include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
+STATISTIC(NumMergedBufferAllocas, "Number of typed array and byte layout allocas sharing a buffer");
+STATISTIC(NumAllocaBytesSaved, "Number of bytes of buffers saved by sharing them between allocas");
+STATISTIC(NumHoistedAllocas, "Number of typed array allocas moved to globals");
+STATISTIC(NumZeroedScratchBuffers, "Number of typed array allocas moved to globals which are zeroed on every call");
+
 using namespace llvm;
 
 namespace llvm {
 
-void AllocaMergingBase::analyzeBlock(const cheerp::Registerize& registerize, BasicBlock& BB,
-				std::map<AllocaInst*, cheerp::Registerize::LiveRange>& allocaInfos)
+void AllocaMergingBase::analyzeBlock(const cheerp::Registerize& registerize, BasicBlock& BB, AllocaInfosMap& allocaInfos)
 {
 	for(Instruction& I: BB)
 	{
@@ -33,6 +44,8 @@ void AllocaMergingBase::analyzeBlock(const cheerp::Registerize& registerize, Bas
 		{
 			AllocaInst* AI = cast<AllocaInst>(&I);
 			assert(!AI->isArrayAllocation());
+			uint32_t index = allocaIndexes.size();
+			allocaIndexes[AI] = index;
 			allocaInfos.insert(std::make_pair(AI, registerize.getLiveRangeForAlloca(AI)));
 		}
 	}
@@ -60,7 +73,7 @@ bool AllocaMerging::runOnFunction(Function& F)
 {
 	cheerp::PointerAnalyzer & PA = getAnalysis<cheerp::PointerAnalyzer>();
 	cheerp::Registerize & registerize = getAnalysis<cheerp::Registerize>();
-	std::map<AllocaInst*, cheerp::Registerize::LiveRange> allocaInfos;
+	AllocaInfosMap allocaInfos = createAllocaInfosMap();
 	// Gather all the allocas
 	for(BasicBlock& BB: F)
 		analyzeBlock(registerize, BB, allocaInfos);
@@ -215,7 +228,7 @@ bool AllocaArraysMerging::runOnFunction(Function& F)
 
 	cheerp::PointerAnalyzer & PA = getAnalysis<cheerp::PointerAnalyzer>();
 	cheerp::Registerize & registerize = getAnalysis<cheerp::Registerize>();
-	std::map<AllocaInst*, cheerp::Registerize::LiveRange> allocaInfos;
+	AllocaInfosMap allocaInfos = createAllocaInfosMap();
 	// Gather all the allocas
 	for(BasicBlock& BB: F)
 		analyzeBlock(registerize, BB, allocaInfos);
@@ -338,6 +351,359 @@ char AllocaArraysMerging::ID = 0;
 
 FunctionPass *createAllocaArraysMergingPass() { return new AllocaArraysMerging(); }
 
+static bool isLifetimeMarker(const User* U)
+{
+	const IntrinsicInst* II = dyn_cast<IntrinsicInst>(U);
+	return II && (II->getIntrinsicID() == Intrinsic::lifetime_start || II->getIntrinsicID() == Intrinsic::lifetime_end);
+}
+
+static bool isLifetimeStart(const User* U)
+{
+	const IntrinsicInst* II = dyn_cast<IntrinsicInst>(U);
+	return II && II->getIntrinsicID() == Intrinsic::lifetime_start;
+}
+
+// The markers may use the alloca through bitcasts and the GEPs to the array wrapped by AllocaArrays
+static bool hasLifetimeStart(const Value* ptr)
+{
+	for(const User* U: ptr->users())
+	{
+		if(isLifetimeStart(U))
+			return true;
+		const GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(U);
+		if((isa<BitCastInst>(U) || (GEP && GEP->hasAllZeroIndices())) && hasLifetimeStart(U))
+			return true;
+	}
+	return false;
+}
+
+// Returns false if the whole typed array is written in the entry block before any read, so its initial content is never observed
+static bool mayReadBeforeWrite(AllocaInst* alloca)
+{
+	// Look for stores and memory intrinsics which write the whole array in the entry block before any other use.
+	// The offsets of the pointers derived from the alloca are counted in elements, -1 if they are not known.
+	ArrayType* at = cast<ArrayType>(alloca->getAllocatedType());
+	Type* elementType = at->getElementType();
+	uint64_t numElements = at->getNumElements();
+	uint64_t elementSize = elementType->getPrimitiveSizeInBits() / 8;
+	std::vector<bool> written(numElements, false);
+	uint64_t writtenCount = 0;
+	auto markWritten = [&](int64_t offset, const Value* length)
+	{
+		const ConstantInt* CI = dyn_cast<ConstantInt>(length);
+		if(offset < 0 || !CI)
+			return;
+		uint64_t end = std::min(numElements, offset + CI->getZExtValue() / elementSize);
+		for(uint64_t i = offset; i < end; i++)
+		{
+			if(!written[i])
+			{
+				written[i] = true;
+				writtenCount++;
+			}
+		}
+	};
+	DenseMap<const Value*, int64_t> offsets;
+	offsets[alloca] = 0;
+	for(BasicBlock::iterator it = ++BasicBlock::iterator(alloca), E = alloca->getParent()->end(); it != E; ++it)
+	{
+		if(writtenCount == numElements)
+			return false;
+		Instruction& I = *it;
+		if(std::none_of(I.op_begin(), I.op_end(), [&offsets](const Use& U) { return offsets.count(U.get()); }))
+			continue;
+		if(GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(&I))
+		{
+			int64_t offset = offsets[GEP->getPointerOperand()];
+			Type* pointedType = GEP->getPointerOperandType()->getPointerElementType();
+			uint64_t scale = pointedType == at ? numElements : 1;
+			for(auto idx = GEP->idx_begin(); idx != GEP->idx_end() && offset >= 0; ++idx)
+			{
+				const ConstantInt* CI = dyn_cast<ConstantInt>(*idx);
+				offset = CI ? offset + CI->getSExtValue() * scale : -1;
+				scale = 1;
+			}
+			offsets[GEP] = offset;
+		}
+		else if(BitCastInst* BI = dyn_cast<BitCastInst>(&I))
+		{
+			Type* pointedType = BI->getDestTy()->getPointerElementType();
+			offsets[BI] = (pointedType == at || pointedType == elementType) ? offsets[BI->getOperand(0)] : -1;
+		}
+		else if(StoreInst* SI = dyn_cast<StoreInst>(&I))
+		{
+			// Storing a pointer to the array makes it escape
+			if(offsets.count(SI->getValueOperand()))
+				return true;
+			markWritten(offsets[SI->getPointerOperand()], ConstantInt::get(IntegerType::get(SI->getContext(), 32), elementSize));
+		}
+		else if(IntrinsicInst* II = dyn_cast<IntrinsicInst>(&I))
+		{
+			switch(II->getIntrinsicID())
+			{
+				case Intrinsic::lifetime_start:
+				case Intrinsic::lifetime_end:
+					break;
+				case Intrinsic::memcpy:
+				case Intrinsic::memmove:
+					if(offsets.count(II->getArgOperand(1)))
+						return true;
+					// Fallthrough
+				case Intrinsic::memset:
+					if(!offsets.count(II->getArgOperand(0)))
+						return true;
+					markWritten(offsets[II->getArgOperand(0)], II->getArgOperand(2));
+					break;
+				default:
+					return true;
+			}
+		}
+		else
+		{
+			// Loads and any other use may read the array
+			return true;
+		}
+	}
+	return writtenCount != numElements;
+}
+
+uint32_t AllocaBuffersMerging::getBufferSize(const DataLayout& DL, AllocaInst* alloca)
+{
+	// Only typed arrays are backed by an ArrayBuffer. Byte layout structs are not merged, since their buffer
+	// is accessed as a whole when they are copied or casted to other types.
+	// AllocaArrays wraps the allocas which are not COMPLETE_OBJECT in an array of one element.
+	Type* t = alloca->getAllocatedType();
+	if(t->isArrayTy() && t->getArrayNumElements() == 1 && t->getArrayElementType()->isArrayTy())
+		t = t->getArrayElementType();
+	ArrayType* at = dyn_cast<ArrayType>(t);
+	if(!at || !cheerp::TypeSupport::isTypedArrayType(at->getElementType()) || at->getNumElements() < 2)
+		return 0;
+	return DL.getTypeAllocSize(at);
+}
+
+bool AllocaBuffersMerging::runOnFunction(Function& F)
+{
+	cheerp::Registerize & registerize = getAnalysis<cheerp::Registerize>();
+	const DataLayout* DL = F.getParent()->getDataLayout();
+	if (!DL || F.empty() || !registerize.hasAllocaLiveRanges())
+		return false;
+	// The buffers are created when entering the function, only consider the allocas in the entry block
+	struct BufferAlloca
+	{
+		AllocaInst* alloca;
+		uint32_t size;
+	};
+	std::vector<BufferAlloca> candidates;
+	for(Instruction& I: F.getEntryBlock())
+	{
+		AllocaInst* AI = dyn_cast<AllocaInst>(&I);
+		if(!AI || AI->isArrayAllocation())
+			continue;
+		uint32_t size = getBufferSize(*DL, AI);
+		// If the range is empty, we have an alloca that we can't analyze
+		if(!size || registerize.getLiveRangeForAlloca(AI).empty())
+			continue;
+		// The views of a slot see the data left by the other allocas. The writer zeroes them when their
+		// lifetime starts, otherwise they must be completely written before being read.
+		// The allocas wrapped by AllocaArrays escape as regular pointers, so they are not analyzed.
+		if(hasLifetimeStart(AI) || (!AI->getAllocatedType()->getArrayElementType()->isArrayTy() && !mayReadBeforeWrite(AI)))
+			candidates.push_back({AI, size});
+	}
+	if (candidates.size() < 2)
+		return false;
+	// Place the largest buffers first, each slot is as big as its first alloca
+	std::stable_sort(candidates.begin(), candidates.end(),
+		[](const BufferAlloca& a, const BufferAlloca& b) { return a.size > b.size; });
+	struct Slot
+	{
+		cheerp::Registerize::LiveRange range;
+		uint32_t size;
+		uint32_t totalSize;
+		std::vector<AllocaInst*> allocas;
+	};
+	std::vector<Slot> slots;
+	for(const BufferAlloca& candidate: candidates)
+	{
+		const cheerp::Registerize::LiveRange& range = registerize.getLiveRangeForAlloca(candidate.alloca);
+		auto it = std::find_if(slots.begin(), slots.end(),
+			[&range](const Slot& s) { return !s.range.doesInterfere(range); });
+		if(it == slots.end())
+		{
+			slots.push_back({range, candidate.size, 0, {}});
+			it = slots.end() - 1;
+		}
+		else
+			it->range.merge(range);
+		it->totalSize += candidate.size;
+		it->allocas.push_back(candidate.alloca);
+	}
+
+	bool Changed = false;
+	uint32_t slotIndex = 0;
+	uint32_t savedBytes = 0;
+	Type* int32Type = IntegerType::get(F.getContext(), 32);
+	for(const Slot& slot: slots)
+	{
+		if(slot.allocas.size() < 2)
+			continue;
+		Value* slotOps[] = { ConstantInt::get(int32Type, slotIndex++), ConstantInt::get(int32Type, slot.size) };
+		MDNode* slotMD = MDNode::get(F.getContext(), slotOps);
+		for(AllocaInst* AI: slot.allocas)
+			AI->setMetadata("cheerp.stackslot", slotMD);
+		NumMergedBufferAllocas += slot.allocas.size();
+		savedBytes += slot.totalSize - slot.size;
+		Changed = true;
+	}
+	NumAllocaBytesSaved += savedBytes;
+	DEBUG(if(Changed) dbgs() << "AllocaBuffersMerging: " << F.getName() << " uses " << slotIndex << " buffers, "
+		<< savedBytes << " bytes saved per call\n");
+	return Changed;
+}
+
+const char *AllocaBuffersMerging::getPassName() const {
+	return "AllocaBuffersMerging";
+}
+
+void AllocaBuffersMerging::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	AU.addRequired<cheerp::Registerize>();
+	AU.setPreservesAll();
+
+	llvm::FunctionPass::getAnalysisUsage(AU);
+}
+
+char AllocaBuffersMerging::ID = 0;
+
+FunctionPass *createAllocaBuffersMergingPass() { return new AllocaBuffersMerging(); }
+
+bool AllocaArraysHoisting::isSafeCall(ImmutableCallSite CS)
+{
+	const Function* F = CS.getCalledFunction();
+	if(!F)
+		return false;
+	if(F->isIntrinsic() || cheerp::DynamicAllocInfo::getAllocType(CS) != cheerp::DynamicAllocInfo::not_an_alloc)
+		return true;
+	// Builtins compiled inline by the writer, they never call back compiled code.
+	// The whitelist is conservative: the only client functions are the ones of Math, any other browser
+	// function may run a callback, e.g. an event listener, which could reenter the caller.
+	StringRef name = F->getName();
+	return name == "free" || name == "_ZdlPv" || name == "_ZdaPv" || name == "fmod" ||
+		name.startswith("_ZN6client4Math");
+}
+
+bool AllocaArraysHoisting::hoistAllocas(Function& F)
+{
+	Module& M = *F.getParent();
+	std::vector<AllocaInst*> candidates;
+	for(Instruction& I: F.getEntryBlock())
+	{
+		AllocaInst* AI = dyn_cast<AllocaInst>(&I);
+		if(!AI || AI->isArrayAllocation())
+			continue;
+		ArrayType* at = dyn_cast<ArrayType>(AI->getAllocatedType());
+		if(at && cheerp::TypeSupport::isTypedArrayType(at->getElementType()) && at->getNumElements() >= 2)
+			candidates.push_back(AI);
+	}
+
+	for(AllocaInst* AI: candidates)
+	{
+		ArrayType* at = cast<ArrayType>(AI->getAllocatedType());
+		GlobalVariable* scratch = new GlobalVariable(M, at, false, GlobalValue::InternalLinkage,
+					ConstantAggregateZero::get(at), F.getName() + "." + (AI->hasName() ? AI->getName() : "scratch"));
+		if(mayReadBeforeWrite(AI))
+		{
+			IRBuilder<> Builder(AI);
+			Value* start = Builder.CreateConstInBoundsGEP2_32(scratch, 0, 0);
+			uint32_t elementSize = at->getElementType()->getPrimitiveSizeInBits() / 8;
+			Builder.CreateMemSet(start, Builder.getInt8(0), Builder.getInt32(at->getNumElements() * elementSize), elementSize,
+						/*isVolatile*/false, /*TBAATag*/nullptr, /*byteLayout*/false);
+			NumZeroedScratchBuffers++;
+		}
+		// Lifetime markers are only meaningful for allocas, and the casts they use would force the global to be a regular pointer
+		SmallVector<Instruction*, 4> lifetimeMarkers;
+		for(User* U: AI->users())
+		{
+			Instruction* I = cast<Instruction>(U);
+			if(isa<BitCastInst>(I))
+			{
+				if(std::all_of(I->user_begin(), I->user_end(), isLifetimeMarker))
+					lifetimeMarkers.push_back(I);
+			}
+			else if(isLifetimeMarker(I))
+				lifetimeMarkers.push_back(I);
+		}
+		for(Instruction* I: lifetimeMarkers)
+		{
+			while(!I->use_empty())
+				cast<Instruction>(I->user_back())->eraseFromParent();
+			I->eraseFromParent();
+		}
+		AI->replaceAllUsesWith(scratch);
+		AI->eraseFromParent();
+		NumHoistedAllocas++;
+	}
+	return !candidates.empty();
+}
+
+bool AllocaArraysHoisting::runOnModule(Module& M)
+{
+	// Visit the functions bottom up over the SCCs of the call graph, so that it is already known
+	// if the callees may call unknown code
+	DenseSet<const Function*> callsUnknownCode;
+	std::vector<Function*> nonReentrant;
+	CallGraph CG(M);
+	for(scc_iterator<CallGraph*> it = scc_begin(&CG); !it.isAtEnd(); ++it)
+	{
+		const std::vector<CallGraphNode*>& scc = *it;
+		bool callsUnknown = false;
+		for(CallGraphNode* node: scc)
+		{
+			Function* F = node->getFunction();
+			if(!F || F->isDeclaration())
+				continue;
+			for(BasicBlock& BB: *F)
+			{
+				for(Instruction& I: BB)
+				{
+					ImmutableCallSite CS(&I);
+					if(!CS)
+						continue;
+					const Function* callee = CS.getCalledFunction();
+					if(callee && !callee->isDeclaration())
+						callsUnknown |= callsUnknownCode.count(callee);
+					else
+						callsUnknown |= !isSafeCall(CS);
+				}
+			}
+		}
+		if(callsUnknown)
+		{
+			for(CallGraphNode* node: scc)
+				callsUnknownCode.insert(node->getFunction());
+		}
+		else if(!it.hasLoop() && scc[0]->getFunction() && !scc[0]->getFunction()->isDeclaration())
+			nonReentrant.push_back(scc[0]->getFunction());
+	}
+
+	bool Changed = false;
+	for(Function* F: nonReentrant)
+		Changed |= hoistAllocas(*F);
+	return Changed;
+}
+
+const char *AllocaArraysHoisting::getPassName() const {
+	return "AllocaArraysHoisting";
+}
+
+void AllocaArraysHoisting::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	llvm::ModulePass::getAnalysisUsage(AU);
+}
+
+char AllocaArraysHoisting::ID = 0;
+
+ModulePass *createAllocaArraysHoistingPass() { return new AllocaArraysHoisting(); }
+
 }
 
 INITIALIZE_PASS_BEGIN(AllocaMerging, "AllocaMerging", "Merge alloca instructions used on non-overlapping ranges",
@@ -0,0 +1,400 @@
+//===-- I64Lowering.cpp - Cheerp helper -----------------------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2014 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpI64Lowering"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Cheerp/I64Lowering.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumLoweredFunctions, "Number of functions with i64 values split in i32 pairs");
+STATISTIC(NumLoweredInstructions, "Number of i64 instructions split in i32 pairs");
+
+const char *I64Lowering::getPassName() const {
+	return "I64Lowering";
+}
+
+/**
+ * i64 values passed through signatures, calls and memory would need to be split
+ * at the boundaries as well. This is not supported and a fatal error is reported,
+ * instead of silently computing them as doubles.
+ */
+static void reportUnsupportedI64(const Function& F, const char* use)
+{
+	llvm::report_fatal_error(Twine("Unsupported 64-bit integer ") + use + " in function " + F.getName() +
+		", please use 32-bit integers or doubles", false);
+}
+
+/**
+ * Only values which never leave the function are lowered.
+ * Intrinsics can only take constant i64 arguments, which are left unchanged.
+ * If any other i64 value is used in an unsupported way the function is left unchanged.
+ */
+bool I64Lowering::canLowerFunction(const Function& F) const
+{
+	if(isI64(F.getReturnType()))
+		reportUnsupportedI64(F, "return value");
+	for(const Argument& arg: F.getArgumentList())
+	{
+		if(isI64(arg.getType()))
+			reportUnsupportedI64(F, "argument");
+	}
+	bool canLower = true;
+	for(const BasicBlock& BB: F)
+	{
+		for(const Instruction& I: BB)
+		{
+			if(const LoadInst* li = dyn_cast<LoadInst>(&I))
+			{
+				if(isI64(li->getType()))
+					reportUnsupportedI64(F, "load");
+				continue;
+			}
+			if(const StoreInst* si = dyn_cast<StoreInst>(&I))
+			{
+				if(isI64(si->getValueOperand()->getType()))
+					reportUnsupportedI64(F, "store");
+				continue;
+			}
+			if(isa<CallInst>(I) || isa<InvokeInst>(I))
+			{
+				ImmutableCallSite CS(&I);
+				if(isI64(I.getType()))
+					reportUnsupportedI64(F, "call result");
+				const Function* callee = CS.getCalledFunction();
+				for(ImmutableCallSite::arg_iterator it = CS.arg_begin(); it != CS.arg_end(); ++it)
+				{
+					const Value* arg = *it;
+					if(isI64(arg->getType()) && !(callee && callee->isIntrinsic() && isa<ConstantInt>(arg)))
+						reportUnsupportedI64(F, "call argument");
+				}
+				continue;
+			}
+			// Once the function is known not to be lowerable only the unsupported uses above are still checked
+			if(!canLower)
+				continue;
+			bool hasI64Operand = false;
+			for(const Value* op: I.operands())
+			{
+				if(!isI64(op->getType()))
+					continue;
+				// Only plain integer constants can be split at compile time
+				if(isa<Constant>(op) && !isa<ConstantInt>(op) && !isa<UndefValue>(op))
+					canLower = false;
+				hasI64Operand = true;
+			}
+			if(isI64(I.getType()))
+			{
+				switch(I.getOpcode())
+				{
+					case Instruction::Add:
+					case Instruction::Sub:
+					case Instruction::Mul:
+					case Instruction::And:
+					case Instruction::Or:
+					case Instruction::Xor:
+					case Instruction::PHI:
+					case Instruction::Select:
+						break;
+					case Instruction::Shl:
+					case Instruction::LShr:
+					case Instruction::AShr:
+						// Only shifts by a constant amount are supported
+						if(!isa<ConstantInt>(I.getOperand(1)))
+							canLower = false;
+						break;
+					case Instruction::ZExt:
+					case Instruction::SExt:
+						if(I.getOperand(0)->getType()->getIntegerBitWidth() > 32)
+							canLower = false;
+						break;
+					default:
+						canLower = false;
+				}
+			}
+			else if(hasI64Operand)
+			{
+				if(!isa<ICmpInst>(I) && !isa<TruncInst>(I))
+					canLower = false;
+			}
+		}
+	}
+	return canLower;
+}
+
+I64Lowering::SplitValue I64Lowering::getSplitValue(Value* v)
+{
+	assert(isI64(v->getType()));
+	if(ConstantInt* c = dyn_cast<ConstantInt>(v))
+	{
+		uint64_t val = c->getZExtValue();
+		return SplitValue(ConstantInt::get(int32Type, val & 0xffffffff), ConstantInt::get(int32Type, val >> 32));
+	}
+	if(isa<UndefValue>(v))
+		return SplitValue(UndefValue::get(int32Type), UndefValue::get(int32Type));
+	auto it = splitValues.find(v);
+	if(it != splitValues.end())
+		return it->second;
+	// Operands are lowered on demand, the new code is inserted just before the original instruction
+	// so that it is still dominated by the lowered operands
+	SplitValue ret = lowerInstruction(*cast<Instruction>(v));
+	splitValues.insert(std::make_pair(v, ret));
+	NumLoweredInstructions++;
+	return ret;
+}
+
+/**
+ * Computes the full 64-bit product of two 32-bit unsigned integers using 16-bit limbs.
+ * Every partial product fits in 32 bits, so the i32 arithmetic is exact.
+ */
+I64Lowering::SplitValue I64Lowering::createMul32(IRBuilder<>& IRB, Value* lhs, Value* rhs)
+{
+	Value* mask = ConstantInt::get(int32Type, 0xffff);
+	Value* sixteen = ConstantInt::get(int32Type, 16);
+	Value* a0 = IRB.CreateAnd(lhs, mask);
+	Value* a1 = IRB.CreateLShr(lhs, sixteen);
+	Value* b0 = IRB.CreateAnd(rhs, mask);
+	Value* b1 = IRB.CreateLShr(rhs, sixteen);
+	Value* p00 = IRB.CreateMul(a0, b0);
+	Value* p01 = IRB.CreateMul(a0, b1);
+	Value* p10 = IRB.CreateMul(a1, b0);
+	Value* p11 = IRB.CreateMul(a1, b1);
+	// The middle column can not overflow, it is less than 3*2^16
+	Value* mid = IRB.CreateAdd(IRB.CreateLShr(p00, sixteen), IRB.CreateAdd(IRB.CreateAnd(p01, mask), IRB.CreateAnd(p10, mask)));
+	Value* lo = IRB.CreateOr(IRB.CreateShl(mid, sixteen), IRB.CreateAnd(p00, mask));
+	Value* hi = IRB.CreateAdd(p11, IRB.CreateAdd(IRB.CreateLShr(p01, sixteen),
+			IRB.CreateAdd(IRB.CreateLShr(p10, sixteen), IRB.CreateLShr(mid, sixteen))));
+	return SplitValue(lo, hi);
+}
+
+I64Lowering::SplitValue I64Lowering::lowerInstruction(Instruction& I)
+{
+	IRBuilder<> IRB(&I);
+	switch(I.getOpcode())
+	{
+		case Instruction::ZExt:
+		{
+			Value* src = I.getOperand(0);
+			Value* lo = src->getType() == int32Type ? src : IRB.CreateZExt(src, int32Type);
+			return SplitValue(lo, ConstantInt::get(int32Type, 0));
+		}
+		case Instruction::SExt:
+		{
+			Value* src = I.getOperand(0);
+			Value* lo = src->getType() == int32Type ? src : IRB.CreateSExt(src, int32Type);
+			return SplitValue(lo, IRB.CreateAShr(lo, ConstantInt::get(int32Type, 31)));
+		}
+		case Instruction::And:
+		case Instruction::Or:
+		case Instruction::Xor:
+		{
+			SplitValue lhs = getSplitValue(I.getOperand(0));
+			SplitValue rhs = getSplitValue(I.getOperand(1));
+			Instruction::BinaryOps opcode = (Instruction::BinaryOps)I.getOpcode();
+			return SplitValue(IRB.CreateBinOp(opcode, lhs.first, rhs.first), IRB.CreateBinOp(opcode, lhs.second, rhs.second));
+		}
+		case Instruction::Add:
+		{
+			SplitValue lhs = getSplitValue(I.getOperand(0));
+			SplitValue rhs = getSplitValue(I.getOperand(1));
+			Value* lo = IRB.CreateAdd(lhs.first, rhs.first);
+			// The low part wrapped around if it is less than one of the addends
+			Value* carry = IRB.CreateZExt(IRB.CreateICmpULT(lo, lhs.first), int32Type);
+			return SplitValue(lo, IRB.CreateAdd(IRB.CreateAdd(lhs.second, rhs.second), carry));
+		}
+		case Instruction::Sub:
+		{
+			SplitValue lhs = getSplitValue(I.getOperand(0));
+			SplitValue rhs = getSplitValue(I.getOperand(1));
+			Value* lo = IRB.CreateSub(lhs.first, rhs.first);
+			Value* borrow = IRB.CreateZExt(IRB.CreateICmpULT(lhs.first, rhs.first), int32Type);
+			return SplitValue(lo, IRB.CreateSub(IRB.CreateSub(lhs.second, rhs.second), borrow));
+		}
+		case Instruction::Mul:
+		{
+			SplitValue lhs = getSplitValue(I.getOperand(0));
+			SplitValue rhs = getSplitValue(I.getOperand(1));
+			SplitValue lowProduct = createMul32(IRB, lhs.first, rhs.first);
+			// The cross products only contribute to the high part, their own high parts overflow
+			Value* cross = IRB.CreateAdd(IRB.CreateMul(lhs.first, rhs.second), IRB.CreateMul(lhs.second, rhs.first));
+			return SplitValue(lowProduct.first, IRB.CreateAdd(lowProduct.second, cross));
+		}
+		case Instruction::Shl:
+		case Instruction::LShr:
+		case Instruction::AShr:
+		{
+			SplitValue lhs = getSplitValue(I.getOperand(0));
+			uint32_t amount = cast<ConstantInt>(I.getOperand(1))->getZExtValue() & 63;
+			Value* zero = ConstantInt::get(int32Type, 0);
+			if(amount == 0)
+				return lhs;
+			if(amount >= 32)
+			{
+				Value* rest = ConstantInt::get(int32Type, amount - 32);
+				if(I.getOpcode() == Instruction::Shl)
+					return SplitValue(zero, IRB.CreateShl(lhs.first, rest));
+				else if(I.getOpcode() == Instruction::LShr)
+					return SplitValue(IRB.CreateLShr(lhs.second, rest), zero);
+				else
+					return SplitValue(IRB.CreateAShr(lhs.second, rest), IRB.CreateAShr(lhs.second, ConstantInt::get(int32Type, 31)));
+			}
+			Value* shift = ConstantInt::get(int32Type, amount);
+			Value* reverseShift = ConstantInt::get(int32Type, 32 - amount);
+			if(I.getOpcode() == Instruction::Shl)
+			{
+				return SplitValue(IRB.CreateShl(lhs.first, shift),
+						IRB.CreateOr(IRB.CreateShl(lhs.second, shift), IRB.CreateLShr(lhs.first, reverseShift)));
+			}
+			Value* lo = IRB.CreateOr(IRB.CreateLShr(lhs.first, shift), IRB.CreateShl(lhs.second, reverseShift));
+			if(I.getOpcode() == Instruction::LShr)
+				return SplitValue(lo, IRB.CreateLShr(lhs.second, shift));
+			else
+				return SplitValue(lo, IRB.CreateAShr(lhs.second, shift));
+		}
+		case Instruction::Select:
+		{
+			SelectInst& si = cast<SelectInst>(I);
+			SplitValue t = getSplitValue(si.getTrueValue());
+			SplitValue f = getSplitValue(si.getFalseValue());
+			return SplitValue(IRB.CreateSelect(si.getCondition(), t.first, f.first),
+					IRB.CreateSelect(si.getCondition(), t.second, f.second));
+		}
+		default:
+			llvm::errs() << "Unexpected instruction " << I << "\n";
+			llvm::report_fatal_error("Unsupported code found, please report a bug", false);
+	}
+	return SplitValue(NULL, NULL);
+}
+
+Value* I64Lowering::lowerComparison(ICmpInst& I)
+{
+	SplitValue lhs = getSplitValue(I.getOperand(0));
+	SplitValue rhs = getSplitValue(I.getOperand(1));
+	IRBuilder<> IRB(&I);
+	CmpInst::Predicate p = I.getPredicate();
+	if(p == CmpInst::ICMP_EQ)
+		return IRB.CreateAnd(IRB.CreateICmpEQ(lhs.first, rhs.first), IRB.CreateICmpEQ(lhs.second, rhs.second));
+	else if(p == CmpInst::ICMP_NE)
+		return IRB.CreateOr(IRB.CreateICmpNE(lhs.first, rhs.first), IRB.CreateICmpNE(lhs.second, rhs.second));
+	// The high parts decide unless they are equal, the low parts are always compared as unsigned
+	CmpInst::Predicate strictPredicate;
+	switch(p)
+	{
+		case CmpInst::ICMP_SLE:
+			strictPredicate = CmpInst::ICMP_SLT;
+			break;
+		case CmpInst::ICMP_SGE:
+			strictPredicate = CmpInst::ICMP_SGT;
+			break;
+		case CmpInst::ICMP_ULE:
+			strictPredicate = CmpInst::ICMP_ULT;
+			break;
+		case CmpInst::ICMP_UGE:
+			strictPredicate = CmpInst::ICMP_UGT;
+			break;
+		default:
+			strictPredicate = p;
+	}
+	CmpInst::Predicate lowPredicate = ICmpInst::getUnsignedPredicate(p);
+	Value* highDecides = IRB.CreateICmp(strictPredicate, lhs.second, rhs.second);
+	Value* highEqual = IRB.CreateICmpEQ(lhs.second, rhs.second);
+	Value* lowDecides = IRB.CreateICmp(lowPredicate, lhs.first, rhs.first);
+	return IRB.CreateOr(highDecides, IRB.CreateAnd(highEqual, lowDecides));
+}
+
+bool I64Lowering::runOnFunction(Function& F)
+{
+	if(F.empty() || !canLowerFunction(F))
+		return false;
+	int32Type = Type::getInt32Ty(F.getContext());
+
+	SmallVector<Instruction*, 16> originalInsts;
+	SmallVector<PHINode*, 4> originalPHIs;
+	for(BasicBlock& BB: F)
+	{
+		for(Instruction& I: BB)
+		{
+			// Calls have been checked to only use constant i64 arguments, which are kept
+			if(isa<CallInst>(I) || isa<InvokeInst>(I))
+				continue;
+			bool hasI64Operand = false;
+			for(const Value* op: I.operands())
+				hasI64Operand |= isI64(op->getType());
+			if(!isI64(I.getType()) && !hasI64Operand)
+				continue;
+			originalInsts.push_back(&I);
+			// PHIs are created in advance to break the cycles between the values
+			if(PHINode* phi = dyn_cast<PHINode>(&I))
+			{
+				originalPHIs.push_back(phi);
+				PHINode* lo = PHINode::Create(int32Type, phi->getNumIncomingValues(), phi->getName()+".lo", phi);
+				PHINode* hi = PHINode::Create(int32Type, phi->getNumIncomingValues(), phi->getName()+".hi", phi);
+				splitValues.insert(std::make_pair(phi, SplitValue(lo, hi)));
+			}
+		}
+	}
+	if(originalInsts.empty())
+		return false;
+
+	for(Instruction* I: originalInsts)
+	{
+		if(isI64(I->getType()))
+			getSplitValue(I);
+		else if(ICmpInst* ci = dyn_cast<ICmpInst>(I))
+			ci->replaceAllUsesWith(lowerComparison(*ci));
+		else
+		{
+			TruncInst* ti = cast<TruncInst>(I);
+			Value* lo = getSplitValue(ti->getOperand(0)).first;
+			if(ti->getType() != int32Type)
+			{
+				IRBuilder<> IRB(ti);
+				lo = IRB.CreateTrunc(lo, ti->getType());
+			}
+			ti->replaceAllUsesWith(lo);
+		}
+	}
+	for(PHINode* phi: originalPHIs)
+	{
+		SplitValue newPHIs = splitValues.find(phi)->second;
+		for(unsigned i = 0; i < phi->getNumIncomingValues(); i++)
+		{
+			SplitValue incoming = getSplitValue(phi->getIncomingValue(i));
+			cast<PHINode>(newPHIs.first)->addIncoming(incoming.first, phi->getIncomingBlock(i));
+			cast<PHINode>(newPHIs.second)->addIncoming(incoming.second, phi->getIncomingBlock(i));
+		}
+	}
+
+	// The original i64 code is now dead, the cycles between PHIs are broken before erasing it
+	for(Instruction* I: originalInsts)
+		I->dropAllReferences();
+	for(Instruction* I: originalInsts)
+		I->eraseFromParent();
+	splitValues.clear();
+
+	NumLoweredFunctions++;
+	DEBUG(dbgs() << "Lowered i64 values in " << F.getName() << "\n");
+	return true;
+}
+
+char I64Lowering::ID = 0;
+
+FunctionPass *llvm::createI64LoweringPass() { return new I64Lowering(); }
+
+INITIALIZE_PASS_BEGIN(I64Lowering, "I64Lowering", "Split i64 values in pairs of i32 values",
+                      false, false)
+INITIALIZE_PASS_END(I64Lowering, "I64Lowering", "Split i64 values in pairs of i32 values",
+                    false, false)
@@ -13,7 +13,10 @@
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/IR/Argument.h"
+#include "llvm/IR/Constants.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/FormattedStream.h"
@@ -35,7 +38,10 @@ void IndirectPointerKindConstraint::dump() const
 			dbgs() << "\tDepends on argument " << i << " of " << funcPtr->getName() << "\n";
 			break;
 		case STORED_TYPE_CONSTRAINT:
-			dbgs() << "Depends on stored type " << *typePtr << "\n";
+			if(i)
+				dbgs() << "Depends on field " << (i-1) << " of stored type " << *typePtr << "\n";
+			else
+				dbgs() << "Depends on stored type " << *typePtr << "\n";
 			break;
 		case RETURN_TYPE_CONSTRAINT:
 			dbgs() << "Depends on returned type " << *typePtr << "\n";
@@ -114,6 +120,8 @@ void PointerAnalyzer::getAnalysisUsage(AnalysisUsage& AU) const
 
 bool PointerAnalyzer::runOnModule(Module& M)
 {
+	if(cacheBundle.fieldSensitive)
+		computeTrackedFields(M);
 	prefetch(M);
 	return false;
 }
@@ -125,26 +133,71 @@ struct PointerUsageVisitor
 
 	PointerUsageVisitor( PointerAnalyzer::CacheBundle& cacheBundle ) : cacheBundle(cacheBundle) {}
 
-	PointerKindWrapper visitValue(const Value* v);
-	PointerKindWrapper visitUse(const Use* U);
+	// A value being visited, or a value whose uses are being visited
+	struct VisitFrame
+	{
+		enum MODE
+		{
+			VALUE_USES, // The kind of the value depends on the kinds of its uses
+			VALUE_FORWARD, // The kind of the value is the kind of another value
+			VALUE_CHECK_USES, // The value is a COMPLETE_OBJECT and its uses must be COMPLETE_OBJECT as well
+			ALL_USES // Only the kind of the uses is needed, nothing is cached
+		};
+		const Value* p;
+		MODE mode;
+		bool indirectRet;
+		const Value* forward;
+		Value::const_use_iterator nextUse;
+		PointerKindWrapper result;
+		VisitFrame(const Value* p, MODE mode, bool indirectRet = false, const Value* forward = nullptr):
+			p(p), mode(mode), indirectRet(indirectRet), forward(forward), nextUse(p->use_begin()), result(COMPLETE_OBJECT)
+		{
+		}
+	};
+
+	PointerKindWrapper visitValue(const Value* v)
+	{
+		return visitFrames(v, false);
+	}
+	PointerKindWrapper visitAllUses(const Value* v)
+	{
+		return visitFrames(v, true);
+	}
+	// Visit a value, or only its uses, following the chains of uses with an explicit stack
+	PointerKindWrapper visitFrames(const Value* v, bool usesOnly);
+	// Return true if the kind of p is known without visiting other values and store it in ret,
+	// otherwise push a frame for p on the stack
+	bool beginValue(const Value* p, std::vector<VisitFrame>& stack, PointerKindWrapper& ret);
+	// Cache the kind of p once it is known
+	PointerKindWrapper endValue(const Value* p, PointerKindWrapper k, bool indirectRet);
+	// If the kind of the use is the kind of the user, the user is stored in next and must be visited
+	PointerKindWrapper visitUse(const Use* U, const Value*& next);
 	PointerKindWrapper visitReturn(const Function* F);
 	PointerKindWrapper resolvePointerKind(const PointerKindWrapper& k, resolve_visited_set_t& closedset);
 	PointerKindWrapper resolveConstraint(const IndirectPointerKindConstraint& c);
 	bool visitByteLayoutChain ( const Value * v );
 	static POINTER_KIND getKindForType(Type*);
 
-	PointerKindWrapper visitAllUses(const Value* v)
+	// The constraint for the pointers stored at the given address
+	PointerKindWrapper storedConstraint( const Value * address ) const
 	{
-		PointerKindWrapper result(COMPLETE_OBJECT);
-		for(const Use& u : v->uses())
-		{
-			result = result | visitUse(&u);
-			if (result==REGULAR)
-				break;
-		}
-		return result;
+		PointerAnalyzer::StructField field = getTrackedField(address);
+		if ( field.first )
+			return PointerKindWrapper( STORED_TYPE_CONSTRAINT, field.first, field.second + 1 );
+		return PointerKindWrapper( STORED_TYPE_CONSTRAINT, address->getType()->getPointerElementType()->getPointerElementType() );
+	}
+
+	// If the address is a struct field tracked by the field sensitive mode return it
+	PointerAnalyzer::StructField getTrackedField( const Value * address ) const
+	{
+		PointerAnalyzer::StructField field = getAddressedField(address);
+		if ( field.first && cacheBundle.isFieldTracked(field.first, field.second) )
+			return field;
+		return PointerAnalyzer::StructField(nullptr, 0);
 	}
 
+	static PointerAnalyzer::StructField getAddressedField( const Value * address );
+
 	Type * realType( const Value * v ) const
 	{
 		assert( v->getType()->isPointerTy() );
@@ -157,16 +210,60 @@ struct PointerUsageVisitor
 	visited_set_t closedset;
 };
 
+PointerAnalyzer::StructField PointerUsageVisitor::getAddressedField( const Value * address )
+{
+	if ( !isGEP(address) )
+		return PointerAnalyzer::StructField(nullptr, 0);
+	const User* u = cast<User>(address);
+	// The struct and the index selected by the last index of the GEP, if any
+	StructType* lastStruct = nullptr;
+	uint32_t lastIndex = 0;
+	Type* curType = u->getOperand(0)->getType()->getPointerElementType();
+	for (uint32_t i=2;i<u->getNumOperands();i++)
+	{
+		if (StructType* ST = dyn_cast<StructType>(curType))
+		{
+			lastStruct = ST;
+			lastIndex = cast<ConstantInt>( u->getOperand(i) )->getZExtValue();
+			curType = ST->getElementType(lastIndex);
+		}
+		else
+		{
+			lastStruct = nullptr;
+			curType = curType->getSequentialElementType();
+		}
+	}
+	return PointerAnalyzer::StructField(lastStruct, lastIndex);
+}
+
 bool PointerUsageVisitor::visitByteLayoutChain( const Value * p )
 {
-	if ( TypeSupport::hasByteLayout(p->getType()->getPointerElementType()) && visitValue(p) != COMPLETE_OBJECT)
-		return true;
-	if ( isGEP(p))
+	// The indices of the GEPs in the chain are checked after their bases
+	SmallVector<const User*, 4> geps;
+	while(true)
 	{
-		const User* u = cast<User>(p);
-		// We need to find out if the base element or any element accessed by the GEP is byte layout
-		if (visitByteLayoutChain(u->getOperand(0)))
+		if ( TypeSupport::hasByteLayout(p->getType()->getPointerElementType()) && visitValue(p) != COMPLETE_OBJECT)
 			return true;
+		if ( isGEP(p))
+		{
+			geps.push_back(cast<User>(p));
+			p = geps.back()->getOperand(0);
+		}
+		else if ( isBitCast(p))
+		{
+			const User* u = cast<User>(p);
+			if (TypeSupport::hasByteLayout(u->getOperand(0)->getType()->getPointerElementType()))
+				return true;
+			p = u->getOperand(0);
+		}
+		else
+			break;
+	}
+
+	for (auto it = geps.rbegin(); it != geps.rend(); ++it)
+	{
+		const User* u = *it;
+		// We need to find out if the base element or any element accessed by the GEP is byte layout
 		Type* curType = u->getOperand(0)->getType();
 		for (uint32_t i=1;i<u->getNumOperands();i++)
 		{
@@ -183,56 +280,120 @@ bool PointerUsageVisitor::visitByteLayoutChain( const Value * p )
 				curType = curType->getSequentialElementType();
 			}
 		}
-		return false;
-	}
-
-	if ( isBitCast(p))
-	{
-		const User* u = cast<User>(p);
-		if (TypeSupport::hasByteLayout(u->getOperand(0)->getType()->getPointerElementType()))
-			return true;
-		if (visitByteLayoutChain(u->getOperand(0)))
-			return true;
-		return false;
 	}
-
 	return false;
 }
 
-PointerKindWrapper PointerUsageVisitor::visitValue(const Value* p)
+PointerKindWrapper PointerUsageVisitor::visitFrames(const Value* v, bool usesOnly)
 {
-	if(cacheBundle.valueCache.count(p))
-		return cacheBundle.valueCache.find(p)->second;
-
-	if(!closedset.insert(p).second)
-		return UNKNOWN;
+	std::vector<VisitFrame> stack;
+	PointerKindWrapper ret;
+	if(usesOnly)
+		stack.push_back(VisitFrame(v, VisitFrame::ALL_USES));
+	else if(beginValue(v, stack, ret))
+		return ret;
 
-	bool indirectRet = false;
-	auto CacheAndReturn = [&](PointerKindWrapper k)
+	// When hasRet is true, ret is the kind of the value requested by the frame on top of the stack
+	bool hasRet = false;
+	while(!stack.empty())
 	{
-		// Do not recurse below here
-		closedset.erase(p);
-		// Keep track of the constraints for loaded pointers of this type
-		if(isa<LoadInst>(p))
+		VisitFrame& frame = stack.back();
+		const Value* next = nullptr;
+		if(frame.mode == VisitFrame::VALUE_FORWARD)
 		{
-			k.makeKnown();
-			Type* curType = p->getType()->getPointerElementType();
-			cacheBundle.typeCache[curType] |= k;
-			return (const PointerKindWrapper&)cacheBundle.valueCache.insert(
-					std::make_pair(p, PointerKindWrapper( STORED_TYPE_CONSTRAINT, curType ) ) ).first->second;
+			if(hasRet)
+				frame.result = ret;
+			else
+				next = frame.forward;
 		}
-		else if(indirectRet)
+		else
 		{
-			k.makeKnown();
-			cacheBundle.returnTypeCache[p->getType()] |= k;
-			return (const PointerKindWrapper&)cacheBundle.valueCache.insert(
-					std::make_pair(p, PointerKindWrapper( RETURN_TYPE_CONSTRAINT, p->getType() ) ) ).first->second;
+			if(hasRet)
+				frame.result |= ret;
+			while(!next && frame.result != REGULAR && frame.nextUse != frame.p->use_end())
+			{
+				const Use* U = &(*frame.nextUse++);
+				PointerKindWrapper k = visitUse(U, next);
+				if(!next)
+					frame.result |= k;
+			}
+		}
+		if(next)
+		{
+			// This may push a new frame, frame must not be used anymore
+			hasRet = beginValue(next, stack, ret);
+			continue;
 		}
-		else if(!k.isKnown())
-			return (const PointerKindWrapper&)k;
+
+		switch(frame.mode)
+		{
+			case VisitFrame::VALUE_USES:
+				ret = endValue(frame.p, frame.result, frame.indirectRet);
+				break;
+			case VisitFrame::VALUE_FORWARD:
+				ret = endValue(frame.p, frame.result, false);
+				break;
+			case VisitFrame::VALUE_CHECK_USES:
+				if(frame.result != COMPLETE_OBJECT)
+				{
+					llvm::errs() << "Result of " << *frame.p << " used as REGULAR: " << *frame.p << "\n";
+					llvm::report_fatal_error("Unsupported code found, please report a bug", false);
+				}
+				ret = endValue(frame.p, COMPLETE_OBJECT, false);
+				break;
+			case VisitFrame::ALL_USES:
+				ret = frame.result;
+				break;
+		}
+		stack.pop_back();
+		hasRet = true;
+	}
+	return ret;
+}
+
+PointerKindWrapper PointerUsageVisitor::endValue(const Value* p, PointerKindWrapper k, bool indirectRet)
+{
+	// Do not recurse below here
+	closedset.erase(p);
+	// Keep track of the constraints for loaded pointers of this type
+	if(const LoadInst* LI = dyn_cast<LoadInst>(p))
+	{
+		k.makeKnown();
+		PointerAnalyzer::StructField field = getTrackedField(LI->getPointerOperand());
+		if(field.first)
+			cacheBundle.fieldCache[field] |= k;
 		else
-			return (const PointerKindWrapper&)cacheBundle.valueCache.insert( std::make_pair(p, k ) ).first->second;
-	};
+			cacheBundle.typeCache[p->getType()->getPointerElementType()] |= k;
+		return cacheBundle.valueCache.insert(
+				std::make_pair(p, storedConstraint(LI->getPointerOperand()) ) ).first->second;
+	}
+	else if(indirectRet)
+	{
+		k.makeKnown();
+		cacheBundle.returnTypeCache[p->getType()] |= k;
+		return cacheBundle.valueCache.insert(
+				std::make_pair(p, PointerKindWrapper( RETURN_TYPE_CONSTRAINT, p->getType() ) ) ).first->second;
+	}
+	else if(!k.isKnown())
+		return k;
+	else
+		return cacheBundle.valueCache.insert( std::make_pair(p, k ) ).first->second;
+}
+
+bool PointerUsageVisitor::beginValue(const Value* p, std::vector<VisitFrame>& stack, PointerKindWrapper& ret)
+{
+	auto it = cacheBundle.valueCache.find(p);
+	if(it != cacheBundle.valueCache.end())
+	{
+		ret = it->second;
+		return true;
+	}
+
+	if(!closedset.insert(p).second)
+	{
+		ret = UNKNOWN;
+		return true;
+	}
 
 	llvm::Type * type = p->getType()->getPointerElementType();
 
@@ -254,22 +415,26 @@ PointerKindWrapper PointerUsageVisitor::visitValue(const Value* p)
 		case Intrinsic::cheerp_make_complete_object:
 		{
 			llvm::Type * rType = realType(p);
-			if(getKindForType(rType) != COMPLETE_OBJECT && visitAllUses(p) != COMPLETE_OBJECT)
+			if(getKindForType(rType) != COMPLETE_OBJECT)
 			{
-				llvm::errs() << "Result of " << *intrinsic << " used as REGULAR: " << *p << "\n";
-				llvm::report_fatal_error("Unsupported code found, please report a bug", false);
+				stack.push_back(VisitFrame(p, VisitFrame::VALUE_CHECK_USES));
+				return false;
 			}
-			return CacheAndReturn(COMPLETE_OBJECT);
+			ret = endValue(p, COMPLETE_OBJECT, false);
+			return true;
 		}
 		case Intrinsic::cheerp_make_regular:
-			return CacheAndReturn(REGULAR);
+			ret = endValue(p, REGULAR, false);
+			return true;
 		case Intrinsic::memmove:
 		case Intrinsic::memcpy:
 		case Intrinsic::memset:
-			return CacheAndReturn(visitValue(intrinsic->getArgOperand(0)));
+			stack.push_back(VisitFrame(p, VisitFrame::VALUE_FORWARD, false, intrinsic->getArgOperand(0)));
+			return false;
 		case Intrinsic::cheerp_pointer_offset:
 		case Intrinsic::invariant_start:
-			return CacheAndReturn(visitValue(intrinsic->getArgOperand(1)));
+			stack.push_back(VisitFrame(p, VisitFrame::VALUE_FORWARD, false, intrinsic->getArgOperand(1)));
+			return false;
 		case Intrinsic::invariant_end:
 		case Intrinsic::vastart:
 		case Intrinsic::vaend:
@@ -282,32 +447,43 @@ PointerKindWrapper PointerUsageVisitor::visitValue(const Value* p)
 	}
 
 	if(getKindForType(type) != UNKNOWN)
-		return CacheAndReturn(getKindForType(type));
+	{
+		ret = endValue(p, getKindForType(type), false);
+		return true;
+	}
 
 	if(const Argument* arg = dyn_cast<Argument>(p))
 	{
 		if(cacheBundle.addressTakenCache.checkAddressTaken(arg->getParent()))
-			return CacheAndReturn(REGULAR);
+		{
+			ret = endValue(p, REGULAR, false);
+			return true;
+		}
 	}
 
 	// TODO this is not really necessary,
 	// but we need to modify the writer so that CallInst and InvokeInst
 	// perform a demotion in place.
+	bool indirectRet = false;
 	if(ImmutableCallSite cs = p)
 	{
 		if (!isIntrinsic)
 		{
 			if(cs.getCalledFunction())
-				return CacheAndReturn(PointerKindWrapper( RETURN_CONSTRAINT, cs.getCalledFunction() ));
+			{
+				ret = endValue(p, PointerKindWrapper( RETURN_CONSTRAINT, cs.getCalledFunction() ), false);
+				return true;
+			}
 			else
 				indirectRet = true;
 		}
 	}
 
-	return CacheAndReturn(visitAllUses(p));
+	stack.push_back(VisitFrame(p, VisitFrame::VALUE_USES, indirectRet));
+	return false;
 }
 
-PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U)
+PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U, const Value*& next)
 {
 	const User * p = U->getUser();
 	if ( isGEP(p) )
@@ -317,7 +493,10 @@ PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U)
 		if ( constOffset && constOffset->isNullValue() )
 		{
 			if ( p->getNumOperands() == 2 )
-				return visitValue( p );
+			{
+				next = p;
+				return COMPLETE_OBJECT;
+			}
 			return COMPLETE_OBJECT;
 		}
 		
@@ -325,12 +504,19 @@ PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U)
 	}
 
 	// Constant data in memory is equivalent to store
-	if ( (isa<StoreInst>(p) && U->getOperandNo() == 0 ) ||
-		isa<ConstantStruct>(p) || isa<ConstantArray>(p))
+	if ( isa<StoreInst>(p) && U->getOperandNo() == 0 )
+		return storedConstraint( cast<StoreInst>(p)->getPointerOperand() );
+
+	if ( isa<ConstantStruct>(p) )
 	{
-		return PointerKindWrapper( STORED_TYPE_CONSTRAINT, U->get()->getType()->getPointerElementType() );
+		StructType* st = cast<ConstantStruct>(p)->getType();
+		if ( cacheBundle.isFieldTracked(st, U->getOperandNo()) )
+			return PointerKindWrapper( STORED_TYPE_CONSTRAINT, st, U->getOperandNo() + 1 );
 	}
 
+	if ( isa<ConstantStruct>(p) || isa<ConstantArray>(p) )
+		return PointerKindWrapper( STORED_TYPE_CONSTRAINT, U->get()->getType()->getPointerElementType() );
+
 	if ( isa<PtrToIntInst>(p) || ( isa<ConstantExpr>(p) && cast<ConstantExpr>(p)->getOpcode() == Instruction::PtrToInt) )
 		return REGULAR;
 
@@ -348,6 +534,7 @@ PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U)
 		{
 		case Intrinsic::memmove:
 		case Intrinsic::memcpy:
+		case Intrinsic::memset:
 		{
 			if (TypeSupport::hasByteLayout(intrinsic->getOperand(0)->getType()->getPointerElementType()))
 				return COMPLETE_OBJECT;
@@ -366,7 +553,8 @@ PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U)
 		case Intrinsic::cheerp_downcast:
 		case Intrinsic::cheerp_upcast_collapsed:
 		case Intrinsic::cheerp_cast_user:
-			return visitValue( p );
+			next = p;
+			return COMPLETE_OBJECT;
 		case Intrinsic::cheerp_reallocate:
 		case Intrinsic::cheerp_pointer_base:
 		case Intrinsic::cheerp_pointer_offset:
@@ -383,7 +571,6 @@ PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U)
 			return COMPLETE_OBJECT;
 		case Intrinsic::flt_rounds:
 		case Intrinsic::cheerp_allocate:
-		case Intrinsic::memset:
 		default:
 			SmallString<128> str("Unreachable code in cheerp::PointerAnalyzer::visitUse, unhandled intrinsic: ");
 			str+=intrinsic->getCalledFunction()->getName();
@@ -423,11 +610,17 @@ PointerKindWrapper PointerUsageVisitor::visitUse(const Use* U)
 		if (TypeSupport::hasByteLayout(p->getOperand(0)->getType()->getPointerElementType()))
 			return COMPLETE_OBJECT;
 		else
-			return visitValue( p );
+		{
+			next = p;
+			return COMPLETE_OBJECT;
+		}
 	}
 
 	if(isa<SelectInst> (p) || isa <PHINode>(p))
-		return visitValue(p);
+	{
+		next = p;
+		return COMPLETE_OBJECT;
+	}
 
 	if ( isa<Constant>(p) )
 		return REGULAR;
@@ -507,6 +700,14 @@ PointerKindWrapper PointerUsageVisitor::resolveConstraint(const IndirectPointerK
 		}
 		case STORED_TYPE_CONSTRAINT:
 		{
+			// Field constraints are resolved through the fieldCache map
+			if(c.i)
+			{
+				const auto& it=cacheBundle.fieldCache.find(PointerAnalyzer::StructField(cast<StructType>(c.typePtr), c.i-1));
+				if(it==cacheBundle.fieldCache.end())
+					return COMPLETE_OBJECT;
+				return it->second;
+			}
 			// We will resolve this constraint indirectly through the typeCache map
 			const auto& it=cacheBundle.typeCache.find(c.typePtr);
 			if(it==cacheBundle.typeCache.end())
@@ -528,19 +729,37 @@ PointerKindWrapper PointerUsageVisitor::resolveConstraint(const IndirectPointerK
 PointerKindWrapper PointerUsageVisitor::resolvePointerKind(const PointerKindWrapper& k, resolve_visited_set_t& closedset)
 {
 	assert(k==INDIRECT);
-	for(uint32_t i=0;i<k.constraints.size();i++)
+	// Depth first visit of the constraints using an explicit stack.
+	// Each frame is an indirect kind and the index of the next constraint to resolve.
+	// A REGULAR kind anywhere makes the whole chain REGULAR, a BYTE_LAYOUT kind
+	// is only significant when it comes from one of the constraints of k.
+	typedef std::pair<PointerKindWrapper, uint32_t> ResolveFrame;
+	std::vector<ResolveFrame> stack;
+	stack.push_back(ResolveFrame(k, 0));
+	while(!stack.empty())
 	{
-		PointerKindWrapper retKind=resolveConstraint(k.constraints[i]);
+		ResolveFrame& frame = stack.back();
+		if(frame.second == frame.first.constraints.size())
+		{
+			stack.pop_back();
+			continue;
+		}
+		const IndirectPointerKindConstraint c = frame.first.constraints[frame.second++];
+		PointerKindWrapper retKind=resolveConstraint(c);
 		retKind.makeKnown();
-		if(retKind==REGULAR || retKind==BYTE_LAYOUT)
+		if(retKind==REGULAR)
 			return retKind;
+		else if(retKind==BYTE_LAYOUT)
+		{
+			if(stack.size() == 1)
+				return retKind;
+			stack.pop_back();
+		}
 		else if(retKind==INDIRECT)
 		{
-			if(!closedset.insert(k.constraints[i]).second)
+			if(!closedset.insert(c).second)
 				continue;
-			PointerKindWrapper resolvedKind=resolvePointerKind(retKind, closedset);
-			if(resolvedKind==REGULAR)
-				return resolvedKind;
+			stack.push_back(ResolveFrame(retKind, 0));
 		}
 	}
 	return COMPLETE_OBJECT;
@@ -567,24 +786,47 @@ void PointerAnalyzer::prefetch(const Module& m) const
 	TimerGuard guard(t);
 #endif //NDEBUG
 
+	// Visit the functions bottom up over the SCCs of the call graph, so that the arguments of
+	// the callees are already known when the call sites are visited and the constraint chains
+	// seen by fullResolve stay short
+	functionOrder.clear();
+	DenseSet<const Function*> ordered;
+	CallGraph CG(const_cast<Module&>(m));
+	for(scc_iterator<CallGraph*> it = scc_begin(&CG); !it.isAtEnd(); ++it)
+	{
+		for(const CallGraphNode* node : *it)
+		{
+			const Function* F = node->getFunction();
+			if(F && ordered.insert(F).second)
+				functionOrder.push_back(F);
+		}
+	}
+	// Functions not reachable from the external node of the call graph go last
 	for(const Function & F : m)
 	{
-		for(const Argument & arg : F.getArgumentList())
+		if(ordered.insert(&F).second)
+			functionOrder.push_back(&F);
+	}
+
+	for(const Function* F : functionOrder)
+	{
+		for(const Argument & arg : F->getArgumentList())
 			if(arg.getType()->isPointerTy())
 				getFinalPointerKindWrapper(&arg);
-		for(const BasicBlock & BB : F)
+		for(const BasicBlock & BB : *F)
 		{
 			for(auto it=BB.rbegin();it != BB.rend();++it)
 				if(it->getType()->isPointerTy())
 					getFinalPointerKindWrapper(&(*it));
 		}
-		if(F.getReturnType()->isPointerTy())
-			getFinalPointerKindWrapperForReturn(&F);
+		if(F->getReturnType()->isPointerTy())
+			getFinalPointerKindWrapperForReturn(F);
 	}
 }
 
 PointerKindWrapper PointerAnalyzer::getFinalPointerKindWrapper(const Value* p) const
 {
+	sys::SmartScopedLock<true> lock(cacheMutex);
 #ifndef NDEBUG
 	TimerGuard guard(gpkTimer);
 #endif //NDEBUG
@@ -601,6 +843,7 @@ PointerKindWrapper PointerAnalyzer::getFinalPointerKindWrapper(const Value* p) c
 
 POINTER_KIND PointerAnalyzer::getPointerKind(const Value* p) const
 {
+	sys::SmartScopedLock<true> lock(cacheMutex);
 #ifndef NDEBUG
 	TimerGuard guard(gpkTimer);
 #endif //NDEBUG
@@ -616,6 +859,7 @@ POINTER_KIND PointerAnalyzer::getPointerKind(const Value* p) const
 
 PointerKindWrapper PointerAnalyzer::getFinalPointerKindWrapperForReturn(const Function* F) const
 {
+	sys::SmartScopedLock<true> lock(cacheMutex);
 #ifndef NDEBUG
 	TimerGuard guard(gpkfrTimer);
 #endif //NDEBUG
@@ -627,6 +871,7 @@ PointerKindWrapper PointerAnalyzer::getFinalPointerKindWrapperForReturn(const Fu
 
 POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 {
+	sys::SmartScopedLock<true> lock(cacheMutex);
 #ifndef NDEBUG
 	TimerGuard guard(gpkfrTimer);
 #endif //NDEBUG
@@ -640,6 +885,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 
 POINTER_KIND PointerAnalyzer::getPointerKindForStoredType(Type* pointerType) const
 {
+	sys::SmartScopedLock<true> lock(cacheMutex);
 	POINTER_KIND ret=PointerUsageVisitor(cacheBundle).getKindForType(pointerType->getPointerElementType());
 	if(ret!=UNKNOWN)
 		return ret;
@@ -657,8 +903,39 @@ POINTER_KIND PointerAnalyzer::getPointerKindForStoredType(Type* pointerType) con
 	return PointerUsageVisitor(cacheBundle).resolvePointerKind(k, closedset).getPointerKind();
 }
 
+POINTER_KIND PointerAnalyzer::getPointerKindForStoredField(StructType* structType, uint32_t fieldIndex) const
+{
+	sys::SmartScopedLock<true> lock(cacheMutex);
+	Type* pointerType = structType->getElementType(fieldIndex);
+	if(!cacheBundle.isFieldTracked(structType, fieldIndex))
+		return getPointerKindForStoredType(pointerType);
+	POINTER_KIND ret=PointerUsageVisitor(cacheBundle).getKindForType(pointerType->getPointerElementType());
+	if(ret!=UNKNOWN)
+		return ret;
+	auto it=cacheBundle.fieldCache.find(StructField(structType, fieldIndex));
+	if(it==cacheBundle.fieldCache.end())
+		return COMPLETE_OBJECT;
+
+	const PointerKindWrapper& k = it->second;
+	assert(k!=UNKNOWN);
+	if (k!=INDIRECT)
+		return k.getPointerKind();
+
+	PointerUsageVisitor::resolve_visited_set_t closedset;
+	return PointerUsageVisitor(cacheBundle).resolvePointerKind(k, closedset).getPointerKind();
+}
+
+POINTER_KIND PointerAnalyzer::getPointerKindForStore(const StoreInst* SI) const
+{
+	StructField field = PointerUsageVisitor(cacheBundle).getTrackedField(SI->getPointerOperand());
+	if(field.first)
+		return getPointerKindForStoredField(field.first, field.second);
+	return getPointerKindForStoredType(SI->getValueOperand()->getType());
+}
+
 POINTER_KIND PointerAnalyzer::getPointerKindForArgumentType(Type* pointerType) const
 {
+	sys::SmartScopedLock<true> lock(cacheMutex);
 	return PointerUsageVisitor(cacheBundle).getKindForType(pointerType->getPointerElementType());
 }
 
@@ -694,16 +971,55 @@ void PointerAnalyzer::invalidate(const Value * v)
 
 void PointerAnalyzer::fullResolve() const
 {
+	sys::SmartScopedLock<true> lock(cacheMutex);
+	auto resolveValue = [this](PointerKindWrapper& kind)
+	{
+		if(kind!=INDIRECT)
+			return;
+		PointerUsageVisitor::resolve_visited_set_t closedset;
+		PointerKindWrapper k=PointerUsageVisitor(cacheBundle).resolvePointerKind(kind, closedset);
+		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==REGULAR);
+		kind=k;
+	};
+	// Resolve the values of each function in the same bottom up order used by prefetch,
+	// the constraints on the arguments of the callees are then already resolved
+	for(const Function* F : functionOrder)
+	{
+		for(const Argument & arg : F->getArgumentList())
+		{
+			auto it=cacheBundle.valueCache.find(&arg);
+			if(it!=cacheBundle.valueCache.end())
+				resolveValue(it->second);
+		}
+		for(const BasicBlock & BB : *F)
+		{
+			for(const Instruction & I : BB)
+			{
+				auto it=cacheBundle.valueCache.find(&I);
+				if(it!=cacheBundle.valueCache.end())
+					resolveValue(it->second);
+			}
+		}
+		if(!F->empty())
+		{
+			auto it=cacheBundle.valueCache.find(F->begin());
+			if(it!=cacheBundle.valueCache.end())
+				resolveValue(it->second);
+		}
+	}
+	// Catch all the remaining values, like constants and globals
 	for(auto& it: cacheBundle.valueCache)
+		resolveValue(it.second);
+	for(auto& it: cacheBundle.typeCache)
 	{
 		if(it.second!=INDIRECT)
 			continue;
 		PointerUsageVisitor::resolve_visited_set_t closedset;
 		PointerKindWrapper k=PointerUsageVisitor(cacheBundle).resolvePointerKind(it.second, closedset);
-		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==REGULAR);
+		assert(k==COMPLETE_OBJECT || k==REGULAR);
 		it.second=k;
 	}
-	for(auto& it: cacheBundle.typeCache)
+	for(auto& it: cacheBundle.fieldCache)
 	{
 		if(it.second!=INDIRECT)
 			continue;
@@ -717,6 +1033,92 @@ void PointerAnalyzer::fullResolve() const
 #endif
 }
 
+void PointerAnalyzer::computeTrackedFields(const Module& M)
+{
+	cacheBundle.untrackedStructs.clear();
+	cacheBundle.untrackedFields.clear();
+	auto untrackType = [this](Type* t)
+	{
+		if(t->isPointerTy())
+			t = t->getPointerElementType();
+		if(StructType* st = dyn_cast<StructType>(t))
+			cacheBundle.untrackedStructs.insert(st);
+	};
+	// Visit every user of the module, including the constant expressions
+	SmallVector<const User*, 16> worklist;
+	DenseSet<const User*> visited;
+	for(const GlobalVariable & GV : M.getGlobalList())
+		if(GV.hasInitializer())
+			worklist.push_back(GV.getInitializer());
+	for(const Function & F : M)
+		for(const BasicBlock & BB : F)
+			for(const Instruction & I : BB)
+				worklist.push_back(&I);
+	while(!worklist.empty())
+	{
+		const User* u = worklist.pop_back_val();
+		if(!visited.insert(u).second)
+			continue;
+		for(const Use & op : u->operands())
+		{
+			if(const ConstantExpr* CE = dyn_cast<ConstantExpr>(op.get()))
+				worklist.push_back(CE);
+			else if(isa<ConstantStruct>(op.get()) || isa<ConstantArray>(op.get()))
+				worklist.push_back(cast<User>(op.get()));
+		}
+		if(isBitCast(u))
+		{
+			// Bitcasts to i8* only used by the memory intrinsics do not reinterpret the fields
+			bool onlyMemFuncs = u->getType()->getPointerElementType()->isIntegerTy(8);
+			for(const User* bitcastUser : u->users())
+			{
+				const IntrinsicInst* II = dyn_cast<IntrinsicInst>(bitcastUser);
+				if(!II || (II->getIntrinsicID() != Intrinsic::memcpy && II->getIntrinsicID() != Intrinsic::memmove &&
+					II->getIntrinsicID() != Intrinsic::memset && II->getIntrinsicID() != Intrinsic::cheerp_deallocate))
+				{
+					onlyMemFuncs = false;
+				}
+			}
+			if(!onlyMemFuncs)
+			{
+				untrackType(u->getOperand(0)->getType());
+				untrackType(u->getType());
+			}
+		}
+		else if(const IntrinsicInst* II = dyn_cast<IntrinsicInst>(u))
+		{
+			switch(II->getIntrinsicID())
+			{
+				case Intrinsic::cheerp_downcast:
+				case Intrinsic::cheerp_upcast_collapsed:
+				case Intrinsic::cheerp_cast_user:
+					untrackType(II->getArgOperand(0)->getType());
+					untrackType(II->getType());
+					break;
+				default:
+					break;
+			}
+		}
+		else if(isGEP(u))
+		{
+			// The address of a field can only be used to load and store
+			StructField field = PointerUsageVisitor::getAddressedField(u);
+			if(!field.first)
+				continue;
+			for(const Use & gepUse : u->uses())
+			{
+				const User* gepUser = gepUse.getUser();
+				if(isa<LoadInst>(gepUser))
+					continue;
+				if(isa<StoreInst>(gepUser) && gepUse.getOperandNo() == 1)
+					continue;
+				cacheBundle.untrackedFields.insert(field);
+				break;
+			}
+		}
+	}
+}
+
 #ifndef NDEBUG
 
 void PointerAnalyzer::dumpPointer(const Value* v, bool dumpOwnerFunc) const
@@ -11,6 +11,7 @@
 
 #define DEBUG_TYPE "CheerpPointerPasses"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/Cheerp/PointerPasses.h"
@@ -18,15 +19,18 @@
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
 #include <set>
 #include <map>
 
 STATISTIC(NumIndirectFun, "Number of indirect functions processed");
 STATISTIC(NumAllocasTransformedToArrays, "Number of allocas of values transformed to allocas of arrays");
+STATISTIC(NumStructAllocasScalarized, "Number of allocas of structs replaced by registers");
 
 namespace llvm {
 
@@ -146,6 +150,144 @@ void AllocaArrays::getAnalysisUsage(AnalysisUsage & AU) const
 FunctionPass *createAllocaArraysPass() { return new AllocaArrays(); }
 
 
+bool StructAllocaScalarization::collectFieldAccesses(Value* ptr, std::vector<uint32_t>& path, FieldAccessMap& accesses,
+				std::vector<Instruction*>& deadInsts)
+{
+	for(User* U: ptr->users())
+	{
+		if(LoadInst* LI = dyn_cast<LoadInst>(U))
+		{
+			if(LI->isVolatile() || !LI->getType()->isSingleValueType() || LI->getType()->isVectorTy())
+				return false;
+			accesses[path].push_back(LI);
+		}
+		else if(StoreInst* SI = dyn_cast<StoreInst>(U))
+		{
+			Type* storedType = SI->getValueOperand()->getType();
+			// Storing the address itself makes it escape
+			if(SI->isVolatile() || SI->getValueOperand() == ptr || !storedType->isSingleValueType() || storedType->isVectorTy())
+				return false;
+			accesses[path].push_back(SI);
+		}
+		else if(GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(U))
+		{
+			// Only constant indexes inside the object are allowed
+			if(!GEP->hasAllConstantIndices() || !cast<Constant>(*GEP->idx_begin())->isNullValue())
+				return false;
+			size_t oldSize = path.size();
+			Type* curType = GEP->getPointerOperandType()->getPointerElementType();
+			for(auto it = GEP->idx_begin() + 1; it != GEP->idx_end(); ++it)
+			{
+				uint64_t index = cast<ConstantInt>(*it)->getZExtValue();
+				if(StructType* st = dyn_cast<StructType>(curType))
+					curType = st->getElementType(index);
+				else if(ArrayType* at = dyn_cast<ArrayType>(curType))
+				{
+					if(index >= at->getNumElements())
+						return false;
+					curType = at->getElementType();
+				}
+				else
+					return false;
+				path.push_back(index);
+			}
+			if(!collectFieldAccesses(GEP, path, accesses, deadInsts))
+				return false;
+			path.resize(oldSize);
+			deadInsts.push_back(GEP);
+		}
+		else if(isa<BitCastInst>(U) && onlyUsedByLifetimeMarkers(U))
+		{
+			for(User* marker: U->users())
+				deadInsts.push_back(cast<Instruction>(marker));
+			deadInsts.push_back(cast<Instruction>(U));
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+void StructAllocaScalarization::scalarizeAlloca(AllocaInst* ai, const FieldAccessMap& accesses, std::vector<AllocaInst*>& fieldAllocas)
+{
+	Instruction* entryInsertPoint = ai->getParent()->getParent()->getEntryBlock().getFirstInsertionPt();
+	for(auto& it: accesses)
+	{
+		Instruction* firstAccess = it.second.front();
+		Type* fieldType = isa<LoadInst>(firstAccess) ? firstAccess->getType() :
+					cast<StoreInst>(firstAccess)->getValueOperand()->getType();
+		AllocaInst* fieldAlloca = new AllocaInst(fieldType, ai->getName() + ".field", entryInsertPoint);
+		// The JS object had all the fields initialized to zero, keep the same values for reads which come before any write
+		new StoreInst(Constant::getNullValue(fieldType), fieldAlloca, ai);
+		for(Instruction* I: it.second)
+		{
+			if(LoadInst* LI = dyn_cast<LoadInst>(I))
+				LI->setOperand(LI->getPointerOperandIndex(), fieldAlloca);
+			else
+				I->setOperand(cast<StoreInst>(I)->getPointerOperandIndex(), fieldAlloca);
+		}
+		fieldAllocas.push_back(fieldAlloca);
+	}
+}
+
+bool StructAllocaScalarization::runOnFunction(Function& F)
+{
+	// Collect the candidates first, scalarizing an alloca erases the instructions which use it
+	std::vector<AllocaInst*> structAllocas;
+	for ( BasicBlock & BB : F )
+	{
+		for ( Instruction & I : BB )
+		{
+			AllocaInst * ai = dyn_cast<AllocaInst>(&I);
+			if (! ai || ai->isArrayAllocation() )
+				continue;
+			StructType* st = dyn_cast<StructType>(ai->getAllocatedType());
+			if (st && !st->hasByteLayout() )
+				structAllocas.push_back(ai);
+		}
+	}
+
+	bool Changed = false;
+	std::vector<AllocaInst*> fieldAllocas;
+	for ( AllocaInst * ai : structAllocas )
+	{
+		FieldAccessMap accesses;
+		std::vector<uint32_t> path;
+		std::vector<Instruction*> deadInsts;
+		if (! collectFieldAccesses(ai, path, accesses, deadInsts) )
+			continue;
+
+		scalarizeAlloca(ai, accesses, fieldAllocas);
+		for(Instruction* I: deadInsts)
+			I->eraseFromParent();
+		ai->eraseFromParent();
+		NumStructAllocasScalarized++;
+		Changed = true;
+	}
+	if (fieldAllocas.empty())
+		return Changed;
+
+	DominatorTree DT;
+	DT.recalculate(F);
+	PromoteMemToReg(fieldAllocas, DT);
+	return true;
+}
+
+const char* StructAllocaScalarization::getPassName() const
+{
+	return "StructAllocaScalarization";
+}
+
+char StructAllocaScalarization::ID = 0;
+
+void StructAllocaScalarization::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	AU.addPreserved<cheerp::GlobalDepsAnalyzer>();
+	llvm::Pass::getAnalysisUsage(AU);
+}
+
+FunctionPass *createStructAllocaScalarizationPass() { return new StructAllocaScalarization(); }
+
 const char* IndirectCallOptimizer::getPassName() const
 {
 	return "IndirectCallOptimizer";
@@ -18,10 +18,18 @@
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Timer.h"
+#include <set>
 
 using namespace llvm;
 
+STATISTIC(NumRegisters, "Number of JS locals used by registerized functions");
+STATISTIC(NumInterferenceChecks, "Number of interference checks between live ranges and registers");
+
+static const char* const RegisterizeTimerGroup = "Cheerp Registerize";
+
 namespace cheerp {
 
 char Registerize::ID = 0;
@@ -93,21 +101,31 @@ void Registerize::handleFunction(Function& F)
 	{
 		AllocaSetTy allocaSet;
 		InstIdMapTy instIdMap;
+		LiveRangesTy liveRanges;
 		// First, build live ranges for all instructions
-		LiveRangesTy liveRanges=computeLiveRanges(F, instIdMap, allocaSet);
+		{
+			NamedRegionTimer T("Compute live ranges", RegisterizeTimerGroup, TimePassesIsEnabled);
+			liveRanges=computeLiveRanges(F, instIdMap, allocaSet);
+		}
 		// Assign each instruction to a virtual register
-		assignToRegisters(liveRanges);
+		{
+			NamedRegionTimer T("Assign registers", RegisterizeTimerGroup, TimePassesIsEnabled);
+			assignToRegisters(liveRanges);
+		}
 		// Now compute live ranges for alloca memory which is not in SSA form
-		computeAllocaLiveRanges(allocaSet, instIdMap);
+		{
+			NamedRegionTimer T("Compute alloca live ranges", RegisterizeTimerGroup, TimePassesIsEnabled);
+			computeAllocaLiveRanges(allocaSet, instIdMap);
+		}
 		// To debug we need to know the ranges for each instructions and the assigned register
 		DEBUG(dbgs() << F;
-		for(auto it: liveRanges)
+		for(uint32_t i=0;i<liveRanges.size();i++)
 		{
-			dbgs() << "Instruction " << *it.first << " alive in ranges ";
-			for(const Registerize::LiveRangeChunk& chunk: it.second.range)
+			dbgs() << "Instruction " << *liveRanges.instructions[i] << " alive in ranges ";
+			for(const Registerize::LiveRangeChunk& chunk: liveRanges.ranges[i].range)
 				dbgs() << '[' << chunk.start << ',' << chunk.end << ')';
 			dbgs() << "\n";
-			dbgs() << "\tMapped to register " << registersMap[it.first] << "\n";
+			dbgs() << "\tMapped to register " << registersMap[liveRanges.instructions[i]] << "\n";
 		}
 		for(auto it: allocaLiveRanges)
 		{
@@ -208,8 +226,7 @@ uint32_t Registerize::dfsLiveRangeInBlock(BlocksState& blocksState, LiveRangesTy
 		// Void instruction do not need any lifetime computation
 		if (!I.getType()->isVoidTy())
 		{
-			InstructionLiveRange& range=liveRanges.emplace(&I,
-				InstructionLiveRange(codePathId)).first->second;
+			InstructionLiveRange& range=liveRanges.add(&I, codePathId);
 			range.range.push_back(LiveRangeChunk(thisIndex, thisIndex));
 		}
 		// Operands of PHIs are declared as live out from the source block.
@@ -228,7 +245,7 @@ uint32_t Registerize::dfsLiveRangeInBlock(BlocksState& blocksState, LiveRangesTy
 			extendRangeForUsedOperands(*outLiveInst, liveRanges, endOfBlockIndex, codePathId);
 		else
 		{
-			InstructionLiveRange& range=liveRanges.find(outLiveInst)->second;
+			InstructionLiveRange& range=liveRanges.get(outLiveInst);
 			range.addUse(codePathId, endOfBlockIndex);
 		}
 	}
@@ -261,8 +278,7 @@ void Registerize::extendRangeForUsedOperands(Instruction& I, LiveRangesTy& liveR
 			extendRangeForUsedOperands(*usedI, liveRanges, thisIndex, codePathId);
 		else
 		{
-			assert(liveRanges.count(usedI));
-			InstructionLiveRange& range=liveRanges.find(usedI)->second;
+			InstructionLiveRange& range=liveRanges.get(usedI);
 			range.addUse(codePathId, thisIndex);
 		}
 	}
@@ -270,34 +286,88 @@ void Registerize::extendRangeForUsedOperands(Instruction& I, LiveRangesTy& liveR
 
 void Registerize::assignToRegisters(const LiveRangesTy& liveRanges)
 {
-	llvm::SmallVector<RegisterRange, 4> registers;
+	RegistersTy registers;
+	// The smallest index at which each instruction is alive
+	std::vector<uint32_t> rangeStarts(liveRanges.size());
+	std::vector<uint32_t> order;
+	for(uint32_t i=0;i<liveRanges.size();i++)
+	{
+		uint32_t start=0xffffffff;
+		for(const LiveRangeChunk& chunk: liveRanges.ranges[i].range)
+			start=std::min(start, chunk.start);
+		rangeStarts[i]=start;
+		order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&rangeStarts](uint32_t a, uint32_t b)
+		{
+			if(rangeStarts[a]!=rangeStarts[b])
+				return rangeStarts[a]<rangeStarts[b];
+			return a<b;
+		});
 	// First try to assign all PHI operands to the same register as the PHI itself
-	for(auto it: liveRanges)
+	for(uint32_t i: order)
 	{
-		Instruction* I=it.first;
+		Instruction* I=liveRanges.instructions[i];
 		if(!isa<PHINode>(I))
 			continue;
 		handlePHI(*I, liveRanges, registers);
 	}
-	// Assign a register to the remaining instructions
-	for(auto it: liveRanges)
+	// Assign a register to the remaining instructions using a linear scan over the sorted ranges.
+	// Registers which end before the start of the current range cannot interfere with it anymore
+	// and they are moved from the active to the free set, the others are checked for holes.
+	std::set<uint32_t> freeRegisters[BOOLEAN+1];
+	std::set<std::pair<uint32_t, uint32_t>> activeRegisters[BOOLEAN+1];
+	for(uint32_t i=0;i<registers.size();i++)
+		activeRegisters[registers[i].regKind].insert(std::make_pair(registers[i].getMaxEnd(), i));
+	for(uint32_t i: order)
 	{
-		Instruction* I=it.first;
-		if(isa<PHINode>(I))
-			continue;
-		InstructionLiveRange& range=it.second;
+		Instruction* I=liveRanges.instructions[i];
 		// Move on if a register is already assigned
 		if(registersMap.count(I))
 			continue;
-		uint32_t chosenRegister=findOrCreateRegister(registers, range, getRegKindFromType(I->getType()));
+		const InstructionLiveRange& range=liveRanges.ranges[i];
+		REGISTER_KIND kind=getRegisterKind(I);
+		std::set<uint32_t>& freeSet=freeRegisters[kind];
+		std::set<std::pair<uint32_t, uint32_t>>& activeSet=activeRegisters[kind];
+		while(!activeSet.empty() && activeSet.begin()->first < rangeStarts[i])
+		{
+			freeSet.insert(activeSet.begin()->second);
+			activeSet.erase(activeSet.begin());
+		}
+		uint32_t chosenRegister=0xffffffff;
+		if(!freeSet.empty())
+		{
+			chosenRegister=*freeSet.begin();
+			freeSet.erase(freeSet.begin());
+			registers[chosenRegister].addRange(range.range);
+		}
+		else
+		{
+			for(auto it=activeSet.begin();it!=activeSet.end();++it)
+			{
+				if(addRangeToRegisterIfPossible(registers[it->second], range, kind))
+				{
+					chosenRegister=it->second;
+					activeSet.erase(it);
+					break;
+				}
+			}
+			if(chosenRegister==0xffffffff)
+			{
+				registers.push_back(RegisterRange(range.range, kind));
+				chosenRegister=registers.size()-1;
+			}
+		}
+		activeSet.insert(std::make_pair(registers[chosenRegister].getMaxEnd(), chosenRegister));
 		registersMap[I] = chosenRegister;
 	}
+	NumRegisters += registers.size();
 }
 
-void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers)
+void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, RegistersTy& registers)
 {
 	uint32_t chosenRegister=0xffffffff;
-	const InstructionLiveRange& PHIrange=liveRanges.find(&I)->second;
+	const InstructionLiveRange& PHIrange=liveRanges.get(&I);
 	// A PHI may already have an assigned register if it's an operand to another PHI
 	if(registersMap.count(&I))
 		chosenRegister = registersMap[&I];
@@ -314,7 +384,7 @@ void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm
 				continue;
 			uint32_t operandRegister=registersMap[usedI];
 			if(addRangeToRegisterIfPossible(registers[operandRegister], PHIrange,
-							getRegKindFromType(usedI->getType())))
+							getRegisterKind(&I)))
 			{
 				chosenRegister=operandRegister;
 				break;
@@ -323,7 +393,7 @@ void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm
 	}
 	// If a register has not been chosen yet, find or create a new one
 	if(chosenRegister==0xffffffff)
-		chosenRegister=findOrCreateRegister(registers, PHIrange, getRegKindFromType(I.getType()));
+		chosenRegister=findOrCreateRegister(registers, PHIrange, getRegisterKind(&I));
 	registersMap[&I]=chosenRegister;
 	// Iterate again on the operands and try to map as many as possible into the same register
 	for(Value* op: I.operands())
@@ -335,9 +405,9 @@ void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm
 		// Skip already assigned operands
 		if(registersMap.count(usedI))
 			continue;
-		const InstructionLiveRange& opRange=liveRanges.find(usedI)->second;
+		const InstructionLiveRange& opRange=liveRanges.get(usedI);
 		bool spaceFound=addRangeToRegisterIfPossible(registers[chosenRegister], opRange,
-								getRegKindFromType(usedI->getType()));
+								getRegisterKind(usedI));
 		if (spaceFound)
 		{
 			// Update the mapping
@@ -346,7 +416,7 @@ void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm
 	}
 }
 
-uint32_t Registerize::findOrCreateRegister(llvm::SmallVector<RegisterRange, 4>& registers, const InstructionLiveRange& range,
+uint32_t Registerize::findOrCreateRegister(RegistersTy& registers, const InstructionLiveRange& range,
 						REGISTER_KIND kind)
 {
 	for(uint32_t i=0;i<registers.size();i++)
@@ -359,9 +429,18 @@ uint32_t Registerize::findOrCreateRegister(llvm::SmallVector<RegisterRange, 4>&
 	return registers.size()-1;
 }
 
-Registerize::REGISTER_KIND Registerize::getRegKindFromType(llvm::Type* t)
+Registerize::REGISTER_KIND Registerize::getRegisterKind(const llvm::Instruction* I)
 {
-	if(t->isIntegerTy())
+	Type* t=I->getType();
+	if(t->isIntegerTy(1))
+	{
+		// i1 values are usually JS booleans, but bitwise operations and truncations produce numbers.
+		// The other values which may be numbers, like the ones returned by calls, are coerced by the writer
+		if(isa<BinaryOperator>(I) || isa<TruncInst>(I))
+			return INTEGER;
+		return BOOLEAN;
+	}
+	else if(t->isIntegerTy())
 		return INTEGER;
 	else if(t->isFloatTy())
 		return FLOAT;
@@ -406,6 +485,40 @@ void Registerize::LiveRange::merge(const LiveRange& other)
 	//TODO: Merge adjacent ranges
 }
 
+bool Registerize::RegisterRange::doesInterfere(const LiveRange& other) const
+{
+	NumInterferenceChecks++;
+	if(range.empty())
+		return false;
+	for(const LiveRangeChunk& chunk: other)
+	{
+		// The first chunk which does not start before this one
+		auto it=std::lower_bound(range.begin(), range.end(), chunk);
+		uint32_t index=it-range.begin();
+		// Any of the previous chunks may extend into this one
+		if(index>0 && maxEnds[index-1]>chunk.start)
+			return true;
+		// The following chunk must start after the end of this one
+		if(it!=range.end() && (it->start==chunk.start || it->start<chunk.end))
+			return true;
+	}
+	return false;
+}
+
+void Registerize::RegisterRange::addRange(const LiveRange& other)
+{
+	uint32_t firstChanged=range.size();
+	for(const LiveRangeChunk& chunk: other)
+	{
+		auto it=std::upper_bound(range.begin(), range.end(), chunk);
+		firstChanged=std::min(firstChanged, (uint32_t)(it-range.begin()));
+		range.insert(it, chunk);
+	}
+	maxEnds.resize(range.size());
+	for(uint32_t i=firstChanged;i<range.size();i++)
+		maxEnds[i]=std::max(i>0 ? maxEnds[i-1] : 0, range[i].end);
+}
+
 void Registerize::LiveRange::dump() const
 {
 	for(const Registerize::LiveRangeChunk& chunk: *this)
@@ -417,9 +530,9 @@ bool Registerize::addRangeToRegisterIfPossible(RegisterRange& regRange, const In
 {
 	if(regRange.regKind!=kind)
 		return false;
-	if(regRange.range.doesInterfere(liveRange.range))
+	if(regRange.doesInterfere(liveRange.range))
 		return false;
-	regRange.range.merge(liveRange.range);
+	regRange.addRange(liveRange.range);
 	return true;
 }
 
@@ -678,7 +791,7 @@ bool Registerize::doUpAndMarkForAlloca(AllocaBlocksState& blocksState, const std
 	}
 }
 
-void Registerize::invalidateFunction(llvm::Function& F)
+void Registerize::invalidateFunction(const llvm::Function& F)
 {
 	for(const llvm::BasicBlock& BB: F)
 	{
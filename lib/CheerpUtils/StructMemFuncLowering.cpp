@@ -10,6 +10,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Cheerp/StructMemFuncLowering.h"
+#include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/Support/raw_ostream.h"
@@ -214,12 +215,18 @@ bool StructMemFuncLowering::runOnBlock(BasicBlock& BB)
 		if(mode==NONE)
 			continue;
 		Type* pointedType = F->getFunctionType()->getParamType(0)->getPointerElementType();
-		//We want to decompose everything which is not an immutable type or a byte layout structure. memset is always decomposed.
+		//We want to decompose everything which is not an immutable type or a byte layout structure.
+		//memset is only kept on types stored in typed arrays, where the backend can use TypedArray.fill
 		if(mode != MEMSET && (pointedType->isIntegerTy() || pointedType->isFloatingPointTy() ||
 			(isa<StructType>(pointedType) && cast<StructType>(pointedType)->hasByteLayout())))
 		{
 			continue;
 		}
+		if(mode == MEMSET && cheerp::TypeSupport::isTypedArrayType(pointedType) &&
+			(pointedType->isIntegerTy() || isa<ConstantInt>(CI->getOperand(1))))
+		{
+			continue;
+		}
 		//We have a typed mem func on a struct
 		//Decompose it in a loop
 		Value* dst=CI->getOperand(0);
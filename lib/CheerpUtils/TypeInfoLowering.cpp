@@ -0,0 +1,190 @@
+//===-- TypeInfoLowering.cpp - Replace the exception type infos with ids ---===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2011-2014 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpTypeInfoLowering"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Cheerp/TypeInfoLowering.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Metadata.h"
+
+STATISTIC(NumTypeInfos, "Number of type infos replaced by ids");
+
+namespace llvm {
+
+using namespace cheerp;
+
+const char* TypeInfoLowering::getPassName() const
+{
+	return "CheerpTypeInfoLowering";
+}
+
+char TypeInfoLowering::ID = 0;
+
+// Find the struct type of a class from the name of its type info
+static StructType* getTypeInfoStruct( const Module & module, const Value * typeInfo )
+{
+	if ( !typeInfo->getName().startswith("_ZTI") )
+		return nullptr;
+	std::string mangledName = "_Z" + typeInfo->getName().substr(4).str();
+	if ( StructType * st = module.getTypeByName("class." + mangledName) )
+		return st;
+	return module.getTypeByName("struct." + mangledName);
+}
+
+// Find the field which holds the subobject of a direct base, or -1 if the base is not a field
+static int getBaseField( const Module & module, StructType * derived, StructType * base )
+{
+	uint32_t firstBase, baseCount;
+	if ( !TypeSupport::getBasesInfo(module, derived, firstBase, baseCount) )
+		return -1;
+	for ( uint32_t i = firstBase; i < firstBase + baseCount; i++ )
+	{
+		if ( derived->getElementType(i) == base )
+			return i;
+	}
+	return -1;
+}
+
+uint32_t TypeInfoLowering::getId( const Value * typeInfo )
+{
+	auto it = typeInfoIds.find(typeInfo);
+	if ( it == typeInfoIds.end() )
+	{
+		it = typeInfoIds.insert( std::make_pair( typeInfo, typeInfoIds.size() + 1 ) ).first;
+		NumTypeInfos++;
+	}
+	return it->second;
+}
+
+Constant * TypeInfoLowering::encodeTypeInfo( Constant * typeInfo )
+{
+	// Catch-all clauses and type infos which have been already replaced are kept as they are
+	if ( isa<ConstantPointerNull>(typeInfo) || isa<ConstantAggregateZero>(typeInfo) )
+		return typeInfo;
+	if ( const ConstantExpr * ce = dyn_cast<ConstantExpr>(typeInfo) )
+		if ( ce->getOpcode() == Instruction::IntToPtr )
+			return typeInfo;
+
+	if ( const ConstantArray * filter = dyn_cast<ConstantArray>(typeInfo) )
+	{
+		SmallVector<Constant *, 4> elements;
+		for ( unsigned i = 0; i < filter->getNumOperands(); i++ )
+			elements.push_back( encodeTypeInfo( filter->getOperand(i) ) );
+		return ConstantArray::get( filter->getType(), elements );
+	}
+
+	uint32_t id = getId( typeInfo->stripPointerCasts(true) );
+	return ConstantExpr::getIntToPtr( ConstantInt::get( Type::getInt32Ty(typeInfo->getContext()), id ), typeInfo->getType() );
+}
+
+void TypeInfoLowering::collectCatchableTypes( const Module & module, const Value * typeInfo, StructType * type,
+		SmallVectorImpl<Value*> & path, SmallVectorImpl<Value*> & catchable )
+{
+	LLVMContext & C = module.getContext();
+	catchable.push_back( ConstantInt::get( Type::getInt32Ty(C), getId(typeInfo) ) );
+	catchable.push_back( MDNode::get( C, path ) );
+
+	const GlobalVariable * GV = dyn_cast<GlobalVariable>(typeInfo);
+	if ( !GV || !GV->hasInitializer() )
+		return;
+	const ConstantStruct * info = dyn_cast<ConstantStruct>(GV->getInitializer());
+	if ( !info || info->getNumOperands() < 3 )
+		return;
+
+	// The kind of type info is the class of its vtable
+	StringRef kind = info->getOperand(0)->stripInBoundsConstantOffsets()->getName();
+	SmallVector<const Value *, 4> bases;
+	if ( kind == "_ZTVN10__cxxabiv120__si_class_type_infoE" )
+		bases.push_back( info->getOperand(2) );
+	else if ( kind == "_ZTVN10__cxxabiv121__vmi_class_type_infoE" )
+	{
+		// Each base is followed by its offset and flags, only public bases catch the derived type
+		for ( unsigned i = 4; i + 1 < info->getNumOperands(); i += 2 )
+		{
+			const ConstantInt * flags = dyn_cast<ConstantInt>( info->getOperand(i + 1) );
+			if ( flags && ( flags->getZExtValue() & 0x2 ) )
+				bases.push_back( info->getOperand(i) );
+		}
+	}
+
+	for ( const Value * base : bases )
+	{
+		const Value * baseInfo = base->stripPointerCasts(true);
+		StructType * baseType = getTypeInfoStruct( module, baseInfo );
+		unsigned pathSize = path.size();
+		// Secondary bases are fields of the derived struct, the primary base is laid out at its beginning.
+		// If the layout is unknown the base is caught with the pointer to the thrown object
+		int field = ( type && baseType ) ? getBaseField( module, type, baseType ) : -1;
+		if ( field >= 0 )
+			path.push_back( ConstantInt::get( Type::getInt32Ty(C), field ) );
+		else if ( !type || !baseType || !TypeSupport::isDerivedStructType( type, baseType ) )
+			baseType = nullptr;
+		collectCatchableTypes( module, baseInfo, baseType, path, catchable );
+		path.resize( pathSize );
+	}
+}
+
+bool TypeInfoLowering::runOnModule( Module & module )
+{
+	bool Changed = false;
+
+	for ( Function & F : module )
+		for ( BasicBlock & BB : F )
+			for ( Instruction & I : BB )
+			{
+				if ( LandingPadInst * lpad = dyn_cast<LandingPadInst>(&I) )
+				{
+					for ( unsigned i = 0; i < lpad->getNumClauses(); i++ )
+						lpad->setOperand( i + 1, encodeTypeInfo( cast<Constant>(lpad->getClause(i)) ) );
+					Changed = true;
+					continue;
+				}
+
+				CallSite call(&I);
+				if ( !call || !call.getCalledFunction() )
+					continue;
+
+				const Function * callee = call.getCalledFunction();
+				if ( callee->getName() == "__cxa_throw" )
+				{
+					const Value * typeInfo = call.getArgument(1)->stripPointerCasts(true);
+					SmallVector<Value *, 4> path;
+					SmallVector<Value *, 8> catchable;
+					collectCatchableTypes( module, typeInfo, getTypeInfoStruct( module, typeInfo ), path, catchable );
+					I.setMetadata( "cheerp.catchable", MDNode::get( module.getContext(), catchable ) );
+					call.setArgument( 1, encodeTypeInfo( cast<Constant>(call.getArgument(1)) ) );
+					Changed = true;
+				}
+				else if ( callee->getIntrinsicID() == Intrinsic::eh_typeid_for )
+				{
+					call.setArgument( 0, encodeTypeInfo( cast<Constant>(call.getArgument(0)) ) );
+					Changed = true;
+				}
+			}
+
+	return Changed;
+}
+
+uint32_t TypeInfoLowering::getTypeInfoId( const Value * typeInfo )
+{
+	assert( isa<ConstantExpr>(typeInfo) && cast<ConstantExpr>(typeInfo)->getOpcode() == Instruction::IntToPtr );
+	return cast<ConstantInt>( cast<ConstantExpr>(typeInfo)->getOperand(0) )->getZExtValue();
+}
+
+ModulePass* createTypeInfoLoweringPass()
+{
+	return new TypeInfoLowering();
+}
+
+}
@@ -144,6 +144,7 @@ bool isInlineable(const Instruction& I, const PointerAnalyzer& PA)
 			case Instruction::LShr:
 			case Instruction::FAdd:
 			case Instruction::FDiv:
+			case Instruction::FRem:
 			case Instruction::FSub:
 			case Instruction::FPTrunc:
 			case Instruction::FPExt:
@@ -378,6 +379,8 @@ DynamicAllocInfo::AllocType DynamicAllocInfo::getAllocType( ImmutableCallSite ca
 				return opnew;
 			else if (f->getName() == "_Znaj")
 				return opnew_array;
+			else if (f->getName() == "__cxa_allocate_exception")
+				return cxa_allocate_exception;
 		}
 	}
 	return not_an_alloc;
@@ -419,10 +422,11 @@ PointerType * DynamicAllocInfo::computeCastedType() const
 	PointerType * pt = cast<PointerType>( getTypeForUse(*firstNonNull) );
 	
 	// Check that all uses are the same
+	// Exceptions are also passed as i8* to __cxa_throw and __cxa_free_exception
 	if (! std::all_of( 
 		std::next(firstNonNull),
 		call->user_end(),
-		[&]( const User * U ) { return getTypeForUse(U) == pt; }) )
+		[&]( const User * U ) { return getTypeForUse(U) == pt || (type == cxa_allocate_exception && !getTypeForUse(U)); }) )
 	{
 		llvm::errs() << "Can not deduce valid type for allocation instruction: " << call->getName() << '\n';
 		llvm::report_fatal_error("Unsupported code found, please report a bug", false);
@@ -584,6 +588,7 @@ namespace llvm
 void initializeCheerpOpts(PassRegistry &Registry)
 {
 	initializeStructMemFuncLoweringPass(Registry);
+	initializeI64LoweringPass(Registry);
 	initializeAllocaMergingPass(Registry);
 	initializeGlobalDepsAnalyzerPass(Registry);
 }
@@ -11,12 +11,25 @@
 
 #include "Relooper.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Cheerp/AllocaMerging.h"
+#include "llvm/Cheerp/I64Lowering.h"
+#include "llvm/Cheerp/PointerPasses.h"
+#include "llvm/Cheerp/ResolveAliases.h"
+#include "llvm/Cheerp/TypeInfoLowering.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/Cheerp/Writer.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Path.h"
+#if LLVM_ENABLE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 using namespace llvm;
 using namespace std;
@@ -53,6 +66,17 @@ public:
 	void renderContinue(int labelId);
 	void renderLabel(int labelId);
 	void renderIfOnLabel(int labelId, bool first);
+	void renderSwitchOnLabel();
+	void renderSwitchOnLabel(int labelId);
+	void renderCaseOnLabel(int labelId);
+	void renderSwitchBlockBegin(const void* privateBlock);
+	void renderSwitchBlockBegin(const void* privateBlock, int labelId);
+	void renderCaseBlockBegin(const void* privateBlock, int branchId);
+	void renderDefaultBlockBegin();
+	void renderCaseBlockEnd();
+	void renderTryBlockBegin(int labelId);
+	void renderCatchBlockBegin(const void* privateBlock);
+	void renderCatchBlockEnd(int labelId);
 };
 
 void CheerpWriter::handleBuiltinNamespace(const char* identifier, llvm::ImmutableCallSite callV)
@@ -158,6 +182,15 @@ void CheerpWriter::compileCopyElement(const Value* baseDest,
 		}
 		case Type::StructTyID:
 		{
+			if(TypeSupport::hasByteLayout(currentType) && codeSize)
+			{
+				stream << "$C(";
+				compileCompleteObject(baseDest, nullptr);
+				stream << ',';
+				compileCompleteObject(baseSrc, nullptr);
+				stream << ");" << NewLine;
+				break;
+			}
 			if(TypeSupport::hasByteLayout(currentType))
 			{
 				stream << "var __tmp__=new Int8Array(";
@@ -178,6 +211,38 @@ void CheerpWriter::compileCopyElement(const Value* baseDest,
 	}
 }
 
+void CheerpWriter::compileRegularBegin()
+{
+	if(codeSize)
+		stream << "$P(";
+	else
+		stream << "{d:";
+}
+
+void CheerpWriter::compileRegularOffset()
+{
+	if(codeSize)
+		stream << ',';
+	else
+		stream << ",o:";
+}
+
+void CheerpWriter::compileRegularEnd()
+{
+	if(codeSize)
+		stream << ')';
+	else
+		stream << '}';
+}
+
+void CheerpWriter::compileRegularZeroOffsetEnd()
+{
+	if(codeSize)
+		stream << ",0)";
+	else
+		stream << ",o:0}";
+}
+
 void CheerpWriter::compileDowncast( ImmutableCallSite callV )
 {
 	assert( callV.arg_size() == 2 );
@@ -198,11 +263,13 @@ void CheerpWriter::compileDowncast( ImmutableCallSite callV )
 		//Do a runtime downcast
 		if(REGULAR == result_kind)
 		{
-			stream << "{d:";
+			compileRegularBegin();
 			compileCompleteObject(src);
-			stream << ".a,o:";
+			stream << ".a";
+			compileRegularOffset();
 			compileCompleteObject(src);
-			stream << ".o-" << baseOffset << '}';
+			stream << ".o-" << baseOffset;
+			compileRegularEnd();
 		}
 		else
 		{
@@ -216,10 +283,12 @@ void CheerpWriter::compileDowncast( ImmutableCallSite callV )
 }
 
 /* Method that handles memcpy and memmove.
- * Since only immutable types are handled in the backend and we use TypedArray.set to make the copy
- * there is not need to handle memmove in a special way
+ * Only immutable types are handled in the backend. Small constant copies are unrolled,
+ * everything else goes through cheerpMemMove which uses copyWithin when the source and
+ * the destination share the same typed array and TypedArray.set otherwise. Both have
+ * memmove-like semantics, so there is no need to handle memmove in a special way
 */
-void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Value* size)
+void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Value* size, bool isMemmove)
 {
 	Type* destType=dest->getType();
 	Type* pointedType = cast<PointerType>(destType)->getElementType();
@@ -228,62 +297,169 @@ void CheerpWriter::compileMemFunc(const Value* dest, const Value* src, const Val
 
 	uint64_t typeSize = targetData.getTypeAllocSize(pointedType);
 
-	bool constantNumElements = false;
-	uint32_t numElem = 0;
-
-	if(isa<ConstantInt>(size))
+	if(TypeSupport::hasByteLayout(pointedType))
 	{
-		uint32_t allocatedSize = getIntFromValue(size);
-		numElem = (allocatedSize+typeSize-1)/typeSize;
-		constantNumElements = true;
+		// Byte layout objects are copied using their underlying buffer, every object has its own
+		if(!isa<ConstantInt>(size) || getIntFromValue(size) != typeSize)
+			llvm::report_fatal_error("Unsupported memory intrinsic on multiple byte layout objects", false);
+		compileCopyElement(dest, src, pointedType);
+		return;
 	}
-	else
+
+	if(!isa<ConstantInt>(size))
 	{
 		//Compute number of elements at runtime
-		stream << "var __numElem__=";
+		stream << "cheerpMemMove(";
+		compilePointerBase(dest);
+		stream << ',';
+		compilePointerOffset(dest);
+		stream << ',';
+		compilePointerBase(src);
+		stream << ',';
+		compilePointerOffset(src);
+		stream << ',';
 		compileOperand(size);
-		stream << '/' << typeSize;
-		//Make sure to close this if below
-		stream << ';' << NewLine;
+		if(typeSize > 1)
+			stream << '/' << typeSize;
+		stream << ");" << NewLine;
+		return;
 	}
 
+	uint32_t allocatedSize = getIntFromValue(size);
+	uint32_t numElem = (allocatedSize+typeSize-1)/typeSize;
 
-	// Handle the case for multiple elements, it assumes that we can use TypedArray.set
-	if(!constantNumElements)
-		stream << "if(__numElem__>1)" << NewLine << '{';
-	if(!constantNumElements || numElem>1)
+	if(numElem==1)
+	{
+		// Handle the single element case, do not assume we have a typed array
+		compileCopyElement(dest, src, pointedType);
+	}
+	else if(numElem<=MemFuncUnrollThreshold && !isMemmove)
+	{
+		// memcpy ranges do not overlap, so the elements can be copied in any order
+		for(uint32_t i=0;i<numElem;i++)
+		{
+			compilePointerBase(dest);
+			stream << '[';
+			compilePointerOffset(dest);
+			if(i)
+				stream << '+' << i;
+			stream << "]=";
+			compilePointerBase(src);
+			stream << '[';
+			compilePointerOffset(src);
+			if(i)
+				stream << '+' << i;
+			stream << "];" << NewLine;
+		}
+	}
+	else if(numElem>1)
 	{
-		// The semantics of TypedArray.set is memmove-like, no need to care about direction
+		stream << "cheerpMemMove(";
 		compilePointerBase(dest);
-		stream << ".set(";
+		stream << ',';
+		compilePointerOffset(dest);
+		stream << ',';
 		compilePointerBase(src);
-
-		//We need to get a subview of the source
-		stream << ".subarray(";
-		compilePointerOffset(src);
 		stream << ',';
 		compilePointerOffset(src);
-		stream << '+';
+		stream << ',' << numElem << ");" << NewLine;
+	}
+}
 
-		// Use the size
-		if(constantNumElements)
-			stream << numElem;
+/* Method that handles memset.
+ * The reset value is a byte, it is replicated to fill the whole element and written using TypedArray.fill.
+ * Only whole elements can be written, sizes which are not a multiple of the element size are rejected
+*/
+void CheerpWriter::compileMemset(const Value* dest, const Value* resetVal, const Value* size)
+{
+	Type* pointedType = cast<PointerType>(dest->getType())->getElementType();
+	if(!types.isTypedArrayType(pointedType))
+		llvm::report_fatal_error("Unsupported memory intrinsic, please rebuild the code using an updated version of Cheerp", false);
+
+	uint64_t typeSize = targetData.getTypeAllocSize(pointedType);
+
+	bool constantNumElements = isa<ConstantInt>(size);
+	uint32_t numElem = 0;
+	if(constantNumElements)
+	{
+		if(getIntFromValue(size)%typeSize)
+			llvm::report_fatal_error("Unsupported memset of a partial element", false);
+		numElem = getIntFromValue(size)/typeSize;
+		if(numElem==0)
+			return;
+	}
+	else if(typeSize > 1)
+	{
+		// fill would silently truncate the number of elements, the tail cannot be written anyway
+		stream << "if((";
+		compileOperand(size);
+		stream << ")&" << (typeSize-1) << ")throw new Error(\"Unsupported memset of a partial element\");" << NewLine;
+	}
+
+	// Write the value to be stored in each element
+	auto compileElementValue = [&]()
+	{
+		if(pointedType->isIntegerTy(8))
+			compileOperand(resetVal);
+		else if(const ConstantInt* C = dyn_cast<ConstantInt>(resetVal))
+		{
+			uint64_t byteVal = C->getZExtValue() & 0xff;
+			uint64_t bits = 0;
+			for(uint32_t i=0;i<typeSize;i++)
+				bits = (bits << 8) | byteVal;
+			if(pointedType->isFloatTy())
+				compileOperand(ConstantFP::get(module.getContext(), APFloat(APFloat::IEEEsingle, APInt(32, bits))));
+			else if(pointedType->isDoubleTy())
+				compileOperand(ConstantFP::get(module.getContext(), APFloat(APFloat::IEEEdouble, APInt(64, bits))));
+			else
+				stream << bits;
+		}
+		else if(pointedType->isIntegerTy())
+		{
+			// Replicate the byte at runtime
+			stream << "((";
+			compileOperand(resetVal);
+			stream << ")&255)*" << (pointedType->isIntegerTy(16) ? 0x0101 : 0x01010101);
+		}
 		else
-			stream << "__numElem__";
+			llvm::report_fatal_error("Unsupported memory intrinsic, please rebuild the code using an updated version of Cheerp", false);
+	};
 
-		stream << "),";
-		compilePointerOffset(dest);
-		stream << ");" << NewLine;
+	if(constantNumElements && numElem<=MemFuncUnrollThreshold)
+	{
+		for(uint32_t i=0;i<numElem;i++)
+		{
+			compilePointerBase(dest);
+			stream << '[';
+			compilePointerOffset(dest);
+			if(i)
+				stream << '+' << i;
+			stream << "]=";
+			compileElementValue();
+			stream << ';' << NewLine;
+		}
+		return;
 	}
-	// Handle the single element case, do not assume we have a typed array
-	if(!constantNumElements)
-		stream << NewLine << "}else if(__numElem__===1)" << NewLine << '{';
-	if(!constantNumElements || numElem==1)
+
+	compilePointerBase(dest);
+	stream << ".fill(";
+	compileElementValue();
+	stream << ',';
+	compilePointerOffset(dest);
+	stream << ',';
+	compilePointerOffset(dest);
+	stream << '+';
+	if(constantNumElements)
+		stream << numElem;
+	else
 	{
-		compileCopyElement(dest, src, pointedType);
+		stream << '(';
+		compileOperand(size);
+		stream << ')';
+		if(typeSize > 1)
+			stream << '/' << typeSize;
 	}
-	if(!constantNumElements)
-		stream << NewLine << '}';
+	stream << ");" << NewLine;
 }
 
 void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
@@ -297,42 +473,70 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 	POINTER_KIND result = PA.getPointerKind(info.getInstruction());
 
 	if(result == REGULAR)
+		compileRegularBegin();
+
+	if (typedArrayPool && info.useTypedArray())
 	{
-		stream << "{d:";
+		compilePooledAllocation(info);
+		if(result == REGULAR)
+			compileRegularZeroOffsetEnd();
+		return;
 	}
 
 	// To implement cheerp_reallocate we need to strategies:
-	// 1) Immutable types are stored in typed array which cannot be resized, we need to make a new one
-	//    and copy the old data over
-	// 2) Objects and pointers are stored in a regular array and we can just resize them
+	// 1) Immutable types are stored in typed array which cannot be resized. cheerpRealloc keeps a hidden
+	//    capacity in the underlying buffer and only makes a new, geometrically larger, one when it is exhausted
+	// 2) Objects and pointers are stored in a regular array and we can just resize them, cheerpResizeArray
+	//    returns the old length so that only the new elements are initialized
 	if (info.getAllocType() == DynamicAllocInfo::cheerp_reallocate)
 	{
-		stream << "(function(){";
-		stream << "var __old__=";
-		compilePointerBase(info.getMemoryArg());
-		stream << ';' << NewLine;
-		if (!info.useTypedArray())
+		assert( globalDeps.needRealloc() );
+		if (info.useTypedArray())
+		{
+			stream << "cheerpRealloc(";
+			compileTypedArrayType(t);
+			stream << ',';
+			compilePointerBase(info.getMemoryArg());
+			stream << ',';
+		}
+		else
 		{
-			stream << "var __len__=__old__.length; " << NewLine;
-			stream << "__old__.length = ";
-			if( !info.sizeIsRuntime() )
+			if (info.useCreateArrayFunc())
 			{
-				uint32_t allocatedSize = getIntFromValue( info.getByteSizeArg() );
-				uint32_t numElem = (allocatedSize+typeSize-1)/typeSize;
-				stream << numElem;
+				assert( t->isStructTy() );
+				StructType* st = cast<StructType>(t);
+				assert( globalDeps.dynAllocArrays().count(st) );
+				stream << "createArray" << types.getStructInfo(st)->jsName;
 			}
 			else
 			{
-				compileOperand( info.getByteSizeArg() );
-				stream << '/' << typeSize;
+				assert( info.useCreatePointerArrayFunc() );
+				stream << "createPointerArray";
 			}
-			stream << ';' << NewLine;
+			stream << '(';
+			compilePointerBase(info.getMemoryArg());
+			stream << ",cheerpResizeArray(";
+			compilePointerBase(info.getMemoryArg());
+			stream << ',';
+		}
+		if( !info.sizeIsRuntime() )
+		{
+			uint32_t allocatedSize = getIntFromValue( info.getByteSizeArg() );
+			uint32_t numElem = (allocatedSize+typeSize-1)/typeSize;
+			stream << numElem;
 		}
 		else
 		{
-			//Allocated the new array (created below) in a temporary var
-			stream << "var __ret__=";
+			compileOperand( info.getByteSizeArg() );
+			stream << '/' << typeSize;
 		}
+		if (info.useTypedArray())
+			stream << ')';
+		else
+			stream << "))";
+		if(result == REGULAR)
+			compileRegularZeroOffsetEnd();
+		return;
 	}
 	
 	if (info.useTypedArray())
@@ -363,40 +567,28 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 		
 		assert( globalDeps.dynAllocArrays().count(st) );
 		
-		stream << "createArray" << namegen.filterLLVMName(st->getName(), true);
-		stream << '(';
-		if (info.getAllocType() == DynamicAllocInfo::cheerp_reallocate)
-			stream << "__old__,__len__)";
+		stream << "createArray" << types.getStructInfo(st)->jsName;
+		stream << "(new Array(";
+		if( info.getNumberOfElementsArg() )
+			compileOperand( info.getNumberOfElementsArg() );
 		else
 		{
-			stream << "new Array(";
-			if( info.getNumberOfElementsArg() )
-				compileOperand( info.getNumberOfElementsArg() );
-			else
-			{
-				compileOperand( info.getByteSizeArg() );
-				stream << '/' << typeSize;
-			}
-			stream << "),0)";
+			compileOperand( info.getByteSizeArg() );
+			stream << '/' << typeSize;
 		}
+		stream << "),0)";
 	}
 	else if (info.useCreatePointerArrayFunc() )
 	{
-		stream << "createPointerArray(";
-		if (info.getAllocType() == DynamicAllocInfo::cheerp_reallocate)
-			stream << "__old__,__len__)";
+		stream << "createPointerArray(new Array(";
+		if( info.getNumberOfElementsArg() )
+			compileOperand( info.getNumberOfElementsArg() );
 		else
 		{
-			stream << "new Array(";
-			if( info.getNumberOfElementsArg() )
-				compileOperand( info.getNumberOfElementsArg() );
-			else
-			{
-				compileOperand( info.getByteSizeArg() );
-				stream << '/' << typeSize;
-			}
-			stream << "),0)";
+			compileOperand( info.getByteSizeArg() );
+			stream << '/' << typeSize;
 		}
+		stream << "),0)";
 	
 		assert( globalDeps.needCreatePointerArray() );
 	}
@@ -426,6 +618,17 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 
 		for(uint32_t i = 0; i < numElem;i++)
 		{
+			// A single array of numbers is a typed array of its own, it can be given back to the pool by compileFree
+			if(typedArrayPool && numElem == 1 && TypeSupport::isTypedArrayObjectType(t))
+			{
+				stream << "cheerpPoolAlloc(";
+				compileTypedArrayType(t->getArrayElementType());
+				stream << ',' << t->getArrayNumElements();
+				if (info.getAllocType() == DynamicAllocInfo::calloc)
+					stream << ",1";
+				stream << ')';
+				continue;
+			}
 			compileType(t, LITERAL_OBJ);
 			if((i+1) < numElem)
 				stream << ',';
@@ -440,29 +643,73 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 		llvm::report_fatal_error("Unsupported type in allocation", false);
 	}
 
+	if(result == REGULAR)
+		compileRegularZeroOffsetEnd();
+}
+
+void CheerpWriter::compilePooledAllocation(const DynamicAllocInfo & info)
+{
+	Type * t = info.getCastedType()->getElementType();
+	uint32_t typeSize = targetData.getTypeAllocSize(t);
+
 	if (info.getAllocType() == DynamicAllocInfo::cheerp_reallocate)
 	{
-		stream << ';' << NewLine;
-		if (info.useTypedArray())
-		{
-			//__ret__ now contains the new array, we need to copy over the data
-			//The amount of data to copy is limited by the shortest between the old and new array
-			stream << "__ret__.set(__old__.subarray(0, Math.min(__ret__.length,__old__.length)));" << NewLine;
-			stream << "return __ret__;})()";
-		}
-		else
-			stream << "return __old__;})()";
+		stream << "cheerpPoolRealloc(";
+		compileTypedArrayType(t);
+		stream << ',';
+		compilePointerBase(info.getMemoryArg());
 	}
+	else
+	{
+		stream << "cheerpPoolAlloc(";
+		compileTypedArrayType(t);
+	}
+	stream << ',';
 
-	if(result == REGULAR)
+	if(info.getNumberOfElementsArg())
+		compileOperand(info.getNumberOfElementsArg());
+	else if( !info.sizeIsRuntime() )
 	{
-		stream << ",o:0}";
+		uint32_t allocatedSize = getIntFromValue( info.getByteSizeArg() );
+		uint32_t numElem = (allocatedSize+typeSize-1)/typeSize;
+		stream << numElem;
+	}
+	else
+	{
+		compileOperand( info.getByteSizeArg() );
+		stream << '/' << typeSize;
 	}
+
+	// Recycled buffers are dirty, calloc needs them to be cleared
+	if (info.getAllocType() == DynamicAllocInfo::calloc)
+		stream << ",1";
+	stream << ')';
 }
 
 void CheerpWriter::compileFree(const Value* obj)
 {
-	//TODO: Clean up class related data structures
+	// The memory of the objects is reclaimed by the garbage collector, only the buffers
+	// of the typed arrays are given back to the pool
+	if (!typedArrayPool || !globalDeps.hasTypedArrayAllocations())
+		return;
+	// Arrays of numbers are typed arrays of their own, both as COMPLETE_OBJECT and as the element of a REGULAR pointer.
+	// Look through the casts to i8* for the type they were allocated as.
+	const Value* allocated = obj;
+	while (!TypeSupport::isTypedArrayObjectType(allocated->getType()->getPointerElementType()) && isBitCast(allocated))
+		allocated = cast<User>(allocated)->getOperand(0);
+	if (TypeSupport::isTypedArrayObjectType(allocated->getType()->getPointerElementType()))
+	{
+		stream << "cheerpPoolFree(";
+		compileCompleteObject(allocated);
+		stream << ')';
+		return;
+	}
+	// Only typed arrays are recycled, cheerpPoolFree ignores anything else
+	if (PA.getPointerKind(obj) != REGULAR)
+		return;
+	stream << "cheerpPoolFree(";
+	compilePointerBase(obj);
+	stream << ')';
 }
 
 CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(ImmutableCallSite callV, const Function * func)
@@ -482,12 +729,12 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 	if(intrinsicId==Intrinsic::memmove ||
 		intrinsicId==Intrinsic::memcpy)
 	{
-		compileMemFunc(*(it), *(it+1), *(it+2));
+		compileMemFunc(*(it), *(it+1), *(it+2), intrinsicId==Intrinsic::memmove);
 		return COMPILE_EMPTY;
 	}
 	else if(intrinsicId==Intrinsic::memset)
 	{
-		llvm::report_fatal_error("Unsupported memory intrinsic, please rebuild the code using an updated version of Cheerp", false);
+		compileMemset(*(it), *(it+1), *(it+2));
 		return COMPILE_EMPTY;
 	}
 	else if(intrinsicId==Intrinsic::invariant_start)
@@ -527,9 +774,9 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 		if(TypeSupport::isClientArrayType(callV.getArgument(0)->getType()->getPointerElementType()) &&
 		                PA.getPointerKind(callV.getInstruction()) == REGULAR)
 		{
-			stream << "{d:";
+			compileRegularBegin();
 			compileCompleteObject(callV.getArgument(0));
-			stream << ",o:0}";
+			compileRegularZeroOffsetEnd();
 		}
 		else
 		{
@@ -573,11 +820,11 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 	}
 	else if(intrinsicId==Intrinsic::cheerp_make_regular)
 	{
-		stream << "{d:";
+		compileRegularBegin();
 		compileCompleteObject(*it);
-		stream << ",o:";
+		compileRegularOffset();
 		compileOperand(*(it+1));
-		stream << '}';
+		compileRegularEnd();
 		return COMPILE_OK;
 	}
 	else if(intrinsicId==Intrinsic::cheerp_element_distance)
@@ -592,6 +839,79 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 		stream << '1';
 		return COMPILE_OK;
 	}
+	else if(intrinsicId==Intrinsic::eh_typeid_for)
+	{
+		stream << TypeInfoLowering::getTypeInfoId(*it);
+		return COMPILE_OK;
+	}
+	else if(strcmp(ident,"__cxa_throw")==0)
+	{
+		//The thrown value is a pointer to the exception object tagged with the ids of the types which catch it,
+		//each one followed by the fields which lead to the subobject of that type, and with the destructor of the object
+		assert( globalDeps.needExceptions() );
+		const MDNode* catchable = callV.getInstruction()->getMetadata("cheerp.catchable");
+		assert( catchable );
+		stream << "cheerpThrow(";
+		compilePointerAs(*it, REGULAR);
+		stream << ",[";
+		for(unsigned i=0;i<catchable->getNumOperands();i+=2)
+		{
+			if(i!=0)
+				stream << ',';
+			stream << cast<ConstantInt>(catchable->getOperand(i))->getZExtValue() << ',';
+			const MDNode* path = cast<MDNode>(catchable->getOperand(i+1));
+			if(path->getNumOperands()==0)
+			{
+				stream << "null";
+				continue;
+			}
+			stream << '[';
+			for(unsigned j=0;j<path->getNumOperands();j++)
+			{
+				if(j!=0)
+					stream << ',';
+				stream << "\"a" << cast<ConstantInt>(path->getOperand(j))->getZExtValue() << "0\"";
+			}
+			stream << ']';
+		}
+		stream << "],";
+		const Value* destructor = (*(it+2))->stripPointerCasts(true);
+		if(isa<ConstantPointerNull>(destructor))
+			stream << "null";
+		else
+			compileOperand(destructor);
+		stream << ')';
+		return COMPILE_OK;
+	}
+	else if(strcmp(ident,"__cxa_rethrow")==0)
+	{
+		stream << "cheerpRethrow()";
+		return COMPILE_OK;
+	}
+	else if(strcmp(ident,"__cxa_begin_catch")==0)
+	{
+		stream << "cheerpBeginCatch(";
+		compilePointerAs(*it, REGULAR);
+		stream << ')';
+		return COMPILE_OK;
+	}
+	else if(strcmp(ident,"__cxa_end_catch")==0)
+	{
+		stream << "cheerpEndCatch()";
+		return COMPILE_OK;
+	}
+	else if(strcmp(ident,"__cxa_get_exception_ptr")==0)
+	{
+		stream << "cheerpGetExceptionPtr(";
+		compilePointerAs(*it, REGULAR);
+		stream << ')';
+		return COMPILE_OK;
+	}
+	else if(strcmp(ident,"__cxa_free_exception")==0)
+	{
+		//Exception objects are garbage collected, the destructor is called by cheerpEndCatch
+		return COMPILE_EMPTY;
+	}
 	else if(strcmp(ident,"free")==0 ||
 		strcmp(ident,"_ZdlPv")==0 ||
 		strcmp(ident,"_ZdaPv")==0 ||
@@ -1129,15 +1449,25 @@ void CheerpWriter::compileConstant(const Constant* c)
 	else if(isa<ConstantStruct>(c))
 	{
 		const ConstantStruct* d=cast<ConstantStruct>(c);
-		stream << '{';
+		//Named structs are created by their constructor, like in compileType
+		bool useConstructor = d->getType()->hasName() && !d->getType()->hasByteLayout();
+		if(useConstructor)
+		{
+			stream << "new ";
+			compileStructConstructorName(d->getType());
+			stream << '(';
+		}
+		else
+			stream << '{';
 		assert(d->getType()->getNumElements() == d->getNumOperands());
 
 		for(uint32_t i=0;i<d->getNumOperands();i++)
 		{
-			stream << 'a' << i << "0:";
+			if(!useConstructor)
+				stream << 'a' << i << "0:";
 			Type* elementType = d->getOperand(i)->getType();
 			if(elementType->isPointerTy())
-				compilePointerAs(d->getOperand(i), PA.getPointerKindForStoredType(elementType));
+				compilePointerAs(d->getOperand(i), PA.getPointerKindForStoredField(d->getType(), i));
 			else
 				compileOperand(d->getOperand(i));
 
@@ -1145,7 +1475,7 @@ void CheerpWriter::compileConstant(const Constant* c)
 				stream << ',';
 		}
 
-		stream << '}';
+		stream << (useConstructor ? ')' : '}');
 	}
 	else if(isa<ConstantFP>(c))
 	{
@@ -1163,7 +1493,10 @@ void CheerpWriter::compileConstant(const Constant* c)
 		{
 			SmallString<32> buf;
 			f->getValueAPF().toString(buf);
+			//Float literals are doubles in JS, round them like any other float value
+			compileFloatCoercionBegin(f->getType());
 			stream << buf;
+			compileFloatCoercionEnd(f->getType());
 		}
 	}
 	else if(isa<ConstantInt>(c))
@@ -1208,6 +1541,28 @@ void CheerpWriter::compileConstant(const Constant* c)
 	}
 }
 
+bool CheerpWriter::isBooleanValue(const Value* v) const
+{
+	// i1 constants are compiled as true/false and the selects coerce their operands
+	if(isa<ConstantInt>(v) || isa<CmpInst>(v) || isa<SelectInst>(v))
+		return true;
+	// The registers of the BOOLEAN kind are coerced when assigned, see compileBB
+	const Instruction* I = dyn_cast<Instruction>(v);
+	return I && !isInlineable(*I, PA) && Registerize::getRegisterKind(I) == Registerize::BOOLEAN;
+}
+
+void CheerpWriter::compileBooleanOperand(const Value* v)
+{
+	if(isBooleanValue(v))
+	{
+		compileOperand(v);
+		return;
+	}
+	stream << "!!(";
+	compileOperand(v);
+	stream << ')';
+}
+
 void CheerpWriter::compileOperand(const Value* v)
 {
 	if(const Constant* c=dyn_cast<Constant>(v))
@@ -1278,10 +1633,17 @@ void CheerpWriter::compilePHIOfBlockFromOtherBlock(const BasicBlock* to, const B
 			{
 				return;
 			}
-			writer.stream << "var " << writer.namegen.getName(phi) << '=';
+			if(!writer.typedLocals)
+				writer.stream << "var ";
+			writer.stream << writer.namegen.getName(phi) << '=';
 			writer.namegen.setEdgeContext(fromBB, toBB);
 			if(phiType->isPointerTy())
 				writer.compilePointerAs(incoming, writer.PA.getPointerKind(phi));
+			else if(writer.typedLocals && phiType->isIntegerTy(1))
+			{
+				// Keep the register monomorphic, i1 values may be either booleans or numbers
+				writer.compileBooleanOperand(incoming);
+			}
 			else
 				writer.compileOperand(incoming);
 			writer.stream << ';' << writer.NewLine;
@@ -1373,6 +1735,12 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 				{
 					compilePointerAs(retVal, PA.getPointerKindForReturn(ri.getParent()->getParent()));
 				}
+				else if(isAsmJSFunction(currentFun))
+				{
+					compileCoercionBegin(retVal->getType());
+					compileOperand(retVal);
+					compileCoercionEnd(retVal->getType());
+				}
 				else
 				{
 					compileOperand(retVal);
@@ -1385,9 +1753,13 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 		case Instruction::Invoke:
 		{
 			const InvokeInst& ci = cast<InvokeInst>(I);
+			// The i1 values returned by calls may be numbers, see compileBB
+			bool coerceToBoolean = typedLocals && ci.getType()->isIntegerTy(1);
+			if(coerceToBoolean)
+				stream << "!!(";
 
-			//TODO: Support unwind
-			//For now, pretend it's a regular call
+			//The call is wrapped in a try by compileBB, the PHIs of both the successors
+			//are handled by the relooper when rendering the branches
 			if(ci.getCalledFunction())
 			{
 				//Direct call
@@ -1395,10 +1767,9 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 				assert(cf!=COMPILE_EMPTY);
 				if(cf==COMPILE_OK)
 				{
+					if(coerceToBoolean)
+						stream << ')';
 					stream << ';' << NewLine;
-					//Only consider the normal successor for PHIs here
-					//For each successor output the variables for the phi nodes
-					compilePHIOfBlockFromOtherBlock(ci.getNormalDest(), I.getParent());
 					return COMPILE_OK;
 				}
 				else
@@ -1411,15 +1782,18 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 			}
 
 			compileMethodArgs(ci.op_begin(),ci.op_begin()+ci.getNumArgOperands(),&ci);
+			if(coerceToBoolean)
+				stream << ')';
 			stream << ';' << NewLine;
-			//Only consider the normal successor for PHIs here
-			//For each successor output the variables for the phi nodes
-			compilePHIOfBlockFromOtherBlock(ci.getNormalDest(), I.getParent());
 			return COMPILE_OK;
 		}
 		case Instruction::Resume:
 		{
-			//TODO: support exceptions
+			//The first field of the landing pad value is always the caught JS value
+			const ResumeInst& ri = cast<ResumeInst>(I);
+			stream << "throw ";
+			compileOperand(ri.getValue());
+			stream << ".a00;" << NewLine;
 			return COMPILE_OK;
 		}
 		case Instruction::Br:
@@ -1443,21 +1817,46 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileNotInlineableIns
 
 			if(PA.getPointerKind(ai) == REGULAR)
 			{
-				stream << "{d:[";
-				compileType(ai->getAllocatedType(), LITERAL_OBJ);
-				stream << "],o:0}";
+				compileRegularBegin();
+				stream << '[';
+				compileAllocaType(ai);
+				stream << ']';
+				compileRegularZeroOffsetEnd();
 			}
 			else 
-				compileType( ai->getAllocatedType(), LITERAL_OBJ);
+				compileAllocaType(ai);
 
 			return COMPILE_OK;
 		}
 		case Instruction::LandingPad:
 		{
-			//TODO: Support exceptions
-			stream << " alert('Exceptions not supported')";
-			//Do not continue block
-			return COMPILE_UNSUPPORTED;
+			//Catch clauses are type info ids, filters are arrays of ids and catch-all clauses are null
+			const LandingPadInst& lpad = cast<LandingPadInst>(I);
+			assert( globalDeps.needExceptions() );
+			stream << "cheerpLandingPad(exception,[";
+			for(unsigned i=0;i<lpad.getNumClauses();i++)
+			{
+				if(i!=0)
+					stream << ',';
+				const Constant* clause = cast<Constant>(lpad.getClause(i));
+				if(lpad.isFilter(i))
+				{
+					stream << '[';
+					for(unsigned j=0;j<clause->getType()->getArrayNumElements();j++)
+					{
+						if(j!=0)
+							stream << ',';
+						stream << TypeInfoLowering::getTypeInfoId(clause->getAggregateElement(j));
+					}
+					stream << ']';
+				}
+				else if(isa<ConstantPointerNull>(clause))
+					stream << "null";
+				else
+					stream << TypeInfoLowering::getTypeInfoId(clause);
+			}
+			stream << "]," << (lpad.isCleanup() ? '1' : '0') << ')';
+			return COMPILE_OK;
 		}
 		case Instruction::InsertValue:
 		{
@@ -1533,7 +1932,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileNotInlineableIns
 			if(valOp->getType()->isIntegerTy())
 				compileSignedInteger(valOp);
 			else if(valOp->getType()->isPointerTy())
-				compilePointerAs(valOp, PA.getPointerKindForStoredType(valOp->getType()));
+				compilePointerAs(valOp, PA.getPointerKindForStore(&si));
 			else
 				compileOperand(valOp);
 			return COMPILE_OK;
@@ -1573,16 +1972,16 @@ void CheerpWriter::compileGEP(const llvm::User* gep_inst, POINTER_KIND kind)
 		{
 			if (TypeSupport::hasByteLayout(targetType))
 			{
-				stream << "{d:";
+				compileRegularBegin();
 				compilePointerBase( gep_inst );
-				stream << ",o:";
+				compileRegularOffset();
 				compilePointerOffset( gep_inst );
-				stream << '}';
+				compileRegularEnd();
 			}
 			else
 			{
 				assert(TypeSupport::isTypedArrayType(targetType));
-				stream << "{d:";
+				compileRegularBegin();
 				// Forge an appropiate typed array
 				assert (!TypeSupport::hasByteLayout(targetType));
 				stream << "new ";
@@ -1593,12 +1992,13 @@ void CheerpWriter::compileGEP(const llvm::User* gep_inst, POINTER_KIND kind)
 				// If this GEP or a previous one passed through an array of immutables generate a regular from
 				// the start of the array and not from the pointed element
 				const Value* lastOffset = compileByteLayoutOffset( gep_inst, BYTE_LAYOUT_OFFSET_STOP_AT_ARRAY );
-				stream << "),o:";
+				stream << ')';
+				compileRegularOffset();
 				if (lastOffset)
 					compileOperand(lastOffset);
 				else
 					stream << '0';
-				stream << '}';
+				compileRegularEnd();
 			}
 		}
 		else if (indices.size() == 1)
@@ -1606,9 +2006,9 @@ void CheerpWriter::compileGEP(const llvm::User* gep_inst, POINTER_KIND kind)
 			bool isOffsetConstantZero = isa<Constant>(indices.front()) && cast<Constant>(indices.front())->isNullValue();
 
 			// Just another pointer from this one
-			stream << "{d:";
+			compileRegularBegin();
 			compilePointerBase(gep_inst->getOperand(0));
-			stream << ",o:";
+			compileRegularOffset();
 			compilePointerOffset(gep_inst->getOperand(0));
 
 			if(!isOffsetConstantZero)
@@ -1617,22 +2017,22 @@ void CheerpWriter::compileGEP(const llvm::User* gep_inst, POINTER_KIND kind)
 				compileOperand(indices.front());
 			}
 
-			stream << '}';
+			compileRegularEnd();
 		}
 		else
 		{
 			
 			Type* basePointedType = basePointerType->getPointerElementType();
 			bool useDownCastArray = false;
-			if(containerStructType && types.hasBasesInfo(containerStructType))
+			if(containerStructType)
 			{
-				uint32_t firstBase, baseCount;
-				types.getBasesInfo(containerStructType, firstBase, baseCount);
-				if(lastOffsetConstant >= firstBase && lastOffsetConstant < (firstBase+baseCount))
+				const StructInfo* info = types.getStructInfo(containerStructType);
+				if(info && info->needsDowncastArray &&
+					lastOffsetConstant >= info->firstBase && lastOffsetConstant < (info->firstBase+info->baseCount))
 					useDownCastArray = true;
 			}
 
-			stream << "{d:";
+			compileRegularBegin();
 			compileCompleteObject(gep_inst->getOperand(0), indices.front());
 			if (useDownCastArray)
 			{
@@ -1643,7 +2043,7 @@ void CheerpWriter::compileGEP(const llvm::User* gep_inst, POINTER_KIND kind)
 			{
 				compileAccessToElement(basePointedType, makeArrayRef(std::next(indices.begin()),std::prev(indices.end())));
 			}
-			stream << ",o:";
+			compileRegularOffset();
 			if (useDownCastArray)
 			{
 				compileCompleteObject(gep_inst->getOperand(0), indices.front());
@@ -1652,7 +2052,7 @@ void CheerpWriter::compileGEP(const llvm::User* gep_inst, POINTER_KIND kind)
 			}
 			else
 				compileOffsetForGEP(gep_inst->getOperand(0)->getType(), indices);
-			stream << '}';
+			compileRegularEnd();
 		}
 	}
 }
@@ -1694,10 +2094,129 @@ void CheerpWriter::compileUnsignedInteger(const llvm::Value* v)
 	}
 }
 
-/*
- * This can be used for both named instructions and inlined ones
- * NOTE: Call, Ret, Invoke are NEVER inlined
- */
+static bool isAsmJSScalarType(Type* t)
+{
+	return (t->isIntegerTy() && t->getIntegerBitWidth() <= 32) || t->isFloatTy() || t->isDoubleTy();
+}
+
+/**
+ * Check that F only manipulates numeric values. Booleans are not allowed
+ * in the signature since the |0 coercion would turn them into numbers.
+ * Calls are only accepted for direct calls to functions with a body,
+ * they are validated later on.
+ */
+static bool isAsmJSCandidate(const Function& F)
+{
+	if(F.empty() || F.isVarArg())
+		return false;
+	Type* retType = F.getReturnType();
+	if(!retType->isVoidTy() && (!isAsmJSScalarType(retType) || retType->isIntegerTy(1)))
+		return false;
+	for(const Argument& arg: F.getArgumentList())
+	{
+		if(!isAsmJSScalarType(arg.getType()) || arg.getType()->isIntegerTy(1))
+			return false;
+	}
+	for(const BasicBlock& BB: F)
+	{
+		for(const Instruction& I: BB)
+		{
+			if(const CallInst* ci = dyn_cast<CallInst>(&I))
+			{
+				const Function* callee = ci->getCalledFunction();
+				if(!callee || ci->isInlineAsm())
+					return false;
+				if(callee->getIntrinsicID()==Intrinsic::dbg_value ||
+					callee->getIntrinsicID()==Intrinsic::dbg_declare)
+					continue;
+				if(callee->empty())
+					return false;
+			}
+			else if(isa<InvokeInst>(I) || isa<LandingPadInst>(I) || isa<ResumeInst>(I) || isa<VAArgInst>(I))
+				return false;
+			if(!I.getType()->isVoidTy() && !isAsmJSScalarType(I.getType()))
+				return false;
+			for(const Value* op: I.operands())
+			{
+				if(op->getType()->isPointerTy() && !isa<Function>(op))
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+void CheerpWriter::computeAsmJSFunctions()
+{
+	for(const Function& F: module.getFunctionList())
+	{
+		if(!asmJSCoercions && !F.hasFnAttribute("cheerp-asmjs"))
+			continue;
+		if(isAsmJSCandidate(F))
+			asmJSFunctions.insert(&F);
+	}
+	// asm.js style functions can only call each other, iterate until no more functions are dropped
+	bool changed = true;
+	while(changed)
+	{
+		changed = false;
+		for(auto it = asmJSFunctions.begin(); it != asmJSFunctions.end();)
+		{
+			bool callsOtherCode = false;
+			for(const BasicBlock& BB: **it)
+			{
+				for(const Instruction& I: BB)
+				{
+					const CallInst* ci = dyn_cast<CallInst>(&I);
+					if(ci && !ci->getCalledFunction()->isIntrinsic() && !asmJSFunctions.count(ci->getCalledFunction()))
+						callsOtherCode = true;
+				}
+			}
+			if(callsOtherCode)
+			{
+				it = asmJSFunctions.erase(it);
+				changed = true;
+			}
+			else
+				++it;
+		}
+	}
+}
+
+void CheerpWriter::compileCoercionBegin(Type* t)
+{
+	if(t->isIntegerTy())
+		stream << '(';
+	else if(t->isFloatTy())
+		stream << "Math.fround(";
+	else if(t->isDoubleTy())
+		stream << "(+";
+}
+
+void CheerpWriter::compileCoercionEnd(Type* t)
+{
+	if(t->isIntegerTy())
+		stream << "|0)";
+	else if(t->isFloatTy() || t->isDoubleTy())
+		stream << ')';
+}
+
+void CheerpWriter::compileFloatCoercionBegin(Type* t)
+{
+	if(t->isFloatTy() && currentFun && isAsmJSFunction(currentFun))
+		stream << "Math.fround(";
+}
+
+void CheerpWriter::compileFloatCoercionEnd(Type* t)
+{
+	if(t->isFloatTy() && currentFun && isAsmJSFunction(currentFun))
+		stream << ')';
+}
+
+/*
+ * This can be used for both named instructions and inlined ones
+ * NOTE: Call, Ret, Invoke are NEVER inlined
+ */
 CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstruction(const Instruction& I)
 {
 	switch(I.getOpcode())
@@ -1716,12 +2235,13 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 				llvm::Type* pointedType = (isArray)?elementType->getSequentialElementType():elementType;
 				if(TypeSupport::isTypedArrayType(pointedType))
 				{
-					stream << "{d:";
+					compileRegularBegin();
 					stream << "new ";
 					compileTypedArrayType(pointedType);
 					stream << '(';
 					compileCompleteObject(bi.getOperand(0));
-					stream << ".buffer), o:0}";
+					stream << ".buffer)";
+					compileRegularZeroOffsetEnd();
 					return COMPILE_OK;
 				}
 			}
@@ -1753,18 +2273,22 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 		case Instruction::SIToFP:
 		{
 			const CastInst& ci = cast<CastInst>(I);
+			compileFloatCoercionBegin(ci.getType());
 			stream << "(+";
 			compileSignedInteger(ci.getOperand(0));
 			stream << ')';
+			compileFloatCoercionEnd(ci.getType());
 			return COMPILE_OK;
 		}
 		case Instruction::UIToFP:
 		{
 			const CastInst& ci = cast<CastInst>(I);
 			//We need to cast to unsigned before
+			compileFloatCoercionBegin(ci.getType());
 			stream << "(+";
 			compileUnsignedInteger(ci.getOperand(0));
 			stream << ')';
+			compileFloatCoercionEnd(ci.getType());
 			return COMPILE_OK;
 		}
 		case Instruction::GetElementPtr:
@@ -1803,11 +2327,13 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 		case Instruction::FAdd:
 		{
 			//Double addition
+			compileFloatCoercionBegin(I.getType());
 			stream << '(';
 			compileOperand(I.getOperand(0));
 			stream << '+';
 			compileOperand(I.getOperand(1));
 			stream << ')';
+			compileFloatCoercionEnd(I.getType());
 			return COMPILE_OK;
 		}
 		case Instruction::Sub:
@@ -1819,11 +2345,13 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 		{
 			//Double subtraction
 			//TODO: optimize negation
+			compileFloatCoercionBegin(I.getType());
 			stream << '(';
 			compileOperand(I.getOperand(0));
 			stream << '-';
 			compileOperand(I.getOperand(1));
 			stream << ')';
+			compileFloatCoercionEnd(I.getType());
 			return COMPILE_OK;
 		}
 		case Instruction::ZExt:
@@ -1850,78 +2378,52 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 			return COMPILE_OK;
 		}
 		case Instruction::SDiv:
-		{
-			//Integer signed division
-			stream << "((";
-			compileSignedInteger(I.getOperand(0));
-			stream << '/';
-			compileSignedInteger(I.getOperand(1));
-			stream << ")>>0)";
-			return COMPILE_OK;
-		}
 		case Instruction::UDiv:
-		{
-			//Integer unsigned division
-			stream << "((";
-			compileUnsignedInteger(I.getOperand(0));
-			stream << '/';
-			compileUnsignedInteger(I.getOperand(1));
-			stream << ")>>>0)";
-			return COMPILE_OK;
-		}
 		case Instruction::SRem:
-		{
-			//Integer signed remainder
-			stream << "((";
-			compileSignedInteger(I.getOperand(0));
-			stream << '%';
-			compileSignedInteger(I.getOperand(1));
-			stream << ")>>0)";
-			return COMPILE_OK;
-		}
 		case Instruction::URem:
 		{
-			//Integer unsigned remainder
-			stream << "((";
-			compileUnsignedInteger(I.getOperand(0));
-			stream << '%';
-			compileUnsignedInteger(I.getOperand(1));
-			stream << ")>>>0)";
+			compileDivRem(I.getOperand(0), I.getOperand(1), I.getOpcode());
 			return COMPILE_OK;
 		}
 		case Instruction::FDiv:
 		{
 			//Double division
+			compileFloatCoercionBegin(I.getType());
 			stream << '(';
 			compileOperand(I.getOperand(0));
 			stream << '/';
 			compileOperand(I.getOperand(1));
 			stream << ')';
+			compileFloatCoercionEnd(I.getType());
 			return COMPILE_OK;
 		}
-		case Instruction::Mul:
+		case Instruction::FRem:
 		{
-			//Integer signed multiplication
-			stream << "((";
+			//Floating point remainder, JS % has the same semantics of fmod
+			compileFloatCoercionBegin(I.getType());
+			stream << '(';
 			compileOperand(I.getOperand(0));
-			stream << '*';
+			stream << '%';
 			compileOperand(I.getOperand(1));
 			stream << ')';
-			if(types.isI32Type(I.getType()))
-				stream << ">>0";
-			else
-				stream << '&' << getMaskForBitWidth(I.getType()->getIntegerBitWidth());
-			stream << ')';
+			compileFloatCoercionEnd(I.getType());
+			return COMPILE_OK;
+		}
+		case Instruction::Mul:
+		{
+			compileMultiplication(I.getOperand(0), I.getOperand(1));
 			return COMPILE_OK;
 		}
 		case Instruction::FMul:
 		{
 			//Double multiplication
+			compileFloatCoercionBegin(I.getType());
 			stream << '(';
 			compileOperand(I.getOperand(0));
 			stream << '*';
 			compileOperand(I.getOperand(1));
 			stream << ')';
+			compileFloatCoercionEnd(I.getType());
 			return COMPILE_OK;
 		}
 		case Instruction::ICmp:
@@ -1978,13 +2480,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 		}
 		case Instruction::LShr:
 		{
-			//Integer logical shift right
-			//No need to apply the >> operator. The result is an integer by spec
-			stream << '(';
-			compileOperand(I.getOperand(0));
-			stream << ">>>";
-			compileOperand(I.getOperand(1));
-			stream << ')';
+			compileLogicalShiftRight(I.getOperand(0), I.getOperand(1));
 			return COMPILE_OK;
 		}
 		case Instruction::AShr:
@@ -2066,6 +2562,12 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 				stream << ':';
 				compilePointerAs(si.getFalseValue(), k);
 			}
+			else if(typedLocals && si.getType()->isIntegerTy(1))
+			{
+				compileBooleanOperand(si.getTrueValue());
+				stream << ':';
+				compileBooleanOperand(si.getFalseValue());
+			}
 			else
 			{
 				compileOperand(si.getTrueValue());
@@ -2104,7 +2606,9 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 		case Instruction::FPTrunc:
 		{
 			const Value* src=I.getOperand(0);
+			compileFloatCoercionBegin(I.getType());
 			compileOperand(src);
+			compileFloatCoercionEnd(I.getType());
 			return COMPILE_OK;
 		}
 		case Instruction::PtrToInt:
@@ -2133,6 +2637,15 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 				COMPILE_INSTRUCTION_FEEDBACK cf=handleBuiltinCall(&ci, calledFunc);
 				if(cf!=COMPILE_UNSUPPORTED)
 					return cf;
+				if(isAsmJSFunction(currentFun))
+				{
+					//asm.js style code needs to coerce the result of every call
+					compileCoercionBegin(ci.getType());
+					stream << namegen.getName(calledFunc);
+					compileMethodArgs(ci.op_begin(),ci.op_begin()+ci.getNumArgOperands(), &ci);
+					compileCoercionEnd(ci.getType());
+					return COMPILE_OK;
+				}
 				stream << namegen.getName(calledFunc);
 			}
 			else
@@ -2212,6 +2725,9 @@ void CheerpWriter::compileBB(const BasicBlock& BB, const std::map<const BasicBlo
 			continue;
 		if(const IntrinsicInst* II=dyn_cast<IntrinsicInst>(&(*I)))
 		{
+			// The buffer of a stack slot holds the data of the allocas which used it before
+			if(II->getIntrinsicID()==Intrinsic::lifetime_start)
+				compileStackSlotReset(II->getArgOperand(1)->stripPointerCasts(true));
 			//Skip some kind of intrinsics
 			if(II->getIntrinsicID()==Intrinsic::lifetime_start ||
 				II->getIntrinsicID()==Intrinsic::lifetime_end ||
@@ -2224,9 +2740,16 @@ void CheerpWriter::compileBB(const BasicBlock& BB, const std::map<const BasicBlo
 		const DebugLoc& debugLoc = I->getDebugLoc();
 		if(sourceMapGenerator && !debugLoc.isUnknown())
 			sourceMapGenerator->setDebugLoc(I->getDebugLoc());
+		else if(sourceMapRecorder && !debugLoc.isUnknown())
+			sourceMapRecorder->setDebugLoc(I->getDebugLoc());
+		//Only the invoke is inside the try, the catch is rendered with the unwind branch
+		if(isa<InvokeInst>(I))
+			stream << "try{";
 		if(I->getType()->getTypeID()!=Type::VoidTyID)
 		{
-			stream << "var " << namegen.getName(I) << '=';
+			if(!typedLocals)
+				stream << "var ";
+			stream << namegen.getName(I) << '=';
 		}
 		if(I->isTerminator())
 		{
@@ -2236,10 +2759,17 @@ void CheerpWriter::compileBB(const BasicBlock& BB, const std::map<const BasicBlo
 		}
 		else
 		{
+			// The i1 values returned by calls or loaded from memory may be numbers
+			bool coerceToBoolean = typedLocals && I->getType()->isIntegerTy(1) && !isa<CmpInst>(I) &&
+						!isa<SelectInst>(I) && Registerize::getRegisterKind(I) == Registerize::BOOLEAN;
+			if(coerceToBoolean)
+				stream << "!!(";
 			COMPILE_INSTRUCTION_FEEDBACK ret=compileNotInlineableInstruction(*I);
 
 			if(ret==COMPILE_OK)
 			{
+				if(coerceToBoolean)
+					stream << ')';
 				stream << ';' << NewLine;
 			}
 			else if(ret==COMPILE_UNSUPPORTED)
@@ -2411,6 +2941,85 @@ void CheerpRenderInterface::renderIfOnLabel(int labelId, bool first)
 	writer->stream << "if(label===" << labelId << "){" << NewLine;
 }
 
+void CheerpRenderInterface::renderSwitchOnLabel()
+{
+	writer->stream << "switch(label){" << NewLine;
+}
+
+void CheerpRenderInterface::renderSwitchOnLabel(int labelId)
+{
+	writer->stream << 'L' << labelId << ':';
+	renderSwitchOnLabel();
+}
+
+void CheerpRenderInterface::renderCaseOnLabel(int labelId)
+{
+	writer->stream << "case " << labelId << ":{" << NewLine;
+}
+
+void CheerpRenderInterface::renderSwitchBlockBegin(const void* privateBlock)
+{
+	const BasicBlock* bb=(const BasicBlock*)privateBlock;
+	const SwitchInst* si=cast<SwitchInst>(bb->getTerminator());
+	writer->stream << "switch(";
+	writer->compileOperand(si->getCondition());
+	writer->stream << "){" << NewLine;
+}
+
+void CheerpRenderInterface::renderSwitchBlockBegin(const void* privateBlock, int labelId)
+{
+	writer->stream << 'L' << labelId << ':';
+	renderSwitchBlockBegin(privateBlock);
+}
+
+void CheerpRenderInterface::renderCaseBlockBegin(const void* privateBlock, int branchId)
+{
+	const BasicBlock* bb=(const BasicBlock*)privateBlock;
+	const SwitchInst* si=cast<SwitchInst>(bb->getTerminator());
+	assert(branchId > 0);
+	SwitchInst::ConstCaseIt it=si->case_begin();
+	for(int i=1;i<branchId;i++)
+		++it;
+	const BasicBlock* dest=it.getCaseSuccessor();
+	//There may be more cases for the same destination
+	for(;it!=si->case_end();++it)
+	{
+		if(it.getCaseSuccessor()!=dest)
+			continue;
+		writer->stream << "case ";
+		writer->compileConstant(it.getCaseValue());
+		writer->stream << ':';
+	}
+	writer->stream << '{' << NewLine;
+}
+
+void CheerpRenderInterface::renderDefaultBlockBegin()
+{
+	writer->stream << "default:{" << NewLine;
+}
+
+void CheerpRenderInterface::renderCaseBlockEnd()
+{
+	writer->stream << "break;" << NewLine << '}' << NewLine;
+}
+
+void CheerpRenderInterface::renderTryBlockBegin(int labelId)
+{
+	writer->stream << 'E' << labelId << ":{" << NewLine;
+}
+
+void CheerpRenderInterface::renderCatchBlockBegin(const void* privateBlock)
+{
+	//The try has been opened by the block code, right before the invoke
+	//The caught value is kept in a function variable, so that it is available to the landing pad
+	writer->stream << "}catch(e$){exception=e$;" << NewLine;
+}
+
+void CheerpRenderInterface::renderCatchBlockEnd(int labelId)
+{
+	writer->stream << "break E" << labelId << ';' << NewLine << '}' << NewLine;
+}
+
 void CheerpWriter::compileMethod(const Function& F)
 {
 	currentFun = &F;
@@ -2424,27 +3033,43 @@ void CheerpWriter::compileMethod(const Function& F)
 		stream << namegen.getName(curArg);
 	}
 	stream << "){" << NewLine;
+	if(isAsmJSFunction(&F))
+	{
+		//Declare the type of the arguments, the function may be called from regular code
+		for(Function::const_arg_iterator curArg=A;curArg!=AE;++curArg)
+		{
+			stream << namegen.getName(curArg) << '=';
+			compileCoercionBegin(curArg->getType());
+			stream << namegen.getName(curArg);
+			compileCoercionEnd(curArg->getType());
+			stream << ';' << NewLine;
+		}
+	}
+	if(typedLocals)
+		compileTypedLocals(F);
+	compileStackSlots(F);
 	std::map<const BasicBlock*, uint32_t> blocksMap;
 	if(F.size()==1)
 		compileBB(*F.begin(), blocksMap);
 	else
 	{
-		//TODO: Support exceptions
 		Function::const_iterator B=F.begin();
 		Function::const_iterator BE=F.end();
-		//First run, create the corresponding relooper blocks
+		//First run, create the corresponding relooper blocks and add them to the relooper
+		Relooper* rl=new Relooper();
 		std::map<const BasicBlock*, /*relooper::*/Block*> relooperMap;
+		bool hasLandingPads=false;
 		for(;B!=BE;++B)
 		{
-			if(B->isLandingPad())
-				continue;
+			hasLandingPads|=B->isLandingPad();
 			//Decide if this block should be duplicated instead
 			//of actually directing the control flow to reach it
 			//Currently we just check if the block ends with a return
 			//and its small enough. This should simplify some control flows.
 			bool isSplittable = B->size()<3 && isa<ReturnInst>(B->getTerminator());
-			Block* rlBlock = new Block(&(*B), isSplittable);
+			Block* rlBlock = new Block(&(*B), isSplittable, isa<SwitchInst>(B->getTerminator()), isa<InvokeInst>(B->getTerminator()));
 			relooperMap.insert(make_pair(&(*B),rlBlock));
+			rl->AddBlock(rlBlock);
 		}
 
 		B=F.begin();
@@ -2452,8 +3077,6 @@ void CheerpWriter::compileMethod(const Function& F)
 		//Second run, add the branches
 		for(;B!=BE;++B)
 		{
-			if(B->isLandingPad())
-				continue;
 			const TerminatorInst* term=B->getTerminator();
 			uint32_t defaultBranchId=-1;
 			//Find out which branch id is the default
@@ -2490,8 +3113,7 @@ void CheerpWriter::compileMethod(const Function& F)
 
 			for(uint32_t i=0;i<term->getNumSuccessors();i++)
 			{
-				if(term->getSuccessor(i)->isLandingPad())
-					continue;
+				//The unwind destination of an invoke is taken when the call throws
 				Block* target=relooperMap[term->getSuccessor(i)];
 				//Use -1 for the default target
 				bool ret=relooperMap[&(*B)]->AddBranchTo(target, (i==defaultBranchId)?-1:i);
@@ -2503,19 +3125,12 @@ void CheerpWriter::compileMethod(const Function& F)
 			}
 		}
 
-		B=F.begin();
-		BE=F.end();
-		//Third run, add the block to the relooper and run it
-		Relooper* rl=new Relooper();
-		for(;B!=BE;++B)
-		{
-			if(B->isLandingPad())
-				continue;
-			rl->AddBlock(relooperMap[&(*B)]);
-		}
+		//Run the relooper
 		rl->Calculate(relooperMap[&F.getEntryBlock()]);
 		if(rl->needsLabel())
 			stream << "var label=0;" << NewLine;
+		if(hasLandingPads)
+			stream << "var exception=null;" << NewLine;
 		
 		CheerpRenderInterface ri(this, NewLine);
 		rl->Render(&ri);
@@ -2525,6 +3140,428 @@ void CheerpWriter::compileMethod(const Function& F)
 	currentFun = NULL;
 }
 
+void CheerpWriter::compileStackSlots(const Function& F)
+{
+	// The allocas sharing a slot are all in the entry block, the buffer of each slot is created once per call
+	std::map<uint32_t, uint32_t> slotSizes;
+	for(const Instruction& I: F.getEntryBlock())
+	{
+		const AllocaInst* ai = dyn_cast<AllocaInst>(&I);
+		const MDNode* slot = ai ? ai->getMetadata("cheerp.stackslot") : nullptr;
+		if(slot)
+		{
+			uint32_t slotIndex = cast<ConstantInt>(slot->getOperand(0))->getZExtValue();
+			slotSizes[slotIndex] = cast<ConstantInt>(slot->getOperand(1))->getZExtValue();
+		}
+	}
+	for(auto& it: slotSizes)
+	{
+		stream << "var ";
+		compileStackSlotName(it.first);
+		stream << "=new Uint8Array(" << it.second << ");" << NewLine;
+	}
+}
+
+void CheerpWriter::compileStackSlotReset(const Value* ptr)
+{
+	const AllocaInst* ai = dyn_cast<AllocaInst>(ptr);
+	const MDNode* slot = ai ? ai->getMetadata("cheerp.stackslot") : nullptr;
+	if(!slot)
+		return;
+	// Zero the part of the slot used by the alloca, like a new typed array
+	compileStackSlotName(cast<ConstantInt>(slot->getOperand(0))->getZExtValue());
+	stream << ".fill(0,0," << targetData.getTypeAllocSize(ai->getAllocatedType()) << ");" << NewLine;
+}
+
+void CheerpWriter::compileStackSlotName(uint32_t slot)
+{
+	// Generated names never contain '$' and readable names start with 'L' or '_', so the slots do not clash with other locals
+	stream << (readableOutput ? "stackSlot$" : "S$") << slot;
+}
+
+void CheerpWriter::compileTypedLocals(const Function& F)
+{
+	// Declare all the registers at the start of the function, initialized with a value
+	// of the JS type they will hold, so that each local has a single type from the start
+	std::map<uint32_t, const Instruction*> registers;
+	for(const BasicBlock& BB: F)
+	{
+		for(const Instruction& I: BB)
+		{
+			if(isInlineable(I, PA) || I.getType()->isVoidTy())
+				continue;
+			registers.insert(std::make_pair(registerize.getRegisterId(&I), &I));
+		}
+	}
+	if(registers.empty())
+		return;
+	stream << "var ";
+	for(auto it=registers.begin();it!=registers.end();++it)
+	{
+		if(it!=registers.begin())
+			stream << ',';
+		stream << namegen.getName(it->second) << '=';
+		switch(Registerize::getRegisterKind(it->second))
+		{
+			case Registerize::INTEGER:
+				stream << '0';
+				break;
+			case Registerize::FLOAT:
+			case Registerize::DOUBLE:
+				stream << "0.0";
+				break;
+			case Registerize::BOOLEAN:
+				stream << "false";
+				break;
+			case Registerize::OBJECT:
+				stream << "null";
+				break;
+		}
+	}
+	stream << ';' << NewLine;
+}
+
+void CheerpWriter::compileMethodsInParallel(const std::vector<const Function*>& functions)
+{
+	// Every function is compiled in its own buffer, the buffers and the source map events
+	// are then flushed in module order to get exactly the same output as the serial path.
+	// A buffer is flushed as soon as all the previous ones are, and the workers never get more
+	// than a fixed window of functions ahead, so memory usage does not grow with the module.
+	// The data of the flushed functions is released in batches, while the workers are stopped
+	struct CompiledFunction
+	{
+		std::string code;
+		SourceMapRecorder sourceMapEvents;
+		bool done;
+		CompiledFunction():done(false)
+		{
+		}
+	};
+
+	// In code size mode functions which compile to the same code, apart from their name, are merged.
+	// Only functions with unnamed_addr can be merged, since their address is not significant
+	StringMap<const Function*> compiledBodies;
+	auto flushFunction = [&](const Function* F, const CompiledFunction& cf)
+	{
+		if(codeSize && F->hasUnnamedAddr())
+		{
+			std::string header = "function " + namegen.getName(F).str() + '(';
+			StringRef code(cf.code);
+			if(code.startswith(header))
+			{
+				StringRef body = code.substr(header.size());
+				const Function* mergedWith = compiledBodies.GetOrCreateValue(body, F).getValue();
+				// The duplicate forwards to the first function, as a declaration it is hoisted like the original one
+				StringRef args = body.substr(0, body.find(')'));
+				std::string forward = header + args.str() + "){return " + namegen.getName(mergedWith).str() + '(' + args.str() + ");}";
+				if(mergedWith != F && forward.size() < code.size())
+				{
+					uint64_t before = stream.tell();
+					stream << forward << NewLine;
+					mergedFunctions++;
+					mergedFunctionsBytes += cf.code.size() - (stream.tell() - before);
+					if(sizeReport)
+						functionSizes.push_back(std::make_pair(stream.tell() - before, F));
+					return;
+				}
+			}
+		}
+		stream.writeFormatted(cf.code);
+		if(sourceMapGenerator)
+			cf.sourceMapEvents.replay(*sourceMapGenerator);
+		if(sizeReport)
+			functionSizes.push_back(std::make_pair(uint64_t(cf.code.size()), F));
+	};
+
+#if LLVM_ENABLE_THREADS
+	if(numThreads > 1)
+	{
+		const uint32_t window = 4 * numThreads;
+		std::vector<CompiledFunction> compiledFunctions(functions.size());
+		std::mutex compiledMutex;
+		std::condition_variable compiledCondition;
+		uint32_t nextFunction = 0;
+		uint32_t flushedFunctions = 0;
+		// While releasing is set the workers do not start new functions
+		bool releasing = false;
+		std::vector<const Function*> flushedToRelease;
+
+		auto worker = [&]()
+		{
+			std::string buffer;
+			raw_string_ostream bufferStream(buffer);
+			SourceMapRecorder recorder;
+			CheerpWriter workerWriter(*this, bufferStream, sourceMapGenerator ? &recorder : NULL);
+			while(true)
+			{
+				uint32_t i;
+				{
+					std::unique_lock<std::mutex> lock(compiledMutex);
+					compiledCondition.wait(lock, [&]() { return nextFunction >= functions.size() || (!releasing && nextFunction < flushedFunctions + window); });
+					if(nextFunction >= functions.size())
+					{
+						constructedTypes.insert(workerWriter.constructedTypes.begin(), workerWriter.constructedTypes.end());
+						return;
+					}
+					i = nextFunction++;
+					compilingWorkers++;
+				}
+				workerWriter.compileMethod(*functions[i]);
+				bufferStream.flush();
+				{
+					std::lock_guard<std::mutex> lock(compiledMutex);
+					compilingWorkers--;
+					compiledFunctions[i].code.swap(buffer);
+					std::swap(compiledFunctions[i].sourceMapEvents, recorder);
+					compiledFunctions[i].done = true;
+				}
+				compiledCondition.notify_all();
+				buffer.clear();
+				recorder.clear();
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for(unsigned i = 0; i < numThreads; i++)
+			threads.emplace_back(worker);
+		// The current thread writes the functions in order
+		for(uint32_t i = 0; i < functions.size(); i++)
+		{
+			CompiledFunction cf;
+			{
+				std::unique_lock<std::mutex> lock(compiledMutex);
+				compiledCondition.wait(lock, [&]() { return compiledFunctions[i].done; });
+				std::swap(cf, compiledFunctions[i]);
+				flushedFunctions = i + 1;
+			}
+			compiledCondition.notify_all();
+			flushFunction(functions[i], cf);
+			flushedToRelease.push_back(functions[i]);
+			if(flushedToRelease.size() < window)
+				continue;
+			{
+				std::unique_lock<std::mutex> lock(compiledMutex);
+				releasing = true;
+				compiledCondition.wait(lock, [&]() { return compilingWorkers == 0; });
+				for(const Function* F: flushedToRelease)
+					releaseFunction(*F);
+				releasing = false;
+			}
+			compiledCondition.notify_all();
+			flushedToRelease.clear();
+		}
+		for(std::thread& t: threads)
+			t.join();
+		for(const Function* F: flushedToRelease)
+			releaseFunction(*F);
+		return;
+	}
+#endif
+
+	// Without threads every function is flushed right after being compiled, so its local data can be released
+	CompiledFunction cf;
+	raw_string_ostream bufferStream(cf.code);
+	CheerpWriter workerWriter(*this, bufferStream, sourceMapGenerator ? &cf.sourceMapEvents : NULL);
+	for(const Function* F: functions)
+	{
+		workerWriter.compileMethod(*F);
+		bufferStream.flush();
+		flushFunction(F, cf);
+		cf.code.clear();
+		cf.sourceMapEvents.clear();
+		releaseFunction(*F);
+	}
+	constructedTypes.insert(workerWriter.constructedTypes.begin(), workerWriter.constructedTypes.end());
+}
+
+void CheerpWriter::releaseFunction(const Function& F)
+{
+	assert(compilingWorkers == 0 && "The data of a function cannot be released while workers are compiling");
+	namegen.releaseFunction(F);
+	registerize.invalidateFunction(F);
+}
+
+void CheerpWriter::compileLazyChunks(std::vector<const Function*>& functions)
+{
+	// The core chunk contains the entry points, the constructors and everything they call directly
+	std::unordered_set<const Function*> coreFunctions;
+	std::vector<const Function*> worklist(globalDeps.entryPoints());
+	worklist.insert(worklist.end(), globalDeps.constructors().begin(), globalDeps.constructors().end());
+	while(!worklist.empty())
+	{
+		const Function* F = worklist.back();
+		worklist.pop_back();
+		if(!coreFunctions.insert(F).second)
+			continue;
+		worklist.insert(worklist.end(), globalDeps.directCallees(F).begin(), globalDeps.directCallees(F).end());
+	}
+
+	// Any other function starts a new chunk, which also contains all the functions it calls directly
+	// that are not assigned yet. Calls across chunks go through the stubs, so they work in any order
+	std::vector<const Function*> core;
+	std::vector<std::vector<const Function*>> chunks;
+	std::unordered_map<const Function*, uint32_t> chunkOf;
+	for(const Function* F: functions)
+	{
+		if(coreFunctions.count(F))
+		{
+			core.push_back(F);
+			continue;
+		}
+		if(chunkOf.count(F))
+			continue;
+		chunks.emplace_back();
+		worklist.push_back(F);
+		while(!worklist.empty())
+		{
+			const Function* C = worklist.back();
+			worklist.pop_back();
+			if(coreFunctions.count(C) || !chunkOf.insert(std::make_pair(C, chunks.size() - 1)).second)
+				continue;
+			chunks.back().push_back(C);
+			worklist.insert(worklist.end(), globalDeps.directCallees(C).begin(), globalDeps.directCallees(C).end());
+		}
+	}
+	functions.swap(core);
+
+	if(chunks.empty())
+		return;
+
+	std::string manifest = "{\"chunks\":[";
+	StringRef chunksBaseName = sys::path::filename(lazyChunksPrefix);
+	for(uint32_t i = 0; i < chunks.size(); i++)
+	{
+		std::string fileName = (Twine(lazyChunksPrefix) + "." + Twine(i) + ".js").str();
+		std::string ErrorString;
+		raw_fd_ostream chunkFile(fileName.c_str(), ErrorString, sys::fs::F_None);
+		if(!ErrorString.empty())
+			llvm::report_fatal_error(ErrorString.c_str(), false);
+
+		// Chunks are evaluated in the scope of the main file and return their functions, which become the targets of the stubs.
+		// The stubs are the only pointers to the functions: a chunk replaces its own functions whose address is taken with their
+		// stubs, which it receives as argument, once they are returned
+		SourceMapRecorder chunkEvents;
+		CheerpWriter chunkWriter(*this, chunkFile, sourceMapGenerator ? &chunkEvents : NULL);
+		chunkWriter.stream << "(function(cheerpStubs){\"use strict\";" << chunkWriter.NewLine;
+		for(const Function* F: chunks[i])
+		{
+			chunkWriter.compileMethod(*F);
+			releaseFunction(*F);
+		}
+		chunkWriter.stream << "var cheerpTargets={";
+		std::set<uint32_t> deps;
+		for(const Function* F: chunks[i])
+		{
+			if(F != chunks[i].front())
+				chunkWriter.stream << ',';
+			chunkWriter.stream << namegen.getName(F) << ':' << namegen.getName(F);
+			for(const Function* callee: globalDeps.directCallees(F))
+			{
+				auto it = chunkOf.find(callee);
+				if(it != chunkOf.end() && it->second != i)
+					deps.insert(it->second);
+			}
+		}
+		chunkWriter.stream << "};";
+		for(const Function* F: chunks[i])
+		{
+			if(F->hasAddressTaken())
+				chunkWriter.stream << namegen.getName(F) << "=cheerpStubs." << namegen.getName(F) << ';';
+		}
+		chunkWriter.stream << "return cheerpTargets;})" << chunkWriter.NewLine;
+		// The constructors are compiled in the main file
+		constructedTypes.insert(chunkWriter.constructedTypes.begin(), chunkWriter.constructedTypes.end());
+
+		// Every chunk is a separate script, so it has its own source map
+		if(sourceMapGenerator)
+		{
+			SourceMapGenerator chunkMap(*sourceMapGenerator, fileName + ".map", ErrorString);
+			if(!ErrorString.empty())
+				llvm::report_fatal_error(ErrorString.c_str(), false);
+			chunkMap.beginFile();
+			chunkEvents.replay(chunkMap);
+			chunkMap.endFile();
+			// Chunks are loaded with eval, the source URL is needed to resolve the map
+			StringRef chunkName = sys::path::filename(fileName);
+			chunkFile << "//# sourceURL=" << chunkName << "\n//# sourceMappingURL=" << chunkMap.getSourceMapName();
+		}
+
+		if(i)
+			manifest += ',';
+		manifest += "{\"file\":\"" + (chunksBaseName + "." + Twine(i) + ".js").str() + "\",\"functions\":[";
+		for(const Function* F: chunks[i])
+		{
+			if(F != chunks[i].front())
+				manifest += ',';
+			manifest += '"';
+			for(char c: F->getName())
+			{
+				if(c == '"' || c == '\\')
+					manifest += '\\';
+				manifest += c;
+			}
+			manifest += '"';
+		}
+		manifest += "],\"deps\":[";
+		for(uint32_t d: deps)
+		{
+			if(d != *deps.begin())
+				manifest += ',';
+			manifest += utostr(d);
+		}
+		manifest += "]}";
+	}
+	manifest += "]}\n";
+
+	std::string ErrorString;
+	raw_fd_ostream manifestFile((lazyChunksPrefix + ".manifest.json").c_str(), ErrorString, sys::fs::F_None);
+	if(!ErrorString.empty())
+		llvm::report_fatal_error(ErrorString.c_str(), false);
+	manifestFile << manifest;
+
+	// The loader reads a chunk synchronously, since it is needed to complete the current call. A global cheerpReadChunk
+	// function can be defined to read the chunks in a custom way, otherwise they are read from the directory of the main
+	// file in node and with a synchronous XMLHttpRequest in the browser. Chunks are evaluated with a direct eval, so
+	// that they see the functions and the globals of the main file wherever it runs
+	stream << "var cheerpChunks=[];var cheerpChunkFiles=[";
+	for(uint32_t i = 0; i < chunks.size(); i++)
+	{
+		if(i)
+			stream << ',';
+		stream << '"' << chunksBaseName << '.' << i << ".js\"";
+	}
+	stream << "];" << NewLine;
+	stream << "function cheerpReadChunkSource(f){if(typeof cheerpReadChunk===\"function\")return cheerpReadChunk(f);";
+	stream << "if(typeof require===\"function\"&&typeof __dirname===\"string\")return require(\"fs\").readFileSync(require(\"path\").join(__dirname,f),\"utf8\");";
+	stream << "var x=new XMLHttpRequest();x.open(\"GET\",f,false);x.send();if(x.status!==200&&x.status!==0)throw new Error(\"Cannot load \"+f);return x.responseText;}" << NewLine;
+	stream << "function cheerpLoadChunk(i){var c=cheerpChunks[i];if(c)return c;";
+	stream << "return cheerpChunks[i]=eval(cheerpReadChunkSource(cheerpChunkFiles[i]))(cheerpStubs);}" << NewLine;
+	// The stubs keep their identity, once a chunk is loaded they forward the calls to its functions
+	for(uint32_t i = 0; i < chunks.size(); i++)
+	{
+		for(const Function* F: chunks[i])
+		{
+			stream << "function " << namegen.getName(F) << "(){return cheerpLoadChunk(" << i << ")." << namegen.getName(F);
+			stream << ".apply(null,arguments);}" << NewLine;
+		}
+	}
+	stream << "var cheerpStubs={";
+	bool firstStub = true;
+	for(uint32_t i = 0; i < chunks.size(); i++)
+	{
+		for(const Function* F: chunks[i])
+		{
+			if(!F->hasAddressTaken())
+				continue;
+			if(!firstStub)
+				stream << ',';
+			firstStub = false;
+			stream << namegen.getName(F) << ':' << namegen.getName(F);
+		}
+	}
+	stream << "};" << NewLine;
+}
+
 void CheerpWriter::compileGlobal(const GlobalVariable& G)
 {
 	assert(G.hasName());
@@ -2543,12 +3580,14 @@ void CheerpWriter::compileGlobal(const GlobalVariable& G)
 
 		if(PA.getPointerKind(&G) == REGULAR)
 		{
-			stream << "{d:[";
+			compileRegularBegin();
+			stream << '[';
 			if(C->getType()->isPointerTy())
 				compilePointerAs(C, PA.getPointerKindForStoredType(C->getType()));
 			else
 				compileOperand(C);
-			stream << "],o:0}";
+			stream << ']';
+			compileRegularZeroOffsetEnd();
 		}
 		else
 		{
@@ -2565,11 +3604,10 @@ void CheerpWriter::compileGlobal(const GlobalVariable& G)
 	{
 		if(StructType* st=dyn_cast<StructType>(G.getType()->getPointerElementType()))
 		{
-			//TODO: Verify that it makes sense to assume struct with no name has no bases
-			if(st->hasName() && module.getNamedMetadata(Twine(st->getName(),"_bases")) &&
-				globalDeps.classesWithBaseInfo().count(st))
+			const StructInfo* info = types.getStructInfo(st);
+			if(info && info->needsDowncastArray)
 			{
-				stream << "create" << namegen.filterLLVMName(st->getName(), true) << '(';
+				stream << "create" << info->jsName << '(';
 				compilePointerAs(&G, COMPLETE_OBJECT);
 				stream << ");" << NewLine;
 			}
@@ -2608,7 +3646,10 @@ void CheerpWriter::compileGlobal(const GlobalVariable& G)
 
 		stream << '=';
 		Value* valOp = subExpr.back()->get();
-		if (valOp->getType()->isPointerTy())
+		const User* container = subExpr.back()->getUser();
+		if (valOp->getType()->isPointerTy() && isa<ConstantStruct>(container))
+			compilePointerAs(valOp, PA.getPointerKindForStoredField(cast<ConstantStruct>(container)->getType(), subExpr.back()->getOperandNo()));
+		else if (valOp->getType()->isPointerTy())
 			compilePointerAs(valOp, PA.getPointerKindForStoredType(valOp->getType()));
 		else
 			compileOperand(valOp);
@@ -2626,6 +3667,88 @@ void CheerpWriter::compileCreateClosure()
 	stream << "function cheerpCreateClosure(func, obj){return function(e){func(obj,e);};}" << NewLine;
 }
 
+void CheerpWriter::compileMemMove()
+{
+	stream << "function cheerpMemMove(dst,dstOff,src,srcOff,n){if(dst===src)dst.copyWithin(dstOff,srcOff,srcOff+n);else dst.set(src.subarray(srcOff,srcOff+n),dstOff);}" << NewLine;
+}
+
+void CheerpWriter::compileTypedArrayPool()
+{
+	// Typed arrays are allocated from ArrayBuffers rounded up to a power of two and the released ones are kept
+	// in a list for each size class. With the size report cheerpPoolStats counts the hits at runtime.
+	auto count = [this](const char* stat) -> ostream_proxy&
+	{
+		if ( sizeReport )
+			stream << "cheerpPoolStats." << stat << "++;";
+		return stream;
+	};
+	stream << "var cheerpPool=[];";
+	if ( sizeReport )
+		stream << "var cheerpPoolStats={hits:0,misses:0,inPlace:0,frees:0};";
+	stream << NewLine;
+	stream << "function cheerpPoolClass(bytes){return bytes<=8?3:32-Math.clz32(bytes-1);}" << NewLine;
+	stream << "function cheerpPoolAlloc(T,n,zero){var c=cheerpPoolClass(n*T.BYTES_PER_ELEMENT);";
+	stream << "if(c>30){";
+	count("misses") << "return new T(n);}";
+	stream << "var l=cheerpPool[c];";
+	stream << "if(l&&l.length){";
+	count("hits") << "var r=new T(l.pop(),0,n);if(zero)r.fill(0);return r;}";
+	count("misses") << "return new T(new ArrayBuffer(1<<c),0,n);}" << NewLine;
+	stream << "function cheerpPoolFree(a){if(!ArrayBuffer.isView(a)||a.byteOffset!==0)return;";
+	stream << "var b=a.buffer,c=cheerpPoolClass(b.byteLength);if(c>30||b.byteLength!==(1<<c))return;";
+	stream << "var l=cheerpPool[c]||(cheerpPool[c]=[]);if(l.length<64){l.push(b);";
+	count("frees") << "}}" << NewLine;
+	stream << "function cheerpPoolRealloc(T,a,n){if(!ArrayBuffer.isView(a))return cheerpPoolAlloc(T,n);";
+	stream << "if(a.byteOffset===0&&a.buffer.byteLength>=n*T.BYTES_PER_ELEMENT){";
+	count("inPlace") << "return new T(a.buffer,0,n);}";
+	stream << "var r=cheerpPoolAlloc(T,n);r.set(a.subarray(0,Math.min(n,a.length)));cheerpPoolFree(a);return r;}" << NewLine;
+}
+
+void CheerpWriter::compileRealloc()
+{
+	// Typed arrays are views limited to the requested length, the spare capacity of their buffer is used to grow in place
+	stream << "function cheerpRealloc(T,a,n){if(!ArrayBuffer.isView(a))return new T(n);";
+	stream << "if(a.byteOffset===0&&a.buffer.byteLength>=n*T.BYTES_PER_ELEMENT)return new T(a.buffer,0,n);";
+	stream << "var r=new T(Math.max(n,a.length*2)).subarray(0,n);r.set(a.subarray(0,Math.min(n,a.length)));return r;}" << NewLine;
+	stream << "function cheerpResizeArray(a,n){var l=a.length;a.length=n;return l;}" << NewLine;
+}
+
+void CheerpWriter::compileCodeSizeHelpers()
+{
+	stream << "function $P(d,o){return{d:d,o:o};}" << NewLine;
+	if ( globalDeps.needByteLayoutCopy() )
+		stream << "function $C(d,s){new Int8Array(d.buffer).set(new Int8Array(s.buffer));}" << NewLine;
+}
+
+void CheerpWriter::compileExceptionHelpers()
+{
+	// Thrown C++ exceptions are regular pointers to the exception object, tagged with the ids of the types which catch it.
+	// The landing pads match the ids of their clauses in order, only catch-all clauses match foreign JS exceptions.
+	// When a base catches the exception the caught pointer is moved to the subobject of that base.
+	// The caught exceptions are kept on a stack so that they can be rethrown, the destructor is called
+	// by the last handler, unless the exception has been rethrown
+	stream << "function CheerpException(d,o,t,f){this.d=d;this.o=o;this.t=t;this.f=f;this.a=this;this.c=0;}" << NewLine;
+	stream << "function cheerpThrow(p,t,f){throw new CheerpException(p.d,p.o,t,f);}" << NewLine;
+	stream << "function cheerpCatchable(e,k){if(!(e instanceof CheerpException))return false;var t=e.t;";
+	stream << "for(var i=0;i<t.length;i+=2){if(t[i]!==k)continue;var p=t[i+1];";
+	stream << "if(p===null){e.a=e;return true;}";
+	stream << "var o=e.d[e.o];for(var j=0;j<p.length;j++)o=o[p[j]];e.a={d:[o],o:0};return true;}";
+	stream << "return false;}" << NewLine;
+	stream << "function cheerpLandingPad(e,c,f){";
+	stream << "for(var i=0;i<c.length;i++){var k=c[i];";
+	stream << "if(k===null)return{a00:e,a10:2147483647};";
+	stream << "if(k instanceof Array){var m=false;for(var j=0;j<k.length&&!m;j++)m=cheerpCatchable(e,k[j]);if(!m)return{a00:e,a10:-1-i};}";
+	stream << "else if(cheerpCatchable(e,k))return{a00:e,a10:k};}";
+	stream << "if(f)return{a00:e,a10:0};throw e;}" << NewLine;
+	stream << "var cheerpCaught=[];" << NewLine;
+	stream << "function cheerpGetExceptionPtr(e){return e instanceof CheerpException?e.a:e;}" << NewLine;
+	stream << "function cheerpBeginCatch(e){cheerpCaught.push(e);if(!(e instanceof CheerpException))return e;";
+	stream << "e.c=e.c<0?1-e.c:e.c+1;return e.a;}" << NewLine;
+	stream << "function cheerpEndCatch(){var e=cheerpCaught.pop();if(!(e instanceof CheerpException))return;";
+	stream << "if(e.c<0)e.c++;else if(--e.c==0&&e.f)e.f(e);}" << NewLine;
+	stream << "function cheerpRethrow(){var e=cheerpCaught[cheerpCaught.length-1];if(e instanceof CheerpException)e.c=-e.c;throw e;}" << NewLine;
+}
+
 void CheerpWriter::compileHandleVAArg()
 {
 	stream << "function handleVAArg(ptr){var ret=ptr.d[ptr.o];ptr.o++;return ret;}" << NewLine;
@@ -2644,24 +3767,44 @@ void CheerpWriter::makeJS()
 	PA.prefetch(module);
 	PA.fullResolve();
 
+	computeAsmJSFunctions();
+
+	std::vector<const Function*> functions;
 	for ( const Function & F : module.getFunctionList() )
 		if (!F.empty())
+			functions.push_back(&F);
+
+	uint64_t functionsStart = stream.tell();
+	if ( !lazyChunksPrefix.empty() )
+		compileLazyChunks(functions);
+
+	if ( numThreads > 1 || codeSize || sizeReport )
+		compileMethodsInParallel(functions);
+	else
+	{
+		for ( const Function * F : functions )
 		{
 #ifdef CHEERP_DEBUG_POINTERS
-			dumpAllPointers(F, PA);
+			dumpAllPointers(*F, PA);
 #endif //CHEERP_DEBUG_POINTERS
-			compileMethod(F);
+			compileMethod(*F);
+			releaseFunction(*F);
 		}
+	}
 	
+	uint64_t globalsStart = stream.tell();
 	for ( const GlobalVariable & GV : module.getGlobalList() )
 		compileGlobal(GV);
 
+	uint64_t helpersStart = stream.tell();
 	for ( StructType * st : globalDeps.classesWithBaseInfo() )
 		compileClassType(st);
 
 	for ( StructType * st : globalDeps.dynAllocArrays() )
 		compileArrayClassType(st);
 
+	compileStructConstructors();
+
 	if ( globalDeps.needCreatePointerArray() )
 		compileArrayPointerType();
 	
@@ -2669,10 +3812,32 @@ void CheerpWriter::makeJS()
 	if ( globalDeps.needCreateClosure() )
 		compileCreateClosure();
 	
+	//Compile the typed array copy helper
+	if ( globalDeps.needMemMove() )
+		compileMemMove();
+	
+	//Compile the reallocation helpers if needed
+	if ( globalDeps.needRealloc() )
+		compileRealloc();
+	
+	//Compile the typed array pool if needed
+	if ( typedArrayPool && globalDeps.hasTypedArrayAllocations() )
+		compileTypedArrayPool();
+	
 	//Compile handleVAArg if needed
 	if( globalDeps.needHandleVAArg() )
 		compileHandleVAArg();
+
+	//Compile the exception handling helpers if needed
+	if( globalDeps.needExceptions() )
+		compileExceptionHelpers();
 	
+	//Compile the helpers used by the code size mode
+	if ( codeSize )
+		compileCodeSizeHelpers();
+
+	uint64_t helpersEnd = stream.tell();
+
 	//Call constructors
 	for (const Function * F : globalDeps.constructors() )
 	{
@@ -2689,4 +3854,44 @@ void CheerpWriter::makeJS()
 		sourceMapGenerator->endFile();
 		stream << "//# sourceMappingURL=" << sourceMapGenerator->getSourceMapName();
 	}
+
+	if ( sizeReport )
+	{
+		llvm::errs() << "Cheerp code size report (bytes)\n";
+		llvm::errs() << "  total:     " << stream.tell() << '\n';
+		llvm::errs() << "  functions: " << (globalsStart - functionsStart) << '\n';
+		llvm::errs() << "  globals:   " << (helpersStart - globalsStart) << '\n';
+		llvm::errs() << "  helpers:   " << (helpersEnd - helpersStart) << '\n';
+		llvm::errs() << "  merged functions: " << mergedFunctions << " (" << mergedFunctionsBytes << " bytes saved)\n";
+		if ( !readableOutput )
+			llvm::errs() << "  names:     " << namegen.getNameBytes() << " (" << namegen.getNameBytesSaved() << " bytes saved by ordering them by references)\n";
+		std::sort(functionSizes.begin(), functionSizes.end(),
+			[](const std::pair<uint64_t, const Function*>& lhs, const std::pair<uint64_t, const Function*>& rhs)
+			{
+				return lhs.first > rhs.first;
+			});
+		for ( const auto& fs : functionSizes )
+			llvm::errs() << "  " << fs.first << '\t' << fs.second->getName() << '\n';
+	}
+}
+
+void cheerp::addPreparationPasses(PassManagerBase& PM, bool FieldSensitivePointers, bool NoRegisterize)
+{
+	PM.add(createResolveAliasesPass());
+	PM.add(createTypeInfoLoweringPass());
+	PM.add(createI64LoweringPass());
+	// The allocas are hoisted and scalarized before Registerize, so their live ranges are computed on the final code.
+	// The alloca passes after Registerize compute the ranges again for the functions they change.
+	PM.add(createAllocaArraysHoistingPass());
+	PM.add(createGlobalDepsAnalyzerPass());
+	PM.add(createStructAllocaScalarizationPass());
+	PM.add(createPointerArithmeticToArrayIndexingPass());
+	PM.add(createPointerToImmutablePHIRemovalPass());
+	PM.add(createPointerAnalyzerPass(FieldSensitivePointers));
+	PM.add(createIndirectCallOptimizerPass());
+	PM.add(createRegisterizePass(NoRegisterize));
+	PM.add(createAllocaMergingPass());
+	PM.add(createAllocaArraysPass());
+	PM.add(createAllocaArraysMergingPass());
+	PM.add(createAllocaBuffersMergingPass());
 }
@@ -12,9 +12,12 @@
 #define DEBUG_TYPE "GlobalDepsAnalyzer"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
+#include "llvm/Cheerp/NameGenerator.h"
 #include "llvm/Cheerp/Registerize.h"
 #include "llvm/Cheerp/Utility.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/Support/FormattedStream.h"
 
@@ -34,10 +37,20 @@ const char* GlobalDepsAnalyzer::getPassName() const
 }
 
 GlobalDepsAnalyzer::GlobalDepsAnalyzer() : ModulePass(ID),
-	hasCreateClosureUsers(false), hasVAArgs(false), hasPointerArrays(false)
+	hasCreateClosureUsers(false), hasVAArgs(false), hasPointerArrays(false), hasMemMoveUsers(false),
+	hasByteLayoutCopies(false), hasTypedArrayAllocs(false), hasReallocs(false), hasExceptions(false)
 {
 }
 
+const std::vector<const Function*> & GlobalDepsAnalyzer::directCallees(const Function* F) const
+{
+	static const std::vector<const Function*> noCallees;
+	auto it = callGraph.find(F);
+	if ( it == callGraph.end() )
+		return noCallees;
+	return it->second;
+}
+
 void GlobalDepsAnalyzer::getAnalysisUsage(AnalysisUsage& AU) const
 {
 	AU.addPreserved<cheerp::PointerAnalyzer>();
@@ -46,6 +59,8 @@ void GlobalDepsAnalyzer::getAnalysisUsage(AnalysisUsage& AU) const
 	llvm::ModulePass::getAnalysisUsage(AU);
 }
 
+// The reachable globals are computed from scratch on every run. The walk is linear in the size
+// of the reachable code, and hashing the functions to key a cache of it costs about as much
 bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 {
 	VisitedSet visited;
@@ -65,6 +80,7 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 		{
 			assert( isa<Function>(node->getOperand(0) ) );
 			const Function* f = cast<Function>(node->getOperand(0));
+			entryPointsNeeded.push_back(f);
 			
 			SubExprVec vec;
 			visitGlobal( f, visited, vec );
@@ -80,6 +96,7 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 	else
 	{
 		// Webmain entry point
+		entryPointsNeeded.push_back(webMain);
 		SubExprVec vec;
 		visitGlobal( webMain, visited, vec );
 		assert( visited.empty() );
@@ -168,9 +185,20 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 				getConstructorFunction );
 	}
 	NumRemovedGlobals = filterModule(module);
+	computeStructsInfo(module);
 	return true;
 }
 
+// Collect the named struct type of an object, or of the elements of an array of objects. The writer creates them with their constructor
+static void collectInstantiatedType( Type * t, std::vector< StructType * > & types )
+{
+	while ( ArrayType * at = dyn_cast<ArrayType>(t) )
+		t = at->getElementType();
+	StructType * st = dyn_cast<StructType>(t);
+	if ( st && st->hasName() && !st->hasByteLayout() )
+		types.push_back(st);
+}
+
 void GlobalDepsAnalyzer::visitGlobal( const GlobalValue * C, VisitedSet & visited, const SubExprVec & subexpr )
 {
 	// Cycle detector
@@ -200,6 +228,10 @@ void GlobalDepsAnalyzer::visitGlobal( const GlobalValue * C, VisitedSet & visite
 		{
 			if (GV->hasInitializer() )
 			{
+				std::vector< StructType * > types;
+				collectInstantiatedType( GV->getType()->getElementType(), types );
+				typesInstantiated.insert( types.begin(), types.end() );
+
 				// Add the "GlobalVariable - initializer" use to the subexpr,
 				// in order to being able to get the global variable from the fixup map
 				SubExprVec Newsubexpr (1, &GV->getOperandUse(0));
@@ -266,10 +298,21 @@ void GlobalDepsAnalyzer::visitConstant( const Constant * C, VisitedSet & visited
 void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
 {
 	VisitedSet NewvisitPath;
+	std::vector< StructType * > types;
 
 	for ( const BasicBlock & bb : *F )
 		for (const Instruction & I : bb)
 		{
+			// The type infos used by the exception handling have already been replaced by TypeInfoLowering
+			if ( isa<LandingPadInst>(I) )
+				hasExceptions = true;
+			else if ( ImmutableCallSite(&I) && ImmutableCallSite(&I).getCalledFunction() )
+			{
+				StringRef calleeName = ImmutableCallSite(&I).getCalledFunction()->getName();
+				if ( calleeName == "__cxa_throw" || calleeName == "__cxa_rethrow" || calleeName == "__cxa_begin_catch" )
+					hasExceptions = true;
+			}
+
 			for (const Value * v : I.operands() )
 			{
 				if (const Constant * c = dyn_cast<Constant>(v) )
@@ -277,14 +320,26 @@ void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
 					SubExprVec Newsubexpr;
 					visitConstant(c, NewvisitPath, Newsubexpr);
 					assert( NewvisitPath.empty() );
+					if ( isa<ConstantStruct>(c) || isa<ConstantAggregateZero>(c) )
+						collectInstantiatedType(c->getType(), types);
 				}
 			}
+
+			if ( const AllocaInst * AI = dyn_cast<AllocaInst>(&I) )
+				collectInstantiatedType(AI->getAllocatedType(), types);
+			else if ( isa<InsertValueInst>(I) )
+				collectInstantiatedType(I.getType(), types);
 			
 			if ( ImmutableCallSite(&I).isCall() || ImmutableCallSite(&I).isInvoke() )
 			{
+				const Function* callee = ImmutableCallSite(&I).getCalledFunction();
+				if ( callee && !callee->empty() )
+					callGraph[F].push_back(callee);
+
 				DynamicAllocInfo ai (&I);
 				if ( ai.isValidAlloc() )
 				{
+					collectInstantiatedType(ai.getCastedType()->getElementType(), types);
 					if ( ai.useCreateArrayFunc() )
 					{
 						assert( isa<StructType>(ai.getCastedType()->getElementType()) );
@@ -292,12 +347,17 @@ void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
 					}
 					if ( ai.useCreatePointerArrayFunc() )
 						hasPointerArrays = true;
+					if ( ai.useTypedArray() || TypeSupport::isTypedArrayObjectType(ai.getCastedType()->getElementType()) )
+						hasTypedArrayAllocs = true;
+					if ( ai.getAllocType() == DynamicAllocInfo::cheerp_reallocate )
+						hasReallocs = true;
 				}
 			}
 				
 			if (I.getOpcode() == Instruction::VAArg)
 				hasVAArgs = true;
 		}
+	typesInstantiated.insert( types.begin(), types.end() );
 	
 	// Gather informations about all the classes which may be downcast targets
 	if (F->getIntrinsicID() == Intrinsic::cheerp_downcast)
@@ -313,6 +373,15 @@ void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
 	}
 	else if (F->getIntrinsicID() == Intrinsic::cheerp_create_closure)
 		hasCreateClosureUsers = true;
+	else if (F->getIntrinsicID() == Intrinsic::memcpy || F->getIntrinsicID() == Intrinsic::memmove)
+	{
+		// Only copies between typed arrays go through the cheerpMemMove helper
+		Type* pointedType = F->getFunctionType()->getParamType(0)->getPointerElementType();
+		if (TypeSupport::isTypedArrayType(pointedType))
+			hasMemMoveUsers = true;
+		else if (TypeSupport::hasByteLayout(pointedType))
+			hasByteLayoutCopies = true;
+	}
 }
 
 int GlobalDepsAnalyzer::filterModule( llvm::Module & module )
@@ -378,6 +447,92 @@ int GlobalDepsAnalyzer::filterModule( llvm::Module & module )
 	return eraseQueue.size();
 }
 
+void GlobalDepsAnalyzer::computeStructsInfo( const llvm::Module & module )
+{
+	// Every class with bases has a <class name>_bases metadata, with the index of the first base
+	// and the number of entries of the downcast array
+	for (const NamedMDNode & namedNode : module.named_metadata() )
+	{
+		StringRef name = namedNode.getName();
+		if(!name.endswith("_bases"))
+			continue;
+		StructType * st = module.getTypeByName(name.drop_back(6));
+		if(!st)
+			continue;
+
+		MDNode* basesMeta = namedNode.getOperand(0);
+		assert(basesMeta->getNumOperands()==2);
+		StructInfo & info = structsInfoCache[st];
+		info.hasBasesMetadata = true;
+		info.firstBase = getIntFromValue(basesMeta->getOperand(0));
+		info.downcastArraySize = getIntFromValue(basesMeta->getOperand(1));
+	}
+
+	// The direct bases are the elements which fill the downcast array, like in TypeSupport::getBasesInfo
+	for ( auto & it : structsInfoCache )
+	{
+		StructInfo & info = it.second;
+		int32_t baseMax = info.downcastArraySize - 1;
+		for ( uint32_t i = info.firstBase; i < it.first->getNumElements() && baseMax > 0; i++ )
+		{
+			auto baseIt = structsInfoCache.find(cast<StructType>(it.first->getElementType(i)));
+			baseMax -= baseIt == structsInfoCache.end() ? 1 : baseIt->second.downcastArraySize;
+			info.baseCount++;
+		}
+		assert(baseMax == 0);
+	}
+
+	// Only the helpers of these types are compiled, the other ones do not need a name
+	for ( StructType * st : classesNeeded )
+	{
+		StructInfo & info = structsInfoCache[st];
+		info.needsDowncastArray = true;
+		info.jsName = NameGenerator::filterLLVMName(st->getName(), true).str();
+	}
+
+	// The classes and all their bases, recursively, are stored in the downcast arrays
+	std::vector<StructType*> worklist(classesNeeded.begin(), classesNeeded.end());
+	while ( !worklist.empty() )
+	{
+		StructType * st = worklist.back();
+		worklist.pop_back();
+		StructInfo & info = structsInfoCache[st];
+		if ( info.hasDowncastSlots )
+			continue;
+		info.hasDowncastSlots = true;
+		for ( uint32_t i = info.firstBase; i < info.firstBase + info.baseCount; i++ )
+			worklist.push_back(cast<StructType>(st->getElementType(i)));
+	}
+
+	for ( StructType * st : arraysNeeded )
+		structsInfoCache[st].jsName = NameGenerator::filterLLVMName(st->getName(), true).str();
+
+	// The named structs contained in the instantiated ones are instantiated as well
+	std::vector<StructType*> instantiated(typesInstantiated.begin(), typesInstantiated.end());
+	for ( uint32_t i = 0; i < instantiated.size(); i++ )
+	{
+		std::vector<StructType*> elements;
+		for ( StructType::element_iterator it = instantiated[i]->element_begin(); it != instantiated[i]->element_end(); ++it )
+			collectInstantiatedType(*it, elements);
+		for ( StructType * st : elements )
+			if ( typesInstantiated.insert(st).second )
+				instantiated.push_back(st);
+	}
+
+	// Number the instantiated types by name, so that the constructors get short and stable names
+	std::sort( instantiated.begin(), instantiated.end(), []( StructType * lhs, StructType * rhs )
+		{
+			return lhs->getName() < rhs->getName();
+		});
+	for ( uint32_t i = 0; i < instantiated.size(); i++ )
+	{
+		StructInfo & info = structsInfoCache[instantiated[i]];
+		info.constructorId = i + 1;
+		if ( info.jsName.empty() )
+			info.jsName = NameGenerator::filterLLVMName(instantiated[i]->getName(), true).str();
+	}
+}
+
 }
 
 using namespace cheerp;
@@ -14,8 +14,8 @@
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/Function.h"
+#include <algorithm>
 #include <functional>
-#include <set>
 
 using namespace llvm;
 
@@ -112,12 +112,14 @@ struct JSSymbols
 };
 
 NameGenerator::NameGenerator(const Module& M, const GlobalDepsAnalyzer& gda, const Registerize& r,
-				const PointerAnalyzer& PA, bool makeReadableNames):registerize(r), PA(PA)
+				const PointerAnalyzer& PA, bool makeReadableNames, bool computeSavings):registerize(r), PA(PA),
+				namemap(std::make_shared<NameMapTy>()), edgeNamemap(std::make_shared<EdgeNameMapTy>()),
+				nameBytes(0), nameBytesSaved(0)
 {
 	if ( makeReadableNames )
 		generateReadableNames(M, gda);
 	else
-		generateCompressedNames(M, gda);
+		generateCompressedNames(M, gda, computeSavings);
 }
 
 llvm::StringRef NameGenerator::getNameForEdge(const llvm::Value* v) const
@@ -125,11 +127,35 @@ llvm::StringRef NameGenerator::getNameForEdge(const llvm::Value* v) const
 	assert(!edgeContext.isNull());
 	if (const Instruction* I=dyn_cast<Instruction>(v))
 	{
-		auto it=edgeNamemap.find(InstOnEdge(edgeContext.fromBB, edgeContext.toBB, registerize.getRegisterId(I)));
-		if (it!=edgeNamemap.end())
+		auto it=edgeNamemap->find(InstOnEdge(edgeContext.fromBB, edgeContext.toBB, registerize.getRegisterId(I)));
+		if (it!=edgeNamemap->end())
 			return it->second;
 	}
-	return namemap.at(v);
+	return namemap->at(v);
+}
+
+void NameGenerator::releaseFunction(const llvm::Function& F)
+{
+	for (const BasicBlock & bb : F)
+	{
+		for (const Instruction & I : bb)
+			namemap->erase(&I);
+		// Temporary names on edges are only used by PHIs
+		const TerminatorInst* term=bb.getTerminator();
+		for(uint32_t i=0;i<term->getNumSuccessors();i++)
+		{
+			const BasicBlock* succBB=term->getSuccessor(i);
+			for (const Instruction & I : *succBB)
+			{
+				if (!isa<PHINode>(I))
+					break;
+				if (needsName(I, PA))
+					edgeNamemap->erase(InstOnEdge(&bb, succBB, registerize.getRegisterId(&I)));
+			}
+		}
+	}
+	for ( auto arg_it = F.arg_begin(); arg_it != F.arg_end(); ++arg_it )
+		namemap->erase(arg_it);
 }
 
 SmallString< 4 > NameGenerator::filterLLVMName(StringRef s, bool isGlobalName)
@@ -171,14 +197,8 @@ SmallString< 4 > NameGenerator::filterLLVMName(StringRef s, bool isGlobalName)
 	return ans;
 }
 
-void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAnalyzer& gda)
+void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAnalyzer& gda, bool computeSavings)
 {
-	typedef std::pair<unsigned, const Value *> useValuePair;
-	typedef std::pair<unsigned, std::vector<const Value *> > useValuesPair;
-	typedef std::vector<useValuesPair> useValuesVec;
-	typedef std::pair<unsigned, std::vector<InstOnEdge> > useInstsOnEdgePair;
-	typedef std::vector<useInstsOnEdgePair> useInstsOnEdgeVec;
-        
 	// Class to handle giving names to temporary variables needed for recursively dependent PHIs
 	class CompressedPHIHandler: public EndOfBlockPHIHandler
 	{
@@ -210,35 +230,36 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 			// Nothing to do here, we have already given names to all PHIs
 		}
 	};
-	/**
-	 * Collect the local values.
-	 * 
-	 * We sort them by uses, then store together those in the same position.
-	 * i.e. allLocalValues[0].second will contain all the most used local values
-	 * for each function, and allLocalValues[0].first will be the sum of the uses
-	 * of all those local values.
-	 */
-        
-	useValuesVec allLocalValues;
+
+	std::vector<NameCandidate> globals;
+	std::vector<std::vector<NameCandidate>> functionsLocals;
 	useInstsOnEdgeVec allTmpPHIs;
-        
-	/**
-	 * Sort the global values by number of uses
-	 */
-	std::set< useValuePair, std::greater< useValuePair > > allGlobalValues;
+	std::unordered_map<const Value*, uint32_t> refsCache;
 
+	// Every name is written once where it is defined, and then once for each reference.
+	// Named regular pointers are mostly written as base and offset, i.e. a.d[a.o]
+	auto estimateReferences = [&](const Value* v) -> uint32_t
+	{
+		uint32_t refs = countReferences(v, refsCache);
+		if ( v->getType()->isPointerTy() && !isa<Function>(v) && PA.getPointerKind(v) == REGULAR )
+			refs *= 2;
+		return 1 + refs;
+	};
 	for (const Function & f : M.getFunctionList() )
 	{
-		unsigned nUses = f.getNumUses();
+		unsigned nExplicitUses = 0;
 
 		if ( f.getName() == "_Z7webMainv" )
-			++nUses; // We explicitly invoke the webmain
+			++nExplicitUses; // We explicitly invoke the webmain
 
 		// Constructors are also explicitly invoked
 		if ( std::find(gda.constructors().begin(), gda.constructors().end(), &f ) != gda.constructors().end() )
-			++nUses;
+			++nExplicitUses;
 
-		allGlobalValues.emplace( nUses, &f );
+		globals.emplace_back();
+		globals.back().uses = f.getNumUses() + nExplicitUses;
+		globals.back().refs = estimateReferences(&f) + nExplicitUses;
+		globals.back().values.push_back(&f);
 
 		/**
 		 * TODO, some cheerp-internals functions are actually generated even with an empty IR.
@@ -248,7 +269,8 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 			continue;
 
 		// Local values are all stored in registers
-		useValuesVec thisFunctionLocals;
+		functionsLocals.emplace_back();
+		std::vector<NameCandidate>& thisFunctionLocals = functionsLocals.back();
 
 		// Insert all the instructions
 		for (const BasicBlock & bb : f)
@@ -260,11 +282,12 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 					uint32_t registerId = registerize.getRegisterId(&I);
 					if (registerId >= thisFunctionLocals.size())
 						thisFunctionLocals.resize(registerId+1);
-					useValuesPair& regData = thisFunctionLocals[registerId];
+					NameCandidate& regData = thisFunctionLocals[registerId];
 					// Add the uses for this instruction to the total count for the register
-					regData.first+=I.getNumUses();
+					regData.uses+=I.getNumUses();
+					regData.refs+=estimateReferences(&I);
 					// Add the instruction itself to the list of istructions
-					regData.second.push_back(&I);
+					regData.values.push_back(&I);
 				}
 			}
 			// Handle the special names required for the edges between blocks
@@ -276,34 +299,15 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 			}
 		}
 
-		uint32_t currentArgPos=thisFunctionLocals.size();
-		thisFunctionLocals.resize(currentArgPos+f.arg_size());
 		// Insert the arguments
-		for ( auto arg_it = f.arg_begin(); arg_it != f.arg_end(); ++arg_it, currentArgPos++ )
-		{
-			thisFunctionLocals[currentArgPos].first = f.getNumUses();
-			thisFunctionLocals[currentArgPos].second.push_back( arg_it );
-		}
-
-		// Resize allLocalValues so that we have empty useValuesPair at the end of the container
-		if ( thisFunctionLocals.size() > allLocalValues.size() )
-			allLocalValues.resize( thisFunctionLocals.size() );
-
-		std::sort(thisFunctionLocals.begin(),thisFunctionLocals.end());
-		auto dst_it = allLocalValues.begin();
-
-		for (auto src_it = thisFunctionLocals.rbegin(); src_it != thisFunctionLocals.rend(); ++src_it, ++dst_it )
+		for ( auto arg_it = f.arg_begin(); arg_it != f.arg_end(); ++arg_it )
 		{
-			dst_it->first += src_it->first;
-			dst_it->second.insert(dst_it->second.end(), src_it->second.begin(), src_it->second.end());
+			thisFunctionLocals.emplace_back();
+			thisFunctionLocals.back().uses = f.getNumUses();
+			thisFunctionLocals.back().refs = estimateReferences(arg_it);
+			thisFunctionLocals.back().values.push_back( arg_it );
 		}
 	}
-        
-	assert( std::is_sorted( 
-		allLocalValues.rbegin(), 
-		allLocalValues.rend(),
-		[] (const useValuesPair & lhs, const useValuesPair & rhs) { return lhs.first < rhs.first; } 
-		) );
 
 	for ( const GlobalValue & GV : M.getGlobalList() )
 	{
@@ -312,14 +316,109 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 			demangler_iterator dmg( GV.getName() );
 			assert(*dmg == "client");
 			
-			namemap.emplace( &GV, *(++dmg) );
+			namemap->emplace( &GV, *(++dmg) );
 			
 			continue;
 		}
 
-		allGlobalValues.emplace( GV.getNumUses(), &GV );
+		globals.emplace_back();
+		globals.back().uses = GV.getNumUses();
+		globals.back().refs = estimateReferences(&GV);
+		globals.back().values.push_back(&GV);
 	}
 
+	nameBytes = assignCompressedNames(globals, functionsLocals, allTmpPHIs, true, true);
+	if ( computeSavings )
+		nameBytesSaved = (int64_t)assignCompressedNames(globals, functionsLocals, allTmpPHIs, false, false) - (int64_t)nameBytes;
+}
+
+uint32_t NameGenerator::countReferences(const Value* v, std::unordered_map<const Value*, uint32_t>& cache) const
+{
+	uint32_t refs = 0;
+	for (const Use & U : v->uses())
+	{
+		const User* user = U.getUser();
+		bool inlined = isa<ConstantExpr>(user) ||
+			(isa<Instruction>(user) && isInlineable(*cast<Instruction>(user), PA));
+		if ( !inlined )
+		{
+			refs++;
+			continue;
+		}
+		auto it = cache.find(user);
+		if ( it == cache.end() )
+			it = cache.emplace(user, countReferences(user, cache)).first;
+		refs += it->second;
+	}
+	return refs;
+}
+
+uint64_t NameGenerator::assignCompressedNames(const std::vector<NameCandidate>& globals, const std::vector<std::vector<NameCandidate>>& functionsLocals,
+						const useInstsOnEdgeVec& allTmpPHIs, bool byRefs, bool emitNames)
+{
+	struct WeightedCandidates
+	{
+		uint64_t weight;
+		uint64_t refs;
+		std::vector<const NameCandidate*> candidates;
+		WeightedCandidates():weight(0), refs(0)
+		{
+		}
+	};
+	auto getWeight = [byRefs](const NameCandidate& c) -> uint64_t { return byRefs ? c.refs : c.uses; };
+	auto heavierFirst = [](const std::pair<uint64_t, const NameCandidate*>& lhs, const std::pair<uint64_t, const NameCandidate*>& rhs)
+	{
+		return lhs.first > rhs.first;
+	};
+
+	/**
+	 * Sort the global values by weight.
+	 * Values with the same weight keep the module order, so that the names do not depend on the memory layout
+	 */
+	std::vector< std::pair<uint64_t, const NameCandidate*> > allGlobalValues;
+	for ( const NameCandidate& c : globals )
+		allGlobalValues.emplace_back( getWeight(c), &c );
+	std::stable_sort( allGlobalValues.begin(), allGlobalValues.end(), heavierFirst );
+
+	/**
+	 * Collect the local values.
+	 * 
+	 * We sort them by weight, then store together those in the same position.
+	 * i.e. allLocalValues[0].candidates will contain all the heaviest local values
+	 * for each function, and allLocalValues[0].weight will be the sum of the weights
+	 * of all those local values.
+	 */
+	std::vector<WeightedCandidates> allLocalValues;
+	std::vector< std::pair<uint64_t, const NameCandidate*> > thisFunctionLocals;
+	for ( const std::vector<NameCandidate>& locals : functionsLocals )
+	{
+		thisFunctionLocals.clear();
+		for ( const NameCandidate& c : locals )
+		{
+			// Registers which are not used by any named value do not need a name
+			if ( !c.values.empty() )
+				thisFunctionLocals.emplace_back( getWeight(c), &c );
+		}
+		std::stable_sort( thisFunctionLocals.begin(), thisFunctionLocals.end(), heavierFirst );
+
+		// Resize allLocalValues so that we have empty WeightedCandidates at the end of the container
+		if ( thisFunctionLocals.size() > allLocalValues.size() )
+			allLocalValues.resize( thisFunctionLocals.size() );
+
+		for ( uint32_t i = 0; i < thisFunctionLocals.size(); i++ )
+		{
+			allLocalValues[i].weight += thisFunctionLocals[i].first;
+			allLocalValues[i].refs += thisFunctionLocals[i].second->refs;
+			allLocalValues[i].candidates.push_back( thisFunctionLocals[i].second );
+		}
+	}
+        
+	assert( std::is_sorted( 
+		allLocalValues.rbegin(), 
+		allLocalValues.rend(),
+		[] (const WeightedCandidates & lhs, const WeightedCandidates & rhs) { return lhs.weight < rhs.weight; } 
+		) );
+
 	/**
 	 * Now generate the names and fill the namemap.
 	 * 
@@ -328,13 +427,14 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 	 * of the global inside the function.
 	 */
 	name_iterator<JSSymbols> name_it;
+	uint64_t bytes = 0;
 	
 	// We need to iterate over allGlobalValues, allLocalValues and allTmpPHIs
 	// at the same time incrementing selectively only one of the iterators
 	
-	std::set< useValuePair >::const_iterator global_it = allGlobalValues.begin();
-	useValuesVec::const_iterator local_it = allLocalValues.begin();
-	useInstsOnEdgeVec::const_iterator tmpphi_it = allTmpPHIs.begin();
+	auto global_it = allGlobalValues.begin();
+	auto local_it = allLocalValues.begin();
+	auto tmpphi_it = allTmpPHIs.begin();
 
 	bool globalsFinished = global_it == allGlobalValues.end();
 	bool localsFinished = local_it == allLocalValues.end();
@@ -342,28 +442,39 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 	for ( ; !globalsFinished || !localsFinished || !tmpPHIsFinished; ++name_it )
 	{
 		if ( !globalsFinished &&
-			(localsFinished || global_it->first >= local_it->first) &&
+			(localsFinished || global_it->first >= local_it->weight) &&
 			(tmpPHIsFinished || global_it->first >= tmpphi_it->first))
 		{
 			// Assign this name to a global value
-			namemap.emplace( global_it->second, *name_it );
+			bytes += global_it->second->refs * name_it->size();
+			if ( emitNames )
+				namemap->emplace( global_it->second->values.front(), *name_it );
 			++global_it;
 		}
 		else if ( !localsFinished &&
-			(globalsFinished || local_it->first >= global_it->first) &&
-			(tmpPHIsFinished || local_it->first >= tmpphi_it->first))
+			(globalsFinished || local_it->weight >= global_it->first) &&
+			(tmpPHIsFinished || local_it->weight >= tmpphi_it->first))
 		{
 			// Assign this name to all the local values
-			for ( const Value * v : local_it->second )
-				namemap.emplace( v, *name_it );
+			bytes += local_it->refs * name_it->size();
+			if ( emitNames )
+			{
+				for ( const NameCandidate* c : local_it->candidates )
+					for ( const Value * v : c->values )
+						namemap->emplace( v, *name_it );
+			}
 			
 			++local_it;
 		}
 		else
 		{
 			// Assign this name to all the tmpphis
-			for ( const InstOnEdge& i : tmpphi_it->second )
-				edgeNamemap.emplace( i, StringRef(*name_it));
+			bytes += tmpphi_it->first * name_it->size();
+			if ( emitNames )
+			{
+				for ( const InstOnEdge& i : tmpphi_it->second )
+					edgeNamemap->emplace( i, StringRef(*name_it));
+			}
 			
 			++tmpphi_it;
 		}
@@ -371,6 +482,7 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 		localsFinished = local_it == allLocalValues.end();
 		tmpPHIsFinished = tmpphi_it == allTmpPHIs.end();
 	}
+	return bytes;
 }
 
 void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnalyzer& gda)
@@ -391,7 +503,7 @@ void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnaly
 		void handleRecursivePHIDependency(const Instruction* phi) override
 		{
 			uint32_t regId=namegen.registerize.getRegisterId(phi);
-			namegen.edgeNamemap.emplace(InstOnEdge(fromBB, toBB, regId),
+			namegen.edgeNamemap->emplace(InstOnEdge(fromBB, toBB, regId),
 							StringRef( "tmpphi" + std::to_string(nextIndex++)));
 		}
 		void handlePHI(const Instruction* phi, const Value* incoming) override
@@ -416,15 +528,15 @@ void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnaly
 					// Otherwise assign one as good as possible and assign it to the register as well
 					auto regNameIt = regmap.find(registerId);
 					if(regNameIt != regmap.end())
-						namemap.emplace( &I, regNameIt->second );
+						namemap->emplace( &I, regNameIt->second );
 					else if ( I.hasName() )
 					{
-						auto it=namemap.emplace( &I, filterLLVMName(I.getName(), false) ).first;
+						auto it=namemap->emplace( &I, filterLLVMName(I.getName(), false) ).first;
 						regmap.emplace( registerId, it->second );
 					}
 					else
 					{
-						auto it=namemap.emplace( &I,
+						auto it=namemap->emplace( &I,
 							StringRef( "tmp" + std::to_string(registerId) ) ).first;
 						regmap.emplace( registerId, it->second );
 					}
@@ -442,11 +554,11 @@ void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnaly
 		unsigned argCounter = 0;
 		for ( auto arg_it = f.arg_begin(); arg_it != f.arg_end(); ++arg_it )
 			if ( arg_it->hasName() )
-				namemap.emplace( arg_it, filterLLVMName(arg_it->getName(), false) );
+				namemap->emplace( arg_it, filterLLVMName(arg_it->getName(), false) );
 			else
-				namemap.emplace( arg_it, StringRef( "arg" + std::to_string(argCounter++) ) );
+				namemap->emplace( arg_it, StringRef( "arg" + std::to_string(argCounter++) ) );
 			
-		namemap.emplace( &f, filterLLVMName( f.getName(), true ) );
+		namemap->emplace( &f, filterLLVMName( f.getName(), true ) );
 	}
 
 	for (const GlobalVariable & GV : M.getGlobalList() )
@@ -455,11 +567,11 @@ void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnaly
 			demangler_iterator dmg( GV.getName() );
 			assert(*dmg == "client");
 			
-			namemap.emplace( &GV, *(++dmg) );
+			namemap->emplace( &GV, *(++dmg) );
 			
 		}
 		else
-			namemap.emplace( &GV, filterLLVMName( GV.getName(), true ) );
+			namemap->emplace( &GV, filterLLVMName( GV.getName(), true ) );
 }
 
 bool NameGenerator::needsName(const Instruction & I, const PointerAnalyzer& PA) const
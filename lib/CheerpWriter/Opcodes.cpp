@@ -9,6 +9,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "llvm/Analysis/ValueTracking.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/Cheerp/Writer.h"
 
@@ -59,3 +60,119 @@ void CheerpWriter::compileSubtraction(const llvm::Value* lhs, const llvm::Value*
 		stream << '&' << getMaskForBitWidth(lhs->getType()->getIntegerBitWidth());
 	stream << ')';
 }
+
+bool CheerpWriter::isKnownNonNegativeI32(const llvm::Value* v)
+{
+	// Narrower integers may have garbage in the upper bits of their JS value
+	if(!types.isI32Type(v->getType()))
+		return false;
+	bool knownZero = false, knownOne = false;
+	ComputeSignBit(const_cast<Value*>(v), knownZero, knownOne, &targetData);
+	return knownZero;
+}
+
+void CheerpWriter::compileMultiplication(const llvm::Value* lhs, const llvm::Value* rhs)
+{
+	//Integer signed multiplication
+	//Math.imul computes the exact lower 32 bits, a double multiplication loses them above 2^53
+	if(!types.isI32Type(lhs->getType()))
+		stream << '(';
+	stream << "Math.imul(";
+	compileOperand(lhs);
+	stream << ',';
+	compileOperand(rhs);
+	stream << ')';
+	if(!types.isI32Type(lhs->getType()))
+		stream << '&' << getMaskForBitWidth(lhs->getType()->getIntegerBitWidth()) << ')';
+}
+
+void CheerpWriter::compileDivRem(const llvm::Value* lhs, const llvm::Value* rhs, unsigned opcode)
+{
+	bool isSigned = opcode == Instruction::SDiv || opcode == Instruction::SRem;
+	bool isDiv = opcode == Instruction::SDiv || opcode == Instruction::UDiv;
+	bool lhsNonNegative = isKnownNonNegativeI32(lhs);
+
+	// Power of two divisors can be lowered to shifts and masks.
+	// For signed operations this is only correct if the dividend is not negative.
+	const ConstantInt* c = dyn_cast<ConstantInt>(rhs);
+	if(c && c->getValue().isPowerOf2() && (!isSigned || lhsNonNegative))
+	{
+		stream << '(';
+		if(isDiv)
+		{
+			if(isSigned || lhsNonNegative)
+				compileOperand(lhs);
+			else
+				compileUnsignedInteger(lhs);
+			stream << (lhsNonNegative ? ">>" : ">>>") << c->getValue().logBase2();
+		}
+		else
+		{
+			// The mask also clears the upper bits of narrower integers
+			compileOperand(lhs);
+			stream << '&' << (c->getValue() - 1).getZExtValue();
+		}
+		stream << ')';
+		return;
+	}
+
+	// If both operands are known to be positive the signed and unsigned operations are the same
+	// and the remainder is an integer already
+	if(lhsNonNegative && isKnownNonNegativeI32(rhs))
+	{
+		stream << '(';
+		if(isDiv)
+			stream << '(';
+		compileOperand(lhs);
+		stream << (isDiv ? '/' : '%');
+		compileOperand(rhs);
+		if(isDiv)
+			stream << ")>>0";
+		stream << ')';
+		return;
+	}
+
+	stream << '(';
+	if(isDiv || isSigned)
+		stream << '(';
+	if(isSigned)
+		compileSignedInteger(lhs);
+	else
+		compileUnsignedInteger(lhs);
+	stream << (isDiv ? '/' : '%');
+	if(isSigned)
+		compileSignedInteger(rhs);
+	else
+		compileUnsignedInteger(rhs);
+	// The remainder of two unsigned integers is an unsigned integer already
+	// The signed remainder may be -0, normalize it to keep the value an integer
+	if(isSigned)
+		stream << ")>>0";
+	else if(isDiv)
+		stream << ")>>>0";
+	stream << ')';
+}
+
+void CheerpWriter::compileLogicalShiftRight(const llvm::Value* lhs, const llvm::Value* rhs)
+{
+	//Integer logical shift right
+	//No need to apply the >> operator. The result is an integer by spec
+	stream << '(';
+	if(isKnownNonNegativeI32(lhs))
+	{
+		// Keep the result in the signed range
+		compileOperand(lhs);
+		stream << ">>";
+	}
+	else
+	{
+		// The upper bits of narrower integers must be cleared
+		if(types.isI32Type(lhs->getType()))
+			compileOperand(lhs);
+		else
+			compileUnsignedInteger(lhs);
+		stream << ">>>";
+	}
+	compileOperand(rhs);
+	stream << ')';
+}
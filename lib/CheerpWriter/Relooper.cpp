@@ -2,9 +2,13 @@
 
 #include "Relooper.h"
 
+#include "llvm/ADT/BitVector.h"
+
 #include <string.h>
 #include <stdlib.h>
-#include <list>
+#include <algorithm>
+#include <functional>
+#include <iterator>
 #include <stack>
 
 // TODO: move all set to unorderedset
@@ -25,6 +29,35 @@ Branch::Branch(int bId) : Ancestor(NULL), Labeled(false), branchId(bId) {
 Branch::~Branch() {
 }
 
+// Functions may be compiled in parallel, so there is a free list of branches per thread.
+// The list is capped, so that a single huge function does not keep its branches alive
+// for the lifetime of the thread.
+namespace {
+struct BranchFreeList {
+  static const size_t MaxSize = 4096;
+  std::vector<void*> Free;
+  ~BranchFreeList() {
+    for (unsigned int i = 0; i < Free.size(); i++) ::operator delete(Free[i]);
+  }
+};
+}
+
+static thread_local BranchFreeList FreeBranches;
+
+void *Branch::operator new(size_t Size) {
+  assert(Size == sizeof(Branch));
+  if (FreeBranches.Free.empty()) return ::operator new(Size);
+  void *Ret = FreeBranches.Free.back();
+  FreeBranches.Free.pop_back();
+  return Ret;
+}
+
+void Branch::operator delete(void *Ptr) {
+  if (!Ptr) return;
+  if (FreeBranches.Free.size() < BranchFreeList::MaxSize) FreeBranches.Free.push_back(Ptr);
+  else ::operator delete(Ptr);
+}
+
 void Branch::Render(Block *Target, bool SetLabel, RenderInterface* renderInterface) {
   if (SetLabel) renderInterface->renderLabel(Target->Id);
   if (Ancestor) {
@@ -46,10 +79,8 @@ void Branch::Render(Block *Target, bool SetLabel, RenderInterface* renderInterfa
 
 // Block
 
-int Block::IdCounter = 1; // 0 is reserved for clearings
-
-Block::Block(const void* b, bool s) : Parent(NULL), Id(Block::IdCounter++), privateBlock(b), DefaultTarget(NULL),
-	IsCheckedMultipleEntry(false), IsSplittable(s) {
+Block::Block(const void* b, bool s, bool sw, bool t) : Parent(NULL), Id(-1), Index(-1), privateBlock(b), DefaultTarget(NULL),
+	IsCheckedMultipleEntry(false), NeedsLabelClear(true), IsSplittable(s), IsSwitch(sw), IsTry(t) {
 }
 
 Block::~Block() {
@@ -69,11 +100,24 @@ bool Block::AddBranchTo(Block *Target, int branchId) {
   return true;
 }
 
+// Whether the code for a branch, including the fused code of its target, is not empty
+static bool HasBranchContent(Block *Target, Branch *Details, bool SetCurrLabel, MultipleShape *Fused, RenderInterface* renderInterface) {
+  bool HasFusedContent = Fused && Fused->InnerMap.find(Target) != Fused->InnerMap.end();
+  //Cheerp: We assume that the block has content, otherwise why it's even here?
+  return SetCurrLabel || Details->Type != Branch::Direct ||
+         HasFusedContent || renderInterface->hasBlockPrologue(Target->privateBlock);
+}
+
 void Block::Render(bool InLoop, RenderInterface* renderInterface) {
-  if (IsCheckedMultipleEntry && InLoop) {
+  if (IsCheckedMultipleEntry && NeedsLabelClear && InLoop) {
     renderInterface->renderLabel(0);
   }
 
+  if (IsTry) {
+    RenderTry(InLoop, renderInterface);
+    return;
+  }
+
   renderInterface->renderBlock(privateBlock);
 
   if (!ProcessedBranchesOut.size()) return;
@@ -108,10 +152,12 @@ void Block::Render(bool InLoop, RenderInterface* renderInterface) {
   // Multiple), so we can remove the Multiple and add its independent groups
   // into the Simple's branches.
   MultipleShape *Fused = Shape::IsMultiple(Parent->Next);
+  // A switch is the target of the breaks out of the fused Multiple, so it replaces the loop
+  bool Switch = RendersAsSwitch();
   if (Fused) {
     PrintDebug("Fusing Multiple to Simple\n");
     Parent->Next = Parent->Next->Next;
-    Fused->RenderLoopPrefix(renderInterface);
+    if (!Switch) Fused->RenderLoopPrefix(renderInterface);
 
     // When the Multiple has the same number of groups as we have branches,
     // they will all be fused, so it is safe to not set the label at all
@@ -129,6 +175,11 @@ void Block::Render(bool InLoop, RenderInterface* renderInterface) {
   }
   assert(DefaultTarget); // Must be a default
 
+  if (Switch) {
+    RenderSwitch(InLoop, Fused, SetLabel, renderInterface);
+    return;
+  }
+
   std::vector<int> emptyBranchesIds;
   bool First = true;
   for (BlockBranchMap::iterator iter = ProcessedBranchesOut.begin();; iter++) {
@@ -145,9 +196,7 @@ void Block::Render(bool InLoop, RenderInterface* renderInterface) {
     }
     bool SetCurrLabel = SetLabel && Target->IsCheckedMultipleEntry;
     bool HasFusedContent = Fused && Fused->InnerMap.find(Target) != Fused->InnerMap.end();
-    //Cheerp: We assume that the block has content, otherwise why it's even here?
-    bool HasContent = SetCurrLabel || Details->Type != Branch::Direct ||
-                      HasFusedContent || renderInterface->hasBlockPrologue(Target->privateBlock);
+    bool HasContent = HasBranchContent(Target, Details, SetCurrLabel, Fused, renderInterface);
     if (iter != ProcessedBranchesOut.end()) {
       // If there is nothing to show in this branch, omit the condition
       if (HasContent) {
@@ -180,9 +229,98 @@ void Block::Render(bool InLoop, RenderInterface* renderInterface) {
   }
 }
 
+void Block::RenderSwitch(bool InLoop, MultipleShape *Fused, bool SetLabel, RenderInterface* renderInterface) {
+  if (Fused && Fused->NeedLoop && Fused->Labeled) {
+    renderInterface->renderSwitchBlockBegin(privateBlock, Fused->Id);
+  } else {
+    renderInterface->renderSwitchBlockBegin(privateBlock);
+  }
+  // A case with nothing to do can be omitted, unless it would then reach a default with some content
+  Branch *DefaultDetails = ProcessedBranchesOut[DefaultTarget];
+  bool DefaultHasContent = HasBranchContent(DefaultTarget, DefaultDetails, SetLabel && DefaultTarget->IsCheckedMultipleEntry, Fused, renderInterface);
+  for (BlockBranchMap::iterator iter = ProcessedBranchesOut.begin();; iter++) {
+    Block *Target;
+    Branch *Details;
+    if (iter != ProcessedBranchesOut.end()) {
+      Target = iter->first;
+      if (Target == DefaultTarget) continue; // done at the end
+      Details = iter->second;
+    } else {
+      Target = DefaultTarget;
+      Details = DefaultDetails;
+    }
+    bool SetCurrLabel = SetLabel && Target->IsCheckedMultipleEntry;
+    bool HasContent = HasBranchContent(Target, Details, SetCurrLabel, Fused, renderInterface);
+    if (iter != ProcessedBranchesOut.end()) {
+      if (!HasContent && !DefaultHasContent) continue;
+      renderInterface->renderCaseBlockBegin(privateBlock, Details->branchId);
+    } else {
+      if (!HasContent) break;
+      renderInterface->renderDefaultBlockBegin();
+    }
+    renderInterface->renderBlockPrologue(Target->privateBlock, privateBlock);
+    Details->Render(Target, SetCurrLabel, renderInterface);
+    if (Fused && Fused->InnerMap.find(Target) != Fused->InnerMap.end()) {
+      Fused->InnerMap.find(Target)->second->Render(InLoop, renderInterface);
+    }
+    renderInterface->renderCaseBlockEnd();
+    if (iter == ProcessedBranchesOut.end()) break;
+  }
+  renderInterface->renderBlockEnd();
+}
+
+// The call that may throw is wrapped in a try by the block code itself. Its catch runs the unwind branch
+// and then skips the normal one, so that the normal path has no overhead:
+//
+//   E1: { code; try { call } catch { unwind branch; break E1; } normal branch }
+//
+// The labeled block is not a loop, so unlabeled breaks and continues inside the branches are not affected.
+void Block::RenderTry(bool InLoop, RenderInterface* renderInterface) {
+  assert(ProcessedBranchesOut.size() == 2);
+  // Fusing works as in Render, but the loop of the Multiple must enclose the whole try
+  MultipleShape *Fused = Shape::IsMultiple(Parent->Next);
+  bool SetLabel = true;
+  if (Fused) {
+    Parent->Next = Parent->Next->Next;
+    Fused->RenderLoopPrefix(renderInterface);
+    if (Fused->InnerMap.size() == ProcessedBranchesOut.size()) {
+      SetLabel = false;
+    }
+  }
+
+  renderInterface->renderTryBlockBegin(Id);
+  renderInterface->renderBlock(privateBlock);
+
+  Block *UnwindTarget = NULL;
+  for (BlockBranchMap::iterator iter = ProcessedBranchesOut.begin(); iter != ProcessedBranchesOut.end(); iter++) {
+    if (iter->second->branchId == -1) {
+      DefaultTarget = iter->first;
+    } else {
+      UnwindTarget = iter->first;
+    }
+  }
+  assert(DefaultTarget && UnwindTarget);
+
+  for (int i = 0; i < 2; i++) {
+    Block *Target = i == 0 ? UnwindTarget : DefaultTarget;
+    Branch *Details = ProcessedBranchesOut[Target];
+    if (i == 0) renderInterface->renderCatchBlockBegin(privateBlock);
+    renderInterface->renderBlockPrologue(Target->privateBlock, privateBlock);
+    Details->Render(Target, SetLabel && Target->IsCheckedMultipleEntry, renderInterface);
+    if (Fused && Fused->InnerMap.find(Target) != Fused->InnerMap.end()) {
+      Fused->InnerMap.find(Target)->second->Render(InLoop, renderInterface);
+    }
+    if (i == 0) renderInterface->renderCatchBlockEnd(Id);
+  }
+  renderInterface->renderBlockEnd();
+
+  if (Fused) {
+    Fused->RenderLoopPostfix(renderInterface);
+  }
+}
+
 // Shape
 
-int Shape::IdCounter = 0;
 
 // MultipleShape
 
@@ -203,6 +341,21 @@ void MultipleShape::RenderLoopPostfix(RenderInterface* renderInterface) {
 }
 
 void MultipleShape::Render(bool InLoop, RenderInterface* renderInterface) {
+  if (RendersAsSwitch()) {
+    if (Labeled) {
+      renderInterface->renderSwitchOnLabel(Id);
+    } else {
+      renderInterface->renderSwitchOnLabel();
+    }
+    for (BlockShapeMap::iterator iter = InnerMap.begin(); iter != InnerMap.end(); iter++) {
+      renderInterface->renderCaseOnLabel(iter->first->Id);
+      iter->second->Render(InLoop, renderInterface);
+      renderInterface->renderCaseBlockEnd();
+    }
+    renderInterface->renderBlockEnd();
+    if (Next) Next->Render(InLoop, renderInterface);
+    return;
+  }
   RenderLoopPrefix(renderInterface);
   bool First = true;
   for (BlockShapeMap::iterator iter = InnerMap.begin(); iter != InnerMap.end(); iter++) {
@@ -255,15 +408,18 @@ void EmulatedShape::Render(bool InLoop) {
 
 // Relooper
 
-Relooper::Relooper() : Root(NULL), NeedsLabel(false) {
+Relooper::Relooper() : Root(NULL), NeedsLabel(false), BlockIdCounter(1), ShapeIdCounter(0) {
+  // Block id 0 is reserved for clearings
 }
 
 Relooper::~Relooper() {
   for (unsigned int i = 0; i < Blocks.size(); i++) delete Blocks[i];
-  for (unsigned int i = 0; i < Shapes.size(); i++) delete Shapes[i];
+  // Shapes live in ShapeAllocator, which releases their memory
+  for (unsigned int i = 0; i < Shapes.size(); i++) Shapes[i]->~Shape();
 }
 
 void Relooper::AddBlock(Block *New) {
+  New->Id = BlockIdCounter++;
   Blocks.push_back(New);
 }
 
@@ -272,7 +428,56 @@ struct RelooperRecursor {
   RelooperRecursor(Relooper *ParentInit) : Parent(ParentInit) {}
 };
 
-typedef std::list<Block*> BlockList;
+typedef std::deque<Block*> BlockList;
+
+// A set of the blocks of a Relooper, stored as a bit vector over their dense indices.
+// Indices follow the order of the block ids, so iterating visits the blocks in
+// the same order as a BlockSet, and the shapes do not depend on the representation.
+class DenseBlockSet {
+  const std::vector<Block*> *Universe;
+  llvm::BitVector Bits;
+  unsigned int Count;
+
+public:
+  class iterator : public std::iterator<std::forward_iterator_tag, Block*> {
+    const DenseBlockSet *Set;
+    int Curr;
+
+  public:
+    iterator(const DenseBlockSet *SetInit, int CurrInit) : Set(SetInit), Curr(CurrInit) {}
+    Block *operator*() const { return (*Set->Universe)[Curr]; }
+    iterator &operator++() { Curr = Set->Bits.find_next(Curr); return *this; }
+    iterator operator++(int) { iterator Ret = *this; ++*this; return Ret; }
+    bool operator==(const iterator &Other) const { return Curr == Other.Curr; }
+    bool operator!=(const iterator &Other) const { return Curr != Other.Curr; }
+  };
+
+  DenseBlockSet() : Universe(NULL), Count(0) {}
+  explicit DenseBlockSet(const std::vector<Block*> &UniverseInit) : Universe(&UniverseInit), Bits(UniverseInit.size()), Count(0) {}
+
+  iterator begin() const { return iterator(this, Bits.find_first()); }
+  iterator end() const { return iterator(this, -1); }
+  unsigned int size() const { return Count; }
+  bool count(Block *B) const { return (unsigned int)B->Index < Bits.size() && Bits.test(B->Index); }
+  bool insert(Block *B) {
+    assert(Universe && (*Universe)[B->Index] == B);
+    if (Bits.test(B->Index)) return false;
+    Bits.set(B->Index);
+    Count++;
+    return true;
+  }
+  void erase(Block *B) {
+    if (!count(B)) return;
+    Bits.reset(B->Index);
+    Count--;
+  }
+  void clear() {
+    Bits.reset();
+    Count = 0;
+  }
+};
+
+typedef std::map<Block*, DenseBlockSet, BlockIdLess> BlockBlockSetMap;
 
 void Relooper::Calculate(Block *Entry) {
   // Scan and optimize the input
@@ -307,10 +512,11 @@ void Relooper::Calculate(Block *Entry) {
         for (BlockBranchMap::iterator iter = Original->BranchesIn.begin(); iter != Original->BranchesIn.end(); iter++) {
           Block *Prior = iter->first;
           Block *Split = new Block(Original->privateBlock, Original->IsSplittable);
+          // The id is needed to insert the block in the branch maps
+          Parent->AddBlock(Split);
           Split->BranchesIn[Prior] = new Branch(-1);
           Prior->BranchesOut[Split] = new Branch(Prior->BranchesOut[Original]->branchId);
           Prior->BranchesOut.erase(Original);
-          Parent->AddBlock(Split);
           Live.insert(Split);
         }
       }
@@ -330,33 +536,43 @@ void Relooper::Calculate(Block *Entry) {
 
   Pre.SplitDeadEnds();
 
+  // Give the blocks dense indices in id order, the Analyzer keeps its sets of blocks as bit vectors
+  IndexedBlocks.assign(Blocks.begin(), Blocks.end());
+  std::sort(IndexedBlocks.begin(), IndexedBlocks.end(), BlockIdLess());
+  for (unsigned int i = 0; i < IndexedBlocks.size(); i++) {
+    IndexedBlocks[i]->Index = i;
+  }
+
   // Recursively process the graph
 
   struct Analyzer : public RelooperRecursor {
-    Analyzer(Relooper *Parent) : RelooperRecursor(Parent) {}
+    const std::vector<Block*> &Universe;
+    // The entry owning each block in FindIndependentGroups, indexed by Block::Index. A value
+    // is only valid if its epoch is the current one, so nothing is cleared between calls
+    std::vector<Block*> Ownership;
+    std::vector<unsigned int> OwnershipEpoch;
+    unsigned int Epoch;
 
-    // Add a shape to the list of shapes in this Relooper calculation
-    void Notice(Shape *New) {
-      Parent->Shapes.push_back(New);
-    }
+    Analyzer(Relooper *Parent) : RelooperRecursor(Parent), Universe(Parent->IndexedBlocks),
+      Ownership(Universe.size(), NULL), OwnershipEpoch(Universe.size(), 0), Epoch(0) {}
 
     // Create a list of entries from a block. If LimitTo is provided, only results in that set
     // will appear
-    void GetBlocksOut(Block *Source, BlockSet& Entries, BlockSet *LimitTo=NULL) {
+    void GetBlocksOut(Block *Source, DenseBlockSet& Entries, DenseBlockSet *LimitTo=NULL) {
       for (BlockBranchMap::iterator iter = Source->BranchesOut.begin(); iter != Source->BranchesOut.end(); iter++) {
-        if (!LimitTo || LimitTo->find(iter->first) != LimitTo->end()) {
+        if (!LimitTo || LimitTo->count(iter->first)) {
           Entries.insert(iter->first);
         }
       }
     }
 
     // Converts/processes all branchings to a specific target
-    void Solipsize(Block *Target, Branch::FlowType Type, Shape *Ancestor, BlockSet &From) {
+    void Solipsize(Block *Target, Branch::FlowType Type, Shape *Ancestor, DenseBlockSet &From) {
       PrintDebug("Solipsizing branches into %d\n", Target->Id);
       DebugDump(From, "  relevant to solipsize: ");
       for (BlockBranchMap::iterator iter = Target->BranchesIn.begin(); iter != Target->BranchesIn.end();) {
         Block *Prior = iter->first;
-        if (From.find(Prior) == From.end()) {
+        if (!From.count(Prior)) {
           iter++;
           continue;
         }
@@ -376,49 +592,48 @@ void Relooper::Calculate(Block *Entry) {
       }
     }
 
-    Shape *MakeSimple(BlockSet &Blocks, Block *Inner, BlockSet &NextEntries) {
+    Shape *MakeSimple(DenseBlockSet &Blocks, Block *Inner, DenseBlockSet &NextEntries) {
       PrintDebug("creating simple block with block #%d\n", Inner->Id);
-      SimpleShape *Simple = new SimpleShape;
-      Notice(Simple);
+      SimpleShape *Simple = Parent->NewShape<SimpleShape>();
       Simple->Inner = Inner;
       Inner->Parent = Simple;
       if (Blocks.size() > 1) {
         Blocks.erase(Inner);
         GetBlocksOut(Inner, NextEntries, &Blocks);
-        BlockSet JustInner;
+        DenseBlockSet JustInner(Universe);
         JustInner.insert(Inner);
-        for (BlockSet::iterator iter = NextEntries.begin(); iter != NextEntries.end(); iter++) {
+        for (DenseBlockSet::iterator iter = NextEntries.begin(); iter != NextEntries.end(); iter++) {
           Solipsize(*iter, Branch::Direct, Simple, JustInner);
         }
       }
       return Simple;
     }
 
-    Shape *MakeLoop(BlockSet &Blocks, BlockSet& Entries, BlockSet &NextEntries) {
+    Shape *MakeLoop(DenseBlockSet &Blocks, DenseBlockSet& Entries, DenseBlockSet &NextEntries) {
       // Find the inner blocks in this loop. Proceed backwards from the entries until
       // you reach a seen block, collecting as you go.
-      BlockSet InnerBlocks;
-      BlockSet Queue = Entries;
+      // The visiting order does not matter, the result is the set of all the blocks reaching the entries
+      DenseBlockSet InnerBlocks(Universe);
+      BlockList Queue(Entries.begin(), Entries.end());
       while (Queue.size() > 0) {
-        Block *Curr = *(Queue.begin());
-        Queue.erase(Queue.begin());
-        if (InnerBlocks.find(Curr) == InnerBlocks.end()) {
-          // This element is new, mark it as inner and remove from outer
-          InnerBlocks.insert(Curr);
+        Block *Curr = Queue.back();
+        Queue.pop_back();
+        if (InnerBlocks.insert(Curr)) {
+          // This element is new, it is now inner, remove it from outer
           Blocks.erase(Curr);
           // Add the elements prior to it
           for (BlockBranchMap::iterator iter = Curr->BranchesIn.begin(); iter != Curr->BranchesIn.end(); iter++) {
-            Queue.insert(iter->first);
+            if (!InnerBlocks.count(iter->first)) Queue.push_back(iter->first);
           }
         }
       }
       assert(InnerBlocks.size() > 0);
 
-      for (BlockSet::iterator iter = InnerBlocks.begin(); iter != InnerBlocks.end(); iter++) {
+      for (DenseBlockSet::iterator iter = InnerBlocks.begin(); iter != InnerBlocks.end(); iter++) {
         Block *Curr = *iter;
         for (BlockBranchMap::iterator iter = Curr->BranchesOut.begin(); iter != Curr->BranchesOut.end(); iter++) {
           Block *Possible = iter->first;
-          if (InnerBlocks.find(Possible) == InnerBlocks.end()) {
+          if (!InnerBlocks.count(Possible)) {
             NextEntries.insert(Possible);
           }
         }
@@ -432,16 +647,15 @@ void Relooper::Calculate(Block *Entry) {
 
       // TODO: Optionally hoist additional blocks into the loop
 
-      LoopShape *Loop = new LoopShape();
-      Notice(Loop);
+      LoopShape *Loop = Parent->NewShape<LoopShape>();
 
       // Solipsize the loop, replacing with break/continue and marking branches as Processed (will not affect later calculations)
       // A. Branches to the loop entries become a continue to this shape
-      for (BlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+      for (DenseBlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
         Solipsize(*iter, Branch::Continue, Loop, InnerBlocks);
       }
       // B. Branches to outside the loop (a next entry) become breaks on this shape
-      for (BlockSet::iterator iter = NextEntries.begin(); iter != NextEntries.end(); iter++) {
+      for (DenseBlockSet::iterator iter = NextEntries.begin(); iter != NextEntries.end(); iter++) {
         Solipsize(*iter, Branch::Break, Loop, InnerBlocks);
       }
       // Finish up
@@ -453,41 +667,50 @@ void Relooper::Calculate(Block *Entry) {
     // For each entry, find the independent group reachable by it. The independent group is
     // the entry itself, plus all the blocks it can reach that cannot be directly reached by another entry. Note that we
     // ignore directly reaching the entry itself by another entry.
-    void FindIndependentGroups(BlockSet &Blocks, BlockSet &Entries, BlockBlockSetMap& IndependentGroups) {
-      typedef std::map<Block*, Block*> BlockBlockMap;
-
+    void FindIndependentGroups(DenseBlockSet &Blocks, DenseBlockSet &Entries, BlockBlockSetMap& IndependentGroups) {
       struct HelperClass {
         BlockBlockSetMap& IndependentGroups;
-        BlockBlockMap Ownership; // For each block, which entry it belongs to. We have reached it from there.
-
-        HelperClass(BlockBlockSetMap& IndependentGroupsInit) : IndependentGroups(IndependentGroupsInit) {}
+        // For each block, which entry it belongs to. We have reached it from there.
+        std::vector<Block*>& Owners;
+        std::vector<unsigned int>& OwnersEpoch;
+        unsigned int Epoch;
+
+        HelperClass(BlockBlockSetMap& IndependentGroupsInit, std::vector<Block*>& OwnersInit, std::vector<unsigned int>& OwnersEpochInit, unsigned int EpochInit) :
+          IndependentGroups(IndependentGroupsInit), Owners(OwnersInit), OwnersEpoch(OwnersEpochInit), Epoch(EpochInit) {}
+        bool IsKnown(Block *B) {
+          return OwnersEpoch[B->Index] == Epoch;
+        }
+        // An unknown block becomes known without an owner
+        Block *&Ownership(Block *B) {
+          if (!IsKnown(B)) {
+            OwnersEpoch[B->Index] = Epoch;
+            Owners[B->Index] = NULL;
+          }
+          return Owners[B->Index];
+        }
         void InvalidateWithChildren(Block *New) { // TODO: rename New
           BlockList ToInvalidate; // Being in the list means you need to be invalidated
           ToInvalidate.push_back(New);
           while (ToInvalidate.size() > 0) {
             Block *Invalidatee = ToInvalidate.front();
             ToInvalidate.pop_front();
-            Block *Owner = Ownership[Invalidatee];
-            if (IndependentGroups.find(Owner) != IndependentGroups.end()) { // Owner may have been invalidated, do not add to IndependentGroups!
+            Block *Owner = Ownership(Invalidatee);
+            if (IndependentGroups.count(Owner)) { // Owner may have been invalidated, do not add to IndependentGroups!
               IndependentGroups[Owner].erase(Invalidatee);
             }
-            if (Ownership[Invalidatee]) { // may have been seen before and invalidated already
-              Ownership[Invalidatee] = NULL;
+            if (Owner) { // may have been seen before and invalidated already
+              Ownership(Invalidatee) = NULL;
               for (BlockBranchMap::iterator iter = Invalidatee->BranchesOut.begin(); iter != Invalidatee->BranchesOut.end(); iter++) {
                 Block *Target = iter->first;
-                BlockBlockMap::iterator Known = Ownership.find(Target);
-                if (Known != Ownership.end()) {
-                  Block *TargetOwner = Known->second;
-                  if (TargetOwner) {
-                    ToInvalidate.push_back(Target);
-                  }
+                if (IsKnown(Target) && Ownership(Target)) {
+                  ToInvalidate.push_back(Target);
                 }
               }
             }
           }
         }
       };
-      HelperClass Helper(IndependentGroups);
+      HelperClass Helper(IndependentGroups, Ownership, OwnershipEpoch, ++Epoch);
 
       // We flow out from each of the entries, simultaneously.
       // When we reach a new block, we add it as belonging to the one we got to it from.
@@ -496,29 +719,28 @@ void Relooper::Calculate(Block *Entry) {
       // visited.
 
       BlockList Queue; // Being in the queue means we just added this item, and we need to add its children
-      for (BlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+      for (DenseBlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
         Block *Entry = *iter;
-        Helper.Ownership[Entry] = Entry;
-        IndependentGroups[Entry].insert(Entry);
+        Helper.Ownership(Entry) = Entry;
+        IndependentGroups.insert(std::make_pair(Entry, DenseBlockSet(Universe))).first->second.insert(Entry);
         Queue.push_back(Entry);
       }
       while (Queue.size() > 0) {
         Block *Curr = Queue.front();
         Queue.pop_front();
-        Block *Owner = Helper.Ownership[Curr]; // Curr must be in the ownership map if we are in the queue
+        Block *Owner = Helper.Ownership(Curr); // Curr must be in the ownership map if we are in the queue
         if (!Owner) continue; // we have been invalidated meanwhile after being reached from two entries
         // Add all children
         for (BlockBranchMap::iterator iter = Curr->BranchesOut.begin(); iter != Curr->BranchesOut.end(); iter++) {
           Block *New = iter->first;
-          BlockBlockMap::iterator Known = Helper.Ownership.find(New);
-          if (Known == Helper.Ownership.end()) {
+          if (!Helper.IsKnown(New)) {
             // New node. Add it, and put it in the queue
-            Helper.Ownership[New] = Owner;
+            Helper.Ownership(New) = Owner;
             IndependentGroups[Owner].insert(New);
             Queue.push_back(New);
             continue;
           }
-          Block *NewOwner = Known->second;
+          Block *NewOwner = Helper.Ownership(New);
           if (!NewOwner) continue; // We reached an invalidated node
           if (NewOwner != Owner) {
             // Invalidate this and all reachable that we have seen - we reached this from two locations
@@ -534,14 +756,14 @@ void Relooper::Calculate(Block *Entry) {
       // if an element has a parent which does *not* have the same owner, we must remove it
       // and all its children.
 
-      for (BlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
-        BlockSet &CurrGroup = IndependentGroups[*iter];
+      for (DenseBlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+        DenseBlockSet &CurrGroup = IndependentGroups[*iter];
         BlockList ToInvalidate;
-        for (BlockSet::iterator iter = CurrGroup.begin(); iter != CurrGroup.end(); iter++) {
+        for (DenseBlockSet::iterator iter = CurrGroup.begin(); iter != CurrGroup.end(); iter++) {
           Block *Child = *iter;
           for (BlockBranchMap::iterator iter = Child->BranchesIn.begin(); iter != Child->BranchesIn.end(); iter++) {
             Block *Parent = iter->first;
-            if (Helper.Ownership[Parent] != Helper.Ownership[Child]) {
+            if (Helper.Ownership(Parent) != Helper.Ownership(Child)) {
               ToInvalidate.push_back(Child);
             }
           }
@@ -554,7 +776,7 @@ void Relooper::Calculate(Block *Entry) {
       }
 
       // Remove empty groups
-      for (BlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+      for (DenseBlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
         if (IndependentGroups[*iter].size() == 0) {
           IndependentGroups.erase(*iter);
         }
@@ -568,22 +790,21 @@ void Relooper::Calculate(Block *Entry) {
 #endif
     }
 
-    Shape *MakeMultiple(BlockSet &Blocks, BlockSet& Entries, BlockBlockSetMap& IndependentGroups, Shape *Prev, BlockSet &NextEntries) {
+    Shape *MakeMultiple(DenseBlockSet &Blocks, DenseBlockSet& Entries, BlockBlockSetMap& IndependentGroups, Shape *Prev, DenseBlockSet &NextEntries) {
       PrintDebug("creating multiple block with %d inner groups\n", IndependentGroups.size());
       bool Fused = !!(Shape::IsSimple(Prev));
       Parent->NeedsLabel = true;
-      MultipleShape *Multiple = new MultipleShape();
-      Notice(Multiple);
-      BlockSet CurrEntries;
+      MultipleShape *Multiple = Parent->NewShape<MultipleShape>();
+      DenseBlockSet CurrEntries(Universe);
       for (BlockBlockSetMap::iterator iter = IndependentGroups.begin(); iter != IndependentGroups.end(); iter++) {
         Block *CurrEntry = iter->first;
-        BlockSet &CurrBlocks = iter->second;
+        DenseBlockSet &CurrBlocks = iter->second;
         PrintDebug("  multiple group with entry %d:\n", CurrEntry->Id);
         DebugDump(CurrBlocks, "    ");
         // Create inner block
         CurrEntries.clear();
         CurrEntries.insert(CurrEntry);
-        for (BlockSet::iterator iter = CurrBlocks.begin(); iter != CurrBlocks.end(); iter++) {
+        for (DenseBlockSet::iterator iter = CurrBlocks.begin(); iter != CurrBlocks.end(); iter++) {
           Block *CurrInner = *iter;
           // Remove the block from the remaining blocks
           Blocks.erase(CurrInner);
@@ -592,7 +813,7 @@ void Relooper::Calculate(Block *Entry) {
             Block *CurrTarget = iter->first;
             BlockBranchMap::iterator Next = iter;
             Next++;
-            if (CurrBlocks.find(CurrTarget) == CurrBlocks.end()) {
+            if (!CurrBlocks.count(CurrTarget)) {
               NextEntries.insert(CurrTarget);
               Solipsize(CurrTarget, Branch::Break, Multiple, CurrBlocks); 
             }
@@ -607,9 +828,9 @@ void Relooper::Calculate(Block *Entry) {
       }
       DebugDump(Blocks, "  remaining blocks after multiple:");
       // Add entries not handled as next entries, they are deferred
-      for (BlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
+      for (DenseBlockSet::iterator iter = Entries.begin(); iter != Entries.end(); iter++) {
         Block *Entry = *iter;
-        if (IndependentGroups.find(Entry) == IndependentGroups.end()) {
+        if (!IndependentGroups.count(Entry)) {
           NextEntries.insert(Entry);
         }
       }
@@ -621,12 +842,12 @@ void Relooper::Calculate(Block *Entry) {
     // The Make* functions receive a NextEntries. If they fill it with data, those are the entries for the
     //   ->Next block on them, and the blocks are what remains in Blocks (which Make* modify). In this way
     //   we avoid recursing on Next (imagine a long chain of Simples, if we recursed we could blow the stack).
-    Shape *Process(BlockSet &Blocks, BlockSet& InitialEntries, Shape *Prev) {
+    Shape *Process(DenseBlockSet &Blocks, DenseBlockSet& InitialEntries, Shape *Prev) {
       PrintDebug("Process() called\n");
-      BlockSet *Entries = &InitialEntries;
-      BlockSet TempEntries[2];
+      DenseBlockSet *Entries = &InitialEntries;
+      DenseBlockSet TempEntries[2] = { DenseBlockSet(Universe), DenseBlockSet(Universe) };
       int CurrTempIndex = 0;
-      BlockSet *NextEntries;
+      DenseBlockSet *NextEntries;
       Shape *Ret = NULL;
       #define Make(call) \
         Shape *Temp = call; \
@@ -669,11 +890,11 @@ void Relooper::Calculate(Block *Entry) {
           // a loop inside the multiple block (which is the performant order to do it).
           for (BlockBlockSetMap::iterator iter = IndependentGroups.begin(); iter != IndependentGroups.end();) {
             Block *Entry = iter->first;
-            BlockSet &Group = iter->second;
+            DenseBlockSet &Group = iter->second;
             BlockBlockSetMap::iterator curr = iter++; // iterate carefully, we may delete
             for (BlockBranchMap::iterator iterBranch = Entry->BranchesIn.begin(); iterBranch != Entry->BranchesIn.end(); iterBranch++) {
               Block *Origin = iterBranch->first;
-              if (Group.find(Origin) == Group.end()) {
+              if (!Group.count(Origin)) {
                 // Reached from outside the group, so we cannot handle this
                 PrintDebug("Cannot handle group with entry %d because of incoming branch from %d\n", Entry->Id, Origin->Id);
                 IndependentGroups.erase(curr);
@@ -706,12 +927,12 @@ void Relooper::Calculate(Block *Entry) {
               }
               // Check if dead end
               bool DeadEnd = true;
-              BlockSet &SmallGroup = IndependentGroups[SmallEntry];
-              for (BlockSet::iterator iter = SmallGroup.begin(); iter != SmallGroup.end(); iter++) {
+              DenseBlockSet &SmallGroup = IndependentGroups[SmallEntry];
+              for (DenseBlockSet::iterator iter = SmallGroup.begin(); iter != SmallGroup.end(); iter++) {
                 Block *Curr = *iter;
                 for (BlockBranchMap::iterator iter = Curr->BranchesOut.begin(); iter != Curr->BranchesOut.end(); iter++) {
                   Block *Target = iter->first;
-                  if (SmallGroup.find(Target) == SmallGroup.end()) {
+                  if (!SmallGroup.count(Target)) {
                     DeadEnd = false;
                     break;
                   }
@@ -740,7 +961,7 @@ void Relooper::Calculate(Block *Entry) {
 
   // Main
 
-  BlockSet AllBlocks;
+  DenseBlockSet AllBlocks(IndexedBlocks);
   for (unsigned int i = 0; i < Blocks.size(); i++) {
     AllBlocks.insert(Blocks[i]);
 #if DEBUG
@@ -751,7 +972,7 @@ void Relooper::Calculate(Block *Entry) {
 #endif
   }
 
-  BlockSet Entries;
+  DenseBlockSet Entries(IndexedBlocks);
   Entries.insert(Entry);
   Root = Analyzer(this).Process(AllBlocks, Entries, NULL);
 
@@ -847,9 +1068,20 @@ void Relooper::Calculate(Block *Entry) {
 
         SHAPE_SWITCH(Root, {
           MultipleShape *Fused = Shape::IsMultiple(Root->Next);
-          // If we are fusing a Multiple with a loop into this Simple, then visit it now
+          // An unlabeled break inside a switch would exit the switch. If we are fusing a Multiple
+          // with a loop the switch replaces that loop, otherwise nothing can break to this Simple,
+          // so all the breaks inside the switch get a label
+          Shape *Breakable = NULL;
           if (Fused && Fused->NeedLoop) {
-            LoopStack.push(Fused);
+            Breakable = Fused;
+          } else if (Simple->Inner->RendersAsSwitch()) {
+            Breakable = Simple;
+          }
+          if (Breakable) {
+            LoopStack.push(Breakable);
+          }
+          // If we are fusing a Multiple, then visit it now
+          if (Fused) {
             RECURSE_MULTIPLE_MANUAL(FindLabeledLoops, Fused);
           }
           for (BlockBranchMap::iterator iter = Simple->Inner->ProcessedBranchesOut.begin(); iter != Simple->Inner->ProcessedBranchesOut.end(); iter++) {
@@ -866,18 +1098,18 @@ void Relooper::Calculate(Block *Entry) {
               }
             }
           }
-          if (Fused && Fused->NeedLoop) {
+          if (Breakable) {
             LoopStack.pop();
-            Next = Fused->Next;
-          } else {
-            Next = Root->Next;
           }
+          Next = Fused ? Fused->Next : Root->Next;
         }, {
-          if (Multiple->NeedLoop) {
+          // A switch on the label is a target for breaks, even when we do not need a loop
+          bool Breakable = Multiple->NeedLoop || Multiple->RendersAsSwitch();
+          if (Breakable) {
             LoopStack.push(Multiple);
           }
           RECURSE_MULTIPLE(FindLabeledLoops);
-          if (Multiple->NeedLoop) {
+          if (Breakable) {
             LoopStack.pop();
           }
           Next = Root->Next;
@@ -894,9 +1126,31 @@ void Relooper::Calculate(Block *Entry) {
       }
     }
 
+    // The label variable of a Multiple is cleared by its entries so that a stale value cannot match
+    // when the Multiple is reached again to go to one of the Next entries. Without a Next, every branch
+    // reaching the Multiple targets one of its checked entries and sets the label, so the clear is dead.
+    void RemoveUnneededLabelClears(Shape *Root) {
+      Shape *Next = Root;
+      while (Next) {
+        Root = Next;
+        if (MultipleShape *Multiple = Shape::IsMultiple(Root)) {
+          if (!Multiple->Next) {
+            for (BlockShapeMap::iterator iter = Multiple->InnerMap.begin(); iter != Multiple->InnerMap.end(); iter++) {
+              iter->first->NeedsLabelClear = false;
+            }
+          }
+          RECURSE_MULTIPLE(RemoveUnneededLabelClears);
+        } else if (LoopShape *Loop = Shape::IsLoop(Root)) {
+          RECURSE_LOOP(RemoveUnneededLabelClears);
+        }
+        Next = Root->Next;
+      }
+    }
+
     void Process(Shape *Root) {
       RemoveUnneededFlows(Root);
       FindLabeledLoops(Root);
+      RemoveUnneededLabelClears(Root);
     }
   };
 
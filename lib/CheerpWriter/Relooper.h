@@ -20,14 +20,31 @@ LLVM.
 #include <set>
 #include <vector>
 
+#include "llvm/Support/Allocator.h"
+
 struct Block;
 struct Shape;
+struct MultipleShape;
+
+// Multi-way branches and label dispatches with at least this many targets are rendered as a switch
+const unsigned int SwitchThreshold = 3;
 
 class RenderInterface
 {
 public:
 	virtual void renderBlock(const void* privateBlock) = 0;
 	virtual void renderIfOnLabel(int labelId, bool first) = 0;
+	virtual void renderSwitchOnLabel() = 0;
+	virtual void renderSwitchOnLabel(int labelId) = 0;
+	virtual void renderCaseOnLabel(int labelId) = 0;
+	virtual void renderSwitchBlockBegin(const void* privateBlock) = 0;
+	virtual void renderSwitchBlockBegin(const void* privateBlock, int labelId) = 0;
+	virtual void renderCaseBlockBegin(const void* privateBlock, int branchId) = 0;
+	virtual void renderDefaultBlockBegin() = 0;
+	virtual void renderCaseBlockEnd() = 0;
+	virtual void renderTryBlockBegin(int labelId) = 0;
+	virtual void renderCatchBlockBegin(const void* privateBlock) = 0;
+	virtual void renderCatchBlockEnd(int labelId) = 0;
 	virtual void renderIfBlockBegin(const void* privateBlock, int branchId, bool first) = 0;
 	virtual void renderIfBlockBegin(const void* privateBlock, const std::vector<int>& skipBranchIds, bool first) = 0;
 	virtual void renderElseBlockBegin() = 0;
@@ -61,11 +78,22 @@ struct Branch {
   Branch(int bId);
   ~Branch();
 
+  // Branches are created for every edge of every function, their storage is recycled
+  static void *operator new(size_t Size);
+  static void operator delete(void *Ptr);
+
   // Prints out the branch
   void Render(Block *Target, bool SetLabel, RenderInterface* renderInterface);
 };
 
-typedef std::map<Block*, Branch*> BlockBranchMap;
+// Orders the blocks by id, so that the shapes do not depend on the addresses of the blocks.
+// The original relooper ordered them by address, so the shapes and the order of the rendered
+// blocks may differ from the ones it produced, although they are equivalent.
+struct BlockIdLess {
+  bool operator()(const Block *A, const Block *B) const;
+};
+
+typedef std::map<Block*, Branch*, BlockIdLess> BlockBranchMap;
 
 // Represents a basic block of code - some instructions that end with a
 // control flow modifier (a branch, return or throw).
@@ -80,16 +108,23 @@ struct Block {
   BlockBranchMap ProcessedBranchesOut;
   BlockBranchMap ProcessedBranchesIn;
   Shape *Parent; // The shape we are directly inside
-  int Id; // A unique identifier
+  int Id; // A unique identifier in the Relooper, assigned by AddBlock
+  int Index; // Dense index in the Relooper, assigned by Calculate following the order of the ids
   const void* privateBlock; //A private value that will be passed back to the callback
   Block *DefaultTarget; // The block we branch to without checking the condition, if none of the other conditions held.
                         // Since each block *must* branch somewhere, this must be set
   bool IsCheckedMultipleEntry; // If true, we are a multiple entry, so reaching us requires setting the label variable
+  bool NeedsLabelClear; // If a checked multiple entry, whether we must clear the label variable when reached in a loop
   bool IsSplittable;
+  bool IsSwitch; // If true, all the branch conditions test a single value, so they can be rendered as a switch
+  bool IsTry; // If true, the block ends with a call which may throw. The non default branch is taken when it throws
 
-  Block(const void* privateBlock, bool splittable);
+  Block(const void* privateBlock, bool splittable, bool isSwitch = false, bool isTry = false);
   ~Block();
 
+  // Whether the branchings are rendered as a switch instead of a chain of ifs
+  bool RendersAsSwitch() const { return IsSwitch && ProcessedBranchesOut.size() >= SwitchThreshold; }
+
   /*
    * Return false is a branch to the Target already exists
    */
@@ -98,10 +133,14 @@ struct Block {
   // Prints out the instructions code and branchings
   void Render(bool InLoop, RenderInterface* renderInterface);
 
-  // INTERNAL
-  static int IdCounter;
+private:
+  void RenderSwitch(bool InLoop, MultipleShape *Fused, bool SetLabel, RenderInterface* renderInterface);
+  void RenderTry(bool InLoop, RenderInterface* renderInterface);
 };
 
+// NULL is looked up in the maps too, it comes before every block
+inline bool BlockIdLess::operator()(const Block *A, const Block *B) const { return A && B ? A->Id < B->Id : A < B; }
+
 // Represents a structured control flow shape, one of
 //
 //  Simple: No control flow at all, just instructions. If several
@@ -122,11 +161,10 @@ struct Block {
 
 struct SimpleShape;
 struct LabeledShape;
-struct MultipleShape;
 struct LoopShape;
 
 struct Shape {
-  int Id; // A unique identifier. Used to identify loops, labels are Lx where x is the Id.
+  int Id; // A unique identifier in the Relooper, assigned by NewShape. Used to identify loops, labels are Lx where x is the Id.
   Shape *Next; // The shape that will appear in the code right after this one
 
   enum ShapeType {
@@ -136,7 +174,7 @@ struct Shape {
   };
   ShapeType Type;
 
-  Shape(ShapeType TypeInit) : Id(Shape::IdCounter++), Next(NULL), Type(TypeInit) {}
+  Shape(ShapeType TypeInit) : Id(-1), Next(NULL), Type(TypeInit) {}
   virtual ~Shape() {}
 
   virtual void Render(bool InLoop, RenderInterface* renderInterface) = 0;
@@ -145,9 +183,6 @@ struct Shape {
   static MultipleShape *IsMultiple(Shape *It) { return It && It->Type == Multiple ? (MultipleShape*)It : NULL; }
   static LoopShape *IsLoop(Shape *It) { return It && It->Type == Loop ? (LoopShape*)It : NULL; }
   static LabeledShape *IsLabeled(Shape *It) { return IsMultiple(It) || IsLoop(It) ? (LabeledShape*)It : NULL; }
-
-  // INTERNAL
-  static int IdCounter;
 };
 
 struct SimpleShape : public Shape {
@@ -160,7 +195,7 @@ struct SimpleShape : public Shape {
   }
 };
 
-typedef std::map<Block*, Shape*> BlockShapeMap;
+typedef std::map<Block*, Shape*, BlockIdLess> BlockShapeMap;
 
 // A shape that may be implemented with a labeled loop.
 struct LabeledShape : public Shape {
@@ -176,6 +211,9 @@ struct MultipleShape : public LabeledShape {
 
   MultipleShape() : LabeledShape(Multiple), NeedLoop(0) {}
 
+  // When dispatching on the label with a switch, the switch itself is the target of our breaks and no loop is needed
+  bool RendersAsSwitch() const { return InnerMap.size() >= SwitchThreshold; }
+
   void RenderLoopPrefix(RenderInterface* renderInterface);
   void RenderLoopPostfix(RenderInterface* renderInterface);
 
@@ -200,24 +238,39 @@ struct EmulatedShape : public Shape {
 //
 // Usage:
 //  1. Instantiate this struct.
-//  2. Call AddBlock with the blocks you have. Each should already
-//     have its branchings in specified (the branchings out will
-//     be calculated by the relooper).
+//  2. Call AddBlock with the blocks you have, before adding the
+//     branchings between them, since the blocks are ordered by the
+//     id assigned by AddBlock.
 //  3. Call Render().
 //
 // Implementation details: The Relooper instance has
 // ownership of the blocks and shapes, and frees them when done.
+// Shapes are allocated from a pool owned by the Relooper.
 struct Relooper {
   std::deque<Block*> Blocks;
+  std::vector<Block*> IndexedBlocks; // The blocks sorted by id, so that IndexedBlocks[i]->Index == i
   std::deque<Shape*> Shapes;
+  llvm::BumpPtrAllocator ShapeAllocator;
   Shape *Root;
   bool NeedsLabel;
+  // The ids only depend on the order of the blocks and of the shapes of this Relooper,
+  // so that the labels of a function are the same whatever was compiled before it
+  int BlockIdCounter;
+  int ShapeIdCounter;
 
   Relooper();
   ~Relooper();
 
   void AddBlock(Block *New);
 
+  // Allocates a new shape from the pool
+  template<class T> T *NewShape() {
+    T *New = new (ShapeAllocator.Allocate<T>()) T();
+    New->Id = ShapeIdCounter++;
+    Shapes.push_back(New);
+    return New;
+  }
+
   // Calculates the shapes
   void Calculate(Block *Entry);
 
@@ -227,8 +280,7 @@ struct Relooper {
   bool needsLabel() const { return NeedsLabel; }
 };
 
-typedef std::set<Block*> BlockSet;
-typedef std::map<Block*, BlockSet> BlockBlockSetMap;
+typedef std::set<Block*, BlockIdLess> BlockSet;
 
 #if DEBUG
 struct Debugging {
@@ -9,8 +9,12 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Cheerp/SourceMaps.h"
 #include "llvm/IR/Metadata.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 
 using namespace llvm;
@@ -18,9 +22,18 @@ using namespace llvm;
 namespace cheerp
 {
 
-SourceMapGenerator::SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C, std::string& ErrorString):
+SourceMapGenerator::SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, bool sourcesContent,
+		llvm::LLVMContext& C, std::string& ErrorString):
 	sourceMap(sourceMapName.c_str(), ErrorString, sys::fs::F_None), sourceMapName(sourceMapName), sourceMapPrefix(sourceMapPrefix),
-	Ctx(C), lastFile(0), lastLine(0), lastColoumn(0), validInfo(false), lineStart(true)
+	Ctx(C), sourcesContent(sourcesContent), lastScope(NULL), lastScopeFile(0), lastFile(0), lastLine(0), lastColoumn(0),
+	lastLineMapped(false), validInfo(false), lineStart(true)
+{
+}
+
+SourceMapGenerator::SourceMapGenerator(const SourceMapGenerator& other, const std::string& sourceMapName, std::string& ErrorString):
+	sourceMap(sourceMapName.c_str(), ErrorString, sys::fs::F_None), sourceMapName(sourceMapName), sourceMapPrefix(other.sourceMapPrefix),
+	Ctx(other.Ctx), sourcesContent(other.sourcesContent), lastScope(NULL), lastScopeFile(0), lastFile(0), lastLine(0), lastColoumn(0),
+	lastLineMapped(false), validInfo(false), lineStart(true)
 {
 }
 
@@ -33,6 +46,9 @@ void SourceMapGenerator::writeBase64VLQInt(int i)
 		i = ((-i) << 1) | 1;
 	else
 		i = i << 1;
+	// 32 bits are at most 7 characters
+	char encoded[7];
+	uint32_t length = 0;
 	do
 	{
 		// 5 bit of data, 1 of continuation
@@ -40,9 +56,30 @@ void SourceMapGenerator::writeBase64VLQInt(int i)
 		i >>= 5;
 		if(i)
 			base64Char |= 0x20;
-		sourceMap.os() << base64Chars[base64Char];
+		encoded[length++] = base64Chars[base64Char];
 	}
 	while(i);
+	mappings.append(encoded, length);
+}
+
+uint32_t SourceMapGenerator::getFileIndex(MDNode* scope)
+{
+	if (scope == lastScope)
+		return lastScopeFile;
+	assert(scope->getNumOperands()>=2);
+	MDNode* fileNamePath = cast<MDNode>(scope->getOperand(1));
+	assert(fileNamePath->getNumOperands()==2);
+	MDString* fileNameString = cast<MDString>(fileNamePath->getOperand(0));
+
+	auto fileMapIt = fileMap.find(fileNameString);
+	if (fileMapIt == fileMap.end())
+	{
+		fileMapIt = fileMap.insert(std::make_pair(fileNameString, files.size())).first;
+		files.push_back(fileNamePath);
+	}
+	lastScope = scope;
+	lastScopeFile = fileMapIt->second;
+	return lastScopeFile;
 }
 
 void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc& debugLoc)
@@ -54,31 +91,28 @@ void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc& debugLoc)
 	else
 	{
 		// Start a new line
-		MDNode* file = debugLoc.getScope(Ctx);
-		assert(file->getNumOperands()>=2);
-		MDNode* fileNamePath = cast<MDNode>(file->getOperand(1));
-		assert(fileNamePath->getNumOperands()==2);
-		MDString* fileNameString = cast<MDString>(fileNamePath->getOperand(0));
-
-		auto fileMapIt = fileMap.find(fileNameString);
-		if (fileMapIt == fileMap.end())
-			fileMapIt = fileMap.insert(std::make_pair(fileNameString, fileMap.size())).first;
-		uint32_t currentFile = fileMapIt->second;
+		uint32_t currentFile = getFileIndex(debugLoc.getScope(Ctx));
 		uint32_t currentLine = debugLoc.getLine() - 1;
 		uint32_t currentColoumn = debugLoc.getCol();
-		// Starting coloumn in the generated code
-		writeBase64VLQInt(0);
-		// Other fields are encoded as difference from the previous one in the file
-		// We can use the last value directly because it is initialized as 0
-		// File index
-		writeBase64VLQInt(currentFile - lastFile);
-		// Line index
-		writeBase64VLQInt(currentLine - lastLine);
-		// Coloumn index
-		writeBase64VLQInt(currentColoumn - lastColoumn);
-		lastFile = currentFile;
-		lastLine = currentLine;
-		lastColoumn = currentColoumn;
+		// Only the first of consecutive lines with the same location gets a segment,
+		// the code of a single statement usually spans many lines
+		if(!lastLineMapped || currentFile != lastFile || currentLine != lastLine || currentColoumn != lastColoumn)
+		{
+			// Starting coloumn in the generated code
+			writeBase64VLQInt(0);
+			// Other fields are encoded as difference from the previous one in the file
+			// We can use the last value directly because it is initialized as 0
+			// File index
+			writeBase64VLQInt(currentFile - lastFile);
+			// Line index
+			writeBase64VLQInt(currentLine - lastLine);
+			// Coloumn index
+			writeBase64VLQInt(currentColoumn - lastColoumn);
+			lastFile = currentFile;
+			lastLine = currentLine;
+			lastColoumn = currentColoumn;
+		}
+		lastLineMapped = true;
 	}
 	lineStart = false;
 }
@@ -90,23 +124,60 @@ void SourceMapGenerator::beginFile()
 	sourceMap.os() << "\"version\": 3,\n";
 	sourceMap.os() << "\"names\": [],\n";
 	sourceMap.os() << "\"mappings\": \"";
+	mappings.clear();
+	// Most lines have a short segment
+	mappings.reserve(1 << 16);
 }
 
 void SourceMapGenerator::finishLine()
 {
 	assert(!validInfo);
-	sourceMap.os() << ";";
+	// A line without locations stops the current segment
+	if(lineStart)
+		lastLineMapped = false;
+	mappings.push_back(';');
 	lineStart = true;
 }
 
+static void writeJSONString(raw_ostream& os, StringRef string)
+{
+	os << '"';
+	for(char c: string)
+	{
+		switch(c)
+		{
+			case '"':
+				os << "\\\"";
+				break;
+			case '\\':
+				os << "\\\\";
+				break;
+			case '\n':
+				os << "\\n";
+				break;
+			case '\r':
+				os << "\\r";
+				break;
+			case '\t':
+				os << "\\t";
+				break;
+			default:
+				if((unsigned char)c < 0x20)
+					os << format("\\u%04x", (unsigned char)c);
+				else
+					os << c;
+		}
+	}
+	os << '"';
+}
+
 void SourceMapGenerator::endFile()
 {
+	sourceMap.os() << mappings;
+	mappings.clear();
 	// Output the prologue of the file
 	sourceMap.os() << "\",\n";
 	// Output file names
-	SmallVector<MDString*, 10> files(fileMap.size(), NULL);
-	for(auto mapItem: fileMap)
-		files[mapItem.second] = mapItem.first;
 	sourceMap.os() << "\"sources\": [";
 	for(uint32_t i=0;i<files.size();i++)
 	{
@@ -114,7 +185,7 @@ void SourceMapGenerator::endFile()
 			sourceMap.os() << ',';
 		// Fix slashes in the file path
 		std::string tmp;
-		StringRef string=files[i]->getString();
+		StringRef string=cast<MDString>(files[i]->getOperand(0))->getString();
 		unsigned start=0;
 		if(string.startswith(sourceMapPrefix))
 			start=sourceMapPrefix.size();
@@ -126,13 +197,43 @@ void SourceMapGenerator::endFile()
 				c='/';
 			tmp.push_back(c);
 		}
-		sourceMap.os() << '"' << tmp << '"';
+		writeJSONString(sourceMap.os(), tmp);
 	}
-	sourceMap.os() << "]\n";
-	sourceMap.os() << "}\n";
+	sourceMap.os() << "]";
+	if(sourcesContent)
+	{
+		// Files which cannot be read are null
+		sourceMap.os() << ",\n\"sourcesContent\": [";
+		for(uint32_t i=0;i<files.size();i++)
+		{
+			if(i!=0)
+				sourceMap.os() << ',';
+			SmallString<256> path(cast<MDString>(files[i]->getOperand(1))->getString());
+			sys::path::append(path, cast<MDString>(files[i]->getOperand(0))->getString());
+			StringRef fileName = cast<MDString>(files[i]->getOperand(0))->getString();
+			OwningPtr<MemoryBuffer> content;
+			if(MemoryBuffer::getFile(sys::path::is_absolute(fileName) ? fileName : path.str(), content))
+				sourceMap.os() << "null";
+			else
+				writeJSONString(sourceMap.os(), content->getBuffer());
+		}
+		sourceMap.os() << "]";
+	}
+	sourceMap.os() << "\n}\n";
 	sourceMap.keep();
 }
 
+void SourceMapRecorder::replay(SourceMapGenerator& generator) const
+{
+	for(const DebugLoc& debugLoc: events)
+	{
+		if(debugLoc.isUnknown())
+			generator.finishLine();
+		else
+			generator.setDebugLoc(debugLoc);
+	}
+}
+
 std::string SourceMapGenerator::getSourceMapName() const
 {
 	return llvm::sys::path::filename(sourceMapName);
@@ -67,7 +67,15 @@ void CheerpWriter::compileTypeImpl(Type* t, COMPILE_TYPE_STYLE style)
 				break;
 			}
 			StructType* st=static_cast<StructType*>(t);
-			if(style == LITERAL_OBJ)
+			//Named structs are created by their constructor, the fields are passed in order
+			bool useConstructor = style == LITERAL_OBJ && st->hasName();
+			if(useConstructor)
+			{
+				stream << "new ";
+				compileStructConstructorName(st);
+				stream << '(';
+			}
+			else if(style == LITERAL_OBJ)
 				stream << '{';
 			StructType::element_iterator E=st->element_begin();
 			StructType::element_iterator EE=st->element_end();
@@ -83,16 +91,31 @@ void CheerpWriter::compileTypeImpl(Type* t, COMPILE_TYPE_STYLE style)
 				}
 				if(style==THIS_OBJ)
 					stream << "this.";
-				stream << 'a' << offset << '0';
-				if(style==LITERAL_OBJ)
-					stream << ':';
+				if(!useConstructor)
+				{
+					stream << 'a' << offset << '0';
+					if(style==LITERAL_OBJ)
+						stream << ':';
+					else
+						stream << '=';
+				}
+				if((*E)->isPointerTy())
+					stream << (PA.getPointerKindForStoredField(st, offset)==COMPLETE_OBJECT ? "null" : "nullObj");
 				else
-					stream << '=';
-				compileType(*E, LITERAL_OBJ);
+					compileType(*E, LITERAL_OBJ);
 				offset++;
 			}
-			if(style == LITERAL_OBJ)
+			if(useConstructor)
+				stream << ')';
+			else if(style == LITERAL_OBJ)
 				stream << '}';
+			else
+			{
+				//Reserve the properties set when the object is added to a downcast array
+				const StructInfo* info = types.getStructInfo(st);
+				if(info && info->hasDowncastSlots)
+					stream << ';' << NewLine << "this.o=0;" << NewLine << "this.a=null";
+			}
 			break;
 		}
 		case Type::PointerTyID:
@@ -134,30 +157,49 @@ void CheerpWriter::compileTypeImpl(Type* t, COMPILE_TYPE_STYLE style)
 	}
 }
 
-void CheerpWriter::compileType(Type* t, COMPILE_TYPE_STYLE style)
+void CheerpWriter::compileAllocaType(const AllocaInst* ai)
 {
-	bool addDowncastArray = false;
-	if(StructType* st=dyn_cast<StructType>(t))
+	Type* t = ai->getAllocatedType();
+	const MDNode* slot = ai->getMetadata("cheerp.stackslot");
+	if(!slot)
 	{
-		//TODO: Verify that it makes sense to assume struct with no name has no bases
-		if(st->hasName() && module.getNamedMetadata(Twine(st->getName(),"_bases")) &&
-			globalDeps.classesWithBaseInfo().count(st))
-		{
-			addDowncastArray = true;
-		}
+		compileType(t, LITERAL_OBJ);
+		return;
+	}
+	// Allocas wrapped in an array of one element by AllocaArrays
+	ArrayType* at = cast<ArrayType>(t);
+	bool wrapped = at->getNumElements() == 1 && at->getElementType()->isArrayTy();
+	if(wrapped)
+	{
+		stream << '[';
+		at = cast<ArrayType>(at->getElementType());
 	}
-	if(addDowncastArray)
+	stream << "new ";
+	compileTypedArrayType(at->getElementType());
+	stream << '(';
+	compileStackSlotName(cast<ConstantInt>(slot->getOperand(0))->getZExtValue());
+	stream << ".buffer,0," << at->getNumElements() << ')';
+	if(wrapped)
+		stream << ']';
+}
+
+void CheerpWriter::compileType(Type* t, COMPILE_TYPE_STYLE style)
+{
+	const StructInfo* info = nullptr;
+	if(StructType* st=dyn_cast<StructType>(t))
+		info = types.getStructInfo(st);
+	if(info && info->needsDowncastArray)
 	{
 		if(style==LITERAL_OBJ)
 		{
-			stream << "create" << namegen.filterLLVMName(cast<StructType>(t)->getName(), true) << '(';
+			stream << "create" << info->jsName << '(';
 			compileTypeImpl(t, LITERAL_OBJ);
 			stream << ')';
 		}
 		else
 		{
 			compileTypeImpl(t, THIS_OBJ);
-			stream << "create" << namegen.filterLLVMName(cast<StructType>(t)->getName(), true) << "(this)";
+			stream << "create" << info->jsName << "(this)";
 		}
 	}
 	else
@@ -195,15 +237,11 @@ void CheerpWriter::compileClassType(StructType* T)
 		llvm::report_fatal_error("Unsupported code found, please report a bug", false);
 		return;
 	}
+	const StructInfo* info = types.getStructInfo(T);
+	assert(info && info->hasBasesMetadata);
 	//This function is used as a constructor using the new syntax
-	stream << "function create" << namegen.filterLLVMName(T->getName(), true) << "(obj){" << NewLine;
-
-	NamedMDNode* basesNamedMeta=module.getNamedMetadata(Twine(T->getName(),"_bases"));
-	assert(basesNamedMeta);
-	MDNode* basesMeta=basesNamedMeta->getOperand(0);
-	assert(basesMeta->getNumOperands()==2);
-	uint32_t baseMax=getIntFromValue(basesMeta->getOperand(1));
-	stream << "var a=new Array(" << baseMax << ");" << NewLine;
+	stream << "function create" << info->jsName << "(obj){" << NewLine;
+	stream << "var a=new Array(" << info->downcastArraySize << ");" << NewLine;
 	compileClassTypeRecursive("obj", T, 0);
 	stream << "return obj;}" << NewLine;
 }
@@ -217,7 +255,7 @@ void CheerpWriter::compileArrayClassType(StructType* T)
 		return;
 	}
 	stream << "function createArray";
-	stream << namegen.filterLLVMName(T->getName(), true);
+	stream << types.getStructInfo(T)->jsName;
 	stream << "(ret,start){" << NewLine;
 	stream << "for(var __i__=start;__i__<ret.length;__i__++)" << NewLine;
 	stream << "ret[__i__]=";
@@ -225,6 +263,46 @@ void CheerpWriter::compileArrayClassType(StructType* T)
 	stream << ';' << NewLine << "return ret;" << NewLine << '}' << NewLine;
 }
 
+void CheerpWriter::compileStructConstructorName(StructType* T)
+{
+	constructedTypes.insert(T);
+	const StructInfo* info = types.getStructInfo(T);
+	//Generated names never contain a $, so the short names do not clash with them
+	if(!readableOutput && info && info->constructorId)
+		stream << "C$" << info->constructorId;
+	else if(info && !info->jsName.empty())
+		stream << "constructor" << info->jsName;
+	else
+		stream << "constructor" << namegen.filterLLVMName(T->getName(), true);
+}
+
+void CheerpWriter::compileStructConstructors()
+{
+	//Sort the types, so that the output does not depend on the order they are used in
+	std::vector<StructType*> sortedTypes(constructedTypes.begin(), constructedTypes.end());
+	std::sort(sortedTypes.begin(), sortedTypes.end(), [](StructType* lhs, StructType* rhs) { return lhs->getName() < rhs->getName(); });
+	for(StructType* T: sortedTypes)
+	{
+		stream << "function ";
+		compileStructConstructorName(T);
+		stream << '(';
+		for(uint32_t i=0;i<T->getNumElements();i++)
+		{
+			if(i!=0)
+				stream << ',';
+			stream << 'a' << i;
+		}
+		stream << "){" << NewLine;
+		for(uint32_t i=0;i<T->getNumElements();i++)
+			stream << "this.a" << i << "0=a" << i << ';' << NewLine;
+		//The properties set when the object is added to a downcast array, so that its shape does not change
+		const StructInfo* info = types.getStructInfo(T);
+		if(info && info->hasDowncastSlots)
+			stream << "this.o=0;" << NewLine << "this.a=null;" << NewLine;
+		stream << '}' << NewLine;
+	}
+}
+
 void CheerpWriter::compileArrayPointerType()
 {
 	stream << "function createPointerArray(ret, start) { for(var __i__=start;__i__<ret.length;__i__++) ret[__i__]={ d: null, o: 0}; return ret; }"
@@ -17,10 +17,6 @@
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/Type.h"
 #include "llvm/Cheerp/Writer.h"
-#include "llvm/Cheerp/AllocaMerging.h"
-#include "llvm/Cheerp/PointerPasses.h"
-#include "llvm/Cheerp/Registerize.h"
-#include "llvm/Cheerp/ResolveAliases.h"
 #include "llvm/Cheerp/SourceMaps.h"
 #include "llvm/Support/CommandLine.h"
 
@@ -32,10 +28,32 @@ static cl::opt<std::string> SourceMap("cheerp-sourcemap", cl::Optional,
 static cl::opt<std::string> SourceMapPrefix("cheerp-sourcemap-prefix", cl::Optional,
   cl::desc("If specified, this prefix will be removed from source map file paths"), cl::value_desc("path"));
 
+static cl::opt<bool> SourceMapSourcesContent("cheerp-sourcemap-sources-content",
+  cl::desc("Embed the content of the source files in the source map") );
+
 static cl::opt<bool> PrettyCode("cheerp-pretty-code", cl::desc("Generate human-readable JS") );
 
 static cl::opt<bool> NoRegisterize("cheerp-no-registerize", cl::desc("Disable registerize pass") );
 
+static cl::opt<unsigned> WriteThreads("cheerp-write-threads", cl::init(1),
+  cl::desc("Number of threads used to generate the code of functions"), cl::value_desc("threads"));
+
+static cl::opt<bool> AsmJSCoercions("cheerp-asmjs-coercions", cl::desc("Emit asm.js style type coercions in all the functions which only manipulate numeric values") );
+
+static cl::opt<bool> CodeSize("cheerp-code-size", cl::desc("Reduce the size of the generated JS using shared helpers and merging identical functions") );
+
+static cl::opt<bool> SizeReport("cheerp-size-report", cl::desc("Print a per function breakdown of the size of the generated JS") );
+
+static cl::opt<std::string> LazyChunks("cheerp-lazy-chunks", cl::Optional,
+  cl::desc("If specified, functions not directly called from webMain are written to chunks loaded on demand, using this path as prefix"),
+  cl::value_desc("path"));
+
+static cl::opt<bool> FieldSensitivePointers("cheerp-field-sensitive-pointers", cl::desc("Compute the kind of pointers stored in memory separately for each struct field") );
+
+static cl::opt<bool> TypedLocals("cheerp-typed-locals", cl::desc("Declare all the locals at the start of functions, initialized with a value of their type") );
+
+static cl::opt<bool> TypedArrayPool("cheerp-typed-array-pool", cl::desc("Recycle the typed arrays released by free/delete using size-class pools") );
+
 extern "C" void LLVMInitializeCheerpBackendTarget() {
   // Register the target.
   RegisterTargetMachine<CheerpTargetMachine> X(TheCheerpBackendTarget);
@@ -63,7 +81,7 @@ bool CheerpWritePass::runOnModule(Module& M)
   if (!SourceMap.empty())
   {
     std::string ErrorString;
-    sourceMapGenerator = new cheerp::SourceMapGenerator(SourceMap, SourceMapPrefix, M.getContext(), ErrorString);
+    sourceMapGenerator = new cheerp::SourceMapGenerator(SourceMap, SourceMapPrefix, SourceMapSourcesContent, M.getContext(), ErrorString);
     if (!ErrorString.empty())
     {
        // An error occurred opening the source map file, bail out
@@ -72,7 +90,9 @@ bool CheerpWritePass::runOnModule(Module& M)
        return false;
     }
   }
-  cheerp::CheerpWriter writer(M, Out, PA, registerize, GDA, sourceMapGenerator, PrettyCode, NoRegisterize);
+  cheerp::CheerpWriter writer(M, Out, PA, registerize, GDA, sourceMapGenerator, PrettyCode, NoRegisterize,
+                              AsmJSCoercions, TypedArrayPool, TypedLocals, CodeSize, SizeReport, LazyChunks,
+                              WriteThreads);
   writer.makeJS();
   delete sourceMapGenerator;
   return false;
@@ -98,16 +118,7 @@ bool CheerpTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
                                            AnalysisID StartAfter,
                                            AnalysisID StopAfter) {
   if (FileType != TargetMachine::CGFT_AssemblyFile) return true;
-  PM.add(createResolveAliasesPass());
-  PM.add(cheerp::createGlobalDepsAnalyzerPass());
-  PM.add(createPointerArithmeticToArrayIndexingPass());
-  PM.add(createPointerToImmutablePHIRemovalPass());
-  PM.add(cheerp::createPointerAnalyzerPass());
-  PM.add(createIndirectCallOptimizerPass());
-  PM.add(cheerp::createRegisterizePass(NoRegisterize));
-  PM.add(createAllocaMergingPass());
-  PM.add(createAllocaArraysPass());
-  PM.add(createAllocaArraysMergingPass());
+  cheerp::addPreparationPasses(PM, FieldSensitivePointers, NoRegisterize);
   PM.add(new CheerpWritePass(o));
   return false;
 }
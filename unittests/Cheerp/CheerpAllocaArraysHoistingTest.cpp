@@ -0,0 +1,148 @@
+//===- llvm/unittest/Cheerp/CheerpAllocaArraysHoistingTest.cpp ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/Cheerp/AllocaMerging.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/PassManager.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+using namespace cheerp;
+
+// Each function reads an element of its array which it did not write, so the hoisted arrays must be zeroed
+#define SCRATCH_BODY(name) \
+	"  %buf = alloca [4 x i32]\n" \
+	"  %b0 = getelementptr [4 x i32]* %buf, i32 0, i32 0\n" \
+	"  store i32 %x, i32* %b0\n" \
+	"  %b1 = getelementptr [4 x i32]* %buf, i32 0, i32 1\n" \
+	"  %" name " = load i32* %b1\n"
+
+const char* hoistingFunctions =
+	"@fp = global void ()* null\n"
+	// Math is the only client class which never calls back compiled code
+	"define i32 @leaf(i32 %x) {\n"
+	"entry:\n"
+	SCRATCH_BODY("v")
+	"  %d = sitofp i32 %x to double\n"
+	"  %s = call double @_ZN6client4Math4sqrtEd(double %d)\n"
+	"  %r = fptosi double %s to i32\n"
+	"  %t = add i32 %r, %v\n"
+	"  ret i32 %t\n"
+	"}\n"
+	// Only calls known code
+	"define i32 @caller(i32 %x) {\n"
+	"entry:\n"
+	SCRATCH_BODY("v")
+	"  %r = call i32 @leaf(i32 %v)\n"
+	"  ret i32 %r\n"
+	"}\n"
+	// Any other client function may run a callback
+	"define i32 @client(i32 %x) {\n"
+	"entry:\n"
+	SCRATCH_BODY("v")
+	"  call void @_ZN6client6Window5alertEv()\n"
+	"  ret i32 %v\n"
+	"}\n"
+	"define i32 @recursive(i32 %x) {\n"
+	"entry:\n"
+	SCRATCH_BODY("v")
+	"  %c = icmp sgt i32 %x, 0\n"
+	"  br i1 %c, label %rec, label %exit\n"
+	"rec:\n"
+	"  %m = sub i32 %x, 1\n"
+	"  %r = call i32 @recursive(i32 %m)\n"
+	"  br label %exit\n"
+	"exit:\n"
+	"  %p = phi i32 [ %r, %rec ], [ %v, %entry ]\n"
+	"  ret i32 %p\n"
+	"}\n"
+	// The target of the pointer is unknown, it may be the function itself
+	"define i32 @indirect(i32 %x) {\n"
+	"entry:\n"
+	SCRATCH_BODY("v")
+	"  %f = load void ()** @fp\n"
+	"  call void %f()\n"
+	"  ret i32 %v\n"
+	"}\n"
+	// Calls a function which calls unknown code
+	"define i32 @callsIndirect(i32 %x) {\n"
+	"entry:\n"
+	SCRATCH_BODY("v")
+	"  %r = call i32 @indirect(i32 %v)\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @caller(i32 1)\n"
+	"  %b = call i32 @client(i32 1)\n"
+	"  %c = call i32 @recursive(i32 1)\n"
+	"  %d = call i32 @callsIndirect(i32 1)\n"
+	"  ret void\n"
+	"}\n"
+	"declare double @_ZN6client4Math4sqrtEd(double)\n"
+	"declare void @_ZN6client6Window5alertEv()\n";
+
+#undef SCRATCH_BODY
+
+bool hasAlloca(const Function* F)
+{
+	for(const Instruction& I: F->getEntryBlock())
+	{
+		if(isa<AllocaInst>(I))
+			return true;
+	}
+	return false;
+}
+
+bool hasMemSet(const Function* F)
+{
+	for(const Instruction& I: F->getEntryBlock())
+	{
+		if(isa<MemSetInst>(I))
+			return true;
+	}
+	return false;
+}
+
+TEST(CheerpTest, AllocaArraysHoistingTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(hoistingFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	PassManager PM;
+	PM.add(createAllocaArraysHoistingPass());
+	PM.run(*M);
+
+	// The arrays of the functions which can't be reentered become zeroed globals
+	for(const char* name: { "leaf", "caller" })
+	{
+		const Function* F = M->getFunction(name);
+		EXPECT_FALSE(hasAlloca(F)) << name;
+		EXPECT_TRUE(hasMemSet(F)) << name;
+		const GlobalVariable* scratch = M->getNamedGlobal((Twine(name) + ".buf").str());
+		ASSERT_TRUE(scratch != NULL) << name;
+		EXPECT_TRUE(scratch->hasInternalLinkage()) << name;
+	}
+	// The other ones keep their allocas
+	for(const char* name: { "client", "recursive", "indirect", "callsIndirect" })
+	{
+		const Function* F = M->getFunction(name);
+		EXPECT_TRUE(hasAlloca(F)) << name;
+		EXPECT_FALSE(hasMemSet(F)) << name;
+		EXPECT_TRUE(M->getNamedGlobal((Twine(name) + ".buf").str()) == NULL) << name;
+	}
+}
+
+}
+}
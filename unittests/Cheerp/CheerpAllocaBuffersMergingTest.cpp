@@ -0,0 +1,126 @@
+//===- llvm/unittest/Cheerp/CheerpAllocaBuffersMergingTest.cpp ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* slotFunctions =
+	"%struct.V = type { i32, i32 }\n"
+	"@out = global i32 0\n"
+	// The two arrays are never live at the same time. The function is recursive, so they are not hoisted to globals.
+	// The second array reads the bytes where the first one stored 1.5, they must be zeroed when its lifetime starts
+	"define i32 @work(i32 %n) {\n"
+	"entry:\n"
+	"  %s = alloca %struct.V\n"
+	"  %d = alloca [4 x double]\n"
+	"  %w = alloca [8 x i32]\n"
+	"  %sa = getelementptr %struct.V* %s, i32 0, i32 0\n"
+	"  store i32 %n, i32* %sa\n"
+	"  %d8 = bitcast [4 x double]* %d to i8*\n"
+	"  call void @llvm.lifetime.start(i64 32, i8* %d8)\n"
+	"  %d0 = getelementptr [4 x double]* %d, i32 0, i32 0\n"
+	"  store double 1.5, double* %d0\n"
+	"  %d1 = getelementptr [4 x double]* %d, i32 0, i32 0\n"
+	"  %dv = load double* %d1\n"
+	"  %di = fptosi double %dv to i32\n"
+	"  call void @llvm.lifetime.end(i64 32, i8* %d8)\n"
+	"  %w8 = bitcast [8 x i32]* %w to i8*\n"
+	"  call void @llvm.lifetime.start(i64 32, i8* %w8)\n"
+	"  %w0 = getelementptr [8 x i32]* %w, i32 0, i32 0\n"
+	"  store i32 7, i32* %w0\n"
+	"  %w1 = getelementptr [8 x i32]* %w, i32 0, i32 1\n"
+	"  %wv = load i32* %w1\n"
+	"  call void @llvm.lifetime.end(i64 32, i8* %w8)\n"
+	"  %sv = load i32* %sa\n"
+	"  %c = icmp sgt i32 %sv, 0\n"
+	"  br i1 %c, label %rec, label %exit\n"
+	"rec:\n"
+	"  %m = sub i32 %sv, 1\n"
+	"  %r = call i32 @work(i32 %m)\n"
+	"  br label %exit\n"
+	"exit:\n"
+	"  %p = phi i32 [ %r, %rec ], [ 0, %entry ]\n"
+	"  %a = add i32 %di, %wv\n"
+	"  %b = add i32 %a, %p\n"
+	"  ret i32 %b\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %r = call i32 @work(i32 2)\n"
+	"  store i32 %r, i32* @out\n"
+	"  ret void\n"
+	"}\n"
+	"declare void @llvm.lifetime.start(i64, i8* nocapture)\n"
+	"declare void @llvm.lifetime.end(i64, i8* nocapture)\n";
+
+TEST(CheerpTest, AllocaBuffersMergingTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(slotFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	WriterOptions options;
+	options.readable = true;
+	std::string js = compileToJS(*M, options);
+
+	// The struct is scalarized before the live ranges are computed, only the two arrays are left and they share slot 0
+	std::vector<const MDNode*> slots;
+	for(const Instruction& I: M->getFunction("work")->getEntryBlock())
+	{
+		const AllocaInst* AI = dyn_cast<AllocaInst>(&I);
+		if(!AI)
+			continue;
+		EXPECT_FALSE(AI->getAllocatedType()->isStructTy());
+		slots.push_back(AI->getMetadata("cheerp.stackslot"));
+	}
+	ASSERT_EQ(2u, slots.size());
+	ASSERT_TRUE(slots[0] != NULL);
+	EXPECT_EQ(slots[0], slots[1]);
+	EXPECT_EQ(0u, cast<ConstantInt>(slots[0]->getOperand(0))->getZExtValue());
+	EXPECT_EQ(32u, cast<ConstantInt>(slots[0]->getOperand(1))->getZExtValue());
+
+	// Both arrays are views of the buffer of the slot, which is zeroed when each of them becomes live
+	std::string work = getFunctionCode(js, "_work");
+	EXPECT_NE(std::string::npos, work.find("var stackSlot$0=new Uint8Array(32);")) << js;
+	EXPECT_NE(std::string::npos, work.find("new Float64Array(stackSlot$0.buffer,0,4)")) << js;
+	EXPECT_NE(std::string::npos, work.find("new Int32Array(stackSlot$0.buffer,0,8)")) << js;
+	size_t firstFill = work.find("stackSlot$0.fill(0,0,32);");
+	ASSERT_NE(std::string::npos, firstFill) << js;
+	EXPECT_NE(std::string::npos, work.find("stackSlot$0.fill(0,0,32);", firstFill + 1)) << js;
+
+	// Without the registers the live ranges are not computed and nothing is shared
+	LLVMContext C2;
+	OwningPtr<Module> M2(parseCheerpModule(slotFunctions, C2));
+	ASSERT_TRUE(M2.get() != NULL);
+	WriterOptions plainOptions;
+	plainOptions.readable = true;
+	plainOptions.noRegisterize = true;
+	std::string plain = compileToJS(*M2, plainOptions);
+	EXPECT_EQ(std::string::npos, plain.find("stackSlot$")) << plain;
+
+	js += "console.log(_out.d[0]);\n";
+	std::string output;
+	if ( !runInNode( js, output ) )
+	{
+		outs() << "node is not installed, the shared slot is not run\n";
+		return;
+	}
+	// Each call adds 1 from the first array and 0 from the second one
+	EXPECT_EQ("3\n", output) << js;
+}
+
+}
+}
@@ -0,0 +1,86 @@
+//===- llvm/unittest/Cheerp/CheerpAsmJSTest.cpp ---------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* numericFunctions =
+	"define float @scale(float %x, float %y) {\n"
+	"entry:\n"
+	"  %m = fmul float %x, 2.500000e-01\n"
+	"  %r = frem float %m, %y\n"
+	"  %s = fadd float %r, 1.000000e+00\n"
+	"  ret float %s\n"
+	"}\n"
+	"define i32 @mix(i32 %a, double %d, float %f) {\n"
+	"entry:\n"
+	"  %c = call float @scale(float %f, float 3.000000e+00)\n"
+	"  %e = fpext float %c to double\n"
+	"  %s = fadd double %d, %e\n"
+	"  %i = fptosi double %s to i32\n"
+	"  %r = add i32 %i, %a\n"
+	"  ret i32 %r\n"
+	"}\n"
+	// Uses a pointer, so it is written as regular code
+	"define i32 @load(i32* %p) {\n"
+	"entry:\n"
+	"  %v = load i32* %p\n"
+	"  ret i32 %v\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %p = alloca i32\n"
+	"  store i32 4, i32* %p\n"
+	"  %v = call i32 @load(i32* %p)\n"
+	"  %r = call i32 @mix(i32 %v, double 2.000000e+00, float 5.000000e-01)\n"
+	"  ret void\n"
+	"}\n";
+
+std::string compileNumericFunctions(bool asmJSCoercions)
+{
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(numericFunctions, C));
+	if(!M)
+		return "";
+	WriterOptions options;
+	options.readable = true;
+	options.asmJSCoercions = asmJSCoercions;
+	return compileToJS(*M, options);
+}
+
+TEST(CheerpTest, AsmJSCoercionsTest) {
+
+	std::string js = compileNumericFunctions(true);
+
+	// The arguments are coerced at function entry
+	EXPECT_NE(std::string::npos, js.find("Lx=Math.fround(Lx);")) << js;
+	EXPECT_NE(std::string::npos, js.find("La=(La|0);")) << js;
+	EXPECT_NE(std::string::npos, js.find("Ld=(+Ld);")) << js;
+	// Float constants and the results of the float operations, including the remainder, are rounded
+	EXPECT_NE(std::string::npos, js.find("Math.fround(0.25)")) << js;
+	EXPECT_NE(std::string::npos, js.find("Math.fround((Math.fround((Lx*Math.fround(0.25)))%Ly))")) << js;
+	EXPECT_NE(std::string::npos, js.find("Math.fround(3)")) << js;
+	// Integer returns and call results are coerced
+	EXPECT_NE(std::string::npos, js.find("|0);\n}")) << js;
+	EXPECT_NE(std::string::npos, js.find("Math.fround(_scale(")) << js;
+	// The function using memory is left alone
+	EXPECT_EQ(std::string::npos, js.find("Lp=(")) << js;
+
+	// Without the option the float values are not rounded
+	std::string plain = compileNumericFunctions(false);
+	EXPECT_EQ(std::string::npos, plain.find("Math.fround")) << plain;
+	EXPECT_NE(std::string::npos, plain.find("%Ly")) << plain;
+}
+
+}
+}
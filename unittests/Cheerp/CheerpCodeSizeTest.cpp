@@ -0,0 +1,102 @@
+//===- llvm/unittest/Cheerp/CheerpCodeSizeTest.cpp ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* codeSizeFunctions =
+	"%struct.U = type bytelayout { i32, float }\n"
+	"declare void @llvm.memcpy.p0struct.U.p0struct.U.i32(%struct.U*, %struct.U*, i32, i32, i1)\n"
+	// Two functions with the same code, only their name is different
+	"define internal i32 @first(i32* %p, i32 %v) unnamed_addr {\n"
+	"entry:\n"
+	"  %q = getelementptr i32* %p, i32 1\n"
+	"  store i32 %v, i32* %q\n"
+	"  %r = load i32* %p\n"
+	"  %s = mul i32 %r, %v\n"
+	"  ret i32 %s\n"
+	"}\n"
+	"define internal i32 @second(i32* %p, i32 %v) unnamed_addr {\n"
+	"entry:\n"
+	"  %q = getelementptr i32* %p, i32 1\n"
+	"  store i32 %v, i32* %q\n"
+	"  %r = load i32* %p\n"
+	"  %s = mul i32 %r, %v\n"
+	"  ret i32 %s\n"
+	"}\n"
+	// The same code again, but the address of this one is significant
+	"define internal i32 @third(i32* %p, i32 %v) {\n"
+	"entry:\n"
+	"  %q = getelementptr i32* %p, i32 1\n"
+	"  store i32 %v, i32* %q\n"
+	"  %r = load i32* %p\n"
+	"  %s = mul i32 %r, %v\n"
+	"  ret i32 %s\n"
+	"}\n"
+	"define void @copy(%struct.U* %d, %struct.U* %s) {\n"
+	"entry:\n"
+	"  call void @llvm.memcpy.p0struct.U.p0struct.U.i32(%struct.U* %d, %struct.U* %s, i32 8, i32 1, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = alloca [2 x i32]\n"
+	"  %p = getelementptr [2 x i32]* %a, i32 0, i32 0\n"
+	"  %b = call i32 @second(i32* %p, i32 2)\n"
+	"  %c = call i32 @first(i32* %p, i32 3)\n"
+	"  %d = call i32 @third(i32* %p, i32 4)\n"
+	"  %u = alloca %struct.U\n"
+	"  %v = alloca %struct.U\n"
+	"  call void @copy(%struct.U* %u, %struct.U* %v)\n"
+	"  ret void\n"
+	"}\n";
+
+std::string compileCodeSizeFunctions(bool codeSize, bool readable)
+{
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(codeSizeFunctions, C));
+	if(!M)
+		return "";
+	WriterOptions options;
+	options.readable = readable;
+	options.codeSize = codeSize;
+	return compileToJS(*M, options);
+}
+
+TEST(CheerpTest, CodeSizeTest) {
+
+	std::string js = compileCodeSizeFunctions(true, true);
+
+	// The duplicate is a declaration forwarding to the first function, so it is hoisted like the others
+	EXPECT_NE(std::string::npos, js.find("function _second(Lp,Lv){return _first(Lp,Lv);}")) << js;
+	EXPECT_EQ(std::string::npos, js.find("var _second")) << js;
+	EXPECT_NE(std::string::npos, getFunctionCode(js, "_third").find("Math.imul(Lr,Lv)")) << js;
+	// REGULAR pointers and byte layout copies use the shared helpers
+	EXPECT_NE(std::string::npos, js.find("function $P(d,o){return{d:d,o:o};}")) << js;
+	EXPECT_NE(std::string::npos, js.find("$P(")) << js;
+	EXPECT_NE(std::string::npos, getFunctionCode(js, "_copy").find("$C(Ld,Ls);")) << js;
+	EXPECT_NE(std::string::npos, js.find("function $C(d,s){")) << js;
+	EXPECT_EQ(std::string::npos, js.find("__tmp__")) << js;
+	EXPECT_EQ(std::string::npos, getFunctionCode(js, "__Z7webMainv").find("{d:")) << js;
+
+	// The compact output is smaller than the default one
+	std::string compact = compileCodeSizeFunctions(true, false);
+	std::string plain = compileCodeSizeFunctions(false, false);
+	EXPECT_LT(compact.size(), plain.size()) << compact << plain;
+	EXPECT_EQ(std::string::npos, plain.find("$P")) << plain;
+	EXPECT_EQ(std::string::npos, plain.find("$C")) << plain;
+	EXPECT_NE(std::string::npos, plain.find("__tmp__")) << plain;
+}
+
+}
+}
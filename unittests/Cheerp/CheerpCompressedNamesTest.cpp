@@ -0,0 +1,81 @@
+//===- llvm/unittest/Cheerp/CheerpCompressedNamesTest.cpp -----------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* namesFunctions =
+	"@cold = global i32 111\n"
+	"@hot = global [2 x i32] [i32 222, i32 333]\n"
+	// @cold has three uses, every one of them writes its name
+	"define i32 @readCold() {\n"
+	"entry:\n"
+	"  %a = load i32* @cold\n"
+	"  %b = load i32* @cold\n"
+	"  %c = load i32* @cold\n"
+	"  %s = add i32 %a, %b\n"
+	"  %t = add i32 %s, %c\n"
+	"  ret i32 %t\n"
+	"}\n"
+	// @hot has a single use, the constant expression, but its name is written by each of the loads
+	"define i32 @readHot() {\n"
+	"entry:\n"
+	"  %a = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %b = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %c = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %d = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %e = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %f = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %g = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %h = load i32* getelementptr ([2 x i32]* @hot, i32 0, i32 1)\n"
+	"  %s1 = add i32 %a, %b\n"
+	"  %s2 = add i32 %s1, %c\n"
+	"  %s3 = add i32 %s2, %d\n"
+	"  %s4 = add i32 %s3, %e\n"
+	"  %s5 = add i32 %s4, %f\n"
+	"  %s6 = add i32 %s5, %g\n"
+	"  %s7 = add i32 %s6, %h\n"
+	"  ret i32 %s7\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @readCold()\n"
+	"  %b = call i32 @readHot()\n"
+	"  ret void\n"
+	"}\n";
+
+TEST(CheerpTest, CompressedNamesTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(namesFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	std::string js = compileToJS(*M);
+
+	// @hot is referenced 8 times and gets the first name, even if it has less uses than the 3 of @cold.
+	// @cold is a regular pointer, each reference writes its name twice
+	EXPECT_NE(std::string::npos, js.find("var a=new Int32Array([222,333]);")) << js;
+	EXPECT_NE(std::string::npos, js.find("var b={d:[111],o:0};")) << js;
+	EXPECT_NE(std::string::npos, js.find("(a[1]>>0)")) << js;
+	EXPECT_NE(std::string::npos, js.find("(b.d[b.o+0]>>0)")) << js;
+
+	// The functions are all called once, with the same weight they keep the module order
+	size_t readCold = js.find("function f(){");
+	size_t readHot = js.find("function g(){");
+	ASSERT_NE(std::string::npos, readCold) << js;
+	ASSERT_NE(std::string::npos, readHot) << js;
+	EXPECT_LT(readCold, readHot) << js;
+	EXPECT_NE(std::string::npos, js.find("\nh()")) << js;
+}
+
+}
+}
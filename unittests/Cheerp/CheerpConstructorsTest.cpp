@@ -0,0 +1,88 @@
+//===- llvm/unittest/Cheerp/CheerpConstructorsTest.cpp --------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* constructorsFunctions =
+	"%struct.A = type { i32 }\n"
+	"%struct.C = type { %struct.A, i32 }\n"
+	"%struct.P = type { i32, double }\n"
+	// A constant struct, P is never part of a downcast array
+	"@g = global %struct.P { i32 7, double 2.5 }\n"
+	"@res = global i32 0\n"
+	"define i32 @use(%struct.A* %p) {\n"
+	"entry:\n"
+	"  %c = call %struct.C* @llvm.cheerp.downcast.p0struct.C.p0struct.A(%struct.A* %p, i32 1)\n"
+	"  %f = getelementptr %struct.C* %c, i32 0, i32 1\n"
+	"  %v = load i32* %f\n"
+	"  ret i32 %v\n"
+	"}\n"
+	// A zero initialized C, and its base A, are created by new
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %m = call i8* @_Znwj(i32 8)\n"
+	"  %c = bitcast i8* %m to %struct.C*\n"
+	"  %f = getelementptr %struct.C* %c, i32 0, i32 1\n"
+	"  store i32 42, i32* %f\n"
+	"  %ca = getelementptr %struct.C* %c, i32 0, i32 0\n"
+	"  %v = call i32 @use(%struct.A* %ca)\n"
+	"  %gp = getelementptr %struct.P* @g, i32 0, i32 0\n"
+	"  %w = load i32* %gp\n"
+	"  %s = add i32 %v, %w\n"
+	"  store i32 %s, i32* @res\n"
+	"  ret void\n"
+	"}\n"
+	"declare %struct.C* @llvm.cheerp.downcast.p0struct.C.p0struct.A(%struct.A*, i32)\n"
+	"declare i8* @_Znwj(i32)\n"
+	"!struct.C_bases = !{!0}\n"
+	"!0 = metadata !{i32 0, i32 2}\n";
+
+TEST(CheerpTest, ConstructorsTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(constructorsFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+
+	// The instantiated types are numbered by name: A is 1, C is 2 and P is 3
+	std::string js = compileToJS(*M);
+	EXPECT_NE(std::string::npos, js.find("create_struct$pC(new C$2(new C$1(0),0))")) << js;
+	EXPECT_NE(std::string::npos, js.find("=new C$3(7,2.5);")) << js;
+	// The objects which may be stored in a downcast array reserve its properties, so createX does not change their shape
+	EXPECT_NE(std::string::npos, js.find("function C$1(a0){\nthis.a00=a0;\nthis.o=0;\nthis.a=null;\n}")) << js;
+	EXPECT_NE(std::string::npos, js.find("function C$2(a0,a1){\nthis.a00=a0;\nthis.a10=a1;\nthis.o=0;\nthis.a=null;\n}")) << js;
+	EXPECT_NE(std::string::npos, js.find("function C$3(a0,a1){\nthis.a00=a0;\nthis.a10=a1;\n}")) << js;
+	EXPECT_EQ(std::string::npos, js.find("={a00:")) << js;
+
+	// Readable output uses the long names
+	WriterOptions options;
+	options.readable = true;
+	std::string readable = compileToJS(*M, options);
+	EXPECT_NE(std::string::npos, readable.find("create_struct$pC(new constructor_struct$pC(new constructor_struct$pA(0),0))")) << readable;
+	EXPECT_NE(std::string::npos, readable.find("var _g=new constructor_struct$pP(7,2.5);")) << readable;
+	EXPECT_EQ(std::string::npos, readable.find("C$")) << readable;
+
+	// The downcast reaches the field of C, and the constant keeps only its own fields
+	readable += "console.log(_res.d[0]+\" \"+Object.keys(_g).join());\n";
+	std::string output;
+	if ( !runInNode( readable, output ) )
+	{
+		outs() << "node is not installed, the constructors are not run\n";
+		return;
+	}
+	EXPECT_EQ("49 a00,a10\n", output) << readable;
+}
+
+}
+}
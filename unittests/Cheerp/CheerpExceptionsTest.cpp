@@ -0,0 +1,151 @@
+//===- llvm/unittest/Cheerp/CheerpExceptionsTest.cpp ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/Cheerp/TypeInfoLowering.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+// Returns the catchable list of a __cxa_throw as "id:field.field,id:,..." with ids renamed to their type infos
+std::string catchableToString( const Instruction * I, const std::map< uint32_t, std::string > & names )
+{
+	std::string out;
+	const MDNode * catchable = I->getMetadata("cheerp.catchable");
+	if ( !catchable )
+		return out;
+	for ( unsigned i = 0; i + 1 < catchable->getNumOperands(); i += 2 )
+	{
+		auto it = names.find( cast<ConstantInt>(catchable->getOperand(i))->getZExtValue() );
+		out += ( it == names.end() ? std::string("?") : it->second ) + ":";
+		const MDNode * path = cast<MDNode>(catchable->getOperand(i + 1));
+		for ( unsigned j = 0; j < path->getNumOperands(); j++ )
+			out += ( j ? "." : "" ) + std::to_string( cast<ConstantInt>(path->getOperand(j))->getZExtValue() );
+		out += ",";
+	}
+	return out;
+}
+
+TEST(CheerpTest, TypeInfoLoweringTest) {
+
+	LLVMContext C;
+	SMDiagnostic Err;
+
+	Module * M = ParseIRFile( CHEERP_TEST_INPUTS "exceptions.ll", Err, C );
+	ASSERT_TRUE( M != nullptr );
+
+	// The landing pads catch Base, Other and Multi, so their ids can be named from the clauses
+	std::map< const Function *, std::vector< const Value * > > clausesBefore;
+	for ( const Function & F : *M )
+		for ( const BasicBlock & BB : F )
+			if ( const LandingPadInst * lpad = dyn_cast<LandingPadInst>(BB.getFirstNonPHI()) )
+				for ( unsigned i = 0; i < lpad->getNumClauses(); i++ )
+					clausesBefore[&F].push_back( lpad->getClause(i)->stripPointerCasts(true) );
+
+	TypeInfoLowering lowering;
+	EXPECT_TRUE( lowering.runOnModule(*M) );
+
+	std::map< uint32_t, std::string > names;
+	for ( const Function & F : *M )
+		for ( const BasicBlock & BB : F )
+			if ( const LandingPadInst * lpad = dyn_cast<LandingPadInst>(BB.getFirstNonPHI()) )
+				for ( unsigned i = 0; i < lpad->getNumClauses(); i++ )
+				{
+					const Value * before = clausesBefore[&F][i];
+					if ( isa<ConstantPointerNull>(before) )
+					{
+						EXPECT_TRUE( isa<ConstantPointerNull>(lpad->getClause(i)) );
+						continue;
+					}
+					uint32_t id = TypeInfoLowering::getTypeInfoId( lpad->getClause(i) );
+					EXPECT_LE( 1u, id );
+					auto it = names.insert( std::make_pair( id, before->getName().str() ) ).first;
+					// The same type info has the same id in every function
+					EXPECT_EQ( before->getName(), it->second );
+				}
+	EXPECT_EQ( 3u, names.size() );
+
+	std::vector< std::string > thrown;
+	for ( const Function & F : *M )
+		for ( const BasicBlock & BB : F )
+			for ( const Instruction & I : BB )
+			{
+				// No type info is referenced by the code anymore
+				for ( const Value * op : I.operands() )
+					EXPECT_FALSE( op->stripPointerCasts(true)->getName().startswith("_ZTI") ) << F.getName().str();
+
+				ImmutableCallSite call(&I);
+				if ( !call || !call.getCalledFunction() )
+					continue;
+				if ( call.getCalledFunction()->getName() == "__cxa_throw" )
+				{
+					thrown.push_back( catchableToString( &I, names ) );
+					// The id of the thrown type comes first in the catchable list
+					const MDNode * catchable = I.getMetadata("cheerp.catchable");
+					ASSERT_TRUE( catchable != nullptr );
+					EXPECT_EQ( TypeInfoLowering::getTypeInfoId( call.getArgument(1) ),
+						cast<ConstantInt>(catchable->getOperand(0))->getZExtValue() );
+					// The destructor is run by the last handler, so it must be kept
+					if ( I.getParent()->getName() == "multi" )
+						EXPECT_EQ( M->getFunction("_ZN5MultiD2Ev"), call.getArgument(2)->stripPointerCasts(true) );
+				}
+				else if ( call.getCalledFunction()->getIntrinsicID() == Intrinsic::eh_typeid_for )
+					EXPECT_TRUE( names.count( TypeInfoLowering::getTypeInfoId( call.getArgument(0) ) ) );
+			}
+
+	// Der is caught as Base, Multi as Other (its primary base) and as Der and Base through field 2, Hidden only as itself
+	ASSERT_EQ( 3u, thrown.size() );
+	EXPECT_EQ( "?:,_ZTI4Base:,", thrown[0] );
+	EXPECT_EQ( "_ZTI5Multi:,_ZTI5Other:,?:2,_ZTI4Base:2,", thrown[1] );
+	EXPECT_EQ( "?:,", thrown[2] );
+
+	delete M;
+}
+
+// Run exceptions.ll, webMain logs the results of the handlers and the number of destroyed exceptions and guards.
+// In the end no exception may be left on the stack of the caught ones, also after the cleanups and the rethrows
+TEST(CheerpTest, ExceptionsRunTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M( loadCheerpModule( "exceptions.ll", C ) );
+	ASSERT_TRUE( M.get() != nullptr );
+	std::string js = compileToJS( *M );
+	js += "function log(i,v){console.log(i+\":\"+v);}\n";
+	js += "console.log(\"caught:\"+cheerpCaught.length);\n";
+	std::string output;
+	if ( !runInNode( js, output ) )
+	{
+		outs() << "node is not installed, the exceptions are not run\n";
+		return;
+	}
+	EXPECT_EQ( "0:10\n"   // Der caught as Base
+	           "1:20\n"   // Multi caught as Base through field 2
+	           "2:-1\n"   // Hidden only caught by catch(...)
+	           "3:43\n"   // Multi rethrown from a catch(Base&) in another function
+	           "4:-52\n"  // Multi caught as Other
+	           "5:160\n"  // Der rethrown from the inner handler and caught by the outer one
+	           "6:170\n"  // The same with Multi
+	           "7:81\n"   // Der thrown inside a handler runs the cleanup, which ends the catch of Multi and resumes
+	           "8:5\n"    // Every Multi has been destroyed once
+	           "9:1\n"    // The guard of the handler has been destroyed
+	           "caught:0\n", output );
+}
+
+}
+}
@@ -0,0 +1,126 @@
+//===- llvm/unittest/Cheerp/CheerpFieldSensitivePointersTest.cpp ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/Cheerp/PointerAnalyzer.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+using namespace cheerp;
+
+const char* fieldFunctions =
+	"%struct.N = type { i32 }\n"
+	"%struct.S = type { %struct.N*, %struct.N*, %struct.N* }\n"
+	"@arr = global [4 x %struct.N] zeroinitializer\n"
+	"@single = global %struct.N zeroinitializer\n"
+	"@s = global %struct.S zeroinitializer\n"
+	"@esc = global %struct.N** null\n"
+	// Field 0 holds a pointer inside an array, field 1 a single object and the address of field 2 escapes
+	"define void @fill(i32 %i) {\n"
+	"entry:\n"
+	"  %p = getelementptr [4 x %struct.N]* @arr, i32 0, i32 %i\n"
+	"  %f0 = getelementptr %struct.S* @s, i32 0, i32 0\n"
+	"  store %struct.N* %p, %struct.N** %f0\n"
+	"  %f1 = getelementptr %struct.S* @s, i32 0, i32 1\n"
+	"  store %struct.N* @single, %struct.N** %f1\n"
+	"  %f2 = getelementptr %struct.S* @s, i32 0, i32 2\n"
+	"  store %struct.N** %f2, %struct.N*** @esc\n"
+	"  ret void\n"
+	"}\n"
+	// Pointer arithmetic is used on the pointer loaded from field 0 and on the one loaded through the escaped address
+	"define i32 @read() {\n"
+	"entry:\n"
+	"  %f0 = getelementptr %struct.S* @s, i32 0, i32 0\n"
+	"  %a = load %struct.N** %f0\n"
+	"  %f1 = getelementptr %struct.S* @s, i32 0, i32 1\n"
+	"  %b = load %struct.N** %f1\n"
+	"  %f2 = getelementptr %struct.S* @s, i32 0, i32 2\n"
+	"  %c = load %struct.N** %f2\n"
+	"  %va = getelementptr %struct.N* %a, i32 1, i32 0\n"
+	"  %x = load i32* %va\n"
+	"  %vb = getelementptr %struct.N* %b, i32 0, i32 0\n"
+	"  %y = load i32* %vb\n"
+	"  %vc = getelementptr %struct.N* %c, i32 0, i32 0\n"
+	"  %z = load i32* %vc\n"
+	"  %e = load %struct.N*** @esc\n"
+	"  %d = load %struct.N** %e\n"
+	"  %vd = getelementptr %struct.N* %d, i32 1, i32 0\n"
+	"  %w = load i32* %vd\n"
+	"  %r = add i32 %x, %y\n"
+	"  %r2 = add i32 %r, %z\n"
+	"  %r3 = add i32 %r2, %w\n"
+	"  ret i32 %r3\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  call void @fill(i32 2)\n"
+	"  %r = call i32 @read()\n"
+	"  ret void\n"
+	"}\n";
+
+const Value* getLoad(const Module& M, StringRef name)
+{
+	for(const Instruction& I: M.getFunction("read")->getEntryBlock())
+	{
+		if(I.getName() == name)
+			return &I;
+	}
+	return nullptr;
+}
+
+TEST(CheerpTest, FieldSensitivePointersTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(fieldFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	StructType* S = M->getTypeByName("struct.S");
+	ASSERT_TRUE(S != NULL);
+
+	// By default all the pointers to N stored in memory share the same kind
+	{
+		PointerAnalyzer PA;
+		PA.prefetch(*M);
+		EXPECT_EQ(REGULAR, PA.getPointerKind(getLoad(*M, "a")));
+		EXPECT_EQ(REGULAR, PA.getPointerKind(getLoad(*M, "b")));
+		EXPECT_EQ(REGULAR, PA.getPointerKind(getLoad(*M, "c")));
+		EXPECT_EQ(REGULAR, PA.getPointerKindForStoredField(S, 1));
+	}
+	// Each field has a kind of its own, but the field whose address escapes shares the kind of all the pointers to N
+	{
+		PointerAnalyzer PA(true);
+		PA.computeTrackedFields(*M);
+		PA.prefetch(*M);
+		EXPECT_EQ(REGULAR, PA.getPointerKind(getLoad(*M, "a")));
+		EXPECT_EQ(COMPLETE_OBJECT, PA.getPointerKind(getLoad(*M, "b")));
+		EXPECT_EQ(REGULAR, PA.getPointerKind(getLoad(*M, "c")));
+		EXPECT_EQ(REGULAR, PA.getPointerKindForStoredField(S, 0));
+		EXPECT_EQ(COMPLETE_OBJECT, PA.getPointerKindForStoredField(S, 1));
+		EXPECT_EQ(REGULAR, PA.getPointerKindForStoredField(S, 2));
+	}
+
+	WriterOptions options;
+	options.readable = true;
+	std::string plain = compileToJS(*M, options);
+	EXPECT_NE(std::string::npos, getFunctionCode(plain, "_read").find("Ly=(Lb.d[Lb.o+0].a00>>0)")) << plain;
+
+	options.fieldSensitivePointers = true;
+	std::string js = compileToJS(*M, options);
+	std::string fill = getFunctionCode(js, "_fill");
+	std::string read = getFunctionCode(js, "_read");
+	EXPECT_NE(std::string::npos, fill.find("_s.a00={d:_arr,o:Li};")) << js;
+	EXPECT_NE(std::string::npos, read.find("La.d[La.o+1]")) << js;
+	EXPECT_NE(std::string::npos, read.find("Lc.d[Lc.o+0]")) << js;
+	EXPECT_NE(std::string::npos, read.find("Ly=(Lb.a00>>0)")) << js;
+}
+
+}
+}
@@ -0,0 +1,362 @@
+//===- llvm/unittest/Cheerp/CheerpI64LoweringTest.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/I64Lowering.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/ExecutionEngine/Interpreter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <functional>
+
+namespace llvm {
+namespace {
+
+// The arguments of the lowerable functions must be i32, so the two i64 operands are passed as pairs
+// and the low or the high half of the result is returned depending on %part
+std::string lowerableFunction(const char* name, const char* body)
+{
+	return std::string("define i32 @") + name + "(i32 %alo, i32 %ahi, i32 %blo, i32 %bhi, i32 %part) {\n"
+		"entry:\n"
+		"  %alo64 = zext i32 %alo to i64\n"
+		"  %ahi64 = zext i32 %ahi to i64\n"
+		"  %ahis = shl i64 %ahi64, 32\n"
+		"  %a = or i64 %ahis, %alo64\n"
+		"  %blo64 = zext i32 %blo to i64\n"
+		"  %bhi64 = zext i32 %bhi to i64\n"
+		"  %bhis = shl i64 %bhi64, 32\n"
+		"  %b = or i64 %bhis, %blo64\n"
+		+ body +
+		"  %rlo = trunc i64 %r to i32\n"
+		"  %rshift = lshr i64 %r, 32\n"
+		"  %rhi = trunc i64 %rshift to i32\n"
+		"  %islo = icmp eq i32 %part, 0\n"
+		"  %ret = select i1 %islo, i32 %rlo, i32 %rhi\n"
+		"  ret i32 %ret\n"
+		"}\n";
+}
+
+std::string binaryFunction(const char* name, const char* expr)
+{
+	return lowerableFunction(name, (std::string("  %r = ") + expr + "\n").c_str());
+}
+
+// The comparisons return 0 or 1 in the low half
+std::string compareFunction(const char* name, const char* predicate)
+{
+	return lowerableFunction(name, (std::string("  %cmp = icmp ") + predicate + " i64 %a, %b\n"
+		"  %r = zext i1 %cmp to i64\n").c_str());
+}
+
+typedef std::function<uint64_t(uint64_t, uint64_t)> Reference;
+
+struct LoweringTest
+{
+	const char* name;
+	Reference reference;
+};
+
+const uint64_t edgeValues[] = {
+	0x0000000000000000ULL, 0x0000000000000001ULL, 0x0000000000000002ULL,
+	0x000000007fffffffULL, 0x0000000080000000ULL, 0x00000000ffffffffULL,
+	0x0000000100000000ULL, 0x00000001ffffffffULL, 0x00000000fffffffeULL,
+	0x7fffffffffffffffULL, 0x8000000000000000ULL, 0x8000000000000001ULL,
+	0xffffffff00000000ULL, 0xfffffffe00000001ULL, 0xffffffffffffffffULL,
+	0x123456789abcdef0ULL, 0xfedcba9876543210ULL
+};
+
+uint32_t runFunction(ExecutionEngine* EE, Function* F, uint64_t a, uint64_t b, bool high)
+{
+	std::vector<GenericValue> args(5);
+	args[0].IntVal = APInt(32, a & 0xffffffff);
+	args[1].IntVal = APInt(32, a >> 32);
+	args[2].IntVal = APInt(32, b & 0xffffffff);
+	args[3].IntVal = APInt(32, b >> 32);
+	args[4].IntVal = APInt(32, high);
+	return EE->runFunction(F, args).IntVal.getZExtValue();
+}
+
+bool hasI64Values(const Function& F)
+{
+	for(const BasicBlock& BB: F)
+	{
+		for(const Instruction& I: BB)
+		{
+			if(I.getType()->isIntegerTy(64))
+				return true;
+			for(const Value* op: I.operands())
+			{
+				if(op->getType()->isIntegerTy(64))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Every i64 value is split in two i32 values, and the results are the same as the ones of the i64 operations
+TEST(CheerpTest, I64LoweringArithmeticTest) {
+
+	const LoweringTest tests[] = {
+		{ "add", [](uint64_t a, uint64_t b) { return a + b; } },
+		{ "sub", [](uint64_t a, uint64_t b) { return a - b; } },
+		{ "mul", [](uint64_t a, uint64_t b) { return a * b; } },
+		{ "and", [](uint64_t a, uint64_t b) { return a & b; } },
+		{ "or", [](uint64_t a, uint64_t b) { return a | b; } },
+		{ "xor", [](uint64_t a, uint64_t b) { return a ^ b; } },
+		{ "addconst", [](uint64_t a, uint64_t b) { return a + 0xffffffffULL; } },
+		{ "subconst", [](uint64_t a, uint64_t b) { return 1 - a; } },
+		{ "mulconst", [](uint64_t a, uint64_t b) { return a * 0x100000001ULL; } },
+		{ "shl0", [](uint64_t a, uint64_t b) { return a; } },
+		{ "shl1", [](uint64_t a, uint64_t b) { return a << 1; } },
+		{ "shl31", [](uint64_t a, uint64_t b) { return a << 31; } },
+		{ "shl32", [](uint64_t a, uint64_t b) { return a << 32; } },
+		{ "shl33", [](uint64_t a, uint64_t b) { return a << 33; } },
+		{ "shl63", [](uint64_t a, uint64_t b) { return a << 63; } },
+		{ "lshr0", [](uint64_t a, uint64_t b) { return a; } },
+		{ "lshr1", [](uint64_t a, uint64_t b) { return a >> 1; } },
+		{ "lshr31", [](uint64_t a, uint64_t b) { return a >> 31; } },
+		{ "lshr32", [](uint64_t a, uint64_t b) { return a >> 32; } },
+		{ "lshr33", [](uint64_t a, uint64_t b) { return a >> 33; } },
+		{ "lshr63", [](uint64_t a, uint64_t b) { return a >> 63; } },
+		{ "ashr0", [](uint64_t a, uint64_t b) { return a; } },
+		{ "ashr1", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a >> 1); } },
+		{ "ashr31", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a >> 31); } },
+		{ "ashr32", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a >> 32); } },
+		{ "ashr33", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a >> 33); } },
+		{ "ashr63", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a >> 63); } },
+		{ "sext", [](uint64_t a, uint64_t b) { return (uint64_t)(int64_t)(int32_t)(uint32_t)a + b; } },
+		{ "zext", [](uint64_t a, uint64_t b) { return (uint64_t)(uint32_t)a - b; } },
+		{ "select", [](uint64_t a, uint64_t b) { return (int64_t)a < (int64_t)b ? a : b; } },
+		{ "eq", [](uint64_t a, uint64_t b) { return (uint64_t)(a == b); } },
+		{ "ne", [](uint64_t a, uint64_t b) { return (uint64_t)(a != b); } },
+		{ "ult", [](uint64_t a, uint64_t b) { return (uint64_t)(a < b); } },
+		{ "ule", [](uint64_t a, uint64_t b) { return (uint64_t)(a <= b); } },
+		{ "ugt", [](uint64_t a, uint64_t b) { return (uint64_t)(a > b); } },
+		{ "uge", [](uint64_t a, uint64_t b) { return (uint64_t)(a >= b); } },
+		{ "slt", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a < (int64_t)b); } },
+		{ "sle", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a <= (int64_t)b); } },
+		{ "sgt", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a > (int64_t)b); } },
+		{ "sge", [](uint64_t a, uint64_t b) { return (uint64_t)((int64_t)a >= (int64_t)b); } },
+		{ "loop", [](uint64_t a, uint64_t b) { uint64_t acc = a; for(int i = 0; i < 5; i++) acc = acc * b + a; return acc; } },
+		{ "swap", [](uint64_t a, uint64_t b) { uint64_t x = a, y = b; for(int i = 0; i < 3; i++) { uint64_t t = x; x = y - 1; y = t; } return x; } },
+	};
+
+	std::string source;
+	source += binaryFunction("add", "add i64 %a, %b");
+	source += binaryFunction("sub", "sub i64 %a, %b");
+	source += binaryFunction("mul", "mul i64 %a, %b");
+	source += binaryFunction("and", "and i64 %a, %b");
+	source += binaryFunction("or", "or i64 %a, %b");
+	source += binaryFunction("xor", "xor i64 %a, %b");
+	source += binaryFunction("addconst", "add i64 %a, 4294967295");
+	source += binaryFunction("subconst", "sub i64 1, %a");
+	source += binaryFunction("mulconst", "mul i64 %a, 4294967297");
+	const char* shifts[] = { "shl", "lshr", "ashr" };
+	const unsigned amounts[] = { 0, 1, 31, 32, 33, 63 };
+	for(const char* shift: shifts)
+	{
+		for(unsigned amount: amounts)
+		{
+			std::string name = std::string(shift) + std::to_string(amount);
+			std::string expr = std::string(shift) + " i64 %a, " + std::to_string(amount);
+			source += binaryFunction(name.c_str(), expr.c_str());
+		}
+	}
+	source += lowerableFunction("sext", "  %s = sext i32 %alo to i64\n  %r = add i64 %s, %b\n");
+	source += lowerableFunction("zext", "  %s = zext i32 %alo to i64\n  %r = sub i64 %s, %b\n");
+	source += lowerableFunction("select", "  %cmp = icmp slt i64 %a, %b\n  %r = select i1 %cmp, i64 %a, i64 %b\n");
+	const char* predicates[] = { "eq", "ne", "ult", "ule", "ugt", "uge", "slt", "sle", "sgt", "sge" };
+	for(const char* predicate: predicates)
+		source += compareFunction(predicate, predicate);
+	source += lowerableFunction("loop",
+		"  br label %loop\n"
+		"loop:\n"
+		"  %i = phi i32 [ 0, %entry ], [ %inext, %loop ]\n"
+		"  %acc = phi i64 [ %a, %entry ], [ %accnext, %loop ]\n"
+		"  %mul = mul i64 %acc, %b\n"
+		"  %accnext = add i64 %mul, %a\n"
+		"  %inext = add i32 %i, 1\n"
+		"  %done = icmp eq i32 %inext, 5\n"
+		"  br i1 %done, label %exit, label %loop\n"
+		"exit:\n"
+		"  %r = phi i64 [ %accnext, %loop ]\n");
+	// The PHIs depend on each other in the same block
+	source += lowerableFunction("swap",
+		"  br label %loop\n"
+		"loop:\n"
+		"  %i = phi i32 [ 0, %entry ], [ %inext, %loop ]\n"
+		"  %x = phi i64 [ %a, %entry ], [ %xnext, %loop ]\n"
+		"  %y = phi i64 [ %b, %entry ], [ %x, %loop ]\n"
+		"  %xnext = sub i64 %y, 1\n"
+		"  %inext = add i32 %i, 1\n"
+		"  %done = icmp eq i32 %inext, 3\n"
+		"  br i1 %done, label %exit, label %loop\n"
+		"exit:\n"
+		"  %r = phi i64 [ %xnext, %loop ]\n");
+
+	LLVMContext C;
+	SMDiagnostic Err;
+	Module* M = ParseAssemblyString(source.c_str(), NULL, Err, C);
+	ASSERT_TRUE(M) << Err.getMessage().str();
+	ASSERT_FALSE(verifyModule(*M, &errs()));
+
+	I64Lowering lowering;
+	for(const LoweringTest& test: tests)
+	{
+		Function* F = M->getFunction(test.name);
+		ASSERT_TRUE(F) << test.name;
+		EXPECT_TRUE(lowering.runOnFunction(*F)) << test.name;
+		EXPECT_FALSE(hasI64Values(*F)) << test.name;
+		EXPECT_FALSE(verifyFunction(*F, &errs())) << test.name;
+	}
+
+	std::string errorStr;
+	// The engine owns the module
+	std::unique_ptr<ExecutionEngine> EE(EngineBuilder(M).setEngineKind(EngineKind::Interpreter).setErrorStr(&errorStr).create());
+	ASSERT_TRUE(EE.get()) << errorStr;
+
+	for(const LoweringTest& test: tests)
+	{
+		Function* F = M->getFunction(test.name);
+		for(uint64_t a: edgeValues)
+		{
+			for(uint64_t b: edgeValues)
+			{
+				uint64_t expected = test.reference(a, b);
+				uint64_t lo = runFunction(EE.get(), F, a, b, false);
+				uint64_t hi = runFunction(EE.get(), F, a, b, true);
+				EXPECT_EQ(expected, lo | (hi << 32)) << test.name << " " << utohexstr(a) << " " << utohexstr(b);
+			}
+		}
+	}
+}
+
+// i64 values which are loaded, stored, passed or returned cannot be split, a fatal error is reported for them
+TEST(CheerpTest, I64LoweringUnsupportedTest) {
+
+	const char* source =
+		"declare void @external(i64)\n"
+		"declare i64 @externalresult()\n"
+		"define void @load(i64* %p, i32* %q) {\n"
+		"entry:\n"
+		"  %v = load i64* %p\n"
+		"  %r = trunc i64 %v to i32\n"
+		"  store i32 %r, i32* %q\n"
+		"  ret void\n"
+		"}\n"
+		"define void @store(i64* %p, i32 %x) {\n"
+		"entry:\n"
+		"  %s = sext i32 %x to i64\n"
+		"  store i64 %s, i64* %p\n"
+		"  ret void\n"
+		"}\n"
+		"define i32 @argument(i64 %a) {\n"
+		"entry:\n"
+		"  %r = trunc i64 %a to i32\n"
+		"  ret i32 %r\n"
+		"}\n"
+		"define i64 @return(i32 %a) {\n"
+		"entry:\n"
+		"  %r = zext i32 %a to i64\n"
+		"  ret i64 %r\n"
+		"}\n"
+		"define void @callargument(i32 %a) {\n"
+		"entry:\n"
+		"  %r = zext i32 %a to i64\n"
+		"  call void @external(i64 %r)\n"
+		"  ret void\n"
+		"}\n"
+		"define i32 @callresult() {\n"
+		"entry:\n"
+		"  %v = call i64 @externalresult()\n"
+		"  %r = trunc i64 %v to i32\n"
+		"  ret i32 %r\n"
+		"}\n"
+		// Shifts by a variable amount are not supported, but the values do not leave the function
+		"define i32 @variableshift(i32 %a, i32 %b) {\n"
+		"entry:\n"
+		"  %a64 = zext i32 %a to i64\n"
+		"  %b64 = zext i32 %b to i64\n"
+		"  %r = shl i64 %a64, %b64\n"
+		"  %rlo = trunc i64 %r to i32\n"
+		"  ret i32 %rlo\n"
+		"}\n";
+
+	LLVMContext C;
+	SMDiagnostic Err;
+	OwningPtr<Module> M(ParseAssemblyString(source, NULL, Err, C));
+	ASSERT_TRUE(M.get() != NULL) << Err.getMessage().str();
+
+	I64Lowering lowering;
+	EXPECT_DEATH(lowering.runOnFunction(*M->getFunction("load")), "Unsupported 64-bit integer load in function load");
+	EXPECT_DEATH(lowering.runOnFunction(*M->getFunction("store")), "Unsupported 64-bit integer store in function store");
+	EXPECT_DEATH(lowering.runOnFunction(*M->getFunction("argument")), "Unsupported 64-bit integer argument in function argument");
+	EXPECT_DEATH(lowering.runOnFunction(*M->getFunction("return")), "Unsupported 64-bit integer return value in function return");
+	EXPECT_DEATH(lowering.runOnFunction(*M->getFunction("callargument")), "Unsupported 64-bit integer call argument in function callargument");
+	EXPECT_DEATH(lowering.runOnFunction(*M->getFunction("callresult")), "Unsupported 64-bit integer call result in function callresult");
+
+	Function* F = M->getFunction("variableshift");
+	std::string before, after;
+	raw_string_ostream beforeStream(before), afterStream(after);
+	F->print(beforeStream);
+	EXPECT_FALSE(lowering.runOnFunction(*F));
+	F->print(afterStream);
+	EXPECT_EQ(beforeStream.str(), afterStream.str());
+}
+
+// The constant i64 arguments of intrinsics, like the sizes of lifetime markers, are not an obstacle to the lowering
+TEST(CheerpTest, I64LoweringIntrinsicsTest) {
+
+	std::string source =
+		"declare void @llvm.lifetime.start(i64, i8* nocapture)\n"
+		"declare void @llvm.lifetime.end(i64, i8* nocapture)\n" +
+		lowerableFunction("lifetime",
+			"  %buf = alloca [4 x i8]\n"
+			"  %p = getelementptr [4 x i8]* %buf, i32 0, i32 0\n"
+			"  call void @llvm.lifetime.start(i64 4, i8* %p)\n"
+			"  %r = add i64 %a, %b\n"
+			"  call void @llvm.lifetime.end(i64 4, i8* %p)\n");
+
+	LLVMContext C;
+	SMDiagnostic Err;
+	OwningPtr<Module> M(ParseAssemblyString(source.c_str(), NULL, Err, C));
+	ASSERT_TRUE(M.get() != NULL) << Err.getMessage().str();
+	Function* F = M->getFunction("lifetime");
+
+	I64Lowering lowering;
+	EXPECT_TRUE(lowering.runOnFunction(*F));
+	EXPECT_FALSE(verifyFunction(*F, &errs()));
+	uint32_t markers = 0;
+	for(const BasicBlock& BB: *F)
+	{
+		for(const Instruction& I: BB)
+		{
+			if(isa<CallInst>(I))
+			{
+				markers++;
+				continue;
+			}
+			EXPECT_FALSE(I.getType()->isIntegerTy(64));
+			for(const Value* op: I.operands())
+				EXPECT_FALSE(op->getType()->isIntegerTy(64));
+		}
+	}
+	EXPECT_EQ(2u, markers);
+}
+
+}
+}
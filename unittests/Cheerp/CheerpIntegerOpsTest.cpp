@@ -0,0 +1,117 @@
+//===- llvm/unittest/Cheerp/CheerpIntegerOpsTest.cpp ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* integerFunctions =
+	"define i32 @mul32(i32 %a, i32 %b) {\n"
+	"entry:\n"
+	"  %r = mul i32 %a, %b\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i8 @mul8(i8 %a, i8 %b) {\n"
+	"entry:\n"
+	"  %r = mul i8 %a, %b\n"
+	"  ret i8 %r\n"
+	"}\n"
+	"define i32 @udivpos(i32 %a) {\n"
+	"entry:\n"
+	"  %p = lshr i32 %a, 1\n"
+	"  %r = udiv i32 %p, 8\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i32 @sdivpow2(i32 %a) {\n"
+	"entry:\n"
+	"  %r = sdiv i32 %a, 8\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i32 @sdivpos(i32 %a) {\n"
+	"entry:\n"
+	"  %p = and i32 %a, 1023\n"
+	"  %r = sdiv i32 %p, 8\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i32 @urempow2(i32 %a) {\n"
+	"entry:\n"
+	"  %r = urem i32 %a, 16\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i32 @urem(i32 %a, i32 %b) {\n"
+	"entry:\n"
+	"  %r = urem i32 %a, %b\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i32 @lshrpos(i32 %a) {\n"
+	"entry:\n"
+	"  %p = and i32 %a, 2147483647\n"
+	"  %r = lshr i32 %p, 3\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i32 @lshr32(i32 %a) {\n"
+	"entry:\n"
+	"  %r = lshr i32 %a, 3\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i8 @lshr8(i8 %a) {\n"
+	"entry:\n"
+	"  %r = lshr i8 %a, 1\n"
+	"  ret i8 %r\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @mul32(i32 1, i32 2)\n"
+	"  %b = call i8 @mul8(i8 1, i8 2)\n"
+	"  %c = call i32 @udivpos(i32 1)\n"
+	"  %d = call i32 @sdivpow2(i32 1)\n"
+	"  %e = call i32 @sdivpos(i32 1)\n"
+	"  %f = call i32 @urempow2(i32 1)\n"
+	"  %g = call i32 @urem(i32 1, i32 3)\n"
+	"  %h = call i32 @lshrpos(i32 1)\n"
+	"  %i = call i32 @lshr32(i32 1)\n"
+	"  %j = call i8 @lshr8(i8 1)\n"
+	"  ret void\n"
+	"}\n"
+	;
+
+// Multiplications use Math.imul, divisions, remainders and logical shifts of values known
+// to be non negative skip the normalization of their operands
+TEST(CheerpTest, IntegerOpsTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(integerFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	WriterOptions options;
+	options.readable = true;
+	std::string js = compileToJS(*M, options);
+
+	EXPECT_EQ("function _mul32(La,Lb){\n\treturn Math.imul(La,Lb);\n}", getFunctionCode(js, "_mul32"));
+	// Narrower integers are masked
+	EXPECT_EQ("function _mul8(La,Lb){\n\treturn (Math.imul(La,Lb)&255);\n}", getFunctionCode(js, "_mul8"));
+	// Power of two divisors become shifts if the dividend is not negative
+	EXPECT_EQ("function _udivpos(La){\n\treturn ((La>>>1)>>3);\n}", getFunctionCode(js, "_udivpos"));
+	EXPECT_EQ("function _sdivpos(La){\n\treturn ((La&1023)>>3);\n}", getFunctionCode(js, "_sdivpos"));
+	// A negative dividend would be rounded in the wrong direction by a shift
+	EXPECT_EQ("function _sdivpow2(La){\n\treturn (((La>>0)/(8>>0))>>0);\n}", getFunctionCode(js, "_sdivpow2"));
+	EXPECT_EQ("function _urempow2(La){\n\treturn (La&15);\n}", getFunctionCode(js, "_urempow2"));
+	// The remainder of unsigned values is an unsigned value already
+	EXPECT_EQ("function _urem(La,Lb){\n\treturn ((La>>>0)%(Lb>>>0));\n}", getFunctionCode(js, "_urem"));
+	// Logical shifts of non negative values stay in the signed range
+	EXPECT_EQ("function _lshrpos(La){\n\treturn ((La&2147483647)>>3);\n}", getFunctionCode(js, "_lshrpos"));
+	EXPECT_EQ("function _lshr32(La){\n\treturn (La>>>3);\n}", getFunctionCode(js, "_lshr32"));
+	// The upper bits of narrower integers are cleared before shifting
+	EXPECT_EQ("function _lshr8(La){\n\treturn ((La&255)>>>1);\n}", getFunctionCode(js, "_lshr8"));
+}
+
+}
+}
@@ -0,0 +1,85 @@
+//===- llvm/unittest/Cheerp/CheerpLazyChunksTest.cpp ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+// cb is only reached through a pointer and helper is only called by cb, so both are loaded lazily.
+// helper comes first in the module, so it gets a chunk of its own
+const char* lazyFunctions =
+	"@fp = global i32 (i32)* null\n"
+	"@seen = global i32 (i32)* null\n"
+	"@res = global i32 0\n"
+	"define i32 @helper(i32 %x) {\n"
+	"entry:\n"
+	"  %r = mul i32 %x, 3\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define i32 @cb(i32 %x) {\n"
+	"entry:\n"
+	"  store i32 (i32)* @cb, i32 (i32)** @seen\n"
+	"  %r = call i32 @helper(i32 %x)\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  store i32 (i32)* @cb, i32 (i32)** @fp\n"
+	"  %f = load i32 (i32)** @fp\n"
+	"  %r = call i32 %f(i32 5)\n"
+	"  store i32 %r, i32* @res\n"
+	"  ret void\n"
+	"}\n";
+
+TEST(CheerpTest, LazyChunksTest) {
+
+	SmallString<128> prefix;
+	ASSERT_FALSE(sys::fs::createTemporaryFile("cheerp-chunks", "", prefix));
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(lazyFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	WriterOptions options;
+	options.readable = true;
+	options.lazyChunksPrefix = prefix.str();
+	std::string js = compileToJS(*M, options);
+	std::string manifest = readAndRemove(prefix.str().str() + ".manifest.json");
+	std::string helperChunk = readAndRemove(prefix.str().str() + ".0.js");
+	std::string cbChunk = readAndRemove(prefix.str().str() + ".1.js");
+	sys::fs::remove(prefix.str());
+
+	// The main file only has the stubs of the lazy functions
+	EXPECT_NE(std::string::npos, js.find("function _helper(){return cheerpLoadChunk(0)._helper.apply(null,arguments);}")) << js;
+	EXPECT_NE(std::string::npos, js.find("function _cb(){return cheerpLoadChunk(1)._cb.apply(null,arguments);}")) << js;
+	EXPECT_NE(std::string::npos, getFunctionCode(js, "__Z7webMainv").find("=_cb;")) << js;
+	// The chunks are read by the user hook, by node or by the browser, and evaluated in the scope of the main file
+	EXPECT_NE(std::string::npos, js.find("if(typeof cheerpReadChunk===\"function\")return cheerpReadChunk(f);")) << js;
+	EXPECT_NE(std::string::npos, js.find("require(\"fs\").readFileSync(")) << js;
+	EXPECT_NE(std::string::npos, js.find("new XMLHttpRequest()")) << js;
+	EXPECT_NE(std::string::npos, js.find("=eval(cheerpReadChunkSource(cheerpChunkFiles[i]))(cheerpStubs);")) << js;
+	// The stubs are never replaced, only the stubs of the functions whose address is taken are given to the chunks
+	EXPECT_EQ(std::string::npos, js.find("cheerpGlobal")) << js;
+	EXPECT_NE(std::string::npos, js.find("var cheerpStubs={_cb:_cb};")) << js;
+
+	// A chunk returns the targets of the stubs, then it uses the stub in place of its functions whose address is taken
+	EXPECT_NE(std::string::npos, cbChunk.find("(function(cheerpStubs){\"use strict\";")) << cbChunk;
+	EXPECT_NE(std::string::npos, cbChunk.find("_seen.d[_seen.o+0]=_cb;")) << cbChunk;
+	EXPECT_NE(std::string::npos, cbChunk.find("var cheerpTargets={_cb:_cb};_cb=cheerpStubs._cb;return cheerpTargets;})")) << cbChunk;
+	EXPECT_NE(std::string::npos, helperChunk.find("var cheerpTargets={_helper:_helper};return cheerpTargets;})")) << helperChunk;
+	EXPECT_EQ("{\"chunks\":[{\"file\":\"" + sys::path::filename(prefix).str() + ".0.js\",\"functions\":[\"helper\"],\"deps\":[]},"
+	          "{\"file\":\"" + sys::path::filename(prefix).str() + ".1.js\",\"functions\":[\"cb\"],\"deps\":[0]}]}\n", manifest);
+}
+
+}
+}
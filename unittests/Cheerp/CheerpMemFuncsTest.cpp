@@ -0,0 +1,157 @@
+//===- llvm/unittest/Cheerp/CheerpMemFuncsTest.cpp ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* memFunctions =
+	"declare void @llvm.memcpy.p0i32.p0i32.i32(i32*, i32*, i32, i32, i1)\n"
+	"declare void @llvm.memmove.p0i32.p0i32.i32(i32*, i32*, i32, i32, i1)\n"
+	"declare void @llvm.memset.p0i32.i32(i32*, i8, i32, i32, i1)\n"
+	"declare void @llvm.memset.p0i8.i32(i8*, i8, i32, i32, i1)\n"
+	"define void @copysmall(i32* %d, i32* %s) {\n"
+	"entry:\n"
+	"  call void @llvm.memcpy.p0i32.p0i32.i32(i32* %d, i32* %s, i32 8, i32 4, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @copylarge(i32* %d, i32* %s) {\n"
+	"entry:\n"
+	"  call void @llvm.memcpy.p0i32.p0i32.i32(i32* %d, i32* %s, i32 64, i32 4, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @movesmall(i32* %d, i32* %s) {\n"
+	"entry:\n"
+	"  call void @llvm.memmove.p0i32.p0i32.i32(i32* %d, i32* %s, i32 8, i32 4, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @copyvar(i32* %d, i32* %s, i32 %n) {\n"
+	"entry:\n"
+	"  call void @llvm.memcpy.p0i32.p0i32.i32(i32* %d, i32* %s, i32 %n, i32 4, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @setsmall(i32* %d) {\n"
+	"entry:\n"
+	"  call void @llvm.memset.p0i32.i32(i32* %d, i8 1, i32 8, i32 4, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @setlarge(i32* %d, i8 %v) {\n"
+	"entry:\n"
+	"  call void @llvm.memset.p0i32.i32(i32* %d, i8 %v, i32 64, i32 4, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @setvar(i32* %d, i32 %n) {\n"
+	"entry:\n"
+	"  call void @llvm.memset.p0i32.i32(i32* %d, i8 0, i32 %n, i32 4, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @setbytes(i8* %d, i32 %n) {\n"
+	"entry:\n"
+	"  call void @llvm.memset.p0i8.i32(i8* %d, i8 7, i32 %n, i32 1, i1 false)\n"
+	"  ret void\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = alloca [32 x i32]\n"
+	"  %b = alloca [32 x i32]\n"
+	"  %c = alloca [32 x i8]\n"
+	"  %pa = getelementptr [32 x i32]* %a, i32 0, i32 1\n"
+	"  %pb = getelementptr [32 x i32]* %b, i32 0, i32 2\n"
+	"  %pc = getelementptr [32 x i8]* %c, i32 0, i32 3\n"
+	"  call void @copysmall(i32* %pa, i32* %pb)\n"
+	"  call void @copylarge(i32* %pa, i32* %pb)\n"
+	"  call void @movesmall(i32* %pa, i32* %pb)\n"
+	"  call void @copyvar(i32* %pa, i32* %pb, i32 12)\n"
+	"  call void @setsmall(i32* %pa)\n"
+	"  call void @setlarge(i32* %pa, i8 2)\n"
+	"  call void @setvar(i32* %pa, i32 12)\n"
+	"  call void @setbytes(i8* %pc, i32 5)\n"
+	"  ret void\n"
+	"}\n"
+	;
+
+std::string compileModule(const char* source)
+{
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(source, C));
+	if(!M)
+		return "";
+	WriterOptions options;
+	options.readable = true;
+	return compileToJS(*M, options);
+}
+
+// Small constant copies and memsets are unrolled, the others use cheerpMemMove and TypedArray.fill
+TEST(CheerpTest, MemFuncsTest) {
+
+	std::string js = compileModule(memFunctions);
+
+	EXPECT_EQ("function _copysmall(Ld,Ls){\n\tLd.d[Ld.o]=Ls.d[Ls.o];\n\tLd.d[Ld.o+1]=Ls.d[Ls.o+1];\n\treturn ;\n}",
+		getFunctionCode(js, "_copysmall"));
+	EXPECT_EQ("function _copylarge(Ld,Ls){\n\tcheerpMemMove(Ld.d,Ld.o,Ls.d,Ls.o,16);\n\treturn ;\n}",
+		getFunctionCode(js, "_copylarge"));
+	// The ranges of memmove may overlap, so it is never unrolled
+	EXPECT_EQ("function _movesmall(Ld,Ls){\n\tcheerpMemMove(Ld.d,Ld.o,Ls.d,Ls.o,2);\n\treturn ;\n}",
+		getFunctionCode(js, "_movesmall"));
+	EXPECT_EQ("function _copyvar(Ld,Ls,Ln){\n\tcheerpMemMove(Ld.d,Ld.o,Ls.d,Ls.o,Ln/4);\n\treturn ;\n}",
+		getFunctionCode(js, "_copyvar"));
+	// The byte is replicated over the whole element
+	EXPECT_EQ("function _setsmall(Ld){\n\tLd.d[Ld.o]=16843009;\n\tLd.d[Ld.o+1]=16843009;\n\treturn ;\n}",
+		getFunctionCode(js, "_setsmall"));
+	EXPECT_EQ("function _setlarge(Ld,Lv){\n\tLd.d.fill(((Lv)&255)*16843009,Ld.o,Ld.o+16);\n\treturn ;\n}",
+		getFunctionCode(js, "_setlarge"));
+	// A size which is not a multiple of the element size would be truncated by fill
+	EXPECT_EQ("function _setvar(Ld,Ln){\n\tif((Ln)&3)throw new Error(\"Unsupported memset of a partial element\");\n"
+		"\tLd.d.fill(0,Ld.o,Ld.o+(Ln)/4);\n\treturn ;\n}", getFunctionCode(js, "_setvar"));
+	EXPECT_EQ("function _setbytes(Ld,Ln){\n\tLd.d.fill(7,Ld.o,Ld.o+(Ln));\n\treturn ;\n}",
+		getFunctionCode(js, "_setbytes"));
+	// The helper is emitted once
+	EXPECT_NE(std::string::npos, js.find("function cheerpMemMove("));
+	EXPECT_EQ(js.find("function cheerpMemMove("), js.rfind("function cheerpMemMove("));
+}
+
+// Only whole elements and single byte layout objects can be written
+TEST(CheerpTest, MemFuncsUnsupportedTest) {
+
+	const char* partialMemset =
+		"declare void @llvm.memset.p0i32.i32(i32*, i8, i32, i32, i1)\n"
+		"define void @_Z7webMainv() {\n"
+		"entry:\n"
+		"  %a = alloca [4 x i32]\n"
+		"  %p = getelementptr [4 x i32]* %a, i32 0, i32 0\n"
+		"  call void @llvm.memset.p0i32.i32(i32* %p, i8 0, i32 6, i32 4, i1 false)\n"
+		"  ret void\n"
+		"}\n";
+	EXPECT_DEATH(compileModule(partialMemset), "Unsupported memset of a partial element");
+
+	const char* byteLayoutCopy =
+		"%struct._Z1U = type bytelayout { i32, float }\n"
+		"declare void @llvm.memcpy.p0struct._Z1U.p0struct._Z1U.i32(%struct._Z1U*, %struct._Z1U*, i32, i32, i1)\n"
+		"define void @copy(%struct._Z1U* %d, %struct._Z1U* %s) {\n"
+		"entry:\n"
+		"  call void @llvm.memcpy.p0struct._Z1U.p0struct._Z1U.i32(%struct._Z1U* %d, %struct._Z1U* %s, i32 16, i32 4, i1 false)\n"
+		"  ret void\n"
+		"}\n"
+		"define void @_Z7webMainv() {\n"
+		"entry:\n"
+		"  %a = alloca [2 x %struct._Z1U]\n"
+		"  %b = alloca [2 x %struct._Z1U]\n"
+		"  %pa = getelementptr [2 x %struct._Z1U]* %a, i32 0, i32 0\n"
+		"  %pb = getelementptr [2 x %struct._Z1U]* %b, i32 0, i32 0\n"
+		"  call void @copy(%struct._Z1U* %pa, %struct._Z1U* %pb)\n"
+		"  ret void\n"
+		"}\n";
+	EXPECT_DEATH(compileModule(byteLayoutCopy), "Unsupported memory intrinsic on multiple byte layout objects");
+}
+
+}
+}
@@ -13,7 +13,9 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
 #include "gtest/gtest.h"
 
 namespace llvm {
@@ -37,7 +39,7 @@ TEST(CheerpTest, PointerAnalyzerTest) {
 	LLVMContext C;
 	SMDiagnostic Err;
 
-	Module * M = ParseIRFile( "test1.ll", Err, C );
+	Module * M = ParseIRFile( CHEERP_TEST_INPUTS "test1.ll", Err, C );
 	ASSERT_TRUE( M );
 	
 	const Function * webMain = M->getFunction("_Z7webMainv");
@@ -148,5 +150,70 @@ TEST(CheerpTest, PointerAnalyzerTest) {
 #endif
 }
 
+const char* getKindName( POINTER_KIND kind )
+{
+	switch ( kind )
+	{
+		case COMPLETE_OBJECT: return "COMPLETE_OBJECT";
+		case REGULAR: return "REGULAR";
+		case BYTE_LAYOUT: return "BYTE_LAYOUT";
+		default: return "UNKNOWN";
+	}
+}
+
+// The kinds of all the pointer returns, arguments and instructions of a module, in the format of pointer_kinds.golden
+std::string dumpPointerKinds( const char * fileName, LLVMContext & C )
+{
+	SMDiagnostic Err;
+	OwningPtr<Module> M( ParseIRFile( std::string(CHEERP_TEST_INPUTS) + fileName, Err, C ) );
+	if ( !M )
+		return "";
+	PointerAnalyzer PA;
+	std::string ret;
+	raw_string_ostream os(ret);
+	for ( const Function & F : *M )
+	{
+		if ( F.isDeclaration() )
+			continue;
+		if ( F.getReturnType()->isPointerTy() )
+			os << fileName << ' ' << F.getName() << " ret " << getKindName( PA.getPointerKindForReturn(&F) ) << '\n';
+		uint32_t i = 0;
+		for ( const Argument & A : F.getArgumentList() )
+		{
+			if ( A.getType()->isPointerTy() )
+				os << fileName << ' ' << F.getName() << " arg" << i << ' ' << getKindName( PA.getPointerKind(&A) ) << '\n';
+			i++;
+		}
+		i = 0;
+		for ( const BasicBlock & BB : F )
+			for ( const Instruction & I : BB )
+			{
+				if ( I.getType()->isPointerTy() )
+					os << fileName << ' ' << F.getName() << " inst" << i << ' ' << getKindName( PA.getPointerKind(&I) ) << '\n';
+				i++;
+			}
+	}
+	return os.str();
+}
+
+// The analysis ordered over the call graph must find the same kinds as the recursive one it replaced
+TEST(CheerpTest, PointerAnalyzerGoldenTest) {
+
+	OwningPtr<MemoryBuffer> golden;
+	ASSERT_FALSE( MemoryBuffer::getFile( CHEERP_TEST_INPUTS "pointer_kinds.golden", golden ) );
+	std::string expected;
+	SmallVector<StringRef, 128> lines;
+	golden->getBuffer().split( lines, "\n", -1, false );
+	for ( StringRef line : lines )
+	{
+		if ( !line.startswith("#") )
+			expected += line.str() + '\n';
+	}
+
+	LLVMContext C;
+	std::string kinds = dumpPointerKinds( "test1.ll", C ) + dumpPointerKinds( "exceptions.ll", C );
+	EXPECT_EQ( expected, kinds );
+}
+
 }
 }
@@ -0,0 +1,146 @@
+//===- llvm/unittest/Cheerp/CheerpRegisterizeTest.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+#include <set>
+
+namespace llvm {
+namespace {
+
+const char* registerFunctions =
+	"@out = global i32 0\n"
+	// Each value dies where the next one is defined, they all fit in one register
+	"define i32 @chain(i32 %x) {\n"
+	"entry:\n"
+	"  %a = mul i32 %x, %x\n"
+	"  %b = mul i32 %a, %a\n"
+	"  %c = mul i32 %b, %b\n"
+	"  %d = mul i32 %c, %c\n"
+	"  %e = mul i32 %d, %d\n"
+	"  ret i32 %e\n"
+	"}\n"
+	// a, b and c are all live at the first add
+	"define i32 @overlap(i32 %x) {\n"
+	"entry:\n"
+	"  %a = mul i32 %x, 3\n"
+	"  store i32 %a, i32* @out\n"
+	"  %b = mul i32 %x, 5\n"
+	"  store i32 %b, i32* @out\n"
+	"  %c = mul i32 %x, 7\n"
+	"  store i32 %c, i32* @out\n"
+	"  %s1 = add i32 %a, %b\n"
+	"  %s2 = add i32 %s1, %c\n"
+	"  %s3 = mul i32 %s2, %a\n"
+	"  ret i32 %s3\n"
+	"}\n"
+	// Two pairs of overlapping values, the second pair reuses the registers of the first one
+	"define i32 @groups(i32 %x) {\n"
+	"entry:\n"
+	"  %a = mul i32 %x, 3\n"
+	"  store i32 %a, i32* @out\n"
+	"  %b = mul i32 %x, 5\n"
+	"  store i32 %b, i32* @out\n"
+	"  %s = add i32 %a, %b\n"
+	"  store i32 %s, i32* @out\n"
+	"  %c = mul i32 %s, 7\n"
+	"  store i32 %c, i32* @out\n"
+	"  %d = mul i32 %s, 9\n"
+	"  store i32 %d, i32* @out\n"
+	"  %t = add i32 %c, %d\n"
+	"  ret i32 %t\n"
+	"}\n"
+	// The values of the two branches are never live at the same time
+	"define i32 @branches(i32 %x) {\n"
+	"entry:\n"
+	"  %k = icmp slt i32 %x, 0\n"
+	"  br i1 %k, label %left, label %right\n"
+	"left:\n"
+	"  %a = mul i32 %x, 3\n"
+	"  store i32 %a, i32* @out\n"
+	"  %a2 = mul i32 %a, %x\n"
+	"  store i32 %a2, i32* @out\n"
+	"  %a3 = add i32 %a, %a2\n"
+	"  br label %exit\n"
+	"right:\n"
+	"  %b = mul i32 %x, 5\n"
+	"  store i32 %b, i32* @out\n"
+	"  %b2 = mul i32 %b, %x\n"
+	"  store i32 %b2, i32* @out\n"
+	"  %b3 = add i32 %b, %b2\n"
+	"  br label %exit\n"
+	"exit:\n"
+	"  %r = phi i32 [ %a3, %left ], [ %b3, %right ]\n"
+	"  ret i32 %r\n"
+	"}\n"
+	// The PHIs share the registers of their incoming values
+	"define i32 @loop(i32 %n) {\n"
+	"entry:\n"
+	"  br label %body\n"
+	"body:\n"
+	"  %i = phi i32 [ 0, %entry ], [ %i1, %body ]\n"
+	"  %acc = phi i32 [ 0, %entry ], [ %acc1, %body ]\n"
+	"  %sq = mul i32 %i, %i\n"
+	"  store i32 %sq, i32* @out\n"
+	"  %acc1 = add i32 %acc, %sq\n"
+	"  %i1 = add i32 %i, 1\n"
+	"  %c = icmp slt i32 %i1, %n\n"
+	"  br i1 %c, label %body, label %exit\n"
+	"exit:\n"
+	"  ret i32 %acc1\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @chain(i32 2)\n"
+	"  %b = call i32 @overlap(i32 2)\n"
+	"  %c = call i32 @groups(i32 2)\n"
+	"  %d = call i32 @branches(i32 2)\n"
+	"  %e = call i32 @loop(i32 2)\n"
+	"  ret void\n"
+	"}\n";
+
+// The number of different locals declared in the readable code of a function
+size_t countLocals(const std::string& code)
+{
+	std::set<std::string> locals;
+	for(size_t pos = code.find("var L"); pos != std::string::npos; pos = code.find("var L", pos + 1))
+	{
+		size_t begin = pos + 4;
+		locals.insert(code.substr(begin, code.find('=', begin) - begin));
+	}
+	return locals.size();
+}
+
+TEST(CheerpTest, RegisterizeTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(registerFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	WriterOptions options;
+	options.readable = true;
+	std::string js = compileToJS(*M, options);
+
+	// The linear scan finds the minimum number of registers for all these functions
+	EXPECT_EQ(1u, countLocals(getFunctionCode(js, "_chain"))) << js;
+	EXPECT_EQ(3u, countLocals(getFunctionCode(js, "_overlap"))) << js;
+	EXPECT_EQ(2u, countLocals(getFunctionCode(js, "_groups"))) << js;
+	EXPECT_EQ(2u, countLocals(getFunctionCode(js, "_branches"))) << js;
+	EXPECT_EQ(3u, countLocals(getFunctionCode(js, "_loop"))) << js;
+
+	// Without registers every value is a local of its own
+	options.noRegisterize = true;
+	std::string plain = compileToJS(*M, options);
+	EXPECT_EQ(4u, countLocals(getFunctionCode(plain, "_chain"))) << plain;
+	EXPECT_EQ(5u, countLocals(getFunctionCode(plain, "_groups"))) << plain;
+	EXPECT_EQ(7u, countLocals(getFunctionCode(plain, "_branches"))) << plain;
+}
+
+}
+}
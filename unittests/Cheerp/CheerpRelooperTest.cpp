@@ -0,0 +1,185 @@
+//===- llvm/unittest/Cheerp/CheerpRelooperTest.cpp ------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "../../lib/CheerpWriter/Relooper.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <thread>
+
+namespace llvm {
+namespace {
+
+// Records every render call, including the label and loop ids, and checks that the shapes are well nested
+class RecordingRenderer: public RenderInterface
+{
+public:
+	std::string output;
+	raw_string_ostream stream;
+	std::vector<unsigned> rendered;
+	int depth;
+	RecordingRenderer(unsigned numBlocks) : stream(output), rendered(numBlocks, 0), depth(0)
+	{
+	}
+	void renderBlock(const void* privateBlock)
+	{
+		rendered[(size_t)privateBlock]++;
+		stream << "B" << (size_t)privateBlock << ';';
+	}
+	void renderIfOnLabel(int labelId, bool first) { depth++; stream << (first ? "" : "else ") << "if(label==" << labelId << "){"; }
+	// Only the first condition opens a block, the following ones are chained with else
+	void renderIfBlockBegin(const void* privateBlock, int branchId, bool first)
+	{
+		depth += first;
+		stream << (first ? "" : "}else ") << "if(B" << (size_t)privateBlock << "," << branchId << "){";
+	}
+	void renderIfBlockBegin(const void* privateBlock, const std::vector<int>& skipBranchIds, bool first)
+	{
+		depth += first;
+		stream << (first ? "" : "}else ") << "if(!B" << (size_t)privateBlock;
+		for(int id: skipBranchIds)
+			stream << "," << id;
+		stream << "){";
+	}
+	void renderElseBlockBegin() { stream << "}else{"; }
+	void renderBlockEnd() { depth--; stream << "}"; }
+	void renderBlockPrologue(const void* privateBlockTo, const void* privateBlockFrom) { }
+	bool hasBlockPrologue(const void* privateBlockTo) const { return false; }
+	void renderWhileBlockBegin() { depth++; stream << "while{"; }
+	void renderWhileBlockBegin(int labelId) { depth++; stream << "L" << labelId << ":while{"; }
+	void renderDoBlockBegin() { depth++; stream << "do{"; }
+	void renderDoBlockBegin(int labelId) { depth++; stream << "L" << labelId << ":do{"; }
+	void renderDoBlockEnd() { depth--; stream << "}"; }
+	void renderBreak() { stream << "break;"; }
+	void renderBreak(int labelId) { stream << "break L" << labelId << ';'; }
+	void renderContinue() { stream << "continue;"; }
+	void renderContinue(int labelId) { stream << "continue L" << labelId << ';'; }
+	void renderLabel(int labelId) { stream << "label=" << labelId << ';'; }
+	void renderSwitchOnLabel() { depth++; stream << "switch(label){"; }
+	void renderSwitchOnLabel(int labelId) { depth++; stream << "L" << labelId << ":switch(label){"; }
+	void renderCaseOnLabel(int labelId) { depth++; stream << "case " << labelId << ":{"; }
+	void renderSwitchBlockBegin(const void* privateBlock) { depth++; stream << "switch(B" << (size_t)privateBlock << "){"; }
+	void renderSwitchBlockBegin(const void* privateBlock, int labelId) { depth++; stream << "L" << labelId << ":switch(B" << (size_t)privateBlock << "){"; }
+	void renderCaseBlockBegin(const void* privateBlock, int branchId) { depth++; stream << "case " << branchId << ":{"; }
+	void renderDefaultBlockBegin() { depth++; stream << "default:{"; }
+	void renderCaseBlockEnd() { depth--; stream << "}"; }
+	void renderTryBlockBegin(int labelId) { depth++; stream << "E" << labelId << ":try{"; }
+	void renderCatchBlockBegin(const void* privateBlock) { depth++; stream << "}catch(B" << (size_t)privateBlock << "){"; }
+	void renderCatchBlockEnd(int labelId) { depth--; stream << "}"; }
+};
+
+// Builds a synthetic CFG with mostly forward branches, some loops and a few switch-like and invoke-like blocks.
+// Block i is identified by the private value i.
+void buildCFG(Relooper& R, std::vector<Block*>& blocks, unsigned numBlocks, unsigned seed)
+{
+	for(unsigned i = 0; i < numBlocks; i++)
+	{
+		blocks.push_back(new Block((const void*)(size_t)i, (i % 3) == 0, (i % 2) == 0));
+		R.AddBlock(blocks.back());
+	}
+	// A simple LCG, so that the graphs are the same on every platform
+	auto next = [&seed]() { seed = seed * 1103515245 + 12345; return (seed >> 16) & 0x7fff; };
+	for(unsigned i = 0; i + 1 < numBlocks; i++)
+	{
+		unsigned numSuccessors = (next() % 8) == 0 ? 8 : 1 + next() % 2;
+		blocks[i]->AddBranchTo(blocks[i + 1], -1);
+		for(unsigned j = 1; j < numSuccessors; j++)
+		{
+			unsigned target = (next() % 4) == 0 ? next() % numBlocks : std::min(numBlocks - 1, i + 2 + next() % 16);
+			blocks[i]->AddBranchTo(blocks[target], j);
+		}
+		// Some of the two-way branches are calls which may throw
+		if(!blocks[i]->IsSwitch && blocks[i]->BranchesOut.size() == 2)
+			blocks[i]->IsTry = true;
+	}
+}
+
+// Runs the relooper on a synthetic CFG and returns the rendered code
+std::string renderCFG(unsigned numBlocks, unsigned seed)
+{
+	Relooper R;
+	std::vector<Block*> blocks;
+	buildCFG(R, blocks, numBlocks, seed);
+	R.Calculate(blocks[0]);
+	RecordingRenderer renderer(numBlocks);
+	R.Render(&renderer);
+	EXPECT_EQ(0, renderer.depth);
+	// Every block is reachable through the fallthrough edges, split blocks may be rendered more than once
+	for(unsigned i = 0; i < numBlocks; i++)
+		EXPECT_LE(1u, renderer.rendered[i]);
+	return renderer.stream.str();
+}
+
+// The writer renders the functions on many threads, in any order, and the code must be the same
+// as the one rendered serially, so the relooper output may only depend on the CFG
+TEST(CheerpTest, RelooperSerialParallelTest) {
+
+	const unsigned sizes[] = { 16, 256, 4096 };
+	const unsigned numSeeds = 8;
+	std::vector<std::pair<unsigned, unsigned>> graphs;
+	for(unsigned numBlocks: sizes)
+	{
+		for(unsigned seed = 0; seed < numSeeds; seed++)
+			graphs.push_back(std::make_pair(numBlocks, seed));
+	}
+
+	std::vector<std::string> serial;
+	for(auto& g: graphs)
+		serial.push_back(renderCFG(g.first, g.second));
+
+	// Hand out the graphs in reverse order, so that every thread renders different graphs before each one
+	std::vector<std::string> parallel(graphs.size());
+	std::atomic<unsigned> nextGraph(0);
+	std::vector<std::thread> workers;
+	for(unsigned i = 0; i < 4; i++)
+	{
+		workers.push_back(std::thread([&]()
+		{
+			for(unsigned j = nextGraph++; j < graphs.size(); j = nextGraph++)
+			{
+				unsigned index = graphs.size() - 1 - j;
+				parallel[index] = renderCFG(graphs[index].first, graphs[index].second);
+			}
+		}));
+	}
+	for(std::thread& t: workers)
+		t.join();
+
+	for(unsigned i = 0; i < graphs.size(); i++)
+	{
+		EXPECT_FALSE(serial[i].empty());
+		EXPECT_TRUE(serial[i] == parallel[i]) << "Different code for " << graphs[i].first << " blocks, seed " << graphs[i].second;
+	}
+	// Rendering the same graph again gives the same code
+	EXPECT_EQ(serial[0], renderCFG(graphs[0].first, graphs[0].second));
+}
+
+// The time taken by the relooper on large synthetic CFGs, run it with --gtest_also_run_disabled_tests.
+// On the same graphs without switch and try blocks, which the std::set<Block*> implementation did not
+// support, 4 graphs of 16384 blocks took 9.5s before the bit vector sets and 2.6s after them.
+TEST(CheerpTest, DISABLED_RelooperStressBenchmark) {
+
+	const unsigned sizes[] = { 1024, 4096, 16384 };
+	const unsigned numSeeds = 4;
+	for(unsigned numBlocks: sizes)
+	{
+		TimeRecord start = TimeRecord::getCurrentTime(true);
+		size_t renderedSize = 0;
+		for(unsigned seed = 0; seed < numSeeds; seed++)
+			renderedSize += renderCFG(numBlocks, seed).size();
+		TimeRecord end = TimeRecord::getCurrentTime(false);
+		EXPECT_LT(0u, renderedSize);
+		outs() << numSeeds << " graphs of " << numBlocks << " blocks: " << format("%.3f", end.getWallTime() - start.getWallTime()) << "s\n";
+	}
+}
+
+}
+}
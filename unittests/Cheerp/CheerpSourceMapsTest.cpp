@@ -0,0 +1,188 @@
+//===- llvm/unittest/Cheerp/CheerpSourceMapsTest.cpp ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/Cheerp/SourceMaps.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+using namespace cheerp;
+
+MDNode * getScope( LLVMContext & C, StringRef fileName )
+{
+	Value* fileOps[] = { MDString::get(C, fileName), MDString::get(C, "/tmp") };
+	Value* scopeOps[] = { ConstantInt::get(Type::getInt32Ty(C), 786473), MDNode::get(C, fileOps) };
+	return MDNode::get(C, scopeOps);
+}
+
+std::string readMap( StringRef mapName )
+{
+	OwningPtr<MemoryBuffer> map;
+	EXPECT_FALSE(MemoryBuffer::getFile(mapName, map));
+	std::string ret = map ? map->getBuffer().str() : "";
+	sys::fs::remove(mapName);
+	return ret;
+}
+
+// Lazy chunks get their own map, built from the one of the main file while the main file is being written.
+// The segments of each map are relative to the beginning of its own file and its own list of sources.
+TEST(CheerpTest, SourceMapsTest) {
+
+	LLVMContext C;
+	MDNode* scope0 = getScope(C, "/tmp/src/file0.cpp");
+	MDNode* scope1 = getScope(C, "/tmp/src/file1.cpp");
+
+	SmallString<128> mapName, chunkMapName;
+	ASSERT_FALSE(sys::fs::createTemporaryFile("cheerp-sourcemap", "map", mapName));
+	ASSERT_FALSE(sys::fs::createTemporaryFile("cheerp-sourcemap-chunk", "map", chunkMapName));
+	std::string ErrorString;
+
+	// The maps are written to disk when the generators are destroyed
+	{
+		SourceMapGenerator generator(mapName.str(), "/tmp/", false, C, ErrorString);
+		ASSERT_TRUE(ErrorString.empty());
+		generator.beginFile();
+		generator.setDebugLoc(DebugLoc::get(10, 2, scope0));
+		generator.finishLine();
+		// The location of the previous line is not repeated
+		generator.setDebugLoc(DebugLoc::get(10, 2, scope0));
+		generator.finishLine();
+		// A line without a location stops the segment, so the same location is written again after it
+		generator.finishLine();
+		generator.setDebugLoc(DebugLoc::get(10, 2, scope0));
+		generator.finishLine();
+
+		// The chunk is compiled in a separate buffer and replayed on its own map
+		SourceMapRecorder chunkEvents;
+		chunkEvents.setDebugLoc(DebugLoc::get(5, 1, scope1));
+		chunkEvents.finishLine();
+		chunkEvents.finishLine();
+		chunkEvents.setDebugLoc(DebugLoc::get(3, 0, scope0));
+		chunkEvents.finishLine();
+		SourceMapGenerator chunkMap(generator, chunkMapName.str(), ErrorString);
+		ASSERT_TRUE(ErrorString.empty());
+		chunkMap.beginFile();
+		chunkEvents.replay(chunkMap);
+		chunkMap.endFile();
+		EXPECT_EQ(sys::path::filename(chunkMapName), chunkMap.getSourceMapName());
+
+		// The main map continues from its last segment
+		generator.setDebugLoc(DebugLoc::get(12, 0, scope1));
+		generator.finishLine();
+		generator.endFile();
+		EXPECT_EQ(sys::path::filename(mapName), generator.getSourceMapName());
+	}
+
+	// Line 10, coloumn 2 of file0, then line 12, coloumn 0 of file1
+	EXPECT_EQ("{\n\"version\": 3,\n\"names\": [],\n\"mappings\": \"AASE;;;AAAA;ACEF;\",\n"
+		"\"sources\": [\"src/file0.cpp\",\"src/file1.cpp\"]\n}\n", readMap(mapName));
+	// Line 5, coloumn 1 of file1, which is the first source of the chunk, then line 3, coloumn 0 of file0
+	EXPECT_EQ("{\n\"version\": 3,\n\"names\": [],\n\"mappings\": \"AAIC;;ACFD;\",\n"
+		"\"sources\": [\"src/file1.cpp\",\"src/file0.cpp\"]\n}\n", readMap(chunkMapName));
+}
+
+// cb is only reached through a pointer, so it is written to a lazy chunk
+const char* chunkFunctions =
+	"@fp = global i32 (i32)* null\n"
+	"@res = global i32 0\n"
+	"define i32 @cb(i32 %x) {\n"
+	"entry:\n"
+	"  %a = mul i32 %x, 3\n"
+	"  %r = add i32 %a, 1\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  store i32 (i32)* @cb, i32 (i32)** @fp\n"
+	"  %f = load i32 (i32)** @fp\n"
+	"  %r = call i32 %f(i32 5)\n"
+	"  store i32 %r, i32* @res\n"
+	"  ret void\n"
+	"}\n";
+
+// The chunk written by the backend names its own map, which only has the sources of the chunk
+TEST(CheerpTest, SourceMapsLazyChunkTest) {
+
+	SmallString<128> prefix, mapName;
+	ASSERT_FALSE(sys::fs::createTemporaryFile("cheerp-sourcemap-chunks", "", prefix));
+	ASSERT_FALSE(sys::fs::createTemporaryFile("cheerp-sourcemap-main", "map", mapName));
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(chunkFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	addDebugLocations(*M);
+	WriterOptions options;
+	options.readable = true;
+	options.sourceMap = mapName.str();
+	options.lazyChunksPrefix = prefix.str();
+	std::string js = compileToJS(*M, options);
+	std::string chunkName = sys::path::filename(prefix).str() + ".0.js";
+	std::string chunk = readAndRemove(prefix.str().str() + ".0.js");
+	std::string chunkMap = readMap(prefix.str().str() + ".0.js.map");
+	std::string map = readMap(mapName);
+	readAndRemove(prefix.str().str() + ".manifest.json");
+	sys::fs::remove(prefix.str());
+
+	EXPECT_NE(std::string::npos, js.find("//# sourceMappingURL=" + sys::path::filename(mapName).str())) << js;
+	EXPECT_NE(std::string::npos, map.find("\"sources\": [\"src/_Z7webMainv.cpp\"]")) << map;
+	// The chunk is evaluated from a string, the source URL gives it a name the map can be attached to
+	EXPECT_NE(std::string::npos, chunk.find("//# sourceURL=" + chunkName + "\n//# sourceMappingURL=" + chunkName + ".map")) << chunk;
+	EXPECT_NE(std::string::npos, chunkMap.find("\"sources\": [\"src/cb.cpp\"]")) << chunkMap;
+	EXPECT_EQ(std::string::npos, chunkMap.find("\"mappings\": \"\"")) << chunkMap;
+}
+
+// The time taken by the generator and the size of the map for 1M lines of output with a location every 3 lines,
+// run it with --gtest_also_run_disabled_tests
+TEST(CheerpTest, DISABLED_SourceMapsBenchmark) {
+
+	LLVMContext C;
+	const uint32_t numFiles = 16;
+	const uint32_t numLines = 1000000;
+	std::vector<MDNode*> scopes;
+	for(uint32_t i = 0; i < numFiles; i++)
+		scopes.push_back(getScope(C, ("/tmp/src/file" + Twine(i) + ".cpp").str()));
+
+	SmallString<128> mapName;
+	ASSERT_FALSE(sys::fs::createTemporaryFile("cheerp-sourcemap-bench", "map", mapName));
+	std::string ErrorString;
+	TimeRecord start = TimeRecord::getCurrentTime(true);
+	{
+		SourceMapGenerator generator(mapName.str(), "/tmp/", false, C, ErrorString);
+		ASSERT_TRUE(ErrorString.empty());
+		generator.beginFile();
+		for(uint32_t i = 0; i < numLines; i++)
+		{
+			if(i % 3 == 0)
+				generator.setDebugLoc(DebugLoc::get(i / 3 + 1, i % 7, scopes[(i / 300) % numFiles]));
+			generator.finishLine();
+		}
+		generator.endFile();
+	}
+	TimeRecord end = TimeRecord::getCurrentTime(false);
+	uint64_t mapSize = 0;
+	EXPECT_FALSE(sys::fs::file_size(mapName.str(), mapSize));
+	sys::fs::remove(mapName.str());
+	EXPECT_LT(0u, mapSize);
+	outs() << numLines << " lines: " << format("%.3f", end.getWallTime() - start.getWallTime()) << "s, " << mapSize << " bytes of map\n";
+}
+
+}
+}
@@ -0,0 +1,106 @@
+//===- llvm/unittest/Cheerp/CheerpStructAllocaScalarizationTest.cpp ------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* structAllocaFunctions =
+	"%struct.It = type { i32*, i32 }\n"
+	"%struct.V = type { i32, i32 }\n"
+	"@arr = global [4 x i32] [i32 1, i32 2, i32 3, i32 4]\n"
+	"@out = global i32 0\n"
+	// An iterator-like temporary, its address is only used by constant GEPs, loads and stores. The counter is read before it is written
+	"define i32 @sum(i32 %n) {\n"
+	"entry:\n"
+	"  %it = alloca %struct.It\n"
+	"  %p = getelementptr %struct.It* %it, i32 0, i32 0\n"
+	"  %i = getelementptr %struct.It* %it, i32 0, i32 1\n"
+	"  %old = load i32* %i\n"
+	"  store i32* getelementptr ([4 x i32]* @arr, i32 0, i32 0), i32** %p\n"
+	"  br label %body\n"
+	"body:\n"
+	"  %acc = phi i32 [ %old, %entry ], [ %acc1, %body ]\n"
+	"  %cur = load i32** %p\n"
+	"  %v = load i32* %cur\n"
+	"  %acc1 = add i32 %acc, %v\n"
+	"  %next = getelementptr i32* %cur, i32 1\n"
+	"  store i32* %next, i32** %p\n"
+	"  %k = load i32* %i\n"
+	"  %k1 = add i32 %k, 1\n"
+	"  store i32 %k1, i32* %i\n"
+	"  %c = icmp slt i32 %k1, %n\n"
+	"  br i1 %c, label %body, label %exit\n"
+	"exit:\n"
+	"  ret i32 %acc1\n"
+	"}\n"
+	// The address of the struct is passed to another function, so the object is kept
+	"define i32 @escape() {\n"
+	"entry:\n"
+	"  %v = alloca %struct.V\n"
+	"  %a = getelementptr %struct.V* %v, i32 0, i32 0\n"
+	"  store i32 5, i32* %a\n"
+	"  call void @fill(%struct.V* %v)\n"
+	"  %b = getelementptr %struct.V* %v, i32 0, i32 1\n"
+	"  %r = load i32* %b\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define void @fill(%struct.V* %v) {\n"
+	"entry:\n"
+	"  %a = getelementptr %struct.V* %v, i32 0, i32 0\n"
+	"  %x = load i32* %a\n"
+	"  %b = getelementptr %struct.V* %v, i32 0, i32 1\n"
+	"  %y = mul i32 %x, 3\n"
+	"  store i32 %y, i32* %b\n"
+	"  ret void\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @sum(i32 4)\n"
+	"  %b = call i32 @escape()\n"
+	"  %s = mul i32 %a, 100\n"
+	"  %t = add i32 %s, %b\n"
+	"  store i32 %t, i32* @out\n"
+	"  ret void\n"
+	"}\n";
+
+TEST(CheerpTest, StructAllocaScalarizationTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(structAllocaFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	WriterOptions options;
+	options.readable = true;
+	std::string js = compileToJS(*M, options);
+
+	// The fields of the iterator are locals, the counter starts from the zero of the JS object
+	std::string sum = getFunctionCode(js, "_sum");
+	EXPECT_EQ(std::string::npos, sum.find("new ")) << js;
+	EXPECT_NE(std::string::npos, sum.find("var Lit$pfield1$p0=0;")) << js;
+	EXPECT_NE(std::string::npos, sum.find("Lit$pfield1$p0=((Lit$pfield1$p0+1)>>0);")) << js;
+	// The escaping struct is still an object
+	EXPECT_NE(std::string::npos, getFunctionCode(js, "_escape").find("var Lv=new constructor_struct$pV(0,0);")) << js;
+
+	js += "console.log(_out.d[0]);\n";
+	std::string output;
+	if ( !runInNode( js, output ) )
+	{
+		outs() << "node is not installed, the scalarized code is not run\n";
+		return;
+	}
+	// 1+2+3+4 from the iterator and 5*3 from the escaping struct
+	EXPECT_EQ("1015\n", output) << js;
+}
+
+}
+}
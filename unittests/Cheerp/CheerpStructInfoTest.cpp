@@ -0,0 +1,116 @@
+//===- llvm/unittest/Cheerp/CheerpStructInfoTest.cpp ----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/Cheerp/GlobalDepsAnalyzer.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/PassManager.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+using namespace cheerp;
+
+const char* structFunctions =
+	"%struct.A = type { i32 }\n"
+	"%struct.B = type { i32 }\n"
+	"%struct.C = type { %struct.A, %struct.B, i32 }\n"
+	"%struct.D = type { i32, %struct.C }\n"
+	"%struct.E = type { i32, i32 }\n"
+	"@a = global %struct.A* null\n"
+	"@d = global %struct.D zeroinitializer\n"
+	"@e = global %struct.E* null\n"
+	// D is only a downcast target through C, E is allocated as an array of unknown size
+	"define void @use(%struct.A* %p, i32 %n) {\n"
+	"entry:\n"
+	"  %c = call %struct.C* @llvm.cheerp.downcast.p0struct.C.p0struct.A(%struct.A* %p, i32 1)\n"
+	"  %ca = getelementptr %struct.C* %c, i32 0, i32 0\n"
+	"  store %struct.A* %ca, %struct.A** @a\n"
+	"  %size = mul i32 %n, 8\n"
+	"  %m = call i8* @_Znaj(i32 %size)\n"
+	"  %arr = bitcast i8* %m to %struct.E*\n"
+	"  store %struct.E* %arr, %struct.E** @e\n"
+	"  ret void\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %dc = getelementptr %struct.D* @d, i32 0, i32 1, i32 0\n"
+	"  call void @use(%struct.A* %dc, i32 3)\n"
+	"  ret void\n"
+	"}\n"
+	"declare %struct.C* @llvm.cheerp.downcast.p0struct.C.p0struct.A(%struct.A*, i32)\n"
+	"declare i8* @_Znaj(i32)\n"
+	// C has two direct bases starting from element 0, its downcast array holds C, A and B
+	"!struct.C_bases = !{!0}\n"
+	// D has one base at element 1, its downcast array holds D, C, A and B
+	"!struct.D_bases = !{!1}\n"
+	"!0 = metadata !{i32 0, i32 3}\n"
+	"!1 = metadata !{i32 1, i32 4}\n";
+
+TEST(CheerpTest, StructInfoTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(structFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	StructType* A = M->getTypeByName("struct.A");
+	StructType* B = M->getTypeByName("struct.B");
+	StructType* SC = M->getTypeByName("struct.C");
+	StructType* D = M->getTypeByName("struct.D");
+	StructType* E = M->getTypeByName("struct.E");
+	ASSERT_TRUE(A && B && SC && D && E);
+
+	// The pass manager owns the analyzer, the map lives as long as PM
+	PassManager PM;
+	GlobalDepsAnalyzer* GDA = new GlobalDepsAnalyzer();
+	PM.add(GDA);
+	PM.run(*M);
+	TypeSupport types(GDA->structsInfo());
+
+	// The layout read from the metadata, the direct bases are counted from the sizes of the downcast arrays of the bases
+	const StructInfo* infoC = types.getStructInfo(SC);
+	ASSERT_TRUE(infoC != NULL);
+	EXPECT_TRUE(infoC->hasBasesMetadata);
+	EXPECT_EQ(0u, infoC->firstBase);
+	EXPECT_EQ(2u, infoC->baseCount);
+	EXPECT_EQ(3u, infoC->downcastArraySize);
+	const StructInfo* infoD = types.getStructInfo(D);
+	ASSERT_TRUE(infoD != NULL);
+	EXPECT_TRUE(infoD->hasBasesMetadata);
+	EXPECT_EQ(1u, infoD->firstBase);
+	EXPECT_EQ(1u, infoD->baseCount);
+	EXPECT_EQ(4u, infoD->downcastArraySize);
+	uint32_t firstBase = 0, baseCount = 0;
+	EXPECT_TRUE(types.getBasesInfo(D, firstBase, baseCount));
+	EXPECT_EQ(1u, firstBase);
+	EXPECT_EQ(1u, baseCount);
+	EXPECT_TRUE(TypeSupport::getBasesInfo(*M, D, firstBase, baseCount));
+	EXPECT_EQ(1u, firstBase);
+	EXPECT_EQ(1u, baseCount);
+
+	// Only the downcast target is created with a downcast array, its bases get the slots of the array
+	EXPECT_TRUE(types.hasBasesInfo(SC));
+	EXPECT_EQ("_struct$pC", infoC->jsName);
+	EXPECT_FALSE(types.hasBasesInfo(D));
+	EXPECT_TRUE(infoC->hasDowncastSlots);
+	ASSERT_TRUE(types.getStructInfo(A) != NULL);
+	EXPECT_TRUE(types.getStructInfo(A)->hasDowncastSlots);
+	EXPECT_FALSE(types.hasBasesInfo(A));
+
+	// The arrays of unknown size only need the name of their createArray helper
+	const StructInfo* infoE = types.getStructInfo(E);
+	ASSERT_TRUE(infoE != NULL);
+	EXPECT_FALSE(infoE->hasBasesMetadata);
+	EXPECT_FALSE(types.hasBasesInfo(E));
+	EXPECT_EQ("_struct$pE", infoE->jsName);
+	EXPECT_FALSE(types.getBasesInfo(E, firstBase, baseCount));
+}
+
+}
+}
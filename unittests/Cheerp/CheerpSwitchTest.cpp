@@ -0,0 +1,221 @@
+//===- llvm/unittest/Cheerp/CheerpSwitchTest.cpp --------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* switchFunctions =
+	"@out = global i32 0\n"
+	// A switch with four targets, two of its cases go to the same block
+	"define i32 @dispatch(i32 %x) {\n"
+	"entry:\n"
+	"  switch i32 %x, label %def [ i32 0, label %a\n"
+	"                              i32 1, label %b\n"
+	"                              i32 2, label %c\n"
+	"                              i32 7, label %c ]\n"
+	"a:\n"
+	"  store i32 10, i32* @out\n"
+	"  br label %exit\n"
+	"b:\n"
+	"  store i32 20, i32* @out\n"
+	"  br label %exit\n"
+	"c:\n"
+	"  store i32 30, i32* @out\n"
+	"  br label %exit\n"
+	"def:\n"
+	"  store i32 40, i32* @out\n"
+	"  br label %exit\n"
+	"exit:\n"
+	"  %r = load i32* @out\n"
+	"  ret i32 %r\n"
+	"}\n"
+	// The dispatch loop of an interpreter, the default case leaves the loop from inside the switch
+	"define i32 @interp(i32* %code, i32 %n) {\n"
+	"entry:\n"
+	"  br label %loop\n"
+	"loop:\n"
+	"  %pc = phi i32 [ 0, %entry ], [ %pc1, %next ]\n"
+	"  %acc = phi i32 [ 0, %entry ], [ %acc2, %next ]\n"
+	"  %p = getelementptr i32* %code, i32 %pc\n"
+	"  %op = load i32* %p\n"
+	"  switch i32 %op, label %halt [ i32 0, label %inc\n"
+	"                                i32 1, label %dbl\n"
+	"                                i32 2, label %neg ]\n"
+	"inc:\n"
+	"  %ai = add i32 %acc, 1\n"
+	"  br label %next\n"
+	"dbl:\n"
+	"  %ad = shl i32 %acc, 1\n"
+	"  br label %next\n"
+	"neg:\n"
+	"  %an = sub i32 0, %acc\n"
+	"  br label %next\n"
+	"next:\n"
+	"  %acc2 = phi i32 [ %ai, %inc ], [ %ad, %dbl ], [ %an, %neg ]\n"
+	"  %pc1 = add i32 %pc, 1\n"
+	"  %done = icmp slt i32 %pc1, %n\n"
+	"  br i1 %done, label %loop, label %halt\n"
+	"halt:\n"
+	"  %res = phi i32 [ %acc, %loop ], [ %acc2, %next ]\n"
+	"  ret i32 %res\n"
+	"}\n"
+	// A loop with three exits, dispatched on the label after the loop
+	"define i32 @exits(i32* %code, i32 %n) {\n"
+	"entry:\n"
+	"  br label %loop\n"
+	"loop:\n"
+	"  %pc = phi i32 [ 0, %entry ], [ %pc1, %next ]\n"
+	"  %p = getelementptr i32* %code, i32 %pc\n"
+	"  %op = load i32* %p\n"
+	"  %c0 = icmp eq i32 %op, 0\n"
+	"  br i1 %c0, label %e0, label %t1\n"
+	"t1:\n"
+	"  %c1 = icmp eq i32 %op, 1\n"
+	"  br i1 %c1, label %e1, label %t2\n"
+	"t2:\n"
+	"  %c2 = icmp eq i32 %op, 2\n"
+	"  br i1 %c2, label %e2, label %next\n"
+	"next:\n"
+	"  %pc1 = add i32 %pc, 1\n"
+	"  br label %loop\n"
+	"e0:\n"
+	"  store i32 10, i32* @out\n"
+	"  ret i32 %pc\n"
+	"e1:\n"
+	"  store i32 20, i32* @out\n"
+	"  ret i32 %pc\n"
+	"e2:\n"
+	"  store i32 30, i32* @out\n"
+	"  ret i32 %pc\n"
+	"}\n"
+	// The same loop inside another one, the exits are followed by the latch of the outer loop
+	"define i32 @nested(i32* %code, i32 %n) {\n"
+	"entry:\n"
+	"  br label %outer\n"
+	"outer:\n"
+	"  %i = phi i32 [ 0, %entry ], [ %i1, %latch ]\n"
+	"  br label %loop\n"
+	"loop:\n"
+	"  %pc = phi i32 [ 0, %outer ], [ %pc1, %next ]\n"
+	"  %p = getelementptr i32* %code, i32 %pc\n"
+	"  %op = load i32* %p\n"
+	"  %c0 = icmp eq i32 %op, 0\n"
+	"  br i1 %c0, label %e0, label %t1\n"
+	"t1:\n"
+	"  %c1 = icmp eq i32 %op, 1\n"
+	"  br i1 %c1, label %e1, label %t2\n"
+	"t2:\n"
+	"  %c2 = icmp eq i32 %op, 2\n"
+	"  br i1 %c2, label %e2, label %next\n"
+	"next:\n"
+	"  %pc1 = add i32 %pc, 1\n"
+	"  br label %loop\n"
+	"e0:\n"
+	"  store i32 10, i32* @out\n"
+	"  br label %latch\n"
+	"e1:\n"
+	"  store i32 20, i32* @out\n"
+	"  br label %latch\n"
+	"e2:\n"
+	"  store i32 30, i32* @out\n"
+	"  br label %latch\n"
+	"latch:\n"
+	"  %i1 = add i32 %i, 1\n"
+	"  %d = icmp slt i32 %i1, %n\n"
+	"  br i1 %d, label %outer, label %exit\n"
+	"exit:\n"
+	"  ret i32 %i1\n"
+	"}\n"
+	// The exits go back to the outer loop or return, so nothing follows their dispatch
+	"define i32 @noNext(i32* %code, i32 %n) {\n"
+	"entry:\n"
+	"  br label %outer\n"
+	"outer:\n"
+	"  %i = phi i32 [ 0, %entry ], [ %i2, %e0 ], [ %i3, %e1 ]\n"
+	"  br label %loop\n"
+	"loop:\n"
+	"  %pc = phi i32 [ 0, %outer ], [ %pc1, %next ]\n"
+	"  %p = getelementptr i32* %code, i32 %pc\n"
+	"  %op = load i32* %p\n"
+	"  %c0 = icmp eq i32 %op, 0\n"
+	"  br i1 %c0, label %e0, label %t1\n"
+	"t1:\n"
+	"  %c1 = icmp eq i32 %op, 1\n"
+	"  br i1 %c1, label %e1, label %t2\n"
+	"t2:\n"
+	"  %c2 = icmp eq i32 %op, 2\n"
+	"  br i1 %c2, label %e2, label %next\n"
+	"next:\n"
+	"  %pc1 = add i32 %pc, 1\n"
+	"  br label %loop\n"
+	"e0:\n"
+	"  store i32 10, i32* @out\n"
+	"  %i2 = add i32 %i, 2\n"
+	"  br label %outer\n"
+	"e1:\n"
+	"  store i32 20, i32* @out\n"
+	"  %i3 = add i32 %i, 3\n"
+	"  br label %outer\n"
+	"e2:\n"
+	"  store i32 30, i32* @out\n"
+	"  ret i32 %i\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @dispatch(i32 2)\n"
+	"  %b = call i32 @interp(i32* @out, i32 1)\n"
+	"  %c = call i32 @exits(i32* @out, i32 1)\n"
+	"  %d = call i32 @nested(i32* @out, i32 1)\n"
+	"  %e = call i32 @noNext(i32* @out, i32 1)\n"
+	"  ret void\n"
+	"}\n";
+
+TEST(CheerpTest, SwitchRenderingTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(switchFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	WriterOptions options;
+	options.readable = true;
+	std::string js = compileToJS(*M, options);
+
+	// Multi-way branches are rendered as a switch on the condition, the cases of the same block are merged
+	std::string dispatch = getFunctionCode(js, "_dispatch");
+	EXPECT_NE(std::string::npos, dispatch.find("switch(Lx){")) << dispatch;
+	EXPECT_NE(std::string::npos, dispatch.find("case 0:{")) << dispatch;
+	EXPECT_NE(std::string::npos, dispatch.find("case 2:case 7:{")) << dispatch;
+	EXPECT_NE(std::string::npos, dispatch.find("default:{")) << dispatch;
+	EXPECT_EQ(std::string::npos, dispatch.find("if(")) << dispatch;
+
+	// An unlabeled break would only exit the switch, so leaving the loop needs the label of the loop
+	std::string interp = getFunctionCode(js, "_interp");
+	EXPECT_NE(std::string::npos, interp.find("L1:while(1){")) << interp;
+	EXPECT_NE(std::string::npos, interp.find("switch(Lop){")) << interp;
+	EXPECT_NE(std::string::npos, interp.find("break L1;")) << interp;
+
+	// The label dispatch with three entries is a switch on the label
+	std::string exits = getFunctionCode(js, "_exits");
+	EXPECT_NE(std::string::npos, exits.find("switch(label){")) << exits;
+	EXPECT_EQ(std::string::npos, exits.find("if(label")) << exits;
+
+	// The entries of a dispatch inside a loop clear the label, unless nothing follows the dispatch
+	std::string nested = getFunctionCode(js, "_nested");
+	EXPECT_NE(std::string::npos, nested.find("switch(label){")) << nested;
+	EXPECT_NE(std::string::npos, nested.find("\tlabel=0;")) << nested;
+	std::string noNext = getFunctionCode(js, "_noNext");
+	EXPECT_NE(std::string::npos, noNext.find("if(label===")) << noNext;
+	EXPECT_EQ(std::string::npos, noNext.find("\tlabel=0;")) << noNext;
+}
+
+}
+}
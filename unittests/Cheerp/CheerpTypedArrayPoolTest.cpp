@@ -0,0 +1,117 @@
+//===- llvm/unittest/Cheerp/CheerpTypedArrayPoolTest.cpp ------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+const char* poolFunctions =
+	"declare i8* @malloc(i32)\n"
+	"declare void @free(i8*)\n"
+	"declare void @llvm.cheerp.deallocate(i8*)\n"
+	// An array of numbers allocated as a whole is a typed array of its own, released with cheerp_deallocate
+	"define i32 @fixed(i32 %v) {\n"
+	"entry:\n"
+	"  %m = call i8* @malloc(i32 16)\n"
+	"  %p = bitcast i8* %m to [4 x i32]*\n"
+	"  %q = getelementptr [4 x i32]* %p, i32 0, i32 2\n"
+	"  store i32 %v, i32* %q\n"
+	"  %r = load i32* %q\n"
+	"  %f = bitcast [4 x i32]* %p to i8*\n"
+	"  call void @llvm.cheerp.deallocate(i8* %f)\n"
+	"  ret i32 %r\n"
+	"}\n"
+	// The same array released with free
+	"define i32 @fixedRegular(i32 %v) {\n"
+	"entry:\n"
+	"  %m = call i8* @malloc(i32 16)\n"
+	"  %p = bitcast i8* %m to [4 x i32]*\n"
+	"  %q = getelementptr [4 x i32]* %p, i32 0, i32 1\n"
+	"  store i32 %v, i32* %q\n"
+	"  %r = load i32* %q\n"
+	"  %f = bitcast [4 x i32]* %p to i8*\n"
+	"  call void @free(i8* %f)\n"
+	"  ret i32 %r\n"
+	"}\n"
+	// A typed array of numbers
+	"define i32 @dynamic(i32 %n) {\n"
+	"entry:\n"
+	"  %s = shl i32 %n, 2\n"
+	"  %m = call i8* @malloc(i32 %s)\n"
+	"  %p = bitcast i8* %m to i32*\n"
+	"  store i32 %n, i32* %p\n"
+	"  %r = load i32* %p\n"
+	"  %f = bitcast i32* %p to i8*\n"
+	"  call void @free(i8* %f)\n"
+	"  ret i32 %r\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @fixed(i32 3)\n"
+	"  %b = call i32 @fixedRegular(i32 3)\n"
+	"  %c = call i32 @dynamic(i32 3)\n"
+	"  ret void\n"
+	"}\n";
+
+std::string compilePoolFunctions(bool typedArrayPool, bool sizeReport)
+{
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(poolFunctions, C));
+	if(!M)
+		return "";
+	WriterOptions options;
+	options.readable = true;
+	options.typedArrayPool = typedArrayPool;
+	options.sizeReport = sizeReport;
+	return compileToJS(*M, options);
+}
+
+size_t countOccurrences(const std::string& str, const std::string& what)
+{
+	size_t count = 0;
+	for(size_t pos = str.find(what); pos != std::string::npos; pos = str.find(what, pos + what.size()))
+		count++;
+	return count;
+}
+
+TEST(CheerpTest, TypedArrayPoolTest) {
+
+	std::string js = compilePoolFunctions(true, false);
+
+	// Every allocation comes from the pool and every free gives the typed array back
+	for(const char* name: { "fixed", "fixedRegular", "dynamic" })
+	{
+		std::string code = getFunctionCode(js, std::string("_") + name);
+		EXPECT_NE(std::string::npos, code.find("cheerpPoolAlloc(Int32Array,")) << code;
+		EXPECT_NE(std::string::npos, code.find("cheerpPoolFree(")) << code;
+	}
+	// The array of numbers allocated as a whole is freed as the typed array itself, not as the array holding it
+	std::string fixedRegular = getFunctionCode(js, "_fixedRegular");
+	EXPECT_NE(std::string::npos, fixedRegular.find("cheerpPoolAlloc(Int32Array,4)")) << fixedRegular;
+	EXPECT_NE(std::string::npos, fixedRegular.find("+0])")) << fixedRegular;
+	// The statistics are only collected for the size report
+	EXPECT_EQ(std::string::npos, js.find("cheerpPoolStats")) << js;
+
+	std::string report = compilePoolFunctions(true, true);
+	EXPECT_NE(std::string::npos, report.find("var cheerpPoolStats={hits:0,misses:0,inPlace:0,frees:0};")) << report;
+	EXPECT_EQ(2u, countOccurrences(report, "cheerpPoolStats.misses++;")) << report;
+	EXPECT_EQ(1u, countOccurrences(report, "cheerpPoolStats.hits++;")) << report;
+	EXPECT_EQ(1u, countOccurrences(report, "cheerpPoolStats.frees++;")) << report;
+
+	// Without the pool the memory is left to the garbage collector
+	std::string plain = compilePoolFunctions(false, false);
+	EXPECT_EQ(std::string::npos, plain.find("cheerpPool")) << plain;
+	EXPECT_NE(std::string::npos, plain.find("new Int32Array(4)")) << plain;
+}
+
+}
+}
@@ -0,0 +1,89 @@
+//===- llvm/unittest/Cheerp/CheerpTypedLocalsTest.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+// c is a boolean and t a number, the loaded l and the returned r may be either one. The PHIs mix them
+const char* typedFunctions =
+	"@flag = global i1 false\n"
+	"@d = global double 0.0\n"
+	"@o = global i32* null\n"
+	"define i32 @bools(i32 %x, i32 %y) {\n"
+	"entry:\n"
+	"  %c = icmp slt i32 %x, %y\n"
+	"  %l = load i1* @flag\n"
+	"  %r = call i1 @ext(i32 %x)\n"
+	"  %t = trunc i32 %y to i1\n"
+	"  br i1 %c, label %a, label %b\n"
+	"a:\n"
+	"  br label %exit\n"
+	"b:\n"
+	"  br label %exit\n"
+	"exit:\n"
+	"  %p = phi i1 [ %l, %a ], [ %c, %b ]\n"
+	"  %q = phi i1 [ %r, %a ], [ %t, %b ]\n"
+	"  %s = select i1 %p, i1 %q, i1 %c\n"
+	"  store i1 %s, i1* @flag\n"
+	"  %z = zext i1 %q to i32\n"
+	"  %dv = load double* @d\n"
+	"  %dm = fmul double %dv, %dv\n"
+	"  store double %dm, double* @d\n"
+	"  %ov = load i32** @o\n"
+	"  %ow = getelementptr i32* %ov, i32 1\n"
+	"  store i32* %ov, i32** @o\n"
+	"  store i32* %ow, i32** @o\n"
+	"  ret i32 %z\n"
+	"}\n"
+	"define i1 @ext(i32 %x) {\n"
+	"entry:\n"
+	"  %c = icmp eq i32 %x, 0\n"
+	"  ret i1 %c\n"
+	"}\n"
+	"define void @_Z7webMainv() {\n"
+	"entry:\n"
+	"  %a = call i32 @bools(i32 2, i32 3)\n"
+	"  ret void\n"
+	"}\n";
+
+TEST(CheerpTest, TypedLocalsTest) {
+
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(typedFunctions, C));
+	ASSERT_TRUE(M.get() != NULL);
+	WriterOptions options;
+	options.readable = true;
+	options.typedLocals = true;
+	std::string js = compileToJS(*M, options);
+	std::string code = getFunctionCode(js, "_bools");
+
+	// All the registers are declared at the start with a value of their kind, then assigned without var
+	EXPECT_NE(std::string::npos, code.find("var Ll=false,Lr=false,Lc=false,Lt=0,Ldv=0.0,Lov=null;")) << code;
+	EXPECT_EQ(code.find("var L"), code.rfind("var L")) << code;
+	// The i1 values which may be numbers stay in BOOLEAN registers and are coerced when assigned
+	EXPECT_NE(std::string::npos, code.find("Ll=!!((_flag.d[_flag.o+0]<<31>>31));")) << code;
+	EXPECT_NE(std::string::npos, code.find("Lr=!!(_ext(Lx));")) << code;
+	EXPECT_NE(std::string::npos, code.find("Lr=!!(Lt);")) << code;
+	// Booleans are copied as they are, and truncations are numbers in INTEGER registers
+	EXPECT_NE(std::string::npos, code.find("Ll=Lc;")) << code;
+	EXPECT_NE(std::string::npos, code.find("Lt=(Ly&1);")) << code;
+
+	// Without typed locals the registers are declared where they are assigned and nothing is coerced
+	options.typedLocals = false;
+	std::string plain = getFunctionCode(compileToJS(*M, options), "_bools");
+	EXPECT_NE(std::string::npos, plain.find("var Lr=_ext(Lx);")) << plain;
+	EXPECT_EQ(std::string::npos, plain.find("!!")) << plain;
+}
+
+}
+}
@@ -0,0 +1,168 @@
+//===- llvm/unittest/Cheerp/CheerpWriterTestUtils.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/Cheerp/Writer.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/PassManager.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+
+const char* cheerpModuleHeader =
+	"target datalayout = \"b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8\"\n"
+	"target triple = \"cheerp--webbrowser\"\n";
+
+Module* parseCheerpModule(const std::string& body, LLVMContext& C)
+{
+	SMDiagnostic Err;
+	Module* M = ParseAssemblyString((std::string(cheerpModuleHeader) + body).c_str(), NULL, Err, C);
+	if(!M)
+	{
+		std::string msg;
+		raw_string_ostream os(msg);
+		Err.print("", os);
+		ADD_FAILURE() << os.str();
+	}
+	return M;
+}
+
+Module* loadCheerpModule(const char* fileName, LLVMContext& C)
+{
+	SMDiagnostic Err;
+	Module* M = ParseIRFile(std::string(CHEERP_TEST_INPUTS) + fileName, Err, C);
+	if(!M)
+		ADD_FAILURE() << "Cannot load " << fileName << ": " << Err.getMessage().str();
+	return M;
+}
+
+void addDebugLocations(Module& M)
+{
+	LLVMContext& C = M.getContext();
+	for(Function& F: M)
+	{
+		Value* fileOps[] = { MDString::get(C, ("src/" + F.getName() + ".cpp").str()), MDString::get(C, "/tmp") };
+		Value* scopeOps[] = { ConstantInt::get(Type::getInt32Ty(C), 786473), MDNode::get(C, fileOps) };
+		MDNode* scope = MDNode::get(C, scopeOps);
+		uint32_t line = 1;
+		for(BasicBlock& BB: F)
+			for(Instruction& I: BB)
+				I.setDebugLoc(DebugLoc::get(line++, 0, scope));
+	}
+}
+
+namespace {
+
+// Same as the CheerpWritePass of the backend, but writing to a string
+class TestWritePass : public ModulePass {
+private:
+	raw_ostream& Out;
+	const WriterOptions& options;
+public:
+	static char ID;
+	TestWritePass(raw_ostream& o, const WriterOptions& options) : ModulePass(ID), Out(o), options(options) { }
+	bool runOnModule(Module& M)
+	{
+		cheerp::PointerAnalyzer& PA = getAnalysis<cheerp::PointerAnalyzer>();
+		cheerp::GlobalDepsAnalyzer& GDA = getAnalysis<cheerp::GlobalDepsAnalyzer>();
+		cheerp::Registerize& registerize = getAnalysis<cheerp::Registerize>();
+		OwningPtr<cheerp::SourceMapGenerator> sourceMapGenerator;
+		if(!options.sourceMap.empty())
+		{
+			std::string ErrorString;
+			sourceMapGenerator.reset(new cheerp::SourceMapGenerator(options.sourceMap, "", false, M.getContext(), ErrorString));
+			EXPECT_TRUE(ErrorString.empty()) << ErrorString;
+		}
+		cheerp::CheerpWriter writer(M, Out, PA, registerize, GDA, sourceMapGenerator.get(), options.readable,
+		                            options.noRegisterize, options.asmJSCoercions, options.typedArrayPool,
+		                            options.typedLocals, options.codeSize, options.sizeReport,
+		                            options.lazyChunksPrefix, options.threads);
+		writer.makeJS();
+		return false;
+	}
+	void getAnalysisUsage(AnalysisUsage& AU) const
+	{
+		AU.addRequired<cheerp::GlobalDepsAnalyzer>();
+		AU.addRequired<cheerp::PointerAnalyzer>();
+		AU.addRequired<cheerp::Registerize>();
+	}
+};
+
+char TestWritePass::ID = 0;
+
+}
+
+std::string compileToJS(Module& M, const WriterOptions& options)
+{
+	std::string js;
+	raw_string_ostream os(js);
+	PassManager PM;
+	cheerp::addPreparationPasses(PM, options.fieldSensitivePointers, options.noRegisterize);
+	PM.add(new TestWritePass(os, options));
+	PM.run(M);
+	return os.str();
+}
+
+std::string getFunctionCode(const std::string& js, StringRef name)
+{
+	std::string header = "function " + name.str() + "(";
+	size_t start = js.find(header);
+	if(start == std::string::npos)
+		return "";
+	// Only the closing brace of functions is not indented
+	size_t end = js.find("\n}", start);
+	if(end == std::string::npos)
+		return "";
+	return js.substr(start, end + 2 - start);
+}
+
+std::string readAndRemove(StringRef fileName)
+{
+	OwningPtr<MemoryBuffer> buffer;
+	EXPECT_FALSE(MemoryBuffer::getFile(fileName, buffer)) << fileName.str();
+	std::string ret = buffer ? buffer->getBuffer().str() : "";
+	sys::fs::remove(fileName);
+	return ret;
+}
+
+bool runInNode(const std::string& js, std::string& output)
+{
+	std::string node = sys::FindProgramByName("node");
+	if(node.empty())
+		return false;
+	SmallString<128> script, out;
+	EXPECT_FALSE(sys::fs::createTemporaryFile("cheerp-test", "js", script));
+	EXPECT_FALSE(sys::fs::createTemporaryFile("cheerp-test", "out", out));
+	{
+		std::string ErrorInfo;
+		raw_fd_ostream os(script.c_str(), ErrorInfo, sys::fs::F_None);
+		EXPECT_TRUE(ErrorInfo.empty()) << ErrorInfo;
+		os << js;
+	}
+	const char* args[] = { node.c_str(), script.c_str(), NULL };
+	StringRef outRef(out);
+	const StringRef* redirects[] = { NULL, &outRef, NULL };
+	std::string ErrMsg;
+	EXPECT_EQ(0, sys::ExecuteAndWait(node, args, NULL, redirects, 60, 0, &ErrMsg)) << ErrMsg;
+	sys::fs::remove(script.str());
+	output = readAndRemove(out.str());
+	return true;
+}
+
+}
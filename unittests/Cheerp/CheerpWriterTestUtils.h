@@ -0,0 +1,62 @@
+//===- llvm/unittest/Cheerp/CheerpWriterTestUtils.h -----------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef CHEERP_WRITER_TEST_UTILS_H
+#define CHEERP_WRITER_TEST_UTILS_H
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include <string>
+
+namespace llvm {
+
+// The same options of llc -march=cheerp, the defaults match the ones of the command line
+struct WriterOptions
+{
+	bool readable = false;
+	bool noRegisterize = false;
+	bool asmJSCoercions = false;
+	bool typedArrayPool = false;
+	bool typedLocals = false;
+	bool codeSize = false;
+	bool sizeReport = false;
+	bool fieldSensitivePointers = false;
+	std::string lazyChunksPrefix;
+	// If not empty the source map is written to this file
+	std::string sourceMap;
+	unsigned threads = 1;
+};
+
+// The datalayout and the triple of the modules generated by the Cheerp frontend
+extern const char* cheerpModuleHeader;
+
+// Parse a module from a string of assembly, cheerpModuleHeader is prepended to it
+Module* parseCheerpModule(const std::string& body, LLVMContext& C);
+
+// Parse a module from one of the .ll files of the tests
+Module* loadCheerpModule(const char* fileName, LLVMContext& C);
+
+// Give every instruction a location in a source file named after its function, one line for each instruction
+void addDebugLocations(Module& M);
+
+// Run the backend pipeline on M and return the generated JavaScript
+std::string compileToJS(Module& M, const WriterOptions& options = WriterOptions());
+
+// The code of the JS function called name in readable output, from its header to its closing brace, empty if it is not found
+std::string getFunctionCode(const std::string& js, StringRef name);
+
+// Read the file and remove it
+std::string readAndRemove(StringRef fileName);
+
+// Run the JavaScript with node and store what it prints in output, return false if node is not installed
+bool runInNode(const std::string& js, std::string& output);
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+//===- llvm/unittest/Cheerp/CheerpWriterThreadsTest.cpp -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWriterTestUtils.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include "gtest/gtest.h"
+
+namespace llvm {
+namespace {
+
+struct CompiledModule
+{
+	std::string js;
+	std::string sourceMap;
+};
+
+CompiledModule compileWithThreads(const char* fileName, StringRef mapName, unsigned threads)
+{
+	CompiledModule ret;
+	LLVMContext C;
+	OwningPtr<Module> M(loadCheerpModule(fileName, C));
+	if(!M)
+		return ret;
+	addDebugLocations(*M);
+
+	WriterOptions options;
+	options.threads = threads;
+	options.sourceMap = mapName.str();
+	ret.js = compileToJS(*M, options);
+	ret.sourceMap = readAndRemove(mapName);
+	return ret;
+}
+
+// The functions compiled by the workers are flushed in module order, so the output and its source map
+// must be the same as the ones of the serial writer
+TEST(CheerpTest, WriterThreadsTest) {
+
+	for(const char* fileName: { "test1.ll", "exceptions.ll" })
+	{
+		// The name of the map is written in the output
+		SmallString<128> mapName;
+		ASSERT_FALSE(sys::fs::createTemporaryFile("cheerp-threads", "map", mapName));
+		CompiledModule serial = compileWithThreads(fileName, mapName, 1);
+		CompiledModule parallel = compileWithThreads(fileName, mapName, 4);
+		EXPECT_FALSE(serial.js.empty()) << fileName;
+		EXPECT_NE(std::string::npos, serial.sourceMap.find("\"sources\": [\"src/")) << fileName;
+		EXPECT_EQ(serial.js, parallel.js) << fileName;
+		EXPECT_EQ(serial.sourceMap, parallel.sourceMap) << fileName;
+	}
+}
+
+// Many more functions than the window of the workers, so the data of the flushed functions is released
+// in several batches while the other functions are being compiled
+std::string manyFunctions(uint32_t count)
+{
+	std::string body;
+	raw_string_ostream os(body);
+	for(uint32_t i = 0; i < count; i++)
+	{
+		os << "define i32 @f" << i << "(i32 %a, i32 %b) {\n"
+		   << "entry:\n"
+		   << "  %c = icmp slt i32 %a, %b\n"
+		   << "  br i1 %c, label %then, label %end\n"
+		   << "then:\n"
+		   << "  %s = add i32 %a, " << i << "\n";
+		if(i)
+			os << "  %r = call i32 @f" << i - 1 << "(i32 %s, i32 %b)\n";
+		else
+			os << "  %r = mul i32 %s, %b\n";
+		os << "  br label %end\n"
+		   << "end:\n"
+		   << "  %p = phi i32 [ %a, %entry ], [ %r, %then ]\n"
+		   << "  %q = phi i32 [ %b, %entry ], [ %a, %then ]\n"
+		   << "  %t = sub i32 %p, %q\n"
+		   << "  ret i32 %t\n"
+		   << "}\n";
+	}
+	os << "define void @_Z7webMainv() {\n"
+	   << "entry:\n"
+	   << "  %r = call i32 @f" << count - 1 << "(i32 1, i32 2)\n"
+	   << "  ret void\n"
+	   << "}\n";
+	return os.str();
+}
+
+std::string compileManyFunctions(unsigned threads)
+{
+	LLVMContext C;
+	OwningPtr<Module> M(parseCheerpModule(manyFunctions(100), C));
+	if(!M)
+		return "";
+	WriterOptions options;
+	options.threads = threads;
+	return compileToJS(*M, options);
+}
+
+TEST(CheerpTest, WriterThreadsReleaseTest) {
+
+	std::string serial = compileManyFunctions(1);
+	EXPECT_NE(std::string::npos, serial.find("function ")) << serial;
+	for(unsigned threads: { 2, 3, 8 })
+		EXPECT_EQ(serial, compileManyFunctions(threads)) << threads;
+}
+
+}
+}
@@ -0,0 +1,401 @@
+; Exceptions caught through their bases, modelled on the code generated for:
+;
+;   struct Base { int b; };
+;   struct Other { int o; };
+;   struct Der : Base { int d; };
+;   struct Multi : Other, Der { int m; ~Multi() { destroyed++; } };
+;   struct Hidden : private Base { int h; };
+;   void thrower(int which, int v) {
+;     if(which == 0) throw Der{v, v+1};
+;     if(which == 1) throw Multi{v+2, v, v+1, v+3};
+;     throw Hidden{v, v+1};
+;   }
+;   int catchBase(int which, int v) { try { thrower(which, v); } catch(Base& b) { return b.b; } catch(Other& o) { return -o.o; } catch(...) { return -1; } return 0; }
+;   int catchOther(int which, int v) { try { thrower(which, v); } catch(Other& o) { return -o.o; } return 0; }
+;   int rethrowBase(int which, int v) { try { thrower(which, v); } catch(Base&) { throw; } return 0; }
+;   int catchMulti(int which, int v) { try { return rethrowBase(which, v); } catch(Multi& m) { return m.m; } }
+;   int nestedRethrow(int which, int v) { try { try { thrower(which, v); } catch(Base&) { throw; } } catch(Base& b) { return b.b + 100; } return 0; }
+;   struct Guard { ~Guard() { guards++; } };
+;   int cleanupInHandler(int v) { try { thrower(1, v); } catch(Other&) { Guard g; thrower(0, v + 1); } return 0; }
+;   int catchCleanup(int v) { try { return cleanupInHandler(v); } catch(Base& b) { return b.b; } }
+;
+; The primary bases are laid out at the beginning of the derived structs, Der is a field of Multi.
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+%struct._Z4Base = type { i32 }
+%struct._Z5Other = type { i32 }
+%struct._Z3Der = type { i32, i32 }
+%struct._Z5Multi = type { i32, i32, %struct._Z3Der }
+%struct._Z6Hidden = type { i32, i32 }
+
+@_ZTVN10__cxxabiv117__class_type_infoE = external global i8*
+@_ZTVN10__cxxabiv120__si_class_type_infoE = external global i8*
+@_ZTVN10__cxxabiv121__vmi_class_type_infoE = external global i8*
+@_ZTS4Base = linkonce_odr constant [6 x i8] c"4Base\00"
+@_ZTI4Base = linkonce_odr constant { i8*, i8* } { i8* bitcast (i8** getelementptr inbounds (i8** @_ZTVN10__cxxabiv117__class_type_infoE, i32 2) to i8*), i8* getelementptr inbounds ([6 x i8]* @_ZTS4Base, i32 0, i32 0) }
+@_ZTS5Other = linkonce_odr constant [7 x i8] c"5Other\00"
+@_ZTI5Other = linkonce_odr constant { i8*, i8* } { i8* bitcast (i8** getelementptr inbounds (i8** @_ZTVN10__cxxabiv117__class_type_infoE, i32 2) to i8*), i8* getelementptr inbounds ([7 x i8]* @_ZTS5Other, i32 0, i32 0) }
+@_ZTS3Der = linkonce_odr constant [5 x i8] c"3Der\00"
+@_ZTI3Der = linkonce_odr constant { i8*, i8*, i8* } { i8* bitcast (i8** getelementptr inbounds (i8** @_ZTVN10__cxxabiv120__si_class_type_infoE, i32 2) to i8*), i8* getelementptr inbounds ([5 x i8]* @_ZTS3Der, i32 0, i32 0), i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*) }
+@_ZTS5Multi = linkonce_odr constant [7 x i8] c"5Multi\00"
+@_ZTI5Multi = linkonce_odr constant { i8*, i8*, i32, i32, i8*, i32, i8*, i32 } { i8* bitcast (i8** getelementptr inbounds (i8** @_ZTVN10__cxxabiv121__vmi_class_type_infoE, i32 2) to i8*), i8* getelementptr inbounds ([7 x i8]* @_ZTS5Multi, i32 0, i32 0), i32 0, i32 2, i8* bitcast ({ i8*, i8* }* @_ZTI5Other to i8*), i32 2, i8* bitcast ({ i8*, i8*, i8* }* @_ZTI3Der to i8*), i32 1026 }
+@_ZTS6Hidden = linkonce_odr constant [8 x i8] c"6Hidden\00"
+@_ZTI6Hidden = linkonce_odr constant { i8*, i8*, i32, i32, i8*, i32 } { i8* bitcast (i8** getelementptr inbounds (i8** @_ZTVN10__cxxabiv121__vmi_class_type_infoE, i32 2) to i8*), i8* getelementptr inbounds ([8 x i8]* @_ZTS6Hidden, i32 0, i32 0), i32 0, i32 1, i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*), i32 0 }
+@destroyed = global i32 0
+@guards = global i32 0
+
+define linkonce_odr void @_ZN5MultiD2Ev(%struct._Z5Multi* %this) {
+entry:
+  %0 = load i32* @destroyed
+  %inc = add nsw i32 %0, 1
+  store i32 %inc, i32* @destroyed
+  ret void
+}
+
+define void @_Z7throwerii(i32 %which, i32 %v) noinline {
+entry:
+  %v1 = add nsw i32 %v, 1
+  switch i32 %which, label %hidden [
+    i32 0, label %der
+    i32 1, label %multi
+  ]
+
+der:
+  %exception = call i8* @__cxa_allocate_exception(i32 8)
+  %0 = bitcast i8* %exception to %struct._Z3Der*
+  %b = getelementptr inbounds %struct._Z3Der* %0, i32 0, i32 0
+  store i32 %v, i32* %b
+  %d = getelementptr inbounds %struct._Z3Der* %0, i32 0, i32 1
+  store i32 %v1, i32* %d
+  call void @__cxa_throw(i8* %exception, i8* bitcast ({ i8*, i8*, i8* }* @_ZTI3Der to i8*), i8* null) noreturn
+  unreachable
+
+multi:
+  %exception1 = call i8* @__cxa_allocate_exception(i32 16)
+  %1 = bitcast i8* %exception1 to %struct._Z5Multi*
+  %v2 = add nsw i32 %v, 2
+  %v3 = add nsw i32 %v, 3
+  %o = getelementptr inbounds %struct._Z5Multi* %1, i32 0, i32 0
+  store i32 %v2, i32* %o
+  %m = getelementptr inbounds %struct._Z5Multi* %1, i32 0, i32 1
+  store i32 %v3, i32* %m
+  %b1 = getelementptr inbounds %struct._Z5Multi* %1, i32 0, i32 2, i32 0
+  store i32 %v, i32* %b1
+  %d1 = getelementptr inbounds %struct._Z5Multi* %1, i32 0, i32 2, i32 1
+  store i32 %v1, i32* %d1
+  call void @__cxa_throw(i8* %exception1, i8* bitcast ({ i8*, i8*, i32, i32, i8*, i32, i8*, i32 }* @_ZTI5Multi to i8*), i8* bitcast (void (%struct._Z5Multi*)* @_ZN5MultiD2Ev to i8*)) noreturn
+  unreachable
+
+hidden:
+  %exception2 = call i8* @__cxa_allocate_exception(i32 8)
+  %2 = bitcast i8* %exception2 to %struct._Z6Hidden*
+  %b2 = getelementptr inbounds %struct._Z6Hidden* %2, i32 0, i32 0
+  store i32 %v, i32* %b2
+  %h = getelementptr inbounds %struct._Z6Hidden* %2, i32 0, i32 1
+  store i32 %v1, i32* %h
+  call void @__cxa_throw(i8* %exception2, i8* bitcast ({ i8*, i8*, i32, i32, i8*, i32 }* @_ZTI6Hidden to i8*), i8* null) noreturn
+  unreachable
+}
+
+define i32 @_Z9catchBaseii(i32 %which, i32 %v) noinline {
+entry:
+  invoke void @_Z7throwerii(i32 %which, i32 %v)
+          to label %cont unwind label %lpad
+
+cont:
+  ret i32 0
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI5Other to i8*)
+          catch i8* null
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch.base, label %catch.fallthrough
+
+catch.base:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  %5 = bitcast i8* %4 to %struct._Z4Base*
+  %b = getelementptr inbounds %struct._Z4Base* %5, i32 0, i32 0
+  %6 = load i32* %b
+  call void @__cxa_end_catch()
+  ret i32 %6
+
+catch.fallthrough:
+  %7 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI5Other to i8*))
+  %matches1 = icmp eq i32 %2, %7
+  br i1 %matches1, label %catch.other, label %catch.all
+
+catch.other:
+  %8 = call i8* @__cxa_begin_catch(i8* %1)
+  %9 = bitcast i8* %8 to %struct._Z5Other*
+  %o = getelementptr inbounds %struct._Z5Other* %9, i32 0, i32 0
+  %10 = load i32* %o
+  %neg = sub nsw i32 0, %10
+  call void @__cxa_end_catch()
+  ret i32 %neg
+
+catch.all:
+  %11 = call i8* @__cxa_begin_catch(i8* %1)
+  call void @__cxa_end_catch()
+  ret i32 -1
+}
+
+define i32 @_Z10catchOtherii(i32 %which, i32 %v) noinline {
+entry:
+  invoke void @_Z7throwerii(i32 %which, i32 %v)
+          to label %cont unwind label %lpad
+
+cont:
+  ret i32 0
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI5Other to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI5Other to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch, label %eh.resume
+
+catch:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  %5 = bitcast i8* %4 to %struct._Z5Other*
+  %o = getelementptr inbounds %struct._Z5Other* %5, i32 0, i32 0
+  %6 = load i32* %o
+  %neg = sub nsw i32 0, %6
+  call void @__cxa_end_catch()
+  ret i32 %neg
+
+eh.resume:
+  resume { i8*, i32 } %0
+}
+
+define i32 @_Z11rethrowBaseii(i32 %which, i32 %v) noinline {
+entry:
+  invoke void @_Z7throwerii(i32 %which, i32 %v)
+          to label %cont unwind label %lpad
+
+cont:
+  ret i32 0
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch, label %eh.resume
+
+catch:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  invoke void @__cxa_rethrow() noreturn
+          to label %unreachable unwind label %lpad1
+
+lpad1:
+  %5 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          cleanup
+  call void @__cxa_end_catch()
+  resume { i8*, i32 } %5
+
+eh.resume:
+  resume { i8*, i32 } %0
+
+unreachable:
+  unreachable
+}
+
+define i32 @_Z10catchMultiii(i32 %which, i32 %v) noinline {
+entry:
+  %call = invoke i32 @_Z11rethrowBaseii(i32 %which, i32 %v)
+          to label %cont unwind label %lpad
+
+cont:
+  ret i32 %call
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8*, i32, i32, i8*, i32, i8*, i32 }* @_ZTI5Multi to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8*, i32, i32, i8*, i32, i8*, i32 }* @_ZTI5Multi to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch, label %eh.resume
+
+catch:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  %5 = bitcast i8* %4 to %struct._Z5Multi*
+  %m = getelementptr inbounds %struct._Z5Multi* %5, i32 0, i32 1
+  %6 = load i32* %m
+  call void @__cxa_end_catch()
+  ret i32 %6
+
+eh.resume:
+  resume { i8*, i32 } %0
+}
+
+define i32 @_Z13nestedRethrowii(i32 %which, i32 %v) noinline {
+entry:
+  invoke void @_Z7throwerii(i32 %which, i32 %v)
+          to label %cont unwind label %lpad
+
+cont:
+  ret i32 0
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch.inner, label %eh.resume
+
+catch.inner:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  invoke void @__cxa_rethrow() noreturn
+          to label %unreachable unwind label %lpad1
+
+lpad1:
+  %5 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*)
+  %6 = extractvalue { i8*, i32 } %5, 0
+  %7 = extractvalue { i8*, i32 } %5, 1
+  call void @__cxa_end_catch()
+  %8 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*))
+  %matches1 = icmp eq i32 %7, %8
+  br i1 %matches1, label %catch.outer, label %eh.resume1
+
+catch.outer:
+  %9 = call i8* @__cxa_begin_catch(i8* %6)
+  %10 = bitcast i8* %9 to %struct._Z4Base*
+  %b = getelementptr inbounds %struct._Z4Base* %10, i32 0, i32 0
+  %11 = load i32* %b
+  %add = add nsw i32 %11, 100
+  call void @__cxa_end_catch()
+  ret i32 %add
+
+eh.resume1:
+  resume { i8*, i32 } %5
+
+eh.resume:
+  resume { i8*, i32 } %0
+
+unreachable:
+  unreachable
+}
+
+define i32 @_Z16cleanupInHandleri(i32 %v) noinline {
+entry:
+  invoke void @_Z7throwerii(i32 1, i32 %v)
+          to label %cont unwind label %lpad
+
+cont:
+  ret i32 0
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI5Other to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI5Other to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch, label %eh.resume
+
+catch:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  %v1 = add nsw i32 %v, 1
+  invoke void @_Z7throwerii(i32 0, i32 %v1)
+          to label %cont1 unwind label %lpad1
+
+cont1:
+  %5 = load i32* @guards
+  %inc = add nsw i32 %5, 1
+  store i32 %inc, i32* @guards
+  call void @__cxa_end_catch()
+  ret i32 0
+
+lpad1:
+  %6 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          cleanup
+  %7 = load i32* @guards
+  %inc1 = add nsw i32 %7, 1
+  store i32 %inc1, i32* @guards
+  call void @__cxa_end_catch()
+  resume { i8*, i32 } %6
+
+eh.resume:
+  resume { i8*, i32 } %0
+}
+
+define i32 @_Z12catchCleanupi(i32 %v) noinline {
+entry:
+  %call = invoke i32 @_Z16cleanupInHandleri(i32 %v)
+          to label %cont unwind label %lpad
+
+cont:
+  ret i32 %call
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast ({ i8*, i8* }* @_ZTI4Base to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch, label %eh.resume
+
+catch:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  %5 = bitcast i8* %4 to %struct._Z4Base*
+  %b = getelementptr inbounds %struct._Z4Base* %5, i32 0, i32 0
+  %6 = load i32* %b
+  call void @__cxa_end_catch()
+  ret i32 %6
+
+eh.resume:
+  resume { i8*, i32 } %0
+}
+
+define void @_Z7webMainv() {
+entry:
+  %r0 = call i32 @_Z9catchBaseii(i32 0, i32 10)
+  call void @_ZN6client3logEii(i32 0, i32 %r0)
+  %r1 = call i32 @_Z9catchBaseii(i32 1, i32 20)
+  call void @_ZN6client3logEii(i32 1, i32 %r1)
+  %r2 = call i32 @_Z9catchBaseii(i32 2, i32 30)
+  call void @_ZN6client3logEii(i32 2, i32 %r2)
+  %r3 = call i32 @_Z10catchMultiii(i32 1, i32 40)
+  call void @_ZN6client3logEii(i32 3, i32 %r3)
+  %r4 = call i32 @_Z10catchOtherii(i32 1, i32 50)
+  call void @_ZN6client3logEii(i32 4, i32 %r4)
+  %r5 = call i32 @_Z13nestedRethrowii(i32 0, i32 60)
+  call void @_ZN6client3logEii(i32 5, i32 %r5)
+  %r6 = call i32 @_Z13nestedRethrowii(i32 1, i32 70)
+  call void @_ZN6client3logEii(i32 6, i32 %r6)
+  %r7 = call i32 @_Z12catchCleanupi(i32 80)
+  call void @_ZN6client3logEii(i32 7, i32 %r7)
+  %d = load i32* @destroyed
+  call void @_ZN6client3logEii(i32 8, i32 %d)
+  %g = load i32* @guards
+  call void @_ZN6client3logEii(i32 9, i32 %g)
+  ret void
+}
+
+declare i8* @__cxa_allocate_exception(i32)
+declare void @__cxa_throw(i8*, i8*, i8*)
+declare i32 @__gxx_personality_v0(...)
+declare i32 @llvm.eh.typeid.for(i8*) nounwind readnone
+declare i8* @__cxa_begin_catch(i8*)
+declare void @__cxa_end_catch()
+declare void @__cxa_rethrow()
+declare void @_ZN6client3logEii(i32, i32)
+
+!struct._Z5Multi_bases = !{!0}
+
+!0 = metadata !{i32 2, i32 2}
@@ -0,0 +1,44 @@
+// Benchmark of the throw and no-throw paths of the exception support of the Cheerp backend.
+//
+// Usage: node exceptions-bench.js <path to llc> [iterations]
+//
+// exceptions-bench.ll is compiled with llc -march=cheerp -cheerp-pretty-code, which keeps the
+// names of the functions, and the loops it defines are timed:
+//   plainLoop    calls a function which may throw, without any handler
+//   noThrowLoop  calls the same function through an invoke, nothing is thrown
+//   throwLoop    calls the same function through an invoke, every call throws and is caught
+// The no-throw loop should take about the same time as the plain one, since only the invoke
+// itself is inside the try block.
+
+var childProcess = require("child_process");
+var path = require("path");
+var vm = require("vm");
+
+if (process.argv.length < 3) {
+	console.error("Usage: node exceptions-bench.js <path to llc> [iterations]");
+	process.exit(1);
+}
+var llc = process.argv[2];
+var iterations = process.argv.length > 3 ? parseInt(process.argv[3], 10) : 10000000;
+
+var code = childProcess.execFileSync(llc, ["-march=cheerp", "-cheerp-pretty-code", path.join(__dirname, "exceptions-bench.ll"), "-o", "-"], { encoding: "utf8" });
+vm.runInThisContext(code);
+
+function time(name, f, n) {
+	// Warm up, so that the JIT compiles the loop before it is measured
+	f(Math.min(n, 10000));
+	var start = process.hrtime();
+	var ret = f(n);
+	var elapsed = process.hrtime(start);
+	var ms = elapsed[0] * 1e3 + elapsed[1] / 1e6;
+	console.log(name + ": " + n + " calls in " + ms.toFixed(1) + "ms (" + (ms * 1e6 / n).toFixed(1) + "ns per call), result " + ret);
+}
+
+time("plainLoop", __Z9plainLoopi, iterations);
+time("noThrowLoop", __Z11noThrowLoopi, iterations);
+// Throwing is orders of magnitude slower, run fewer iterations
+time("throwLoop", __Z9throwLoopi, Math.max(1, Math.floor(iterations / 100)));
+if (cheerpCaught.length !== 0) {
+	console.error("The caught exceptions were not all released: " + cheerpCaught.length);
+	process.exit(1);
+}
@@ -0,0 +1,157 @@
+; Throw and no-throw paths of the exception support of the Cheerp backend, run by exceptions-bench.js
+;
+;   int mayThrow(int i, int t) { if(t) throw i; return i * 3; }
+;   int plainLoop(int n) { int s = 0; for(int i = 0; i < n; i++) s += mayThrowNoExcept(i); return s; }
+;   int noThrowLoop(int n) { int s = 0; for(int i = 0; i < n; i++) try { s += mayThrow(i, 0); } catch(int e) { s -= e; } return s; }
+;   int throwLoop(int n) { int s = 0; for(int i = 0; i < n; i++) try { s += mayThrow(i, 1); } catch(int e) { s -= e; } return s; }
+target datalayout = "b-e-p:32:8-i16:8-i32:8-i64:8-f32:8-f64:8-a:0:8-f80:8-n8:8:8-S8"
+target triple = "cheerp--webbrowser"
+
+@_ZTIi = external constant i8*
+
+define i32 @_Z8mayThrowii(i32 %i, i32 %t) noinline {
+entry:
+  %tobool = icmp eq i32 %t, 0
+  br i1 %tobool, label %ret, label %throw
+
+throw:
+  %exception = call i8* @__cxa_allocate_exception(i32 4)
+  %0 = bitcast i8* %exception to i32*
+  store i32 %i, i32* %0
+  call void @__cxa_throw(i8* %exception, i8* bitcast (i8** @_ZTIi to i8*), i8* null) noreturn
+  unreachable
+
+ret:
+  %mul = mul nsw i32 %i, 3
+  ret i32 %mul
+}
+
+define i32 @_Z9plainLoopi(i32 %n) noinline {
+entry:
+  br label %cond
+
+cond:
+  %s = phi i32 [ 0, %entry ], [ %add, %body ]
+  %i = phi i32 [ 0, %entry ], [ %inc, %body ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %end
+
+body:
+  %call = call i32 @_Z8mayThrowii(i32 %i, i32 0)
+  %add = add nsw i32 %s, %call
+  %inc = add nsw i32 %i, 1
+  br label %cond
+
+end:
+  ret i32 %s
+}
+
+define i32 @_Z11noThrowLoopi(i32 %n) noinline {
+entry:
+  br label %cond
+
+cond:
+  %s = phi i32 [ 0, %entry ], [ %s.next, %next ]
+  %i = phi i32 [ 0, %entry ], [ %inc, %next ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %end
+
+body:
+  %call = invoke i32 @_Z8mayThrowii(i32 %i, i32 0)
+          to label %cont unwind label %lpad
+
+cont:
+  %add = add nsw i32 %s, %call
+  br label %next
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast (i8** @_ZTIi to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast (i8** @_ZTIi to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch, label %eh.resume
+
+catch:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  %5 = bitcast i8* %4 to i32*
+  %e = load i32* %5
+  %sub = sub nsw i32 %s, %e
+  call void @__cxa_end_catch()
+  br label %next
+
+next:
+  %s.next = phi i32 [ %add, %cont ], [ %sub, %catch ]
+  %inc = add nsw i32 %i, 1
+  br label %cond
+
+end:
+  ret i32 %s
+
+eh.resume:
+  resume { i8*, i32 } %0
+}
+
+define i32 @_Z9throwLoopi(i32 %n) noinline {
+entry:
+  br label %cond
+
+cond:
+  %s = phi i32 [ 0, %entry ], [ %s.next, %next ]
+  %i = phi i32 [ 0, %entry ], [ %inc, %next ]
+  %cmp = icmp slt i32 %i, %n
+  br i1 %cmp, label %body, label %end
+
+body:
+  %call = invoke i32 @_Z8mayThrowii(i32 %i, i32 1)
+          to label %cont unwind label %lpad
+
+cont:
+  %add = add nsw i32 %s, %call
+  br label %next
+
+lpad:
+  %0 = landingpad { i8*, i32 } personality i8* bitcast (i32 (...)* @__gxx_personality_v0 to i8*)
+          catch i8* bitcast (i8** @_ZTIi to i8*)
+  %1 = extractvalue { i8*, i32 } %0, 0
+  %2 = extractvalue { i8*, i32 } %0, 1
+  %3 = call i32 @llvm.eh.typeid.for(i8* bitcast (i8** @_ZTIi to i8*))
+  %matches = icmp eq i32 %2, %3
+  br i1 %matches, label %catch, label %eh.resume
+
+catch:
+  %4 = call i8* @__cxa_begin_catch(i8* %1)
+  %5 = bitcast i8* %4 to i32*
+  %e = load i32* %5
+  %sub = sub nsw i32 %s, %e
+  call void @__cxa_end_catch()
+  br label %next
+
+next:
+  %s.next = phi i32 [ %add, %cont ], [ %sub, %catch ]
+  %inc = add nsw i32 %i, 1
+  br label %cond
+
+end:
+  ret i32 %s
+
+eh.resume:
+  resume { i8*, i32 } %0
+}
+
+; The loops are run by exceptions-bench.js, webMain only keeps them in the output
+define void @_Z7webMainv() {
+entry:
+  %a = call i32 @_Z9plainLoopi(i32 0)
+  %b = call i32 @_Z11noThrowLoopi(i32 0)
+  %c = call i32 @_Z9throwLoopi(i32 0)
+  ret void
+}
+
+declare i8* @__cxa_allocate_exception(i32)
+declare void @__cxa_throw(i8*, i8*, i8*)
+declare i32 @__gxx_personality_v0(...)
+declare i32 @llvm.eh.typeid.for(i8*) nounwind readnone
+declare i8* @__cxa_begin_catch(i8*)
+declare void @__cxa_end_catch()